@@ -0,0 +1,729 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <getopt.h>
+
+
+#include "raw_binary_io.h"
+
+
+#include "const.h"
+#include "cfmask_water_detection.h"
+#include "utilities.h"
+#include "fill_index.h"
+#include "water_test.h"
+
+
+/* Defaults for the size of the synthetic scene */
+#define BENCH_LINES 2000
+#define BENCH_SAMPLES 2000
+#define BENCH_REPEAT 5
+
+#define BENCH_FILL_VALUE -9999
+
+
+/* The synthetic scene the stages are run over */
+typedef struct
+{
+    int lines;
+    int samples;
+    int16_t *band_red;
+    int16_t *band_nir;
+    uint8_t *band_l2qa;
+    uint8_t *band_water_qa;
+    Fill_Index_t fill_index;
+} Bench_Scene_t;
+
+
+/*****************************************************************************
+  NAME:  bench_usage
+
+  PURPOSE:  Displays the help/usage to the terminal.
+
+  RETURN VALUE:  None
+*****************************************************************************/
+static void
+bench_usage ()
+{
+    printf("Microbenchmarks of the CFmask water detection stages\n"
+           "Runs each stage over a synthetic scene held in memory and writes"
+           " the\n"
+           "results as JSON, in megapixels per second.\n\n");
+    printf("usage: bench_cfwd [--lines <count>] [--samples <count>]"
+           " [--repeat <count>]\n"
+           "                  [--check]\n\n");
+    printf("    --lines: Lines in the synthetic scene (default is %d)\n",
+           BENCH_LINES);
+    printf("    --samples: Samples in the synthetic scene (default is %d)\n",
+           BENCH_SAMPLES);
+    printf("    --repeat: Times each stage is run, the fastest is reported"
+           " (default is %d)\n", BENCH_REPEAT);
+    printf("    --check: Instead of the benchmarks, check each implementation"
+           " of the water\n"
+           "             test against the float reference over every pair of"
+           " int16 red\n"
+           "             and nir values, exits with failure on the first"
+           " difference\n");
+}
+
+
+/*****************************************************************************
+  NAME:  next_random
+
+  PURPOSE:  A small deterministic generator, so every run sees the same
+            scene.
+
+  RETURN VALUE:  Type = uint32_t
+*****************************************************************************/
+static uint32_t
+next_random
+(
+    uint32_t *state
+)
+{
+    *state = *state * 1664525 + 1013904223;
+    return *state >> 8;
+}
+
+
+/*****************************************************************************
+  NAME:  elapsed_seconds
+
+  PURPOSE:  Time since the start time.
+
+  RETURN VALUE:  Type = double
+*****************************************************************************/
+static double
+elapsed_seconds
+(
+    const struct timespec *start
+)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (now.tv_sec - start->tv_sec)
+           + (now.tv_nsec - start->tv_nsec) * 1e-9;
+}
+
+
+/*****************************************************************************
+  NAME:  free_bench_scene
+
+  PURPOSE:  Free the memory allocated by create_bench_scene.
+
+  RETURN VALUE:  None
+*****************************************************************************/
+static void
+free_bench_scene
+(
+    Bench_Scene_t *scene
+)
+{
+    free(scene->band_red);
+    free(scene->band_nir);
+    free(scene->band_l2qa);
+    free(scene->band_water_qa);
+    free_fill_index(&scene->fill_index);
+}
+
+
+/*****************************************************************************
+  NAME:  create_bench_scene
+
+  PURPOSE:  Build a synthetic scene.  About a quarter of the grid is fill
+            around a tilted footprint, the way a Landsat scene sits in its
+            grid.  The footprint is mostly clear, with the NDVI of the clear
+            pixels spread over both sides of the water thresholds.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      ERROR    Failed allocating the scene.
+      SUCCESS  No errors encountered.
+*****************************************************************************/
+static int
+create_bench_scene
+(
+    int lines,
+    int samples,
+    Bench_Scene_t *scene
+)
+{
+    size_t pixel_count = (size_t)lines * samples;
+    uint32_t state = 1;
+    int line;
+    int sample;
+    int first;
+    int end;
+    int cover;
+    size_t index;
+
+    memset(scene, 0, sizeof(*scene));
+    scene->lines = lines;
+    scene->samples = samples;
+
+    scene->band_red = malloc(pixel_count * sizeof(int16_t));
+    scene->band_nir = malloc(pixel_count * sizeof(int16_t));
+    scene->band_l2qa = malloc(pixel_count);
+    scene->band_water_qa = malloc(pixel_count);
+    if (scene->band_red == NULL || scene->band_nir == NULL
+        || scene->band_l2qa == NULL || scene->band_water_qa == NULL
+        || allocate_fill_index(lines, &scene->fill_index) != SUCCESS)
+    {
+        free_bench_scene(scene);
+        RETURN_ERROR("Failed allocating the synthetic scene", MODULE_NAME,
+                     ERROR);
+    }
+
+    for (line = 0; line < lines; line++)
+    {
+        /* The footprint is a parallelogram leaving an eighth of each line
+           as fill on either side */
+        first = samples / 8 + (int)((double)line / lines * samples / 8);
+        end = first + 3 * samples / 4;
+
+        for (sample = 0; sample < samples; sample++)
+        {
+            index = (size_t)line * samples + sample;
+
+            if (sample < first || sample >= end)
+            {
+                scene->band_red[index] = BENCH_FILL_VALUE;
+                scene->band_nir[index] = BENCH_FILL_VALUE;
+                scene->band_l2qa[index] = L2QA_FILL_PIXEL;
+                continue;
+            }
+
+            scene->band_red[index] = next_random(&state) % 3000;
+            scene->band_nir[index] = next_random(&state) % 3000;
+
+            /* 85% clear, the rest cloud or cloud shadow */
+            cover = next_random(&state) % 20;
+            if (cover < 17)
+                scene->band_l2qa[index] = L2QA_CLEAR_PIXEL;
+            else if (cover < 19)
+                scene->band_l2qa[index] = L2QA_CLOUD_PIXEL;
+            else
+                scene->band_l2qa[index] = L2QA_CLOUD_SHADOW_PIXEL;
+        }
+    }
+
+    return SUCCESS;
+}
+
+
+/*****************************************************************************
+  NAME:  report_stage
+
+  PURPOSE:  Write the result of a stage as a JSON object.
+
+  RETURN VALUE:  None
+*****************************************************************************/
+static void
+report_stage
+(
+    const char *stage,
+    const char *variant,
+    const Bench_Scene_t *scene,
+    double seconds,
+    bool *first_result
+)
+{
+    printf("%s\n    {\"stage\": \"%s\", \"variant\": \"%s\","
+           " \"seconds\": %.6f, \"megapixels_per_second\": %.2f}",
+           *first_result ? "" : ",", stage, variant, seconds,
+           (double)scene->lines * scene->samples / 1e6 / seconds);
+    *first_result = false;
+}
+
+
+/*****************************************************************************
+  NAME:  bench_fill_index
+
+  PURPOSE:  Time finding the span of each line which is not fill.
+
+  RETURN VALUE:  Type = double, the fastest time in seconds
+*****************************************************************************/
+static double
+bench_fill_index
+(
+    Bench_Scene_t *scene,
+    int repeat
+)
+{
+    struct timespec start;
+    double best = 0.0;
+    double seconds;
+    int run;
+
+    for (run = 0; run < repeat; run++)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        index_fill_lines(&scene->fill_index, scene->band_l2qa,
+                         L2QA_FILL_PIXEL, 0, scene->lines, scene->samples);
+        seconds = elapsed_seconds(&start);
+        if (run == 0 || seconds < best)
+            best = seconds;
+    }
+
+    return best;
+}
+
+
+/*****************************************************************************
+  NAME:  bench_water_test
+
+  PURPOSE:  Time an implementation of the water test, a line at a time over
+            the span which is not fill as cfmask_water_detection does.
+
+  RETURN VALUE:  Type = double, the fastest time in seconds
+*****************************************************************************/
+static double
+bench_water_test
+(
+    Bench_Scene_t *scene,
+    Water_Test_Function_t water_test,
+    int repeat
+)
+{
+    struct timespec start;
+    double best = 0.0;
+    double seconds;
+    int run;
+    int line;
+    size_t index;
+    Water_Counts_t counts;
+
+    for (run = 0; run < repeat; run++)
+    {
+        memset(&counts, 0, sizeof(counts));
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (line = 0; line < scene->lines; line++)
+        {
+            index = (size_t)line * scene->samples
+                    + scene->fill_index.first_valid[line];
+            water_test(&scene->band_red[index], &scene->band_nir[index],
+                       &scene->band_l2qa[index], BENCH_FILL_VALUE,
+                       BENCH_FILL_VALUE, L2QA_FILL_PIXEL,
+                       scene->fill_index.end_valid[line]
+                           - scene->fill_index.first_valid[line],
+                       &scene->band_water_qa[index], &counts);
+        }
+        seconds = elapsed_seconds(&start);
+        if (run == 0 || seconds < best)
+            best = seconds;
+    }
+
+    return best;
+}
+
+
+/*****************************************************************************
+  NAME:  bench_write_output
+
+  PURPOSE:  Time writing the output band to a temporary file.
+
+  RETURN VALUE:  Type = double, the fastest time in seconds, negative when
+                 the file could not be written
+*****************************************************************************/
+static double
+bench_write_output
+(
+    Bench_Scene_t *scene,
+    int repeat
+)
+{
+    struct timespec start;
+    double best = 0.0;
+    double seconds;
+    int run;
+    FILE *fd;
+
+    for (run = 0; run < repeat; run++)
+    {
+        fd = tmpfile();
+        if (fd == NULL)
+            return -1.0;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        if (write_raw_binary(fd, 1, scene->lines * scene->samples,
+                             sizeof(uint8_t), scene->band_water_qa)
+            != SUCCESS || fflush(fd) != 0)
+        {
+            fclose(fd);
+            return -1.0;
+        }
+        seconds = elapsed_seconds(&start);
+        fclose(fd);
+
+        if (run == 0 || seconds < best)
+            best = seconds;
+    }
+
+    return best;
+}
+
+
+/*****************************************************************************
+  NAME:  detect_water_pixels_float
+
+  PURPOSE:  The water test as it was before the integer implementations,
+            with a float NDVI, as the reference for the check.
+
+  RETURN VALUE:  None
+*****************************************************************************/
+static void
+detect_water_pixels_float
+(
+    const int16_t *band_red,
+    const int16_t *band_nir,
+    const uint8_t *band_l2qa,
+    int16_t red_fill_value,
+    int16_t nir_fill_value,
+    uint8_t l2qa_fill_value,
+    int pixel_count,
+    uint8_t *band_water_qa,
+    Water_Counts_t *counts
+)
+{
+    int pixel_index;
+    float ndvi;
+
+    for (pixel_index = 0; pixel_index < pixel_count; pixel_index++)
+    {
+        band_water_qa[pixel_index] = band_l2qa[pixel_index];
+
+        /* If any of the input is fill, make the output fill */
+        if (band_red[pixel_index] == red_fill_value ||
+            band_nir[pixel_index] == nir_fill_value ||
+            band_l2qa[pixel_index] == l2qa_fill_value)
+        {
+            band_water_qa[pixel_index] = l2qa_fill_value;
+            continue;
+        }
+
+        counts->image_pixels++;
+
+        /* Only need to process clear pixels */
+        if (band_l2qa[pixel_index] != L2QA_CLEAR_PIXEL)
+            continue;
+
+        counts->clear_pixels++;
+
+        if ((band_red[pixel_index] + band_nir[pixel_index]) != 0)
+        {
+            ndvi = (float)(band_nir[pixel_index] - band_red[pixel_index])
+                   / (float)(band_nir[pixel_index] + band_red[pixel_index]);
+        }
+        else
+            ndvi = 0.01;
+
+        if ((ndvi < 0.01 && band_nir[pixel_index] < 1100)
+            || (ndvi < 0.1 && ndvi > 0.0 && band_nir[pixel_index] < 500))
+        {
+            band_water_qa[pixel_index] = L2QA_WATER_PIXEL;
+            counts->clear_pixels--;
+            counts->water_pixels++;
+        }
+    }
+}
+
+
+/*****************************************************************************
+  NAME:  check_water_tests
+
+  PURPOSE:  Check each implementation of the water test against the float
+            reference over every pair of int16 red and nir values, a line
+            for each red value with every nir value as the samples.
+
+            The sweep is made three times:
+            1. Every pixel clear, with nir fill of -9999.
+            2. Every pixel clear, with nir fill of 0, so the pairs with nir
+               of -9999 are also tested as clear pixels.
+            3. Clear, cloud, cloud shadow, snow, and fill QA mixed over the
+               line, with red and nir fill of -9999.
+            The red fill is the red value of the line plus one in the first
+            two, so no red value is fill there.
+
+  RETURN VALUE:  Type = bool
+      Value  Description
+      -----  -----------------------------------------------------------------
+      false  An implementation differs from the reference, the first
+             difference is reported.
+      true   The implementations are identical to the reference.
+*****************************************************************************/
+static bool
+check_water_tests
+(
+    const Water_Test_Function_t *water_tests,
+    const char **water_test_names,
+    int water_test_count
+)
+{
+    const int value_count = INT16_MAX - INT16_MIN + 1;
+    /* The QA repeats every 8 samples, shifted by a sample each line */
+    const uint8_t mixed_qa[8] = {
+        L2QA_CLEAR_PIXEL, L2QA_CLEAR_PIXEL, L2QA_CLEAR_PIXEL,
+        L2QA_CLOUD_PIXEL, L2QA_CLEAR_PIXEL, L2QA_CLOUD_SHADOW_PIXEL,
+        L2QA_SNOW_PIXEL, L2QA_FILL_PIXEL
+    };
+    int16_t *band_red;
+    int16_t *band_nir;
+    uint8_t *band_l2qa;
+    uint8_t *band_clear;
+    uint8_t *expected_qa;
+    uint8_t *water_qa;
+    Water_Counts_t expected_counts;
+    Water_Counts_t counts;
+    int16_t red_fill_value;
+    int16_t nir_fill_value;
+    bool identical = true;
+    int implementation;
+    int sweep;
+    int red;
+    int sample;
+    char msg[256];
+
+    band_red = malloc(value_count * sizeof(int16_t));
+    band_nir = malloc(value_count * sizeof(int16_t));
+    band_l2qa = malloc(value_count + 8);
+    band_clear = malloc(value_count);
+    expected_qa = malloc(value_count);
+    water_qa = malloc(value_count);
+    if (band_red == NULL || band_nir == NULL || band_l2qa == NULL
+        || band_clear == NULL || expected_qa == NULL || water_qa == NULL)
+    {
+        ERROR_MESSAGE("Failed allocating the lines of the check",
+                      MODULE_NAME);
+        identical = false;
+    }
+    else
+    {
+        for (sample = 0; sample < value_count; sample++)
+            band_nir[sample] = INT16_MIN + sample;
+        for (sample = 0; sample < value_count + 8; sample++)
+            band_l2qa[sample] = mixed_qa[sample % 8];
+        memset(band_clear, L2QA_CLEAR_PIXEL, value_count);
+    }
+
+    for (sweep = 0; sweep < 3 && identical; sweep++)
+    {
+        for (red = INT16_MIN; red <= INT16_MAX && identical; red++)
+        {
+            for (sample = 0; sample < value_count; sample++)
+                band_red[sample] = red;
+
+            if (sweep < 2)
+            {
+                red_fill_value = (int16_t)(red + 1);
+                nir_fill_value = sweep == 0 ? BENCH_FILL_VALUE : 0;
+            }
+            else
+            {
+                red_fill_value = BENCH_FILL_VALUE;
+                nir_fill_value = BENCH_FILL_VALUE;
+            }
+
+            memset(&expected_counts, 0, sizeof(expected_counts));
+            detect_water_pixels_float(band_red, band_nir,
+                sweep < 2 ? band_clear : &band_l2qa[red & 7],
+                red_fill_value, nir_fill_value, L2QA_FILL_PIXEL,
+                value_count, expected_qa, &expected_counts);
+
+            for (implementation = 0;
+                 implementation < water_test_count && identical;
+                 implementation++)
+            {
+                memset(&counts, 0, sizeof(counts));
+                water_tests[implementation](band_red, band_nir,
+                    sweep < 2 ? band_clear : &band_l2qa[red & 7],
+                    red_fill_value, nir_fill_value, L2QA_FILL_PIXEL,
+                    value_count, water_qa, &counts);
+
+                for (sample = 0; sample < value_count; sample++)
+                {
+                    if (water_qa[sample] != expected_qa[sample])
+                        break;
+                }
+                if (sample < value_count)
+                {
+                    snprintf(msg, sizeof(msg), "The %s water test differs"
+                             " from the float reference at red %d nir %d in"
+                             " sweep %d, %d instead of %d",
+                             water_test_names[implementation], red,
+                             band_nir[sample], sweep + 1, water_qa[sample],
+                             expected_qa[sample]);
+                    ERROR_MESSAGE(msg, MODULE_NAME);
+                    identical = false;
+                }
+                else if (memcmp(&counts, &expected_counts, sizeof(counts))
+                         != 0)
+                {
+                    snprintf(msg, sizeof(msg), "The %s water test counts"
+                             " differ from the float reference at red %d in"
+                             " sweep %d", water_test_names[implementation],
+                             red, sweep + 1);
+                    ERROR_MESSAGE(msg, MODULE_NAME);
+                    identical = false;
+                }
+            }
+        }
+    }
+
+    for (implementation = 0; implementation < water_test_count && identical;
+         implementation++)
+    {
+        snprintf(msg, sizeof(msg), "The %s water test is identical to the"
+                 " float reference", water_test_names[implementation]);
+        LOG_MESSAGE(msg, MODULE_NAME);
+    }
+
+    free(band_red);
+    free(band_nir);
+    free(band_l2qa);
+    free(band_clear);
+    free(expected_qa);
+    free(water_qa);
+
+    return identical;
+}
+
+
+/*****************************************************************************
+  NAME:  main
+
+  PURPOSE:  Runs the microbenchmark of each stage over a synthetic scene and
+            writes the results to stdout as JSON.
+
+  RETURN VALUE:  Type = int
+      Value           Description
+      --------------  --------------------------------------------------------
+      EXIT_FAILURE    An unrecoverable error occured during processing.
+      EXIT_SUCCESS    No errors encountered processing succesfull.
+*****************************************************************************/
+int
+main (int argc, char *argv[])
+{
+    int lines = BENCH_LINES;
+    int samples = BENCH_SAMPLES;
+    int repeat = BENCH_REPEAT;
+    bool check_flag = false;
+    Bench_Scene_t scene;
+    bool first_result = true;
+    double seconds;
+    Water_Test_Function_t water_test;
+    const char *water_test_name;
+    Water_Test_Function_t check_tests[2];
+    const char *check_names[2];
+    int check_count;
+    int c;
+    int option_index;
+    struct option long_options[] = {
+        {"lines", required_argument, 0, 'l'},
+        {"samples", required_argument, 0, 's'},
+        {"repeat", required_argument, 0, 'r'},
+        {"check", no_argument, 0, 'c'},
+        {"help", no_argument, 0, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    while ((c = getopt_long(argc, argv, "", long_options, &option_index))
+           != -1)
+    {
+        switch (c)
+        {
+            case 'l':
+                lines = atoi(optarg);
+                break;
+            case 's':
+                samples = atoi(optarg);
+                break;
+            case 'r':
+                repeat = atoi(optarg);
+                break;
+            case 'c':
+                check_flag = true;
+                break;
+            case 'h':
+                bench_usage();
+                return EXIT_SUCCESS;
+            default:
+                bench_usage();
+                return EXIT_FAILURE;
+        }
+    }
+    if (lines < 1 || samples < 1 || repeat < 1)
+    {
+        ERROR_MESSAGE("The lines, samples, and repeat must be at least 1",
+                      MODULE_NAME);
+        return EXIT_FAILURE;
+    }
+
+    if (check_flag)
+    {
+        /* The scalar implementation, and the SIMD implementation when the
+           processor has one */
+        check_tests[0] = detect_water_pixels_scalar;
+        check_names[0] = "scalar";
+        check_count = 1;
+        water_test = select_water_test(&water_test_name);
+        if (water_test != detect_water_pixels_scalar)
+        {
+            check_tests[check_count] = water_test;
+            check_names[check_count] = water_test_name;
+            check_count++;
+        }
+
+        if (!check_water_tests(check_tests, check_names, check_count))
+            return EXIT_FAILURE;
+
+        return EXIT_SUCCESS;
+    }
+
+    if (create_bench_scene(lines, samples, &scene) != SUCCESS)
+        return EXIT_FAILURE;
+
+    printf("{\n  \"benchmark\": \"cfmask_water_detection\",\n"
+           "  \"lines\": %d,\n  \"samples\": %d,\n  \"repeat\": %d,\n"
+           "  \"stages\": [", lines, samples, repeat);
+
+    report_stage("fill_index", "scalar", &scene,
+                 bench_fill_index(&scene, repeat), &first_result);
+    report_stage("water_test", "scalar", &scene,
+                 bench_water_test(&scene, detect_water_pixels_scalar, repeat),
+                 &first_result);
+
+    /* The SIMD implementation, when the processor has one */
+    water_test = select_water_test(&water_test_name);
+    if (water_test != detect_water_pixels_scalar)
+    {
+        report_stage("water_test", water_test_name, &scene,
+                     bench_water_test(&scene, water_test, repeat),
+                     &first_result);
+    }
+
+    seconds = bench_write_output(&scene, repeat);
+    if (seconds > 0.0)
+    {
+        report_stage("write_output", "uint8", &scene, seconds,
+                     &first_result);
+    }
+    else
+    {
+        WARNING_MESSAGE("Failed writing the temporary output file, the"
+                        " write_output stage is left out", MODULE_NAME);
+    }
+
+    printf("\n  ]\n}\n");
+
+    free_bench_scene(&scene);
+
+    return EXIT_SUCCESS;
+}
@@ -1,6 +1,11 @@
 
 #include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef _OPENMP
+    #include <omp.h>
+#endif
 #if 0
 #include <stdio.h>
 #include <stdlib.h>
@@ -29,6 +34,10 @@
 #include "utilities.h"
 #include "get_args.h"
 #include "input.h"
+#include "fill_index.h"
+#include "batch.h"
+#include "water_test.h"
+#include "clear_estimate.h"
 #if 0
 #include "output.h"
 
@@ -46,6 +55,34 @@
 #endif
 
 
+/* The settings which are the same for every scene */
+typedef struct
+{
+    int max_memory;              /* Memory budget in megabytes, zero for the
+                                    whole scene at once */
+    int num_threads;
+    bool selective_read_flag;    /* Only read the red and nir of the clear
+                                    pixels */
+    float min_percent_clear;     /* Scenes estimated to have less of their
+                                    pixels clear are skipped, zero for
+                                    none */
+    bool verbose_flag;
+} Cfwd_Options_t;
+
+
+/* The output buffers, they are kept between the scenes of a batch and only
+   reallocated when a scene needs more than they hold */
+typedef struct
+{
+    long pixel_count;        /* Pixels held by each output strip */
+    int buffer_count;        /* Output strips held */
+    uint8_t *band_water_qa[2]; /* Output Level2 QA Band strips with the
+                                  water pixels, one is written while the
+                                  other is processed */
+    Fill_Index_t fill_index; /* Span of each line which is not fill */
+} Band_Memory_t;
+
+
 /*****************************************************************************
   NAME:  free_band_memory
 
@@ -56,69 +93,82 @@
 void
 free_band_memory
 (
-    int16_t *band_red,
-    int16_t *band_nir,
-    uint8_t *band_l2qa
+    Band_Memory_t *memory
 )
 {
-    free (band_red);
-    band_red = NULL;
-    free (band_nir);
-    band_nir = NULL;
-    free (band_l2qa);
-    band_l2qa = NULL;
+    free(memory->band_water_qa[0]);
+    free(memory->band_water_qa[1]);
+    free_fill_index(&memory->fill_index);
+
+    memset(memory, 0, sizeof(*memory));
 }
 
 
 /*****************************************************************************
   NAME:  allocate_band_memory
 
-  PURPOSE:  Allocate memory for all the input bands.
+  PURPOSE:  Allocate memory for the output strips and the fill index, the
+            input bands are provided read-only by the input module.  The
+            buffers already held are kept when they are large enough,
+            otherwise they are replaced with ones large enough for this and
+            the previous scenes.
 
-  RETURN VALUE:  Type = bool
+  RETURN VALUE:  Type = int
       Value    Description
       -------  ---------------------------------------------------------------
-      true     Success with allocating all of the memory needed for the input
-               bands.
-      false    Failed to allocate memory for an input band.
+      ERROR    Failed to allocate memory for the output band.
+      SUCCESS  No errors encountered.
 *****************************************************************************/
 int
 allocate_band_memory
 (
-    int16_t **band_red,
-    int16_t **band_nir,
-    uint8_t **band_l2qa,
-    int pixel_count
+    int lines,          /* I: lines in the scene */
+    long pixel_count,   /* I: pixels in each strip */
+    int buffer_count,   /* I: strips held, two when the scene is processed
+                              in more than one strip */
+    Band_Memory_t *memory
 )
 {
-    *band_red = calloc(pixel_count, sizeof(int16_t));
-    if (*band_red == NULL)
-    {
-        ERROR_MESSAGE("Failed allocating memory for RED band", MODULE_NAME);
+    int index;
 
-        /* Free allocated memory */
-        free_band_memory(*band_red, *band_nir, *band_l2qa);
-        return ERROR;
+    if (pixel_count <= memory->pixel_count
+        && buffer_count <= memory->buffer_count
+        && lines <= memory->fill_index.lines)
+    {
+        return SUCCESS;
     }
 
-    *band_nir = calloc(pixel_count, sizeof(int16_t));
-    if (*band_nir == NULL)
+    /* Grow to the largest scene seen so far */
+    if (pixel_count < memory->pixel_count)
+        pixel_count = memory->pixel_count;
+    if (buffer_count < memory->buffer_count)
+        buffer_count = memory->buffer_count;
+    if (lines < memory->fill_index.lines)
+        lines = memory->fill_index.lines;
+    free_band_memory(memory);
+
+    for (index = 0; index < buffer_count; index++)
     {
-        ERROR_MESSAGE("Failed allocating memory for NIR band", MODULE_NAME);
+        memory->band_water_qa[index] = calloc(pixel_count, sizeof(uint8_t));
+        if (memory->band_water_qa[index] == NULL)
+        {
+            ERROR_MESSAGE("Failed allocating memory for the output L2 QA"
+                          " band", MODULE_NAME);
 
-        /* Free allocated memory */
-        free_band_memory(*band_red, *band_nir, *band_l2qa);
-        return ERROR;
+            free_band_memory(memory);
+            return ERROR;
+        }
     }
+    memory->pixel_count = pixel_count;
+    memory->buffer_count = buffer_count;
 
-    *band_l2qa = calloc(pixel_count, sizeof(uint8_t));
-    if (*band_l2qa == NULL)
+    /* Find the span of each line which is not fill, the fill around the
+       footprint of the scene is written without testing each pixel */
+    if (allocate_fill_index(lines, &memory->fill_index) != SUCCESS)
     {
-        ERROR_MESSAGE("Failed allocating memory for CFMASK band",
-                      MODULE_NAME);
+        ERROR_MESSAGE("Failed allocating the fill index", MODULE_NAME);
 
-        /* Free allocated memory */
-        free_band_memory(*band_red, *band_nir, *band_l2qa);
+        free_band_memory(memory);
         return ERROR;
     }
 
@@ -126,120 +176,232 @@ allocate_band_memory
 }
 
 
-/******************************************************************************
-  NAME:  write_u8bit_data
+/*****************************************************************************
+  NAME:  determine_strip_lines
 
-  PURPOSE:  Create the *.img file and the associated ENVI header.
+  PURPOSE:  Determine how many lines can be processed at a time while keeping
+            the band buffers within the memory budget.
 
   RETURN VALUE:  Type = int
       Value    Description
       -------  ---------------------------------------------------------------
-      SUCCESS  No errors were encountered.
-      ERROR    An error was encountered.
-******************************************************************************/
+      1 - lines  The number of lines to process in each strip.
+*****************************************************************************/
 int
-write_u8bit_data
+determine_strip_lines
 (
-    char *output_filename,
-    int element_count,
-    uint8_t *data
+    int lines,       /* I: number of lines in the scene */
+    int samples,     /* I: number of samples in the scene */
+    int max_memory   /* I: memory budget in megabytes, zero means process
+                           the whole scene at once unless it has more than
+                           LARGE_SCENE_PIXELS */
 )
 {
-    FILE *fd = NULL;
-    char msg[512];
+    long long line_bytes;
+    long long index_bytes;
+    long long strip_lines;
+    char msg[256];
 
-    fd = fopen(output_filename, "w");
-    if (fd == NULL)
+    if (max_memory == 0)
     {
-        snprintf(msg, sizeof(msg), "Failed creating file %s",
-                 output_filename);
-        RETURN_ERROR(msg, MODULE_NAME, ERROR);
+        if ((long)lines * samples <= LARGE_SCENE_PIXELS)
+            return lines;
+
+        snprintf(msg, sizeof(msg), "Processing the scene of %ld pixels in"
+                 " strips within %d MB", (long)lines * samples,
+                 LARGE_SCENE_MAX_MEMORY);
+        LOG_MESSAGE(msg, MODULE_NAME);
+
+        max_memory = LARGE_SCENE_MAX_MEMORY;
     }
 
-    if (write_raw_binary(fd, 1, element_count, sizeof(uint8_t),
-                         data) != SUCCESS)
+    /* The red, nir, and L2 QA lines read, along with the two output strips
+       of which one is being written */
+    line_bytes = (long long)samples
+                 * (2 * sizeof(int16_t) + sizeof(uint8_t)
+                    + 2 * sizeof(uint8_t));
+
+    /* The span of each line which is not fill is held for every line of
+       the scene */
+    index_bytes = (long long)lines * 2 * sizeof(int);
+
+    strip_lines = ((long long)max_memory * 1024 * 1024 - index_bytes)
+                  / line_bytes;
+    if (strip_lines < 1)
     {
-        snprintf(msg, sizeof(msg), "Failed writing file %s", output_filename);
-        RETURN_ERROR(msg, MODULE_NAME, ERROR);
+        snprintf(msg, sizeof(msg), "Max Memory of %d MB is too small for"
+                 " a single line, processing one line at a time",
+                 max_memory);
+        WARNING_MESSAGE(msg, MODULE_NAME);
+
+        strip_lines = 1;
     }
 
-    fclose(fd);
+    if (strip_lines > lines)
+        strip_lines = lines;
+
+    return (int)strip_lines;
+}
+
+
+/*****************************************************************************
+  NAME:  write_strip_lines
+
+  PURPOSE:  Append a strip of lines to the temporary L2 QA file.  The strip
+            is written with fwrite instead of write_raw_binary, which counts
+            the pixels of the strip in an int.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      ERROR    Failed writing the lines.
+      SUCCESS  No errors encountered.
+*****************************************************************************/
+static int
+write_strip_lines
+(
+    FILE *fd,
+    int line_count,
+    int samples,
+    const uint8_t *band_water_qa
+)
+{
+    size_t pixel_count = (size_t)line_count * samples;
+
+    if (fwrite(band_water_qa, sizeof(uint8_t), pixel_count, fd)
+        != pixel_count)
+    {
+        RETURN_ERROR("Failed writing L2 QA band lines", MODULE_NAME, ERROR);
+    }
 
     return SUCCESS;
 }
 
 
 /*****************************************************************************
-  NAME:  main
+  NAME:  abandon_scene
 
-  PURPOSE:  Implements the core algorithm for cfmask based water detection.
+  PURPOSE:  Release everything opened for a scene which failed once its
+            temporary L2 QA file has been created, and remove that file.
 
-  ALGORITHM DEVELOPERS:
+  RETURN VALUE:  None
+*****************************************************************************/
+static void
+abandon_scene
+(
+    Espa_internal_meta_t *xml_metadata,
+    Input_Data_t *input_data,
+    FILE *temp_fd,
+    const char *temp_filename
+)
+{
+    if (temp_fd != NULL)
+        fclose(temp_fd);
+    unlink(temp_filename);
 
-      The algorithm implemented here was developed by the following:
+    free_metadata(xml_metadata);
+    close_input(input_data);
+    free(input_data);
+}
 
-      This software is based on the Matlab code developed by Zhe Zhu,
-      and Curtis E. Woodcock
 
-      Zhu, Z. and Woodcock, C. E., Object-based cloud and cloud shadow
-      detection in Landsat imagery, Remote Sensing of Environment (2012),
-      doi:10.1016/j.rse.2011.10.028
+/*****************************************************************************
+  NAME:  process_scene
+
+  PURPOSE:  Adds the water pixels to the Level2 QA Band of a scene and
+            updates the clear and water percentages in its XML file.
 
   RETURN VALUE:  Type = int
-      Value           Description
-      --------------  --------------------------------------------------------
-      EXIT_FAILURE    An unrecoverable error occured during processing.
-      EXIT_SUCCESS    No errors encountered processing succesfull.
+      Value    Description
+      -------  ---------------------------------------------------------------
+      ERROR    The scene could not be processed, everything opened for it
+               has been released.
+      SCENE_SKIPPED  The scene has less than the minimum percent clear, its
+               L2 QA band and XML file are left unchanged.
+      SUCCESS  No errors encountered.
+
+  NOTES:
+    1. The band memory is kept for the next scene.
+    2. With a memory budget the scene is processed in strips of lines.  The
+       input lines are read for each strip, and each output strip is
+       written to the temporary L2 QA file while the next one is processed.
+       Without a budget the input images are mapped and the scene is one
+       strip, unless it has more than LARGE_SCENE_PIXELS when it is
+       processed in strips within LARGE_SCENE_MAX_MEMORY.
+    3. The lines of a strip are processed by the threads.  The pixel counts
+       are integers summed over the lines, so they do not depend on how the
+       lines were shared out.
 *****************************************************************************/
 int
-main (int argc, char *argv[])
+process_scene
+(
+    char *xml_filename,              /* I: the XML of the scene */
+    const Cfwd_Options_t *options,   /* I: the settings for every scene */
+    Band_Memory_t *memory            /* I/O: buffers for the scene */
+)
 {
-    /* Command line parameters */
-    char *xml_filename = NULL;  /* filename for the XML input */
     Espa_internal_meta_t xml_metadata;  /* XML metadata structure */
-    bool verbose_flag = false;
 
     Input_Data_t *input_data = NULL;
     /* Band data */
-    int16_t *band_red = NULL;  /* TM TOA_Band3,  OLI TOA_Band4 */
-    int16_t *band_nir = NULL;  /* TM TOA_Band4,  OLI TOA_Band5 */
-    uint8_t *band_l2qa = NULL; /* Level2 QA Band */
-
-    float ndvi;
+    const int16_t *band_red = NULL;  /* TM TOA_Band3,  OLI TOA_Band4 */
+    const int16_t *band_nir = NULL;  /* TM TOA_Band4,  OLI TOA_Band5 */
+    const uint8_t *band_l2qa = NULL; /* Level2 QA Band */
+    uint8_t *band_water_qa = NULL;   /* Output Level2 QA Band strip with the
+                                        water pixels */
+    uint8_t *previous_water_qa = NULL; /* The strip before, being written */
+
+    Water_Counts_t line_counts; /* Pixel counts of a line */
+    long image_pixels = 0;      /* Counts summed over the threads */
+    long clear_pixels = 0;
+    long water_pixels = 0;
 
     int16_t red_fill_value;
     int16_t nir_fill_value;
     uint8_t l2qa_fill_value;
 
-    /* Other variables */
-    int pixel_index;
-    int pixel_count;
-    char temp_filename[PATH_MAX];
+    Fill_Index_t *fill_index; /* Span of each line which is not fill */
 
+    Water_Test_Function_t water_test; /* Implementation of the water test */
+    const char *water_test_name;
 
-    /* Get the command line arguments */
-    if (get_args(argc, argv, &xml_filename, &verbose_flag) != SUCCESS)
-    {
-        /* get_args generates all the error messages we need */
-        return EXIT_FAILURE;
-    }
+    float estimated_clear;    /* Percent clear of the scene from its L2 QA
+                                 metadata or a sample of its lines */
+    bool sampled_flag;
+
+    /* Other variables */
+    int lines;
+    int samples;
+    long pixel_count;
+    int strip_lines;
+    int strip_count;
+    int first_line;
+    int line_count;
+    int previous_line_count = 0;
+    int buffer_index = 0;
+    int write_status = SUCCESS;
+    int line;
+    long line_start;
+    long valid_start;
+    long valid_end;
+    char temp_filename[PATH_MAX];
+    FILE *temp_fd = NULL;
+    char msg[256];
 
-    LOG_MESSAGE("Starting CFmask based water detection processing ...",
-                MODULE_NAME);
 
     /* -------------------------------------------------------------------- */
     /* Provide user information if verbose is turned on */
-    if (verbose_flag)
+    if (options->verbose_flag)
     {
         printf("   XML Input File: %s\n", xml_filename);
     }
 
     /* -------------------------------------------------------------------- */
     /* Validate the input XML metadata file */
-    if (validate_xml_file(xml_filename) != SUCCESS)
+    if (validate_metadata(xml_filename) != SUCCESS)
     {
         /* Error messages already written */
-        return EXIT_FAILURE;
+        return ERROR;
     }
 
     /* Initialize the metadata structure */
@@ -251,134 +413,252 @@ main (int argc, char *argv[])
     if (parse_metadata(xml_filename, &xml_metadata) != SUCCESS)
     {
         /* Cleanup memory */
-        free(xml_filename);
+        free_metadata(&xml_metadata);
 
         /* Error messages already written */
-        return EXIT_FAILURE;
+        return ERROR;
     }
 
     /* -------------------------------------------------------------------- */
-    /* Open the input files */
-    input_data = open_input(&xml_metadata);
+    /* Open the input files, they are mapped unless the memory is limited
+       or only the clear pixels are read */
+    input_data = open_input(&xml_metadata, options->max_memory == 0,
+                            options->selective_read_flag);
     if (input_data == NULL)
     {
         ERROR_MESSAGE("Failed opening input files", MODULE_NAME);
 
         /* Cleanup memory */
         free_metadata(&xml_metadata);
-        free(xml_filename);
 
-        return EXIT_FAILURE;
+        return ERROR;
+    }
+
+    /* -------------------------------------------------------------------- */
+    /* A scene with too few clear pixels for the water test to matter is
+       skipped before any of its pixels are processed */
+    if (options->min_percent_clear > 0.0)
+    {
+        if (estimate_percent_clear(
+                &xml_metadata.band[input_data->meta_index[I_BAND_L2QA]],
+                &estimated_clear, &sampled_flag) != SUCCESS)
+        {
+            ERROR_MESSAGE("Failed estimating the percent clear",
+                          MODULE_NAME);
+
+            /* Cleanup memory */
+            free_metadata(&xml_metadata);
+            close_input(input_data);
+            free(input_data);
+
+            return ERROR;
+        }
+
+        if (options->verbose_flag)
+        {
+            printf("Estimated Percent Clear = %f (%s)\n", estimated_clear,
+                   sampled_flag ? "sampled" : "metadata");
+        }
+
+        if (estimated_clear < options->min_percent_clear)
+        {
+            snprintf(msg, sizeof(msg), "Skipping the scene, an estimated"
+                     " %.2f percent is clear", estimated_clear);
+            LOG_MESSAGE(msg, MODULE_NAME);
+
+            /* Cleanup memory */
+            free_metadata(&xml_metadata);
+            close_input(input_data);
+            free(input_data);
+
+            return SCENE_SKIPPED;
+        }
     }
 
     /* -------------------------------------------------------------------- */
     /* Figure out the number of elements in the data */
-    pixel_count = input_data->lines * input_data->samples;
-    if (verbose_flag)
+    lines = input_data->lines;
+    samples = input_data->samples;
+    pixel_count = (long)lines * samples;
+    strip_lines = determine_strip_lines(lines, samples,
+                                        options->max_memory);
+    strip_count = (lines + strip_lines - 1) / strip_lines;
+    if (options->verbose_flag)
     {
-        printf ("Pixel Count = %d\n", pixel_count);
+        printf ("Pixel Count = %ld\n", pixel_count);
+        printf ("Strip Lines = %d\n", strip_lines);
     }
 
-    /* Allocate memory buffers for input and temp processing */
-    if (allocate_band_memory(&band_red, &band_nir, &band_l2qa,
-                             pixel_count) != SUCCESS)
+    /* Allocate memory buffer for the output */
+    if (allocate_band_memory(lines, (long)strip_lines * samples,
+                             strip_count > 1 ? 2 : 1, memory) != SUCCESS)
     {
         ERROR_MESSAGE ("Failed reading bands into memory", MODULE_NAME);
 
         /* Cleanup memory */
         free_metadata(&xml_metadata);
+        close_input(input_data);
         free(input_data);
-        free(xml_filename);
 
-        return EXIT_FAILURE;
+        return ERROR;
+    }
+    fill_index = &memory->fill_index;
+
+    red_fill_value = input_data->fill_value[I_BAND_RED];
+    nir_fill_value = input_data->fill_value[I_BAND_NIR];
+    l2qa_fill_value = input_data->fill_value[I_BAND_L2QA];
+
+    water_test = select_water_test(&water_test_name);
+    if (options->verbose_flag)
+    {
+        printf ("Water Test = %s\n", water_test_name);
     }
 
     /* -------------------------------------------------------------------- */
-    /* Read the input files into the buffers */
-    if (read_bands_into_memory(input_data, band_red, band_nir,
-                               band_l2qa, pixel_count) != SUCCESS)
+    /* The L2 QA Band is written to a temp file on disk as it is processed */
+    snprintf(temp_filename, sizeof(temp_filename), "temp_%s",
+             input_data->band_name[I_BAND_L2QA]);
+
+    temp_fd = fopen(temp_filename, "w");
+    if (temp_fd == NULL)
     {
-        ERROR_MESSAGE("Failed reading bands into memory", MODULE_NAME);
+        ERROR_MESSAGE("Failed creating the temporary L2 QA band file",
+                      MODULE_NAME);
 
         /* Cleanup memory */
         free_metadata(&xml_metadata);
+        close_input(input_data);
         free(input_data);
-        free_band_memory(band_red, band_nir, band_l2qa);
-        free(xml_filename);
 
-        return EXIT_FAILURE;
+        return ERROR;
     }
 
-    red_fill_value = input_data->fill_value[I_BAND_RED];
-    nir_fill_value = input_data->fill_value[I_BAND_NIR];
-    l2qa_fill_value = input_data->fill_value[I_BAND_L2QA];
-
-    int total_image_pixels = 0;
-    int total_clear_pixels = 0;
-    int total_water_pixels = 0;
     /* -------------------------------------------------------------------- */
-    /* Process through each data element and populate the dswe band memory */
-    for (pixel_index = 0; pixel_index < pixel_count; pixel_index++)
+    /* Process through each strip and populate the output band */
+    for (first_line = 0; first_line < lines; first_line += strip_lines)
     {
-        /* If any of the input is fill, make the output fill */
-        if (band_red[pixel_index] == red_fill_value ||
-            band_nir[pixel_index] == nir_fill_value ||
-            band_l2qa[pixel_index] == l2qa_fill_value)
+        line_count = strip_lines;
+        if (first_line + line_count > lines)
+            line_count = lines - first_line;
+
+        /* Map or read the lines of the input files */
+        if (read_bands_into_memory(input_data, first_line, line_count,
+                                   &band_red, &band_nir, &band_l2qa)
+            != SUCCESS)
         {
-            band_l2qa[pixel_index] = l2qa_fill_value;
-            continue;
-        }
-
-        /* Get the total image data pixels */
-        total_image_pixels++;
+            ERROR_MESSAGE("Failed reading bands into memory", MODULE_NAME);
 
-        /* Only need to process clear pixels */
-        if (band_l2qa[pixel_index] != L2QA_CLEAR_PIXEL)
-        {
-            continue;
+            abandon_scene(&xml_metadata, input_data, temp_fd,
+                          temp_filename);
+            return ERROR;
         }
 
-        /* Get the total clear image data pixels */
-        total_clear_pixels++;
+        /* Find the span of each line which is not fill, the fill around
+           the footprint of the scene is written without testing each
+           pixel */
+        index_fill_lines(fill_index, band_l2qa, l2qa_fill_value, first_line,
+                         line_count, samples);
 
-        if ((band_red[pixel_index] + band_nir[pixel_index]) != 0)
+        band_water_qa = memory->band_water_qa[buffer_index];
+
+#ifdef _OPENMP
+        #pragma omp parallel private(line, line_start, valid_start, \
+                                     valid_end, line_counts)
+#endif
         {
-            ndvi = (float)(band_nir[pixel_index] - band_red[pixel_index])
-                   / (float)(band_nir[pixel_index] + band_red[pixel_index]);
+            /* The previous strip is written while this one is processed */
+#ifdef _OPENMP
+            #pragma omp single nowait
+#endif
+            {
+                if (previous_line_count > 0)
+                {
+                    write_status = write_strip_lines(temp_fd,
+                        previous_line_count, samples, previous_water_qa);
+                }
+            }
+
+#ifdef _OPENMP
+            #pragma omp for schedule(dynamic) \
+                reduction(+:image_pixels, clear_pixels, water_pixels)
+#endif
+            for (line = 0; line < line_count; line++)
+            {
+                line_start = (long)line * samples;
+                valid_start = line_start
+                              + fill_index->first_valid[first_line + line];
+                valid_end = line_start
+                            + fill_index->end_valid[first_line + line];
+
+                /* The samples around the span are fill */
+                memset(&band_water_qa[line_start], l2qa_fill_value,
+                       valid_start - line_start);
+                memset(&band_water_qa[valid_end], l2qa_fill_value,
+                       line_start + samples - valid_end);
+
+                memset(&line_counts, 0, sizeof(line_counts));
+                water_test(&band_red[valid_start], &band_nir[valid_start],
+                           &band_l2qa[valid_start], red_fill_value,
+                           nir_fill_value, l2qa_fill_value,
+                           valid_end - valid_start,
+                           &band_water_qa[valid_start], &line_counts);
+
+                image_pixels += line_counts.image_pixels;
+                clear_pixels += line_counts.clear_pixels;
+                water_pixels += line_counts.water_pixels;
+            }
         }
-        else
-            ndvi = 0.01;
 
-        /* Zhe's water test (works over thin cloud),
-           equation 5 from (CFmask) */
-        if ((ndvi < 0.01 && band_nir[pixel_index] < 1100)
-            || (ndvi < 0.1 && ndvi > 0.0 && band_nir[pixel_index] < 500))
+        if (write_status != SUCCESS)
         {
-            band_l2qa[pixel_index] = L2QA_WATER_PIXEL;
+            ERROR_MESSAGE("Failed writing L2 QA band data", MODULE_NAME);
 
-            /* Update the counts */
-            total_clear_pixels--;
-            total_water_pixels++;
+            abandon_scene(&xml_metadata, input_data, temp_fd,
+                          temp_filename);
+            return ERROR;
         }
 
+        previous_water_qa = band_water_qa;
+        previous_line_count = line_count;
+        buffer_index = 1 - buffer_index;
+
         /* Let the use know where we are in the processing */
-        if (pixel_index%99999 == 0)
-        {
-            printf("\rProcessed data element %d", pixel_index);
-        }
+        printf("\rProcessed data element %ld",
+               (long)(first_line + line_count) * samples);
+        fflush(stdout);
     }
     /* Status output cleanup to match the final output size */
-    printf("\rProcessed data element %d\n", pixel_index);
+    printf("\rProcessed data element %ld\n", pixel_count);
+
+    /* Write the last strip */
+    if (write_strip_lines(temp_fd, previous_line_count, samples,
+                          previous_water_qa) != SUCCESS)
+    {
+        ERROR_MESSAGE("Failed writing L2 QA band data", MODULE_NAME);
+
+        abandon_scene(&xml_metadata, input_data, temp_fd, temp_filename);
+        return ERROR;
+    }
 
-    float percent_clear = 100.0 * (float)total_clear_pixels
-                                  / (float)total_image_pixels;
-    float percent_water = 100.0 * (float)total_water_pixels
-                                  / (float)total_image_pixels;
-    if (verbose_flag)
+    if (fclose(temp_fd) != 0)
     {
-        printf ("Total Image Pixels = %d\n", total_image_pixels);
-        printf ("Total Clear Pixels = %d\n", total_clear_pixels);
-        printf ("Total Water Pixels = %d\n", total_water_pixels);
+        ERROR_MESSAGE("Failed writing L2 QA band data", MODULE_NAME);
+
+        abandon_scene(&xml_metadata, input_data, NULL, temp_filename);
+        return ERROR;
+    }
+    temp_fd = NULL;
+
+    float percent_clear = 100.0 * (float)clear_pixels
+                                  / (float)image_pixels;
+    float percent_water = 100.0 * (float)water_pixels
+                                  / (float)image_pixels;
+    if (options->verbose_flag)
+    {
+        printf ("Total Image Pixels = %ld\n", image_pixels);
+        printf ("Total Clear Pixels = %ld\n", clear_pixels);
+        printf ("Total Water Pixels = %ld\n", water_pixels);
+        printf ("Input Bytes Read = %lld\n", input_data->bytes_read);
         printf ("Percent Clear Pixels = %f\n", percent_clear);
         printf ("Percent Water Pixels = %f\n", percent_water);
     }
@@ -411,30 +691,8 @@ main (int argc, char *argv[])
     {
         ERROR_MESSAGE("Writing XML file", MODULE_NAME);
 
-        /* Cleanup memory */
-        free_metadata(&xml_metadata);
-        free(input_data);
-        free_band_memory(band_red, band_nir, band_l2qa);
-        free(xml_filename);
-
-        return EXIT_FAILURE;
-    }
-
-    /* Write the L2 QA Band data to temp file on disk */
-    snprintf(temp_filename, sizeof(temp_filename), "temp_%s",
-             input_data->band_name[I_BAND_L2QA]);
-
-    if (write_u8bit_data(temp_filename, pixel_count, band_l2qa) != SUCCESS)
-    {
-        ERROR_MESSAGE("Failed writing L2 QA band data", MODULE_NAME);
-
-        /* Cleanup memory */
-        free_metadata(&xml_metadata);
-        free(input_data);
-        free_band_memory(band_red, band_nir, band_l2qa);
-        free(xml_filename);
-
-        return EXIT_FAILURE;
+        abandon_scene(&xml_metadata, input_data, NULL, temp_filename);
+        return ERROR;
     }
 
     /* Rename the file over-writing the L2 QA Band filename */
@@ -443,13 +701,8 @@ main (int argc, char *argv[])
         ERROR_MESSAGE("Failed over-writing L2 QA band data with new results",
                       MODULE_NAME);
 
-        /* Cleanup memory */
-        free_metadata(&xml_metadata);
-        free(input_data);
-        free_band_memory(band_red, band_nir, band_l2qa);
-        free(xml_filename);
-
-        return EXIT_FAILURE;
+        abandon_scene(&xml_metadata, input_data, NULL, temp_filename);
+        return ERROR;
     }
 
     /* CLEANUP & EXIT ----------------------------------------------------- */
@@ -467,13 +720,201 @@ main (int argc, char *argv[])
     free(input_data);
     input_data = NULL;
 
-    /* Cleanup all the input band memory */
-    free_band_memory(band_red, band_nir, band_l2qa);
+    return SUCCESS;
+}
+
+
+/*****************************************************************************
+  NAME:  main
+
+  PURPOSE:  Implements the core algorithm for cfmask based water detection.
+
+  ALGORITHM DEVELOPERS:
+
+      The algorithm implemented here was developed by the following:
+
+      This software is based on the Matlab code developed by Zhe Zhu,
+      and Curtis E. Woodcock
+
+      Zhu, Z. and Woodcock, C. E., Object-based cloud and cloud shadow
+      detection in Landsat imagery, Remote Sensing of Environment (2012),
+      doi:10.1016/j.rse.2011.10.028
+
+  RETURN VALUE:  Type = int
+      Value           Description
+      --------------  --------------------------------------------------------
+      EXIT_FAILURE    An unrecoverable error occured during processing, for
+                      a batch at least one of the scenes failed.
+      EXIT_SKIPPED    No errors, but at least one scene was skipped for
+                      having less than the minimum percent clear.
+      EXIT_SUCCESS    No errors encountered processing succesfull.
+
+  NOTES:
+    1. A batch runs every scene in the same process, so the band memory
+       and the metadata schema are set up once and shared by the scenes.  A
+       scene which fails is reported and the batch continues with the next
+       one.
+    2. Each scene of a batch is processed from the directory of its XML
+       file, which is where its L2 QA band is, just as when it is processed
+       by itself.
+*****************************************************************************/
+int
+main (int argc, char *argv[])
+{
+    /* Command line parameters */
+    char *xml_filename = NULL;   /* filename for the XML input */
+    char *batch_filename = NULL; /* filename for a batch manifest */
+    Cfwd_Options_t options;      /* settings for every scene */
+
+    Band_Memory_t band_memory; /* Buffers shared by the scenes */
+
+    /* Batch variables */
+    char **scene_filenames = NULL; /* The XML files listed in the batch */
+    char *scene_filename;          /* XML file within its directory */
+    int scene_count = 0;
+    int scene_failures = 0;
+    int scene_skips = 0;
+    int scene;
+    int previous_dir_fd;
+
+    /* Other variables */
+    int status;
+    char msg[PATH_MAX + 80];
+
+
+    /* Get the command line arguments */
+    memset(&options, 0, sizeof(options));
+    if (get_args(argc, argv, &xml_filename, &batch_filename,
+                 &options.max_memory, &options.num_threads,
+                 &options.selective_read_flag, &options.min_percent_clear,
+                 &options.verbose_flag)
+        != SUCCESS)
+    {
+        /* get_args generates all the error messages we need */
+        return EXIT_FAILURE;
+    }
+
+    LOG_MESSAGE("Starting CFmask based water detection processing ...",
+                MODULE_NAME);
+
+    if (options.verbose_flag)
+    {
+        printf("    Max Memory MB: %d\n", options.max_memory);
+        printf("          Threads: %d\n", options.num_threads);
+
+        printf("   Selective Read:");
+        if (options.selective_read_flag)
+            printf(" TRUE\n");
+        else
+            printf(" FALSE\n");
+
+        printf("Min Percent Clear: %f\n", options.min_percent_clear);
+    }
+
+    /* Set the number of threads used for the pixel processing, the same
+       threads are used for every scene of a batch */
+#ifdef _OPENMP
+    omp_set_num_threads(options.num_threads);
+#endif
+
+    memset(&band_memory, 0, sizeof(band_memory));
+
+    if (batch_filename == NULL)
+    {
+        /* ---------------------------------------------------------------- */
+        /* A single scene */
+        status = process_scene(xml_filename, &options, &band_memory);
+        if (status == SCENE_SKIPPED)
+            scene_skips++;
+        else if (status != SUCCESS)
+            scene_failures++;
+    }
+    else
+    {
+        if (options.verbose_flag)
+        {
+            printf("   Batch Manifest: %s\n", batch_filename);
+        }
+
+        if (read_batch_manifest(batch_filename, &scene_filenames,
+                                &scene_count) != SUCCESS)
+        {
+            ERROR_MESSAGE("Failed reading the batch manifest", MODULE_NAME);
+
+            /* Cleanup memory */
+            free(batch_filename);
+
+            return EXIT_FAILURE;
+        }
+
+        /* The schema is parsed once for every scene, without it each
+           scene is validated the way a single scene is */
+        load_metadata_schema();
+
+        for (scene = 0; scene < scene_count; scene++)
+        {
+            snprintf(msg, sizeof(msg), "Processing scene %d of %d: %s",
+                     scene + 1, scene_count, scene_filenames[scene]);
+            LOG_MESSAGE(msg, MODULE_NAME);
+
+            if (enter_scene_directory(scene_filenames[scene],
+                                      &scene_filename, &previous_dir_fd)
+                != SUCCESS)
+            {
+                ERROR_MESSAGE("Failed changing to the scene directory",
+                              MODULE_NAME);
+                scene_failures++;
+                continue;
+            }
+
+            status = process_scene(scene_filename, &options, &band_memory);
+            if (status == SCENE_SKIPPED)
+            {
+                scene_skips++;
+            }
+            else if (status != SUCCESS)
+            {
+                ERROR_MESSAGE("Failed processing the scene", MODULE_NAME);
+                scene_failures++;
+            }
+            free(scene_filename);
+
+            /* Without the original directory the rest of the manifest can
+               not be found */
+            if (leave_scene_directory(previous_dir_fd) != SUCCESS)
+            {
+                ERROR_MESSAGE("Failed returning from the scene directory",
+                              MODULE_NAME);
+                scene_failures += scene_count - scene - 1;
+                break;
+            }
+        }
+
+        snprintf(msg, sizeof(msg), "Processed %d of %d scenes, %d skipped",
+                 scene_count - scene_failures - scene_skips, scene_count,
+                 scene_skips);
+        LOG_MESSAGE(msg, MODULE_NAME);
+
+        free_batch_manifest(scene_filenames, scene_count);
+        free_metadata_schema();
+    }
+
+    /* CLEANUP & EXIT ----------------------------------------------------- */
+
+    /* Cleanup all the output band memory */
+    free_band_memory(&band_memory);
 
     /* Free remaining allocated memory */
     free(xml_filename);
+    free(batch_filename);
+
+    if (scene_failures > 0)
+        return EXIT_FAILURE;
 
     LOG_MESSAGE("Processing complete.", MODULE_NAME);
 
+    if (scene_skips > 0)
+        return EXIT_SKIPPED;
+
     return EXIT_SUCCESS;
 }
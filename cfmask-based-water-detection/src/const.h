@@ -4,15 +4,14 @@
 
 
 #include "espa_common.h"
+#include "l2qa.h"
 
 
-/* L2QA integer classification values */
-#define L2QA_CLEAR_PIXEL        0
-#define L2QA_WATER_PIXEL        1
-#define L2QA_CLOUD_SHADOW_PIXEL 2
-#define L2QA_SNOW_PIXEL         3
-#define L2QA_CLOUD_PIXEL        4
-#define L2QA_FILL_PIXEL         255
+/* Without a memory budget a scene of more pixels than an int can count is
+   not held in memory at once, it is processed in strips within this
+   budget in megabytes */
+#define LARGE_SCENE_PIXELS 2147483647L
+#define LARGE_SCENE_MAX_MEMORY 1024
 
 
 /* These are used in arrays, and they are position dependent */
@@ -41,14 +41,52 @@ usage ()
     printf("CFmask based Water Detection\n"
            "Determines and adds Water Extent to the Level2 QA Band.\n\n");
     printf("usage: cfmask_water_detection"
-           " --xml <input_xml_filename> [--help]\n\n");
-    printf ("where the following parameters are required:\n");
+           " --xml <input_xml_filename> [--help]\n");
+    printf("       cfmask_water_detection"
+           " --batch <manifest_filename> [--help]\n\n");
+    printf ("where one of the following parameters is required:\n");
     printf ("    --xml: Name of the input XML file which contains the top of"
             " atmosphere\n"
             "           files output from TOA processing in raw binary "
-            "(envi) format\n\n");
+            "(envi) format\n");
+    printf ("    --batch: Name of a file listing the input XML files to"
+            " process,\n"
+            "             one per line, each scene is processed from the"
+            " directory of\n"
+            "             its XML file and a failed scene does not stop the"
+            " others\n\n");
 
     printf("where the following parameters are optional:\n");
+    printf("    --max-memory: Memory budget in megabytes for the band"
+           " buffers.  The scene\n"
+           "                  is processed in strips of lines sized to fit"
+           " the budget,\n"
+           "                  reading the input and writing the output as"
+           " it goes\n"
+           "                  (default is 0, meaning the whole scene is"
+           " processed at once,\n"
+           "                  except a scene of more than 2^31 pixels is"
+           " processed\n"
+           "                  within %d MB)\n", LARGE_SCENE_MAX_MEMORY);
+    printf("    --threads: Number of threads used to process the pixels"
+           " (default is 1)\n"
+           "               Requires building with ENABLE_THREADING=yes\n");
+    printf("    --selective-read: Read the L2 QA band first and only read"
+           " the red and nir\n"
+           "                      under its clear pixels.  Assumes the red"
+           " and nir are\n"
+           "                      only fill where the L2 QA band is (default"
+           " is false)\n");
+    printf("    --min-percent-clear: Skip the scenes with a smaller percent"
+           " of the pixels\n"
+           "                         which are not fill clear or water,"
+           " leaving their L2 QA\n"
+           "                         band unchanged.  Estimated from the"
+           " coverage of the\n"
+           "                         L2 QA band in the XML, or from a sample"
+           " of its lines\n"
+           "                         (default is 0, meaning every scene is"
+           " processed)\n");
     printf("    --verbose: Should intermediate messages be printed? (default"
            " is false)\n\n");
 
@@ -74,22 +112,35 @@ usage ()
 int
 get_args
 (
-    int argc,          /* I: number of cmd-line args */
-    char *argv[],      /* I: string of cmd-line args */
-    char **xml_infile, /* O: input XML filename */
-    bool *verbose_flag /* O: verbose messaging */
+    int argc,            /* I: number of cmd-line args */
+    char *argv[],        /* I: string of cmd-line args */
+    char **xml_infile,   /* O: input XML filename, NULL for a batch */
+    char **batch_infile, /* O: batch manifest filename, NULL for a single
+                               scene */
+    int *max_memory,     /* O: memory budget in megabytes */
+    int *num_threads,    /* O: number of processing threads */
+    bool *selective_read_flag, /* O: only read the red and nir of the clear
+                                     pixels */
+    float *min_percent_clear, /* O: scenes with less clear are skipped */
+    bool *verbose_flag   /* O: verbose messaging */
 )
 {
     int c;
     int option_index;
     char msg[256];
     int tmp_verbose_flag = false;
+    int tmp_selective_read_flag = false;
 
     struct option long_options[] = {
         /* These options provide values */
         {"xml", required_argument, 0, 'x'},
+        {"batch", required_argument, 0, 'b'},
+        {"max-memory", required_argument, 0, 'm'},
+        {"threads", required_argument, 0, 'c'},
+        {"min-percent-clear", required_argument, 0, 'p'},
 
         /* Special options */
+        {"selective-read", no_argument, &tmp_selective_read_flag, true},
         {"verbose", no_argument, &tmp_verbose_flag, true},
         {"version", no_argument, 0, 'v'},
 
@@ -108,6 +159,15 @@ get_args
         return ERROR;
     }
 
+    /* Process the whole scene at once unless a budget is given */
+    *max_memory = 0;
+
+    /* Serial processing unless more threads are requested */
+    *num_threads = 1;
+
+    /* Every scene is processed unless a minimum is given */
+    *min_percent_clear = 0.0;
+
     /* loop through all the cmd-line options */
     opterr = 0; /* turn off getopt_long error msgs as we'll print our own */
     while (1)
@@ -140,6 +200,22 @@ get_args
             *xml_infile = strdup(optarg);
             break;
 
+        case 'b':
+            *batch_infile = strdup(optarg);
+            break;
+
+        case 'm':
+            *max_memory = atoi(optarg);
+            break;
+
+        case 'c':
+            *num_threads = atoi(optarg);
+            break;
+
+        case 'p':
+            *min_percent_clear = atof(optarg);
+            break;
+
         case '?':
         default:
             snprintf(msg, sizeof(msg),
@@ -152,17 +228,61 @@ get_args
     }
 
     /* Grab the boolean command line options */
+    if (tmp_selective_read_flag)
+        *selective_read_flag = true;
+    else
+        *selective_read_flag = false;
+
     if (tmp_verbose_flag)
         *verbose_flag = true;
     else
         *verbose_flag = false;
 
     /* ---------- Validate the parameters ---------- */
-    /* Make sure the XML was specified */
-    if (*xml_infile == NULL)
+    /* Make sure the XML or a batch was specified, but not both */
+    if (*xml_infile == NULL && *batch_infile == NULL)
+    {
+        ERROR_MESSAGE("XML input file or batch manifest is a required"
+                      " command line argument\n\n", MODULE_NAME);
+        usage();
+        return ERROR;
+    }
+    if (*xml_infile != NULL && *batch_infile != NULL)
+    {
+        ERROR_MESSAGE("Only one of an XML input file or a batch manifest"
+                      " can be specified\n\n", MODULE_NAME);
+        usage();
+        return ERROR;
+    }
+
+    if (*max_memory < 0)
+    {
+        ERROR_MESSAGE("Max Memory is out of range\n\n", MODULE_NAME);
+        usage();
+        return ERROR;
+    }
+
+    if (*num_threads < 1)
+    {
+        ERROR_MESSAGE("Threads is out of range\n\n", MODULE_NAME);
+        usage();
+        return ERROR;
+    }
+
+#ifndef _OPENMP
+    if (*num_threads > 1)
+    {
+        ERROR_MESSAGE("Threading support is not compiled in, build with"
+                      " ENABLE_THREADING=yes for more than one thread\n\n",
+                      MODULE_NAME);
+        usage();
+        return ERROR;
+    }
+#endif
+
+    if (*min_percent_clear < 0.0 || *min_percent_clear > 100.0)
     {
-        ERROR_MESSAGE("XML input file is a required command line"
-                      " argument\n\n", MODULE_NAME);
+        ERROR_MESSAGE("Min Percent Clear is out of range\n\n", MODULE_NAME);
         usage();
         return ERROR;
     }
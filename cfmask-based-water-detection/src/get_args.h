@@ -10,6 +10,13 @@ int
 get_args (int argc,                    /* I: number of cmd-line args */
           char *argv[],                /* I: string of cmd-line args */
           char **xml_infile,           /* O: input XML filename */
+          char **batch_infile,         /* O: batch manifest filename */
+          int *max_memory,             /* O: memory budget in megabytes */
+          int *num_threads,            /* O: number of processing threads */
+          bool *selective_read_flag,   /* O: only read the red and nir of
+                                             the clear pixels */
+          float *min_percent_clear,    /* O: scenes with less clear are
+                                             skipped */
           bool * verbose_flag);        /* O: verbose messaging */
 
 
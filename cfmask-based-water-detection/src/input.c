@@ -1,11 +1,21 @@
 
 #include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 
 #include "cfmask_water_detection.h"
 #include "utilities.h"
 #include "input.h"
 
 
+/* Clear pixels closer than this many bytes apart in the red and nir images
+   are read together, instead of with a read for each */
+#define SELECTIVE_READ_GAP 4096
+
+
 /*****************************************************************************
   NAME:  open_band
 
@@ -186,11 +196,66 @@ GetXMLInput
 }
 
 
+/*****************************************************************************
+  NAME: map_band
+
+  PURPOSE: To memory map an input band read-only, so it is not copied from
+           the page cache.  When it can not be mapped its lines are read
+           instead.
+
+  RETURN VALUE:  None
+*****************************************************************************/
+static void
+map_band
+(
+    Input_Data_t *input_data, /* I/O: input data record */
+    Input_Bands_e band_index  /* I: band to map */
+)
+{
+    struct stat file_stat;
+    size_t band_size;
+    void *map;
+    int fd;
+    char msg[256];
+
+    band_size = (size_t)input_data->lines * input_data->samples
+                * input_data->data_size[band_index];
+    fd = fileno(input_data->band_fd[band_index]);
+
+    /* Accessing a mapping beyond the end of the file faults, so a short
+       file is left for the read to report */
+    if (band_size == 0 || fstat(fd, &file_stat) != 0
+        || file_stat.st_size < (off_t)band_size)
+    {
+        return;
+    }
+
+    map = mmap(NULL, band_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED)
+    {
+        snprintf(msg, sizeof(msg), "Failed mapping (%s), reading it instead",
+                 input_data->band_name[band_index]);
+        WARNING_MESSAGE(msg, MODULE_NAME);
+        return;
+    }
+
+    /* The pixels are processed in order, so let the kernel read ahead
+       aggressively */
+    madvise(map, band_size, MADV_SEQUENTIAL);
+
+    input_data->band_map[band_index] = map;
+    input_data->band_map_size[band_index] = band_size;
+}
+
+
 /*****************************************************************************
   NAME: open_input
 
   PURPOSE:  Open all the input files and allocate associated memory for the
-            filenames that reside in the data structure.
+            filenames that reside in the data structure.  The images are
+            mapped when map_flag is set, otherwise their lines are read as
+            they are needed.  With selective_read_flag only the parts of the
+            red and nir images under clear pixels are read.
 
   RETURN VALUE:  Type = Input_Data_t *
       Value    Description
@@ -201,7 +266,9 @@ GetXMLInput
 Input_Data_t *
 open_input
 (
-    Espa_internal_meta_t *metadata /* I: input metadata */
+    Espa_internal_meta_t *metadata,
+    bool map_flag,
+    bool selective_read_flag
 )
 {
     int index;
@@ -222,10 +289,20 @@ open_input
         input_data->band_fd[index] = NULL;
         input_data->fill_value[index] = -1;
         input_data->meta_index[index] = -1;
+        input_data->band_map[index] = NULL;
+        input_data->band_map_size[index] = 0;
+        input_data->band_map_released[index] = 0;
+        input_data->band_buffer[index] = NULL;
+        input_data->band_buffer_size[index] = 0;
     }
+    input_data->data_size[I_BAND_RED] = sizeof(int16_t);
+    input_data->data_size[I_BAND_NIR] = sizeof(int16_t);
+    input_data->data_size[I_BAND_L2QA] = sizeof(uint8_t);
 
     input_data->lines = 0;
     input_data->samples = 0;
+    input_data->selective_read_flag = selective_read_flag;
+    input_data->bytes_read = 0;
 
     /* Open the input images from the XML file */
     if (GetXMLInput(metadata, input_data) != SUCCESS)
@@ -235,6 +312,12 @@ open_input
         return NULL;
     }
 
+    if (map_flag && !selective_read_flag)
+    {
+        for (index = 0; index < MAX_INPUT_BANDS; index++)
+            map_band(input_data, index);
+    }
+
     return input_data;
 }
 
@@ -265,6 +348,16 @@ close_input
     had_issue = false;
     for (index = 0; index < MAX_INPUT_BANDS; index++)
     {
+        if (input_data->band_map[index] != NULL)
+        {
+            munmap((void *)input_data->band_map[index],
+                   input_data->band_map_size[index]);
+            input_data->band_map[index] = NULL;
+        }
+        free(input_data->band_buffer[index]);
+        input_data->band_buffer[index] = NULL;
+        input_data->band_buffer_size[index] = 0;
+
         if (input_data->band_fd[index] != NULL)
         {
             status = fclose(input_data->band_fd[index]);
@@ -296,57 +389,382 @@ close_input
 }
 
 
+/*****************************************************************************
+  NAME: reserve_band_buffer
+
+  PURPOSE: To make sure the buffer owned by the input data record for a band
+           holds at least the specified size.
+
+  RETURN VALUE:  Type = void *
+      Value    Description
+      -------  ---------------------------------------------------------------
+      NULL     Failed allocating the buffer.
+      *        The buffer.
+*****************************************************************************/
+static void *
+reserve_band_buffer
+(
+    Input_Data_t *input_data, /* I: input data record */
+    Input_Bands_e band_index, /* I: band the buffer is for */
+    size_t size               /* I: size needed */
+)
+{
+    if (size > input_data->band_buffer_size[band_index])
+    {
+        free(input_data->band_buffer[band_index]);
+        input_data->band_buffer_size[band_index] = 0;
+
+        input_data->band_buffer[band_index] = malloc(size);
+        if (input_data->band_buffer[band_index] == NULL)
+        {
+            RETURN_ERROR("Failed allocating memory for input lines",
+                         MODULE_NAME, NULL);
+        }
+        input_data->band_buffer_size[band_index] = size;
+    }
+
+    return input_data->band_buffer[band_index];
+}
+
+
+/*****************************************************************************
+  NAME: read_band_lines
+
+  PURPOSE: To read the specified lines of an input band into a buffer owned
+           by the input data record, which is reused for the next lines of
+           the band.
+
+  RETURN VALUE:  Type = const void *
+      Value    Description
+      -------  ---------------------------------------------------------------
+      NULL     Failed to read the lines.
+      *        The lines, valid until the next lines of the band are read or
+               the input is closed.
+*****************************************************************************/
+static const void *
+read_band_lines
+(
+    Input_Data_t *input_data, /* I: input data record */
+    Input_Bands_e band_index, /* I: band to read */
+    int first_line,           /* I: first line to read */
+    int line_count            /* I: how many lines are to be read */
+)
+{
+    off_t offset;
+    size_t element_count;
+    char msg[256];
+
+    offset = (off_t)first_line * input_data->samples
+             * input_data->data_size[band_index];
+    element_count = (size_t)line_count * input_data->samples;
+
+    if (reserve_band_buffer(input_data, band_index,
+                            element_count * input_data->data_size[band_index])
+        == NULL)
+    {
+        /* error messages provided by reserve_band_buffer */
+        return NULL;
+    }
+
+    if (fseeko(input_data->band_fd[band_index], offset, SEEK_SET) != 0)
+    {
+        snprintf(msg, sizeof(msg), "Failed seeking to line %d in (%s)",
+                 first_line, input_data->band_name[band_index]);
+        RETURN_ERROR(msg, MODULE_NAME, NULL);
+    }
+
+    if (fread(input_data->band_buffer[band_index],
+              input_data->data_size[band_index], element_count,
+              input_data->band_fd[band_index]) != element_count)
+    {
+        snprintf(msg, sizeof(msg), "Failed reading lines %d to %d from (%s)",
+                 first_line, first_line + line_count - 1,
+                 input_data->band_name[band_index]);
+        RETURN_ERROR(msg, MODULE_NAME, NULL);
+    }
+    input_data->bytes_read += element_count
+                              * input_data->data_size[band_index];
+
+    return input_data->band_buffer[band_index];
+}
+
+
+/*****************************************************************************
+  NAME: pread_fully
+
+  PURPOSE: To read a range of a file, retrying the reads which are
+           interrupted or come up short.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      SUCCESS  The whole range was read.
+      ERROR    Failed reading, or the file ends before the range does.
+*****************************************************************************/
+static int
+pread_fully
+(
+    int fd,        /* I: file to read */
+    void *data,    /* O: the range read */
+    size_t size,   /* I: size of the range */
+    off_t offset   /* I: start of the range in the file */
+)
+{
+    ssize_t count;
+
+    while (size > 0)
+    {
+        count = pread(fd, data, size, offset);
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count <= 0)
+            return ERROR;
+
+        data = (uint8_t *)data + count;
+        size -= count;
+        offset += count;
+    }
+
+    return SUCCESS;
+}
+
+
+/*****************************************************************************
+  NAME: read_clear_band_lines
+
+  PURPOSE: To read the parts of the specified lines of the red or nir band
+           which are under clear pixels of the L2 QA band.  Clear pixels
+           closer together than SELECTIVE_READ_GAP bytes are read with one
+           read, which includes the pixels between them.
+
+  RETURN VALUE:  Type = const int16_t *
+      Value    Description
+      -------  ---------------------------------------------------------------
+      NULL     Failed to read the lines.
+      *        The lines, valid until the next lines of the band are read or
+               the input is closed.
+
+  NOTES:
+    1. The pixels which are not read are given a value other than the fill
+       value of the band.  They are not tested for water, so only the fill
+       check sees them, which relies on the L2 QA band being fill wherever
+       the red or nir is.
+*****************************************************************************/
+static const int16_t *
+read_clear_band_lines
+(
+    Input_Data_t *input_data, /* I: input data record */
+    Input_Bands_e band_index, /* I: red or nir band to read */
+    int first_line,           /* I: first line to read */
+    int line_count,           /* I: how many lines are to be read */
+    const uint8_t *band_l2qa  /* I: the L2 QA band lines */
+)
+{
+    int16_t *data;
+    int16_t unread_value;
+    size_t pixel_count;
+    size_t gap_pixels;
+    size_t index;
+    size_t start;
+    size_t end;
+    size_t next;
+    off_t offset;
+    char msg[256];
+
+    pixel_count = (size_t)line_count * input_data->samples;
+    gap_pixels = SELECTIVE_READ_GAP / sizeof(int16_t);
+    offset = (off_t)first_line * input_data->samples * sizeof(int16_t);
+
+    data = reserve_band_buffer(input_data, band_index,
+                               pixel_count * sizeof(int16_t));
+    if (data == NULL)
+    {
+        /* error messages provided by reserve_band_buffer */
+        return NULL;
+    }
+
+    unread_value = 0;
+    if (input_data->fill_value[band_index] == 0)
+        unread_value = 1;
+
+    index = 0;
+    while (index < pixel_count)
+    {
+        /* Find the next clear pixel */
+        start = index;
+        while (start < pixel_count && band_l2qa[start] != L2QA_CLEAR_PIXEL)
+            start++;
+
+        /* Extend the range over the clear pixels which follow within the
+           gap */
+        end = start;
+        for (next = start; next < pixel_count && next - end <= gap_pixels;
+             next++)
+        {
+            if (band_l2qa[next] == L2QA_CLEAR_PIXEL)
+                end = next + 1;
+        }
+
+        for (; index < start; index++)
+            data[index] = unread_value;
+
+        if (end > start)
+        {
+            if (pread_fully(fileno(input_data->band_fd[band_index]),
+                            &data[start], (end - start) * sizeof(int16_t),
+                            offset + start * sizeof(int16_t)) != SUCCESS)
+            {
+                snprintf(msg, sizeof(msg), "Failed reading lines %d to %d"
+                         " from (%s)", first_line,
+                         first_line + line_count - 1,
+                         input_data->band_name[band_index]);
+                RETURN_ERROR(msg, MODULE_NAME, NULL);
+            }
+            input_data->bytes_read += (end - start) * sizeof(int16_t);
+        }
+
+        index = end;
+    }
+
+    return data;
+}
+
+
+/*****************************************************************************
+  NAME: release_mapped_lines
+
+  PURPOSE: To drop the pages of a mapped band before the lines about to be
+           provided.  The lines are provided in order, so those pages are
+           done with, and dropping them keeps a large scene processed in
+           strips from holding every page it has mapped.
+
+  RETURN VALUE:  None
+*****************************************************************************/
+static void
+release_mapped_lines
+(
+    Input_Data_t *input_data, /* I/O: input data record */
+    Input_Bands_e band_index, /* I: mapped band */
+    size_t offset             /* I: offset of the lines to provide */
+)
+{
+    size_t page_size;
+    size_t released;
+    size_t end;
+
+    page_size = sysconf(_SC_PAGESIZE);
+    released = input_data->band_map_released[band_index];
+    end = offset - offset % page_size;
+    if (end <= released)
+        return;
+
+    madvise((uint8_t *)input_data->band_map[band_index] + released,
+            end - released, MADV_DONTNEED);
+    input_data->band_map_released[band_index] = end;
+}
+
+
+/*****************************************************************************
+  NAME: get_band_lines
+
+  PURPOSE: To provide the specified lines of an input band.  For a mapped
+           band this points into the mapping, otherwise the lines are read.
+
+  RETURN VALUE:  Type = const void *
+      Value    Description
+      -------  ---------------------------------------------------------------
+      NULL     Failed to provide the lines.
+      *        The lines, valid until the next lines of the band are
+               provided or the input is closed.
+*****************************************************************************/
+static const void *
+get_band_lines
+(
+    Input_Data_t *input_data, /* I: input data record */
+    Input_Bands_e band_index, /* I: band to provide */
+    int first_line,           /* I: first line to provide */
+    int line_count            /* I: how many lines are to be provided */
+)
+{
+    size_t offset = (size_t)first_line * input_data->samples
+                    * input_data->data_size[band_index];
+
+    if (input_data->band_map[band_index] != NULL)
+    {
+        release_mapped_lines(input_data, band_index, offset);
+        return (const uint8_t *)input_data->band_map[band_index] + offset;
+    }
+
+    return read_band_lines(input_data, band_index, first_line, line_count);
+}
+
+
 /*****************************************************************************
   NAME: read_bands_into_memory
 
-  PURPOSE: To read the specified input band data into memory for later
-           processing.
+  PURPOSE: To provide the specified lines of the input bands for later
+           processing.  With a selective read the L2 QA band is provided
+           first and only the red and nir under its clear pixels are read.
 
-  RETURN VALUE:  Type = bool
+  RETURN VALUE:  Type = int
       Value    Description
       -------  ---------------------------------------------------------------
-      true     Success with reading all of the bands into memory.
-      false    Failed to read a band into memory.
+      SUCCESS  Success with providing all of the bands.
+      ERROR    Failed to provide a band.
 *****************************************************************************/
 int
 read_bands_into_memory
 (
     Input_Data_t *input_data,
-    int16_t *band_red,
-    int16_t *band_nir,
-    uint8_t *band_l2qa,
-    int pixel_count
+    int first_line,
+    int line_count,
+    const int16_t **band_red,
+    const int16_t **band_nir,
+    const uint8_t **band_l2qa
 )
 {
-    int count;
-
-    count = fread(band_red, sizeof(int16_t), pixel_count,
-                  input_data->band_fd[I_BAND_RED]);
-    if (count != pixel_count)
+    *band_l2qa = get_band_lines(input_data, I_BAND_L2QA, first_line,
+                                line_count);
+    if (*band_l2qa == NULL)
     {
-        ERROR_MESSAGE("Failed reading red band data", MODULE_NAME);
+        ERROR_MESSAGE("Failed reading L2 QA band data", MODULE_NAME);
 
         return ERROR;
     }
 
-    count = fread(band_nir, sizeof(int16_t), pixel_count,
-                  input_data->band_fd[I_BAND_NIR]);
-    if (count != pixel_count)
+    if (input_data->selective_read_flag)
     {
-        ERROR_MESSAGE("Failed reading nir band data", MODULE_NAME);
+        *band_red = read_clear_band_lines(input_data, I_BAND_RED, first_line,
+                                          line_count, *band_l2qa);
+    }
+    else
+    {
+        *band_red = get_band_lines(input_data, I_BAND_RED, first_line,
+                                   line_count);
+    }
+    if (*band_red == NULL)
+    {
+        ERROR_MESSAGE("Failed reading red band data", MODULE_NAME);
 
         return ERROR;
     }
 
-    count = fread(band_l2qa, sizeof(uint8_t), pixel_count,
-                  input_data->band_fd[I_BAND_L2QA]);
-    if (count != pixel_count)
+    if (input_data->selective_read_flag)
     {
-        ERROR_MESSAGE("Failed reading L2 QA band data", MODULE_NAME);
+        *band_nir = read_clear_band_lines(input_data, I_BAND_NIR, first_line,
+                                          line_count, *band_l2qa);
+    }
+    else
+    {
+        *band_nir = get_band_lines(input_data, I_BAND_NIR, first_line,
+                                   line_count);
+    }
+    if (*band_nir == NULL)
+    {
+        ERROR_MESSAGE("Failed reading nir band data", MODULE_NAME);
 
         return ERROR;
     }
 
     return SUCCESS;
 }
-
@@ -3,6 +3,8 @@
 #define INPUT_H
 
 
+#include <stddef.h>
+#include <stdbool.h>
 #include <stdint.h>
 
 #include "espa_metadata.h"
@@ -19,13 +21,30 @@ typedef struct
     FILE *band_fd[MAX_INPUT_BANDS];      /* Open fd's for the image */
     int fill_value[MAX_INPUT_BANDS];     /* Fill value from the metadata */
     int meta_index[MAX_INPUT_BANDS];     /* Index in the band metadata */
+    int data_size[MAX_INPUT_BANDS];      /* Size of a single data element */
+    const void *band_map[MAX_INPUT_BANDS]; /* Read-only mapping of the image,
+                                              NULL when it is read instead */
+    size_t band_map_size[MAX_INPUT_BANDS]; /* Size of the mapping */
+    size_t band_map_released[MAX_INPUT_BANDS]; /* Bytes at the start of the
+                                                  mapping already dropped */
+    void *band_buffer[MAX_INPUT_BANDS];  /* The lines read when the image is
+                                            not mapped */
+    size_t band_buffer_size[MAX_INPUT_BANDS]; /* Size of the buffer */
+    bool selective_read_flag;  /* Only read the red and nir of the clear
+                                  pixels */
+    long long bytes_read;      /* Bytes of the input bands read */
 } Input_Data_t;
 
 
 Input_Data_t *
 open_input
 (
-    Espa_internal_meta_t *metadata /* I: input metadata */
+    Espa_internal_meta_t *metadata, /* I: input metadata */
+    bool map_flag,                  /* I: map the images instead of reading
+                                          the lines as they are needed */
+    bool selective_read_flag        /* I: only read the red and nir of the
+                                          clear pixels, the images are not
+                                          mapped */
 );
 
 
@@ -39,11 +58,12 @@ close_input
 int
 read_bands_into_memory
 (
-    Input_Data_t *input_data, /* I: input data record */
-    int16_t *band_red,        /* I: pointer to allocated memory */
-    int16_t *band_nir,        /* I: pointer to allocated memory */
-    uint8_t *band_l2qa,       /* I: pointer to allocated memory */
-    int pixel_count           /* I: how many pixel are to be read in */
+    Input_Data_t *input_data,  /* I: input data record */
+    int first_line,            /* I: first line to provide */
+    int line_count,            /* I: how many lines are to be provided */
+    const int16_t **band_red,  /* O: the band data */
+    const int16_t **band_nir,  /* O: the band data */
+    const uint8_t **band_l2qa  /* O: the band data */
 );
 
 
@@ -0,0 +1,365 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ctype.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include <libxml/xmlschemas.h>
+
+
+#include "espa_metadata.h"
+#include "parse_metadata.h"
+
+
+#include "common.h"
+#include "utilities.h"
+#include "batch.h"
+
+
+/* The ESPA metadata schema, parsed once and used to validate the XML of
+   every scene in the batch */
+static xmlSchemaPtr metadata_schema = NULL;
+
+
+/*****************************************************************************
+  NAME:  read_batch_manifest
+
+  PURPOSE:  Read the list of XML files to process from a manifest file.
+            Each line holds one XML file, blank lines and lines starting
+            with # are skipped.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      ERROR    Failed reading the manifest or it lists no XML files.
+      SUCCESS  No errors encountered.
+*****************************************************************************/
+int
+read_batch_manifest
+(
+    const char *manifest_filename,
+    char ***xml_filenames,
+    int *scene_count
+)
+{
+    FILE *fd;
+    char *line = NULL;
+    size_t line_size = 0;
+    char *start;
+    char *end;
+    char **filenames = NULL;
+    char **grown;
+    int capacity = 0;
+    int count = 0;
+    char msg[PATH_MAX + 40];
+
+    fd = fopen(manifest_filename, "r");
+    if (fd == NULL)
+    {
+        snprintf(msg, sizeof(msg), "Failed opening batch manifest %s",
+                 manifest_filename);
+        RETURN_ERROR(msg, MODULE_NAME, ERROR);
+    }
+
+    while (getline(&line, &line_size, fd) != -1)
+    {
+        /* Trim the white space around the filename */
+        start = line;
+        while (isspace((unsigned char) *start))
+            start++;
+        end = start + strlen(start);
+        while (end > start && isspace((unsigned char) end[-1]))
+            end--;
+        *end = '\0';
+
+        if (*start == '\0' || *start == '#')
+            continue;
+
+        if (count == capacity)
+        {
+            capacity = (capacity == 0) ? 16 : 2 * capacity;
+            grown = realloc(filenames, capacity * sizeof(char *));
+            if (grown == NULL)
+            {
+                free(line);
+                fclose(fd);
+                free_batch_manifest(filenames, count);
+                RETURN_ERROR("Failed allocating memory for the batch"
+                             " manifest", MODULE_NAME, ERROR);
+            }
+            filenames = grown;
+        }
+
+        filenames[count] = strdup(start);
+        if (filenames[count] == NULL)
+        {
+            free(line);
+            fclose(fd);
+            free_batch_manifest(filenames, count);
+            RETURN_ERROR("Failed allocating memory for the batch manifest",
+                         MODULE_NAME, ERROR);
+        }
+        count++;
+    }
+    free(line);
+    fclose(fd);
+
+    if (count == 0)
+    {
+        snprintf(msg, sizeof(msg), "Batch manifest %s lists no XML files",
+                 manifest_filename);
+        RETURN_ERROR(msg, MODULE_NAME, ERROR);
+    }
+
+    *xml_filenames = filenames;
+    *scene_count = count;
+
+    return SUCCESS;
+}
+
+
+/*****************************************************************************
+  NAME:  free_batch_manifest
+
+  PURPOSE:  Free the memory allocated by read_batch_manifest.
+
+  RETURN VALUE:  None
+*****************************************************************************/
+void
+free_batch_manifest
+(
+    char **xml_filenames,
+    int scene_count
+)
+{
+    int index;
+
+    for (index = 0; index < scene_count; index++)
+        free(xml_filenames[index]);
+    free(xml_filenames);
+}
+
+
+/*****************************************************************************
+  NAME:  enter_scene_directory
+
+  PURPOSE:  Change to the directory holding the XML file of a scene.  The
+            band files named in the XML, and the output band files, are
+            relative to it, just as when a single scene is processed from
+            its own directory.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      ERROR    Failed changing to the directory.
+      SUCCESS  No errors encountered.
+*****************************************************************************/
+int
+enter_scene_directory
+(
+    const char *xml_path,
+    char **xml_filename,
+    int *previous_dir_fd
+)
+{
+    const char *slash;
+    char *directory;
+    char msg[PATH_MAX + 40];
+
+    *xml_filename = NULL;
+    *previous_dir_fd = open (".", O_RDONLY | O_DIRECTORY);
+    if (*previous_dir_fd == -1)
+    {
+        RETURN_ERROR("Failed opening the current directory", MODULE_NAME,
+                     ERROR);
+    }
+
+    slash = strrchr(xml_path, '/');
+    if (slash != NULL)
+    {
+        /* Keep the slash so the root directory is not empty */
+        directory = strndup(xml_path, slash - xml_path + 1);
+        if (directory == NULL || chdir(directory) != 0)
+        {
+            snprintf(msg, sizeof(msg), "Failed changing to the directory"
+                     " of %s", xml_path);
+            ERROR_MESSAGE(msg, MODULE_NAME);
+
+            free(directory);
+            close(*previous_dir_fd);
+            *previous_dir_fd = -1;
+            return ERROR;
+        }
+        free(directory);
+        xml_path = slash + 1;
+    }
+
+    *xml_filename = strdup (xml_path);
+    if (*xml_filename == NULL)
+    {
+        leave_scene_directory(*previous_dir_fd);
+        *previous_dir_fd = -1;
+        RETURN_ERROR("Failed allocating memory for the XML filename",
+                     MODULE_NAME, ERROR);
+    }
+
+    return SUCCESS;
+}
+
+
+/*****************************************************************************
+  NAME:  leave_scene_directory
+
+  PURPOSE:  Return to the directory the scene directory was entered from.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      ERROR    Failed returning to the directory.
+      SUCCESS  No errors encountered.
+*****************************************************************************/
+int
+leave_scene_directory
+(
+    int previous_dir_fd
+)
+{
+    int status = SUCCESS;
+
+    if (fchdir(previous_dir_fd) != 0)
+    {
+        ERROR_MESSAGE("Failed returning to the batch directory",
+                      MODULE_NAME);
+        status = ERROR;
+    }
+    close(previous_dir_fd);
+
+    return status;
+}
+
+
+/*****************************************************************************
+  NAME:  load_metadata_schema
+
+  PURPOSE:  Parse the ESPA metadata schema once for validating the XML of
+            every scene.  The schema is found the same way the ESPA library
+            finds it, from the ESPA_SCHEMA environment variable, then the
+            locally installed schema, then the published one.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      ERROR    The schema could not be parsed, validate_metadata will use
+               the ESPA library for each XML file instead.
+      SUCCESS  No errors encountered.
+*****************************************************************************/
+int
+load_metadata_schema ()
+{
+    const char *schema_filename;
+    xmlSchemaParserCtxtPtr parser_context;
+    char msg[PATH_MAX + 80];
+
+    if (metadata_schema != NULL)
+        return SUCCESS;
+
+    schema_filename = getenv("ESPA_SCHEMA");
+#ifdef LOCAL_ESPA_SCHEMA
+    if (schema_filename == NULL && access(LOCAL_ESPA_SCHEMA, F_OK) == 0)
+        schema_filename = LOCAL_ESPA_SCHEMA;
+#endif
+#ifdef ESPA_SCHEMA
+    if (schema_filename == NULL)
+        schema_filename = ESPA_SCHEMA;
+#endif
+    if (schema_filename == NULL)
+    {
+        WARNING_MESSAGE("No ESPA metadata schema is known, each XML file is"
+                        " validated separately", MODULE_NAME);
+        return ERROR;
+    }
+
+    parser_context = xmlSchemaNewParserCtxt(schema_filename);
+    if (parser_context != NULL)
+    {
+        metadata_schema = xmlSchemaParse(parser_context);
+        xmlSchemaFreeParserCtxt(parser_context);
+    }
+    if (metadata_schema == NULL)
+    {
+        snprintf(msg, sizeof(msg), "Failed parsing the ESPA metadata schema"
+                 " %s, each XML file is validated separately",
+                 schema_filename);
+        WARNING_MESSAGE(msg, MODULE_NAME);
+        return ERROR;
+    }
+
+    return SUCCESS;
+}
+
+
+/*****************************************************************************
+  NAME:  validate_metadata
+
+  PURPOSE:  Validate an XML file against the ESPA metadata schema, using the
+            schema parsed by load_metadata_schema when there is one.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      ERROR    The XML file is not valid.
+      SUCCESS  No errors encountered.
+*****************************************************************************/
+int
+validate_metadata
+(
+    char *xml_filename
+)
+{
+    xmlSchemaValidCtxtPtr valid_context;
+    int status;
+    char msg[PATH_MAX + 40];
+
+    if (metadata_schema == NULL)
+        return validate_xml_file(xml_filename);
+
+    valid_context = xmlSchemaNewValidCtxt(metadata_schema);
+    if (valid_context == NULL)
+    {
+        RETURN_ERROR("Failed creating the schema validation context",
+                     MODULE_NAME, ERROR);
+    }
+
+    status = xmlSchemaValidateFile(valid_context, xml_filename, 0);
+    xmlSchemaFreeValidCtxt(valid_context);
+    if (status != 0)
+    {
+        snprintf(msg, sizeof(msg), "XML file %s is not valid against the"
+                 " ESPA metadata schema", xml_filename);
+        RETURN_ERROR(msg, MODULE_NAME, ERROR);
+    }
+
+    return SUCCESS;
+}
+
+
+/*****************************************************************************
+  NAME:  free_metadata_schema
+
+  PURPOSE:  Free the schema parsed by load_metadata_schema.
+
+  RETURN VALUE:  None
+*****************************************************************************/
+void
+free_metadata_schema ()
+{
+    if (metadata_schema != NULL)
+    {
+        xmlSchemaFree(metadata_schema);
+        metadata_schema = NULL;
+    }
+}
@@ -0,0 +1,54 @@
+
+#ifndef BATCH_H
+#define BATCH_H
+
+
+int
+read_batch_manifest
+(
+    const char *manifest_filename, /* I: file listing the XML files */
+    char ***xml_filenames,         /* O: the XML files listed */
+    int *scene_count               /* O: number of XML files listed */
+);
+
+
+void
+free_batch_manifest
+(
+    char **xml_filenames, /* I: the XML files from read_batch_manifest */
+    int scene_count       /* I: number of XML files */
+);
+
+
+int
+enter_scene_directory
+(
+    const char *xml_path,  /* I: the XML file as listed in the manifest */
+    char **xml_filename,   /* O: the XML file within its directory */
+    int *previous_dir_fd   /* O: the directory to return to */
+);
+
+
+int
+leave_scene_directory
+(
+    int previous_dir_fd /* I: the directory from enter_scene_directory */
+);
+
+
+int
+load_metadata_schema ();
+
+
+int
+validate_metadata
+(
+    char *xml_filename /* I: the XML file to validate */
+);
+
+
+void
+free_metadata_schema ();
+
+
+#endif /* BATCH_H */
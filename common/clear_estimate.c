@@ -0,0 +1,186 @@
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+
+#include "common.h"
+#include "l2qa.h"
+#include "clear_estimate.h"
+
+
+/*****************************************************************************
+  NAME:  percent_clear_from_coverage
+
+  PURPOSE:  Adds up the clear and water coverage of a mask band from its
+            metadata.
+
+  RETURN VALUE:  Type = bool
+      Value    Description
+      -------  ---------------------------------------------------------------
+      false    The band has no clear coverage in its metadata.
+      true     The percent clear was determined.
+*****************************************************************************/
+static bool
+percent_clear_from_coverage
+(
+    const Espa_band_meta_t *band_meta, /* I: the cfmask or Level2 QA band */
+    float *percent_clear               /* O: percent clear or water */
+)
+{
+    int cover_index;
+    bool clear_flag = false;
+
+    *percent_clear = 0.0;
+    for (cover_index = 0; cover_index < band_meta->ncover; cover_index++)
+    {
+        if (strcmp(band_meta->percent_cover[cover_index].description,
+                   "clear") == 0)
+        {
+            *percent_clear += band_meta->percent_cover[cover_index].percent;
+            clear_flag = true;
+        }
+        else if (strcmp(band_meta->percent_cover[cover_index].description,
+                        "water") == 0)
+        {
+            *percent_clear += band_meta->percent_cover[cover_index].percent;
+        }
+    }
+
+    return clear_flag;
+}
+
+
+/*****************************************************************************
+  NAME:  percent_clear_from_sample
+
+  PURPOSE:  Counts the clear and water pixels of evenly spaced lines of a
+            mask band.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      ERROR    The band could not be read.
+      SUCCESS  The percent clear was determined, zero when every sampled
+               pixel is fill.
+*****************************************************************************/
+static int
+percent_clear_from_sample
+(
+    const Espa_band_meta_t *band_meta, /* I: the cfmask or Level2 QA band */
+    float *percent_clear               /* O: percent clear or water */
+)
+{
+    int fd;
+    uint8_t *line_buffer;
+    uint8_t fill_value = (uint8_t)band_meta->fill_value;
+    int sample_lines = CLEAR_ESTIMATE_SAMPLE_LINES;
+    int sample;
+    int line;
+    int index;
+    long long image_pixels = 0;
+    long long clear_pixels = 0;
+    size_t line_size = band_meta->nsamps;
+    ssize_t bytes;
+
+    if (band_meta->data_type != ESPA_UINT8 || band_meta->nlines <= 0
+        || band_meta->nsamps <= 0)
+    {
+        return ERROR;
+    }
+
+    if (sample_lines > band_meta->nlines)
+        sample_lines = band_meta->nlines;
+
+    line_buffer = malloc(line_size);
+    if (line_buffer == NULL)
+        return ERROR;
+
+    fd = open(band_meta->file_name, O_RDONLY);
+    if (fd == -1)
+    {
+        free(line_buffer);
+        return ERROR;
+    }
+
+    /* The middle line of each of the equal parts of the band */
+    for (sample = 0; sample < sample_lines; sample++)
+    {
+        line = (int)(((2LL * sample + 1) * band_meta->nlines)
+                     / (2LL * sample_lines));
+
+        bytes = pread(fd, line_buffer, line_size, (off_t)line * line_size);
+        if (bytes != (ssize_t)line_size)
+        {
+            close(fd);
+            free(line_buffer);
+            return ERROR;
+        }
+
+        for (index = 0; index < band_meta->nsamps; index++)
+        {
+            if (line_buffer[index] == fill_value)
+                continue;
+
+            image_pixels++;
+            if (line_buffer[index] == L2QA_CLEAR_PIXEL
+                || line_buffer[index] == L2QA_WATER_PIXEL)
+            {
+                clear_pixels++;
+            }
+        }
+    }
+
+    close(fd);
+    free(line_buffer);
+
+    if (image_pixels == 0)
+        *percent_clear = 0.0;
+    else
+        *percent_clear = 100.0 * (double)clear_pixels / image_pixels;
+
+    return SUCCESS;
+}
+
+
+/*****************************************************************************
+  NAME:  estimate_percent_clear
+
+  PURPOSE:  Estimates the percent of the pixels of a scene which are not
+            fill that are clear or water, before any of its bands are read,
+            so a scene which is almost all cloud, cloud shadow, snow, or
+            fill can be passed over.  The coverage in the metadata of the
+            cfmask or Level2 QA band is used when it has it, otherwise the
+            band is sampled.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      ERROR    The band has no coverage and could not be sampled, the caller
+               reports it.
+      SUCCESS  The percent clear was estimated.
+
+  NOTES:
+    1. The cfmask and Level2 QA have the same class values.
+    2. Only CLEAR_ESTIMATE_SAMPLE_LINES lines are read when sampling, which
+       is a small part of the band for a full scene.
+*****************************************************************************/
+int
+estimate_percent_clear
+(
+    const Espa_band_meta_t *band_meta,
+    float *percent_clear,
+    bool *sampled_flag
+)
+{
+    if (percent_clear_from_coverage(band_meta, percent_clear))
+    {
+        *sampled_flag = false;
+        return SUCCESS;
+    }
+
+    *sampled_flag = true;
+    return percent_clear_from_sample(band_meta, percent_clear);
+}
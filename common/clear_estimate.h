@@ -0,0 +1,33 @@
+#ifndef CLEAR_ESTIMATE_H
+#define CLEAR_ESTIMATE_H
+
+
+#include <stdbool.h>
+
+
+#include "espa_metadata.h"
+
+
+/* Returned by process_scene for a scene which is skipped for having too
+   few clear pixels, and the exit status of a run with skipped scenes and
+   no failures */
+#define SCENE_SKIPPED 2
+#define EXIT_SKIPPED 2
+
+/* Lines of the mask band read to estimate the clear pixels when its
+   metadata has no coverage */
+#define CLEAR_ESTIMATE_SAMPLE_LINES 256
+
+
+int
+estimate_percent_clear
+(
+    const Espa_band_meta_t *band_meta, /* I: the cfmask or Level2 QA band */
+    float *percent_clear,   /* O: percent of the pixels which are not fill
+                                  that are clear or water */
+    bool *sampled_flag      /* O: the band was sampled since its metadata has
+                                  no clear coverage */
+);
+
+
+#endif /* CLEAR_ESTIMATE_H */
@@ -0,0 +1,14 @@
+
+#ifndef COMMON_H
+#define COMMON_H
+
+
+#include "espa_common.h"
+
+
+/* The module name the shared code logs under, only the shared code includes
+   this header */
+#define MODULE_NAME "COMMON"
+
+
+#endif /* COMMON_H */
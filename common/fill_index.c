@@ -0,0 +1,108 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+
+#include "common.h"
+#include "utilities.h"
+#include "fill_index.h"
+
+
+/*****************************************************************************
+  NAME:  allocate_fill_index
+
+  PURPOSE:  Allocate the spans for every line of a band.  The spans are
+            filled in by index_fill_lines.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      ERROR    Failed allocating the index.
+      SUCCESS  No errors encountered.
+*****************************************************************************/
+int
+allocate_fill_index
+(
+    int lines,
+    Fill_Index_t *fill_index
+)
+{
+    fill_index->lines = lines;
+    fill_index->first_valid = calloc(lines, sizeof(int));
+    fill_index->end_valid = calloc(lines, sizeof(int));
+    if (fill_index->first_valid == NULL || fill_index->end_valid == NULL)
+    {
+        free_fill_index(fill_index);
+        RETURN_ERROR("Failed allocating memory for the fill index",
+                      MODULE_NAME, ERROR);
+    }
+
+    return SUCCESS;
+}
+
+
+/*****************************************************************************
+  NAME:  free_fill_index
+
+  PURPOSE:  Free the memory allocated by allocate_fill_index.
+
+  RETURN VALUE:  None
+*****************************************************************************/
+void
+free_fill_index
+(
+    Fill_Index_t *fill_index
+)
+{
+    free(fill_index->first_valid);
+    free(fill_index->end_valid);
+    fill_index->first_valid = NULL;
+    fill_index->end_valid = NULL;
+}
+
+
+/*****************************************************************************
+  NAME:  index_fill_lines
+
+  PURPOSE:  Determine the span of each line which is not fill.
+
+  RETURN VALUE:  None
+
+  NOTES:
+    1. Each line is searched from both ends toward the first sample which
+       is not fill, so only the fill around the footprint of the scene is
+       looked at.  Fill within the span is left to the per pixel checks.
+*****************************************************************************/
+void
+index_fill_lines
+(
+    Fill_Index_t *fill_index,
+    const uint8_t *band,
+    uint8_t fill_value,
+    int first_line,
+    int line_count,
+    int samples
+)
+{
+    int line;
+    int first;
+    int end;
+    const uint8_t *line_data;
+
+    for (line = 0; line < line_count; line++)
+    {
+        line_data = &band[(long) line * samples];
+
+        first = 0;
+        while (first < samples && line_data[first] == fill_value)
+            first++;
+
+        end = samples;
+        while (end > first && line_data[end - 1] == fill_value)
+            end--;
+
+        fill_index->first_valid[first_line + line] = first;
+        fill_index->end_valid[first_line + line] = end;
+    }
+}
@@ -0,0 +1,49 @@
+
+#ifndef FILL_INDEX_H
+#define FILL_INDEX_H
+
+
+#include <stdint.h>
+
+
+/* The span of each line which is not fill, the samples before and after it
+   are all fill so they can be written without being processed */
+typedef struct
+{
+    int lines;          /* Lines in the band */
+    int *first_valid;   /* First sample of each line which is not fill */
+    int *end_valid;     /* One past the last sample of each line which is
+                           not fill, equal to first_valid when the whole
+                           line is fill */
+} Fill_Index_t;
+
+
+int
+allocate_fill_index
+(
+    int lines,                /* I: number of lines in the band */
+    Fill_Index_t *fill_index  /* O: the index with every line unindexed */
+);
+
+
+void
+free_fill_index
+(
+    Fill_Index_t *fill_index  /* I: the index to free */
+);
+
+
+void
+index_fill_lines
+(
+    Fill_Index_t *fill_index, /* I/O: the index the lines are added to */
+    const uint8_t *band,      /* I: the lines of the band, starting at
+                                    first_line */
+    uint8_t fill_value,       /* I: fill value of the band */
+    int first_line,           /* I: first line to index */
+    int line_count,           /* I: number of lines to index */
+    int samples               /* I: number of samples in each line */
+);
+
+
+#endif /* FILL_INDEX_H */
@@ -0,0 +1,15 @@
+
+#ifndef L2QA_H
+#define L2QA_H
+
+
+/* L2QA integer classification values */
+#define L2QA_CLEAR_PIXEL        0
+#define L2QA_WATER_PIXEL        1
+#define L2QA_CLOUD_SHADOW_PIXEL 2
+#define L2QA_SNOW_PIXEL         3
+#define L2QA_CLOUD_PIXEL        4
+#define L2QA_FILL_PIXEL         255
+
+
+#endif /* L2QA_H */
@@ -0,0 +1,136 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+
+#include "common.h"
+#include "l2qa.h"
+#include "water_test.h"
+
+
+/*****************************************************************************
+  NAME:  detect_water_pixels_scalar
+
+  PURPOSE:  Adds the water pixels to a span of the Level2 QA Band, using
+            the CFmask water test on the clear pixels.
+
+  RETURN VALUE:  None
+
+  NOTES:
+    1. This is the reference implementation, the SIMD implementation must
+       produce identical results.
+    2. The water test was done with a float NDVI compared against the
+       doubles 0.01 and 0.1.  It is now done with integers, without a
+       division, and gives the same answer for every pair of int16 red and
+       nir values:
+       - With the denominator made positive by negating both the numerator
+         and the denominator, NDVI = difference / sum.
+       - The float quotient is below 0.01 when the exact quotient is at most
+         0.01, since the largest float below 0.01 is the even one and the
+         rounding midpoint above it is within 2.5e-10 of 0.01, closer than
+         any quotient of int16 sums can get to 0.01 without equalling it.
+         So NDVI < 0.01 is 100 * difference <= sum.
+       - The rounding midpoint below 0.1 is within 2.3e-9 of 0.1, so the
+         float quotient is below 0.1 exactly when the exact quotient is.
+         NDVI < 0.1 is 10 * difference < sum.
+       - The quotient of int16 sums can not underflow, NDVI > 0.0 is
+         difference > 0.
+       - A sum of zero made the NDVI 0.01 as a float, which is below the
+         double 0.01, so only the nir test applies.
+*****************************************************************************/
+void
+detect_water_pixels_scalar
+(
+    const int16_t *band_red,
+    const int16_t *band_nir,
+    const uint8_t *band_l2qa,
+    int16_t red_fill_value,
+    int16_t nir_fill_value,
+    uint8_t l2qa_fill_value,
+    int pixel_count,
+    uint8_t *band_water_qa,
+    Water_Counts_t *counts
+)
+{
+    int pixel_index;
+    int red;
+    int nir;
+    int sum;         /* The NDVI denominator */
+    int difference;  /* The NDVI numerator */
+    bool fill;
+    bool clear;
+    bool water;
+
+    for (pixel_index = 0; pixel_index < pixel_count; pixel_index++)
+    {
+        red = band_red[pixel_index];
+        nir = band_nir[pixel_index];
+
+        /* If any of the input is fill, make the output fill */
+        fill = red == red_fill_value || nir == nir_fill_value
+               || band_l2qa[pixel_index] == l2qa_fill_value;
+
+        /* Only need to process clear pixels */
+        clear = !fill && band_l2qa[pixel_index] == L2QA_CLEAR_PIXEL;
+
+        sum = nir + red;
+        difference = nir - red;
+        if (sum < 0)
+        {
+            sum = -sum;
+            difference = -difference;
+        }
+
+        /* Zhe's water test (works over thin cloud),
+           equation 5 from (CFmask) */
+        water = clear
+                && (((sum == 0 || 100 * difference <= sum) && nir < 1100)
+                    || (difference > 0 && 10 * difference < sum
+                        && nir < 500));
+
+        /* The output starts as the input L2 QA */
+        if (fill)
+            band_water_qa[pixel_index] = l2qa_fill_value;
+        else if (water)
+            band_water_qa[pixel_index] = L2QA_WATER_PIXEL;
+        else
+            band_water_qa[pixel_index] = band_l2qa[pixel_index];
+
+        /* Update the counts */
+        counts->image_pixels += !fill;
+        counts->clear_pixels += clear && !water;
+        counts->water_pixels += water;
+    }
+}
+
+
+/*****************************************************************************
+  NAME:  select_water_test
+
+  PURPOSE:  Selects the implementation of the water test to use, the widest
+            instruction set supported by the processor.
+
+  RETURN VALUE:  Type = Water_Test_Function_t
+*****************************************************************************/
+Water_Test_Function_t
+select_water_test
+(
+    const char **selected_name
+)
+{
+    const char *name = "scalar";
+    Water_Test_Function_t water_test = detect_water_pixels_scalar;
+
+#ifdef COMMON_SIMD_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        name = "avx2";
+        water_test = detect_water_pixels_avx2;
+    }
+#endif
+
+    if (selected_name != NULL)
+        *selected_name = name;
+
+    return water_test;
+}
@@ -0,0 +1,73 @@
+#ifndef WATER_TEST_H
+#define WATER_TEST_H
+
+
+#include <stdint.h>
+
+
+/* Pixel counts for the percentages in the XML, added to as each span of
+   pixels is tested */
+typedef struct
+{
+    int image_pixels; /* Pixels which are not fill */
+    int clear_pixels; /* Clear pixels which are not water */
+    int water_pixels; /* Clear pixels found to be water */
+} Water_Counts_t;
+
+
+/* All of the implementations of the water test have this signature */
+typedef void (*Water_Test_Function_t)
+(
+    const int16_t *band_red,  /* I: red band pixels */
+    const int16_t *band_nir,  /* I: nir band pixels */
+    const uint8_t *band_l2qa, /* I: Level2 QA pixels */
+    int16_t red_fill_value,   /* I: fill value of the red band */
+    int16_t nir_fill_value,   /* I: fill value of the nir band */
+    uint8_t l2qa_fill_value,  /* I: fill value of the Level2 QA band */
+    int pixel_count,          /* I: number of pixels to test */
+    uint8_t *band_water_qa,   /* O: Level2 QA with the water pixels */
+    Water_Counts_t *counts    /* I/O: the pixel counts to add to */
+);
+
+
+void
+detect_water_pixels_scalar
+(
+    const int16_t *band_red,  /* I: red band pixels */
+    const int16_t *band_nir,  /* I: nir band pixels */
+    const uint8_t *band_l2qa, /* I: Level2 QA pixels */
+    int16_t red_fill_value,   /* I: fill value of the red band */
+    int16_t nir_fill_value,   /* I: fill value of the nir band */
+    uint8_t l2qa_fill_value,  /* I: fill value of the Level2 QA band */
+    int pixel_count,          /* I: number of pixels to test */
+    uint8_t *band_water_qa,   /* O: Level2 QA with the water pixels */
+    Water_Counts_t *counts    /* I/O: the pixel counts to add to */
+);
+
+
+#ifdef COMMON_SIMD_X86
+void
+detect_water_pixels_avx2
+(
+    const int16_t *band_red,  /* I: red band pixels */
+    const int16_t *band_nir,  /* I: nir band pixels */
+    const uint8_t *band_l2qa, /* I: Level2 QA pixels */
+    int16_t red_fill_value,   /* I: fill value of the red band */
+    int16_t nir_fill_value,   /* I: fill value of the nir band */
+    uint8_t l2qa_fill_value,  /* I: fill value of the Level2 QA band */
+    int pixel_count,          /* I: number of pixels to test */
+    uint8_t *band_water_qa,   /* O: Level2 QA with the water pixels */
+    Water_Counts_t *counts    /* I/O: the pixel counts to add to */
+);
+#endif
+
+
+Water_Test_Function_t
+select_water_test
+(
+    const char **selected_name /* O: name of the implementation selected,
+                                     may be NULL */
+);
+
+
+#endif /* WATER_TEST_H */
@@ -0,0 +1,170 @@
+#include <stdint.h>
+
+
+#include "common.h"
+#include "l2qa.h"
+#include "water_test.h"
+
+
+#ifdef COMMON_SIMD_X86
+
+
+#include <immintrin.h>
+
+
+/* Load eight 16bit pixels sign extended to 32bit */
+#define LOAD_EPI16(p) \
+    _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *) (p)))
+
+
+/*****************************************************************************
+  NAME:  sum_lanes
+
+  PURPOSE:  Adds up the eight 32bit lanes of a vector.
+
+  RETURN VALUE:  Type = int
+*****************************************************************************/
+static int
+sum_lanes
+(
+    __m256i vector
+)
+{
+    __m128i sum;
+
+    sum = _mm_add_epi32(_mm256_castsi256_si128(vector),
+                        _mm256_extracti128_si256(vector, 1));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x4e));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0xb1));
+
+    return _mm_cvtsi128_si32(sum);
+}
+
+
+/*****************************************************************************
+  NAME:  detect_water_pixels_avx2
+
+  PURPOSE:  Performs the water test eight pixels at a time using AVX2.
+
+  RETURN VALUE:  None
+
+  NOTES:
+    1. The same integer tests as detect_water_pixels_scalar.  The counts are
+       kept in each lane, as minus the number of pixels, and added up at the
+       end.
+*****************************************************************************/
+void
+detect_water_pixels_avx2
+(
+    const int16_t *band_red,
+    const int16_t *band_nir,
+    const uint8_t *band_l2qa,
+    int16_t red_fill_value,
+    int16_t nir_fill_value,
+    uint8_t l2qa_fill_value,
+    int pixel_count,
+    uint8_t *band_water_qa,
+    Water_Counts_t *counts
+)
+{
+    int pixel_index;
+    __m256i red;
+    __m256i nir;
+    __m256i l2qa;
+    __m256i fill;
+    __m256i valid;
+    __m256i clear;
+    __m256i water;
+    __m256i sum;
+    __m256i difference;
+    __m256i negative;
+    __m256i test;
+    __m256i output;
+    __m128i packed;
+    __m256i image_pixels = _mm256_setzero_si256();
+    __m256i clear_pixels = _mm256_setzero_si256();
+    __m256i water_pixels = _mm256_setzero_si256();
+
+    const __m256i red_fill = _mm256_set1_epi32(red_fill_value);
+    const __m256i nir_fill = _mm256_set1_epi32(nir_fill_value);
+    const __m256i l2qa_fill = _mm256_set1_epi32(l2qa_fill_value);
+    const __m256i l2qa_clear = _mm256_set1_epi32(L2QA_CLEAR_PIXEL);
+    const __m256i l2qa_water = _mm256_set1_epi32(L2QA_WATER_PIXEL);
+    const __m256i zero = _mm256_setzero_si256();
+
+    for (pixel_index = 0; pixel_index + 8 <= pixel_count; pixel_index += 8)
+    {
+        red = LOAD_EPI16(&band_red[pixel_index]);
+        nir = LOAD_EPI16(&band_nir[pixel_index]);
+        l2qa = _mm256_cvtepu8_epi32(
+            _mm_loadl_epi64((const __m128i *) &band_l2qa[pixel_index]));
+
+        /* If any of the input is fill, make the output fill */
+        fill = _mm256_cmpeq_epi32(red, red_fill);
+        fill = _mm256_or_si256(fill, _mm256_cmpeq_epi32(nir, nir_fill));
+        fill = _mm256_or_si256(fill, _mm256_cmpeq_epi32(l2qa, l2qa_fill));
+        valid = _mm256_andnot_si256(fill, _mm256_cmpeq_epi32(zero, zero));
+
+        /* Only need to process clear pixels */
+        clear = _mm256_and_si256(valid,
+                                 _mm256_cmpeq_epi32(l2qa, l2qa_clear));
+
+        /* Make the denominator positive */
+        sum = _mm256_add_epi32(nir, red);
+        difference = _mm256_sub_epi32(nir, red);
+        negative = _mm256_cmpgt_epi32(zero, sum);
+        sum = _mm256_abs_epi32(sum);
+        difference = _mm256_sub_epi32(
+            _mm256_xor_si256(difference, negative), negative);
+
+        /* NDVI < 0.01 and nir < 1100 */
+        test = _mm256_andnot_si256(
+            _mm256_cmpgt_epi32(
+                _mm256_mullo_epi32(difference, _mm256_set1_epi32(100)),
+                sum),
+            _mm256_cmpgt_epi32(_mm256_set1_epi32(1100), nir));
+        water = _mm256_or_si256(test, _mm256_and_si256(
+            _mm256_cmpeq_epi32(sum, zero),
+            _mm256_cmpgt_epi32(_mm256_set1_epi32(1100), nir)));
+
+        /* 0.0 < NDVI < 0.1 and nir < 500 */
+        test = _mm256_and_si256(
+            _mm256_cmpgt_epi32(difference, zero),
+            _mm256_cmpgt_epi32(
+                sum, _mm256_mullo_epi32(difference, _mm256_set1_epi32(10))));
+        test = _mm256_and_si256(test,
+            _mm256_cmpgt_epi32(_mm256_set1_epi32(500), nir));
+        water = _mm256_and_si256(clear, _mm256_or_si256(water, test));
+
+        /* The output starts as the input L2 QA */
+        output = _mm256_blendv_epi8(l2qa, l2qa_water, water);
+        output = _mm256_blendv_epi8(output, l2qa_fill, fill);
+
+        /* Narrow the eight 32bit results to bytes */
+        packed = _mm_packs_epi32(_mm256_castsi256_si128(output),
+                                 _mm256_extracti128_si256(output, 1));
+        _mm_storel_epi64((__m128i *) &band_water_qa[pixel_index],
+                         _mm_packus_epi16(packed, packed));
+
+        /* Update the counts */
+        image_pixels = _mm256_sub_epi32(image_pixels, valid);
+        clear_pixels = _mm256_sub_epi32(clear_pixels,
+                                        _mm256_andnot_si256(water, clear));
+        water_pixels = _mm256_sub_epi32(water_pixels, water);
+    }
+
+    counts->image_pixels += sum_lanes(image_pixels);
+    counts->clear_pixels += sum_lanes(clear_pixels);
+    counts->water_pixels += sum_lanes(water_pixels);
+
+    /* Finish the remaining pixels */
+    detect_water_pixels_scalar(&band_red[pixel_index],
+                               &band_nir[pixel_index],
+                               &band_l2qa[pixel_index], red_fill_value,
+                               nir_fill_value, l2qa_fill_value,
+                               pixel_count - pixel_index,
+                               &band_water_qa[pixel_index], counts);
+}
+
+
+#endif /* COMMON_SIMD_X86 */
@@ -0,0 +1,134 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+
+
+#include "const.h"
+#include "dswe.h"
+#include "utilities.h"
+#include "arena.h"
+
+
+/* Size of the huge pages the arena is rounded to when they are requested */
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+
+/*****************************************************************************
+  NAME:  create_arena
+
+  PURPOSE:  Map the memory the buffers of an arena are handed out from.
+            The memory comes from the kernel without being cleared by the
+            process, so buffers which are always written before they are
+            read cost nothing more than the page faults.  With huge pages,
+            explicit huge pages are tried first, then transparent huge
+            pages are requested for a normal mapping, which also cuts the
+            number of page faults on large scenes.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      ERROR    Failed mapping the memory.
+      SUCCESS  No errors encountered.
+*****************************************************************************/
+int
+create_arena
+(
+    size_t size,
+    bool huge_pages,
+    Arena_t *arena
+)
+{
+    void *base = MAP_FAILED;
+
+    memset (arena, 0, sizeof (*arena));
+    if (size == 0)
+        return SUCCESS;
+
+    if (huge_pages)
+    {
+        size = (size + HUGE_PAGE_SIZE - 1) & ~((size_t) HUGE_PAGE_SIZE - 1);
+
+#ifdef MAP_HUGETLB
+        base = mmap (NULL, size, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+    }
+
+    if (base == MAP_FAILED)
+    {
+        base = mmap (NULL, size, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (base == MAP_FAILED)
+        {
+            RETURN_ERROR ("Failed mapping memory for the band buffers",
+                          MODULE_NAME, ERROR);
+        }
+
+#ifdef MADV_HUGEPAGE
+        /* Only a hint, the buffers work the same without it */
+        if (huge_pages)
+            madvise (base, size, MADV_HUGEPAGE);
+#endif
+    }
+
+    arena->base = base;
+    arena->size = size;
+
+    return SUCCESS;
+}
+
+
+/*****************************************************************************
+  NAME:  arena_alloc
+
+  PURPOSE:  Hand out the next region of an arena, aligned to
+            ARENA_ALIGNMENT.  The region is not cleared.
+
+  RETURN VALUE:  Type = void *
+      Value    Description
+      -------  ---------------------------------------------------------------
+      NULL     The arena does not have room for the region.
+      *        The region.
+*****************************************************************************/
+void *
+arena_alloc
+(
+    Arena_t *arena,
+    size_t size
+)
+{
+    void *region;
+
+    size = ARENA_ROUND (size);
+    if (size > arena->size - arena->used)
+        return NULL;
+
+    region = arena->base + arena->used;
+    arena->used += size;
+
+    return region;
+}
+
+
+/*****************************************************************************
+  NAME:  free_arena
+
+  PURPOSE:  Release an arena and every region handed out from it.
+
+  RETURN VALUE:  None
+*****************************************************************************/
+void
+free_arena
+(
+    Arena_t *arena
+)
+{
+    if (arena->base != NULL)
+        munmap (arena->base, arena->size);
+
+    memset (arena, 0, sizeof (*arena));
+}
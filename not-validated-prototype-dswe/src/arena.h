@@ -0,0 +1,56 @@
+
+#ifndef ARENA_H
+#define ARENA_H
+
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+/* Every region handed out by an arena starts on this boundary, enough for
+   the widest vector loads */
+#define ARENA_ALIGNMENT 64
+
+/* Size a region takes in an arena, used to size the arena up front */
+#define ARENA_ROUND(size) \
+    (((size_t) (size) + ARENA_ALIGNMENT - 1) \
+     & ~((size_t) ARENA_ALIGNMENT - 1))
+
+
+/* A single mapping the buffers are carved out of, they are all released
+   together when the arena is freed */
+typedef struct
+{
+    uint8_t *base;      /* Start of the mapping, NULL when empty */
+    size_t size;        /* Size of the mapping */
+    size_t used;        /* Bytes handed out so far */
+} Arena_t;
+
+
+int
+create_arena
+(
+    size_t size,      /* I: bytes needed, the sum of ARENA_ROUND of each
+                            region */
+    bool huge_pages,  /* I: back the arena with huge pages when possible */
+    Arena_t *arena    /* O: the arena */
+);
+
+
+void *
+arena_alloc
+(
+    Arena_t *arena,   /* I/O: the arena */
+    size_t size       /* I: bytes needed */
+);
+
+
+void
+free_arena
+(
+    Arena_t *arena    /* I: the arena to free */
+);
+
+
+#endif /* ARENA_H */
@@ -0,0 +1,1496 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <getopt.h>
+
+
+#include "const.h"
+#include "dswe.h"
+#include "utilities.h"
+#include "arena.h"
+#include "fill_index.h"
+#include "dswe_tests.h"
+#include "classify.h"
+#include "build_slope_band.h"
+#include "output.h"
+
+
+/* Defaults for the size of the synthetic scene */
+#define BENCH_LINES 2000
+#define BENCH_SAMPLES 2000
+#define BENCH_REPEAT 5
+
+/* Pixel size and threshold of the synthetic scene, the same as Landsat */
+#define BENCH_PIXEL_SIZE 30.0
+#define BENCH_PERCENT_SLOPE 6.0
+
+/* CFMASK values of the synthetic scene */
+#define BENCH_CFMASK_CLEAR 0
+#define BENCH_CFMASK_WATER 1
+#define BENCH_CFMASK_FILL 255
+
+/* Numerators held for checking the slope kernels, and the widths of the
+   rows checked at every alignment, a few vectors of every instruction set.
+   The longest row checked is odd. */
+#define SLOPE_CHECK_SAMPLES 1032
+#define SLOPE_CHECK_WIDTHS 68
+
+
+/* The synthetic scene the stages are run over */
+typedef struct
+{
+    int lines;
+    int samples;
+    int16_t *band_blue;
+    int16_t *band_green;
+    int16_t *band_red;
+    int16_t *band_nir;
+    int16_t *band_swir1;
+    int16_t *band_swir2;
+    int16_t *band_elevation;
+    uint8_t *band_cfmask;
+    uint8_t *band_tests;      /* Test bits from the tests stage */
+    uint8_t *band_exceeded;   /* Slope threshold results for every line */
+    uint8_t *band_dswe_raw;
+    uint8_t *band_dswe_ccss;
+    uint8_t *band_dswe_psccss;
+    int16_t *band_dswe_diag;
+    float *line_ps;
+    int32_t *slope_work;
+    Fill_Index_t fill_index;
+    Arena_t arena;
+} Bench_Scene_t;
+
+
+/*****************************************************************************
+  NAME:  bench_usage
+
+  PURPOSE:  Displays the help/usage to the terminal.
+
+  RETURN VALUE:  None
+*****************************************************************************/
+static void
+bench_usage ()
+{
+    printf ("Microbenchmarks of the DSWE processing stages\n"
+            "Runs each stage over a synthetic scene held in memory and"
+            " writes the\n"
+            "results as JSON, in megapixels per second.\n\n");
+    printf ("usage: bench_dswe [--lines <count>] [--samples <count>]"
+            " [--repeat <count>] [--check]\n\n");
+    printf ("    --lines: Lines in the synthetic scene (default is %d)\n",
+            BENCH_LINES);
+    printf ("    --samples: Samples in the synthetic scene (default is"
+            " %d)\n", BENCH_SAMPLES);
+    printf ("    --repeat: Times each stage is run, the fastest is reported"
+            " (default is %d)\n", BENCH_REPEAT);
+    printf ("    --check: Instead of timing the stages, check that every"
+            " instruction set\n"
+            "             the processor supports, and every variant of the"
+            " tests and\n"
+            "             classification, gives output identical to the"
+            " scalar\n"
+            "             implementation, and exit with a failure on the"
+            " first difference\n");
+}
+
+
+/*****************************************************************************
+  NAME:  next_random
+
+  PURPOSE:  A small deterministic generator, so every run sees the same
+            scene.
+
+  RETURN VALUE:  Type = uint32_t
+*****************************************************************************/
+static uint32_t
+next_random
+(
+    uint32_t *state
+)
+{
+    *state = *state * 1664525 + 1013904223;
+    return *state >> 8;
+}
+
+
+/*****************************************************************************
+  NAME:  elapsed_seconds
+
+  PURPOSE:  Time since the start time.
+
+  RETURN VALUE:  Type = double
+*****************************************************************************/
+static double
+elapsed_seconds
+(
+    const struct timespec *start
+)
+{
+    struct timespec now;
+
+    clock_gettime (CLOCK_MONOTONIC, &now);
+
+    return (now.tv_sec - start->tv_sec)
+           + (now.tv_nsec - start->tv_nsec) * 1e-9;
+}
+
+
+/*****************************************************************************
+  NAME:  create_bench_scene
+
+  PURPOSE:  Build a synthetic scene.  About a quarter of the grid is fill
+            around a tilted footprint, the way a Landsat scene sits in its
+            grid, and the footprint mixes land, water, and cloud.  The
+            elevation is a smooth surface with noise, so the slope
+            thresholds go both ways.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      ERROR    Failed allocating the scene.
+      SUCCESS  No errors encountered.
+*****************************************************************************/
+static int
+create_bench_scene
+(
+    int lines,
+    int samples,
+    Bench_Scene_t *scene
+)
+{
+    /* blue, green, red, nir, swir1, swir2 reflectance of each cover */
+    static const int16_t signatures[3][6] = {
+        {500, 800, 900, 2500, 2000, 1200},   /* land */
+        {600, 700, 400, 200, 100, 50},       /* water */
+        {4500, 4600, 4700, 5000, 3500, 2500} /* cloud */
+    };
+    static const uint8_t cfmask_values[3] = {
+        BENCH_CFMASK_CLEAR, BENCH_CFMASK_WATER, CFMASK_CLOUD
+    };
+    size_t pixel_count = (size_t) lines * samples;
+    size_t band_size = ARENA_ROUND (pixel_count * sizeof (int16_t));
+    size_t mask_size = ARENA_ROUND (pixel_count);
+    size_t line_size = ARENA_ROUND (samples * sizeof (float));
+    uint32_t state = 1;
+    int line;
+    int sample;
+    int first;
+    int end;
+    int cover;
+    size_t index;
+    int16_t *bands[6];
+    int band;
+    double value;
+
+    memset (scene, 0, sizeof (*scene));
+    scene->lines = lines;
+    scene->samples = samples;
+
+    if (create_arena (8 * band_size + 5 * mask_size + line_size
+                      + ARENA_ROUND (4 * samples * sizeof (int32_t)),
+                      false, &scene->arena) != SUCCESS
+        || allocate_fill_index (lines, &scene->fill_index) != SUCCESS)
+    {
+        free_arena (&scene->arena);
+        RETURN_ERROR ("Failed allocating the synthetic scene", MODULE_NAME,
+                      ERROR);
+    }
+
+    scene->band_blue = arena_alloc (&scene->arena, band_size);
+    scene->band_green = arena_alloc (&scene->arena, band_size);
+    scene->band_red = arena_alloc (&scene->arena, band_size);
+    scene->band_nir = arena_alloc (&scene->arena, band_size);
+    scene->band_swir1 = arena_alloc (&scene->arena, band_size);
+    scene->band_swir2 = arena_alloc (&scene->arena, band_size);
+    scene->band_elevation = arena_alloc (&scene->arena, band_size);
+    scene->band_dswe_diag = arena_alloc (&scene->arena, band_size);
+    scene->band_cfmask = arena_alloc (&scene->arena, mask_size);
+    scene->band_tests = arena_alloc (&scene->arena, mask_size);
+    scene->band_exceeded = arena_alloc (&scene->arena, mask_size);
+    scene->band_dswe_raw = arena_alloc (&scene->arena, mask_size);
+    scene->band_dswe_ccss = arena_alloc (&scene->arena, mask_size);
+    scene->band_dswe_psccss = scene->band_dswe_ccss;
+    scene->line_ps = arena_alloc (&scene->arena, line_size);
+    scene->slope_work = arena_alloc (&scene->arena,
+                                     4 * samples * sizeof (int32_t));
+
+    bands[0] = scene->band_blue;
+    bands[1] = scene->band_green;
+    bands[2] = scene->band_red;
+    bands[3] = scene->band_nir;
+    bands[4] = scene->band_swir1;
+    bands[5] = scene->band_swir2;
+
+    for (line = 0; line < lines; line++)
+    {
+        /* The footprint is a parallelogram leaving an eighth of each line
+           as fill on either side */
+        first = samples / 8 + (int) ((double) line / lines * samples / 8);
+        end = first + 3 * samples / 4;
+
+        for (sample = 0; sample < samples; sample++)
+        {
+            index = (size_t) line * samples + sample;
+
+            value = 400.0 + 150.0 * sin (line * 0.013) * cos (sample * 0.011)
+                    + 60.0 * sin ((line + sample) * 0.041);
+            scene->band_elevation[index] = (int16_t) value
+                                           + next_random (&state) % 5;
+
+            if (sample < first || sample >= end)
+            {
+                for (band = 0; band < 6; band++)
+                    bands[band][index] = -9999;
+                scene->band_cfmask[index] = BENCH_CFMASK_FILL;
+                continue;
+            }
+
+            /* 70% land, 15% water, 15% cloud */
+            cover = next_random (&state) % 20;
+            if (cover < 14)
+                cover = 0;
+            else if (cover < 17)
+                cover = 1;
+            else
+                cover = 2;
+
+            for (band = 0; band < 6; band++)
+            {
+                bands[band][index] = signatures[cover][band]
+                    + (int) (next_random (&state) % 401) - 200;
+            }
+            scene->band_cfmask[index] = cfmask_values[cover];
+        }
+    }
+
+    return SUCCESS;
+}
+
+
+/*****************************************************************************
+  NAME:  free_bench_scene
+
+  PURPOSE:  Free the memory allocated by create_bench_scene.
+
+  RETURN VALUE:  None
+*****************************************************************************/
+static void
+free_bench_scene
+(
+    Bench_Scene_t *scene
+)
+{
+    free_arena (&scene->arena);
+    free_fill_index (&scene->fill_index);
+}
+
+
+/*****************************************************************************
+  NAME:  report_stage
+
+  PURPOSE:  Write the result of a stage as a JSON object.
+
+  RETURN VALUE:  None
+*****************************************************************************/
+static void
+report_stage
+(
+    const char *stage,
+    const char *variant,
+    const Bench_Scene_t *scene,
+    double seconds,
+    bool *first_result
+)
+{
+    printf ("%s\n    {\"stage\": \"%s\", \"variant\": \"%s\","
+            " \"seconds\": %.6f, \"megapixels_per_second\": %.2f}",
+            *first_result ? "" : ",", stage, variant, seconds,
+            (double) scene->lines * scene->samples / 1e6 / seconds);
+    *first_result = false;
+}
+
+
+/*****************************************************************************
+  NAME:  bench_fill_index
+
+  PURPOSE:  Time finding the span of each line which is not fill.
+
+  RETURN VALUE:  Type = double, the fastest time in seconds
+*****************************************************************************/
+static double
+bench_fill_index
+(
+    Bench_Scene_t *scene,
+    int repeat
+)
+{
+    struct timespec start;
+    double best = 0.0;
+    double seconds;
+    int run;
+
+    for (run = 0; run < repeat; run++)
+    {
+        clock_gettime (CLOCK_MONOTONIC, &start);
+        index_fill_lines (&scene->fill_index, scene->band_cfmask,
+                          BENCH_CFMASK_FILL, 0, scene->lines, scene->samples);
+        seconds = elapsed_seconds (&start);
+        if (run == 0 || seconds < best)
+            best = seconds;
+    }
+
+    return best;
+}
+
+
+/*****************************************************************************
+  NAME:  bench_dswe_tests
+
+  PURPOSE:  Time the DSWE tests, a line at a time over the span which is
+            not fill as dswe does.
+
+  RETURN VALUE:  Type = double, the fastest time in seconds
+*****************************************************************************/
+static double
+bench_dswe_tests
+(
+    Bench_Scene_t *scene,
+    Dswe_Tests_Function_t dswe_tests,
+    const Dswe_Tests_Parameters_t *params,
+    int repeat
+)
+{
+    struct timespec start;
+    double best = 0.0;
+    double seconds;
+    int run;
+    int line;
+    size_t index;
+
+    for (run = 0; run < repeat; run++)
+    {
+        clock_gettime (CLOCK_MONOTONIC, &start);
+        for (line = 0; line < scene->lines; line++)
+        {
+            index = (size_t) line * scene->samples
+                    + scene->fill_index.first_valid[line];
+            dswe_tests (params, &scene->band_blue[index],
+                        &scene->band_green[index], &scene->band_red[index],
+                        &scene->band_nir[index], &scene->band_swir1[index],
+                        &scene->band_swir2[index],
+                        &scene->band_cfmask[index],
+                        scene->fill_index.end_valid[line]
+                            - scene->fill_index.first_valid[line],
+                        &scene->band_tests[index]);
+        }
+        seconds = elapsed_seconds (&start);
+        if (run == 0 || seconds < best)
+            best = seconds;
+    }
+
+    return best;
+}
+
+
+/*****************************************************************************
+  NAME:  bench_recode
+
+  PURPOSE:  Time classifying the test bits into every output.
+
+  RETURN VALUE:  Type = double, the fastest time in seconds
+*****************************************************************************/
+static double
+bench_recode
+(
+    Bench_Scene_t *scene,
+    const Classifier_t *classifier,
+    int repeat
+)
+{
+    struct timespec start;
+    double best = 0.0;
+    double seconds;
+    int run;
+    int line;
+    size_t index;
+    int count;
+
+    for (run = 0; run < repeat; run++)
+    {
+        /* Classifying replaces the test bits */
+        memcpy (scene->band_dswe_raw, scene->band_tests,
+                (size_t) scene->lines * scene->samples);
+
+        clock_gettime (CLOCK_MONOTONIC, &start);
+        for (line = 0; line < scene->lines; line++)
+        {
+            index = (size_t) line * scene->samples
+                    + scene->fill_index.first_valid[line];
+            count = scene->fill_index.end_valid[line]
+                    - scene->fill_index.first_valid[line];
+            classify_pixels (classifier, &scene->band_cfmask[index],
+                             &scene->band_exceeded[index], count,
+                             &scene->band_dswe_raw[index],
+                             &scene->band_dswe_ccss[index],
+                             &scene->band_dswe_psccss[index],
+                             &scene->band_dswe_diag[index]);
+        }
+        seconds = elapsed_seconds (&start);
+        if (run == 0 || seconds < best)
+            best = seconds;
+    }
+
+    return best;
+}
+
+
+/*****************************************************************************
+  NAME:  bench_slope
+
+  PURPOSE:  Time generating the percent slope, or only the threshold
+            results, for every line.
+
+  RETURN VALUE:  Type = double, the fastest time in seconds
+*****************************************************************************/
+static double
+bench_slope
+(
+    Bench_Scene_t *scene,
+    const Slope_Kernel_t *kernel,
+    bool exceeded_flag,
+    int repeat
+)
+{
+    struct timespec start;
+    double best = 0.0;
+    double seconds;
+    int run;
+    int line;
+    size_t line_start;
+
+    for (run = 0; run < repeat; run++)
+    {
+        clock_gettime (CLOCK_MONOTONIC, &start);
+        for (line = 0; line < scene->lines; line++)
+        {
+            line_start = (size_t) line * scene->samples;
+            if (exceeded_flag)
+            {
+                build_slope_exceeded_line (kernel, scene->band_elevation, 0,
+                                           line, scene->lines,
+                                           scene->samples, 0, scene->samples,
+                                           scene->slope_work,
+                                           &scene->band_exceeded[line_start]);
+            }
+            else
+            {
+                build_slope_line (kernel, scene->band_elevation, 0, line,
+                                  scene->lines, scene->samples,
+                                  scene->slope_work, scene->line_ps);
+            }
+        }
+        seconds = elapsed_seconds (&start);
+        if (run == 0 || seconds < best)
+            best = seconds;
+    }
+
+    return best;
+}
+
+
+/*****************************************************************************
+  NAME:  bench_write_output
+
+  PURPOSE:  Time writing an 8 bit output band to a temporary file.
+
+  RETURN VALUE:  Type = double, the fastest time in seconds, negative when
+                 the file could not be written
+*****************************************************************************/
+static double
+bench_write_output
+(
+    Bench_Scene_t *scene,
+    int repeat
+)
+{
+    struct timespec start;
+    double best = 0.0;
+    double seconds;
+    int run;
+    FILE *fd;
+
+    for (run = 0; run < repeat; run++)
+    {
+        fd = tmpfile ();
+        if (fd == NULL)
+            return -1.0;
+
+        clock_gettime (CLOCK_MONOTONIC, &start);
+        if (write_band_product_lines (fd, scene->lines, scene->samples,
+                                      sizeof (uint8_t),
+                                      scene->band_dswe_raw) != SUCCESS
+            || fflush (fd) != 0)
+        {
+            fclose (fd);
+            return -1.0;
+        }
+        seconds = elapsed_seconds (&start);
+        fclose (fd);
+
+        if (run == 0 || seconds < best)
+            best = seconds;
+    }
+
+    return best;
+}
+
+
+/*****************************************************************************
+  NAME:  report_slope_accuracy
+
+  PURPOSE:  Compare the percent slope of a slope kernel with the reference
+            algorithm, calculate_slope_horn or
+            calculate_slope_zevenbergen_thorne in double precision rounded
+            to a float, and write the result as a JSON object.  Only the threshold results
+            matter to the outputs other than the percent slope band, so the
+            pixels landing on the other side of the threshold are counted.
+
+  RETURN VALUE:  None
+*****************************************************************************/
+static void
+report_slope_accuracy
+(
+    Bench_Scene_t *scene,
+    const Slope_Kernel_t *kernel,
+    bool *first_result
+)
+{
+    double window[9];
+    double reference;
+    double difference;
+    double max_difference = 0.0;
+    long threshold_mismatches = 0;
+    long pixels = 0;
+    int line;
+    int sample;
+    int row;
+    int column;
+    const int16_t *dem = scene->band_elevation;
+
+    for (line = 2; line < scene->lines - 1; line++)
+    {
+        build_slope_line (kernel, dem, 0, line, scene->lines,
+                          scene->samples, scene->slope_work, scene->line_ps);
+
+        for (sample = 2; sample < scene->samples - 1; sample++)
+        {
+            for (row = 0; row < 3; row++)
+            {
+                for (column = 0; column < 3; column++)
+                {
+                    window[row * 3 + column] =
+                        dem[(size_t) (line + row - 1) * scene->samples
+                            + sample + column - 1];
+                }
+            }
+
+            if (kernel->use_zeven_thorne_flag)
+            {
+                reference = 100.0 * calculate_slope_zevenbergen_thorne
+                    (window, BENCH_PIXEL_SIZE, BENCH_PIXEL_SIZE);
+            }
+            else
+            {
+                reference = 100.0 * calculate_slope_horn
+                    (window, BENCH_PIXEL_SIZE, BENCH_PIXEL_SIZE);
+            }
+
+            /* The kernels store the percent slope as a float, so the
+               reference is rounded the same way before comparing */
+            difference = fabs (scene->line_ps[sample] - (float) reference);
+            if (difference > max_difference)
+                max_difference = difference;
+            if ((scene->line_ps[sample] >= BENCH_PERCENT_SLOPE)
+                != ((float) reference >= BENCH_PERCENT_SLOPE))
+            {
+                threshold_mismatches++;
+            }
+            pixels++;
+        }
+    }
+
+    printf ("%s\n    {\"algorithm\": \"%s\", \"precision\": \"%s\","
+            " \"pixels\": %ld, \"max_abs_difference\": %.9g,"
+            " \"threshold_mismatches\": %ld}",
+            *first_result ? "" : ",",
+            kernel->use_zeven_thorne_flag ? "zeven_thorne" : "horn",
+            kernel->precision == SLOPE_FLOAT ? "float" : "double",
+            pixels, max_difference, threshold_mismatches);
+    *first_result = false;
+}
+
+
+/*****************************************************************************
+  NAME:  randomize_bench_scene
+
+  PURPOSE:  Replace the bands of the synthetic scene with values over the
+            whole int16 range, with some fill, so the checks also see the
+            values a real scene rarely has.
+
+  RETURN VALUE:  None
+*****************************************************************************/
+static void
+randomize_bench_scene
+(
+    Bench_Scene_t *scene
+)
+{
+    size_t pixel_count = (size_t) scene->lines * scene->samples;
+    size_t index;
+    uint32_t state = 2;
+    int16_t *bands[6];
+    int band;
+
+    bands[0] = scene->band_blue;
+    bands[1] = scene->band_green;
+    bands[2] = scene->band_red;
+    bands[3] = scene->band_nir;
+    bands[4] = scene->band_swir1;
+    bands[5] = scene->band_swir2;
+
+    for (index = 0; index < pixel_count; index++)
+    {
+        for (band = 0; band < 6; band++)
+        {
+            if (next_random (&state) % 64 == 0)
+                bands[band][index] = -9999;
+            else
+                bands[band][index] = (int16_t) next_random (&state);
+        }
+
+        if (next_random (&state) % 64 == 0)
+            scene->band_cfmask[index] = BENCH_CFMASK_FILL;
+        else
+            scene->band_cfmask[index] = next_random (&state) % 5;
+    }
+}
+
+
+/*****************************************************************************
+  NAME:  run_dswe_tests
+
+  PURPOSE:  Run an implementation of the DSWE tests over every line of the
+            synthetic scene.  Each line is split in two at a point which
+            moves from line to line, so the SIMD implementations start at
+            every alignment and finish with every length of remainder.
+
+  RETURN VALUE:  None
+*****************************************************************************/
+static void
+run_dswe_tests
+(
+    const Bench_Scene_t *scene,
+    Dswe_Tests_Function_t dswe_tests,
+    const Dswe_Tests_Parameters_t *params,
+    uint8_t *band_tests
+)
+{
+    int line;
+    int split;
+    size_t index;
+
+    for (line = 0; line < scene->lines; line++)
+    {
+        index = (size_t) line * scene->samples;
+        split = line % 37;
+        if (split > scene->samples)
+            split = scene->samples;
+
+        dswe_tests (params, &scene->band_blue[index],
+                    &scene->band_green[index], &scene->band_red[index],
+                    &scene->band_nir[index], &scene->band_swir1[index],
+                    &scene->band_swir2[index], &scene->band_cfmask[index],
+                    split, &band_tests[index]);
+
+        index += split;
+        dswe_tests (params, &scene->band_blue[index],
+                    &scene->band_green[index], &scene->band_red[index],
+                    &scene->band_nir[index], &scene->band_swir1[index],
+                    &scene->band_swir2[index], &scene->band_cfmask[index],
+                    scene->samples - split, &band_tests[index]);
+    }
+}
+
+
+/*****************************************************************************
+  NAME:  check_identical
+
+  PURPOSE:  Compare an output with the output of the reference and report
+            the first difference.
+
+  RETURN VALUE:  Type = bool
+      Value    Description
+      -------  ---------------------------------------------------------------
+      false    The outputs differ.
+      true     The outputs are identical.
+*****************************************************************************/
+static bool
+check_identical
+(
+    const char *what,        /* I: the output and the implementation */
+    const void *reference,   /* I: output of the reference */
+    const void *output,      /* I: output of the implementation */
+    size_t size              /* I: size of the outputs in bytes */
+)
+{
+    const uint8_t *expected = reference;
+    const uint8_t *actual = output;
+    char msg[256];
+    size_t index;
+
+    for (index = 0; index < size; index++)
+    {
+        if (expected[index] != actual[index])
+        {
+            snprintf (msg, sizeof (msg), "%s differs from the reference at"
+                      " byte %zu, %d instead of %d", what, index,
+                      actual[index], expected[index]);
+            ERROR_MESSAGE (msg, MODULE_NAME);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+/*****************************************************************************
+  NAME:  report_identical
+
+  PURPOSE:  Report an output which is identical to the reference.
+
+  RETURN VALUE:  None
+*****************************************************************************/
+static void
+report_identical
+(
+    const char *what         /* I: the output and the implementation */
+)
+{
+    char msg[256];
+
+    snprintf (msg, sizeof (msg), "%s is identical to the reference", what);
+    LOG_MESSAGE (msg, MODULE_NAME);
+}
+
+
+/*****************************************************************************
+  NAME:  check_dswe_tests
+
+  PURPOSE:  Check that the DSWE tests of every instruction set the
+            processor supports, and the variant of each selected for the
+            thresholds and scale factors, give the test bits of the scalar
+            reference over the synthetic scene.
+
+  RETURN VALUE:  Type = bool
+      Value    Description
+      -------  ---------------------------------------------------------------
+      false    An implementation differs from the scalar reference.
+      true     Every implementation is identical to the scalar reference.
+*****************************************************************************/
+static bool
+check_dswe_tests
+(
+    const Bench_Scene_t *scene,
+    const Dswe_Tests_Parameters_t *params,
+    Thresholds_Profile_e expected_profile, /* I: profile of the variant the
+                                                 parameters select */
+    const char *scene_name,         /* I: name of the scene and parameters
+                                          for the report */
+    uint8_t *reference_tests,       /* O: test bits of the scalar
+                                          reference */
+    uint8_t *band_tests             /* O: work space for the test bits */
+)
+{
+    static const Simd_Target_e targets[] = {
+        SIMD_SCALAR, SIMD_SSE2, SIMD_AVX2, SIMD_AVX512
+    };
+    size_t pixel_count = (size_t) scene->lines * scene->samples;
+    Dswe_Tests_Function_t dswe_tests;
+    Dswe_Tests_Function_t variant;
+    Simd_Target_e selected_target;
+    Thresholds_Profile_e profile;
+    bool equal_scale_flag;
+    char what[200];
+    int target;
+
+    run_dswe_tests (scene, dswe_tests_scalar, params, reference_tests);
+
+    for (target = 0; target < 4; target++)
+    {
+        dswe_tests = select_dswe_tests (targets[target], &selected_target);
+        if (dswe_tests == NULL)
+            continue;
+
+        variant = select_dswe_tests_variant (targets[target], params,
+                                             &profile, &equal_scale_flag);
+        snprintf (what, sizeof (what), "dswe_tests %s variant of %s",
+                  simd_target_name (targets[target]), scene_name);
+        if (profile != expected_profile
+            || equal_scale_flag != (params->green_scale_factor
+                                    == params->swir1_scale_factor))
+        {
+            ERROR_MESSAGE ("The thresholds and scale factors selected the"
+                           " wrong variant of the DSWE tests", MODULE_NAME);
+            return false;
+        }
+
+        memset (band_tests, 0, pixel_count);
+        run_dswe_tests (scene, variant, params, band_tests);
+        if (!check_identical (what, reference_tests, band_tests,
+                              pixel_count))
+        {
+            return false;
+        }
+        report_identical (what);
+
+        /* The scalar reference itself needs no checking */
+        if (targets[target] == SIMD_SCALAR)
+            continue;
+
+        memset (band_tests, 0, pixel_count);
+        run_dswe_tests (scene, dswe_tests, params, band_tests);
+
+        snprintf (what, sizeof (what), "dswe_tests %s of %s",
+                  simd_target_name (targets[target]), scene_name);
+        if (!check_identical (what, reference_tests, band_tests,
+                              pixel_count))
+        {
+            return false;
+        }
+        report_identical (what);
+    }
+
+    return true;
+}
+
+
+/*****************************************************************************
+  NAME:  check_classify
+
+  PURPOSE:  Check that each variant of classify_pixels, for a set of the
+            outputs, gives the outputs of classify_pixels itself.
+
+  RETURN VALUE:  Type = bool
+      Value    Description
+      -------  ---------------------------------------------------------------
+      false    A variant differs from classify_pixels.
+      true     Every variant is identical to classify_pixels.
+*****************************************************************************/
+static bool
+check_classify
+(
+    Bench_Scene_t *scene,
+    const Classifier_t *classifier,
+    const uint8_t *band_tests,  /* I: test bits of each pixel */
+    const char *scene_name,     /* I: name of the scene for the report */
+    uint8_t *outputs            /* O: work space for eight 8 bit outputs */
+)
+{
+    size_t pixel_count = (size_t) scene->lines * scene->samples;
+    uint8_t *reference_raw = outputs;
+    uint8_t *reference_ccss = reference_raw + pixel_count;
+    uint8_t *reference_psccss = reference_ccss + pixel_count;
+    int16_t *reference_diag = (int16_t *) (reference_psccss + pixel_count);
+    uint8_t *band_raw = (uint8_t *) (reference_diag + pixel_count);
+    uint8_t *band_ccss = band_raw + pixel_count;
+    uint8_t *band_psccss = band_ccss + pixel_count;
+    int16_t *band_diag = (int16_t *) (band_psccss + pixel_count);
+    Classify_Pixels_Function_t classify;
+    char what[160];
+    int variant;
+    bool include_ccss_flag;
+    bool include_psccss_flag;
+    bool include_diag_flag;
+
+    memcpy (reference_raw, band_tests, pixel_count);
+    classify_pixels (classifier, scene->band_cfmask, scene->band_exceeded,
+                     pixel_count, reference_raw, reference_ccss,
+                     reference_psccss, reference_diag);
+
+    for (variant = 0; variant < 8; variant++)
+    {
+        include_ccss_flag = (variant & 1) != 0;
+        include_psccss_flag = (variant & 2) != 0;
+        include_diag_flag = (variant & 4) != 0;
+        classify = select_classify_pixels (include_ccss_flag,
+                                           include_psccss_flag,
+                                           include_diag_flag);
+
+        memcpy (band_raw, band_tests, pixel_count);
+        memset (band_ccss, 0, pixel_count);
+        memset (band_psccss, 0, pixel_count);
+        memset (band_diag, 0, pixel_count * sizeof (int16_t));
+        classify (classifier, scene->band_cfmask, scene->band_exceeded,
+                  pixel_count, band_raw, band_ccss, band_psccss, band_diag);
+
+        snprintf (what, sizeof (what), "classify_pixels raw%s%s%s variant"
+                  " of the %s scene", include_ccss_flag ? " ccss" : "",
+                  include_psccss_flag ? " psccss" : "",
+                  include_diag_flag ? " diag" : "", scene_name);
+        if (!check_identical (what, reference_raw, band_raw, pixel_count)
+            || (include_ccss_flag
+                && !check_identical (what, reference_ccss, band_ccss,
+                                     pixel_count))
+            || (include_psccss_flag
+                && !check_identical (what, reference_psccss, band_psccss,
+                                     pixel_count))
+            || (include_diag_flag
+                && !check_identical (what, reference_diag, band_diag,
+                                     pixel_count * sizeof (int16_t))))
+        {
+            return false;
+        }
+        report_identical (what);
+    }
+
+    return true;
+}
+
+
+/*****************************************************************************
+  NAME:  check_slope_rows
+
+  PURPOSE:  Check that a row slope and threshold kernel give the results of
+            the scalar kernels byte for byte, and that the threshold results
+            are where the scalar percent slope is at or above the threshold.
+            The rows start at every alignment with every width up to a few
+            vectors, and one long odd width, and the bytes past each row are
+            checked to be left alone.
+
+  RETURN VALUE:  Type = bool
+      Value    Description
+      -------  ---------------------------------------------------------------
+      false    The kernel differs from the scalar reference.
+      true     The kernel is identical to the scalar reference.
+*****************************************************************************/
+static bool
+check_slope_rows
+(
+    const Slope_Kernel_t *reference, /* I: the scalar kernel */
+    const Slope_Kernel_t *kernel,    /* I: the kernel to check */
+    float percent_slope,             /* I: threshold of both kernels */
+    const int32_t *x_numerator,      /* I: SLOPE_CHECK_SAMPLES east/west
+                                           slope numerators */
+    const int32_t *y_numerator,      /* I: SLOPE_CHECK_SAMPLES north/south
+                                           slope numerators */
+    const char *what                 /* I: the kernel for the report */
+)
+{
+    float reference_ps[SLOPE_CHECK_SAMPLES];
+    float line_ps[SLOPE_CHECK_SAMPLES];
+    uint8_t reference_exceeded[SLOPE_CHECK_SAMPLES];
+    uint8_t line_exceeded[SLOPE_CHECK_SAMPLES];
+    uint8_t expected_exceeded[SLOPE_CHECK_SAMPLES];
+    int start;
+    int width;
+    int count;
+    int index;
+
+    for (start = 0; start < 8; start++)
+    {
+        for (width = 0; width <= SLOPE_CHECK_WIDTHS; width++)
+        {
+            if (width < SLOPE_CHECK_WIDTHS)
+                count = width;
+            else
+                count = SLOPE_CHECK_SAMPLES - 11;
+
+            memset (reference_ps, 0x5a, sizeof (reference_ps));
+            memset (line_ps, 0x5a, sizeof (line_ps));
+            memset (reference_exceeded, 0x5a, sizeof (reference_exceeded));
+            memset (line_exceeded, 0x5a, sizeof (line_exceeded));
+            memset (expected_exceeded, 0x5a, sizeof (expected_exceeded));
+
+            reference->slope_row (reference, &x_numerator[start],
+                                  &y_numerator[start], count,
+                                  &reference_ps[start]);
+            reference->exceeds_row (reference, &x_numerator[start],
+                                    &y_numerator[start], count,
+                                    &reference_exceeded[start]);
+            kernel->slope_row (kernel, &x_numerator[start],
+                               &y_numerator[start], count, &line_ps[start]);
+            kernel->exceeds_row (kernel, &x_numerator[start],
+                                 &y_numerator[start], count,
+                                 &line_exceeded[start]);
+
+            for (index = start; index < start + count; index++)
+            {
+                if (reference_ps[index] >= percent_slope)
+                    expected_exceeded[index] = 0xff;
+                else
+                    expected_exceeded[index] = 0;
+            }
+
+            if (!check_identical (what, reference_ps, line_ps,
+                                  sizeof (line_ps))
+                || !check_identical (what, reference_exceeded, line_exceeded,
+                                     sizeof (line_exceeded))
+                || !check_identical (what, expected_exceeded, line_exceeded,
+                                     sizeof (line_exceeded)))
+            {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+
+/*****************************************************************************
+  NAME:  check_slope_kernels
+
+  PURPOSE:  Check the row slope and threshold kernels of every instruction
+            set the processor supports against the scalar kernels, for both
+            algorithms and both precisions, with several thresholds.  The
+            numerators come from ranges around the thresholds up to the
+            largest a DEM gives.
+
+  RETURN VALUE:  Type = bool
+      Value    Description
+      -------  ---------------------------------------------------------------
+      false    A kernel differs from the scalar reference.
+      true     Every kernel is identical to the scalar reference.
+*****************************************************************************/
+static bool
+check_slope_kernels ()
+{
+    static const Simd_Target_e targets[] = {
+        SIMD_SCALAR, SIMD_AVX2, SIMD_AVX512
+    };
+    static const Slope_Precision_e precisions[] = {SLOPE_DOUBLE, SLOPE_FLOAT};
+    static const int32_t ranges[] = {128, 4096, 4 * 65535};
+    static const float thresholds[] = {3.0, BENCH_PERCENT_SLOPE, 10.0, 30.0};
+    int32_t x_numerator[SLOPE_CHECK_SAMPLES];
+    int32_t y_numerator[SLOPE_CHECK_SAMPLES];
+    Slope_Kernel_t reference;
+    Slope_Kernel_t kernel;
+    Simd_Target_e selected_target;
+    uint32_t state = 3;
+    char what[160];
+    int zeven_thorne;
+    int precision;
+    int target;
+    int threshold;
+    int range;
+    int index;
+
+    for (zeven_thorne = 0; zeven_thorne < 2; zeven_thorne++)
+    {
+        for (precision = 0; precision < 2; precision++)
+        {
+            for (target = 0; target < 3; target++)
+            {
+                if (select_dswe_tests (targets[target], &selected_target)
+                    == NULL)
+                {
+                    continue;
+                }
+
+                snprintf (what, sizeof (what), "%s %s %s slope kernels",
+                          zeven_thorne ? "zeven_thorne" : "horn",
+                          precision ? "float" : "double",
+                          simd_target_name (targets[target]));
+
+                for (threshold = 0; threshold < 4; threshold++)
+                {
+                    init_slope_kernel (zeven_thorne, precisions[precision],
+                                       SIMD_SCALAR, BENCH_PIXEL_SIZE,
+                                       BENCH_PIXEL_SIZE,
+                                       thresholds[threshold], &reference);
+                    init_slope_kernel (zeven_thorne, precisions[precision],
+                                       targets[target], BENCH_PIXEL_SIZE,
+                                       BENCH_PIXEL_SIZE,
+                                       thresholds[threshold], &kernel);
+
+                    for (range = 0; range < 3; range++)
+                    {
+                        for (index = 0; index < SLOPE_CHECK_SAMPLES; index++)
+                        {
+                            x_numerator[index] = (int32_t) (next_random
+                                (&state) % (2 * ranges[range] + 1))
+                                - ranges[range];
+                            y_numerator[index] = (int32_t) (next_random
+                                (&state) % (2 * ranges[range] + 1))
+                                - ranges[range];
+                        }
+
+                        if (!check_slope_rows (&reference, &kernel,
+                                               thresholds[threshold],
+                                               x_numerator, y_numerator,
+                                               what))
+                        {
+                            return false;
+                        }
+                    }
+                }
+
+                report_identical (what);
+            }
+        }
+    }
+
+    return true;
+}
+
+
+/*****************************************************************************
+  NAME:  run_checks
+
+  PURPOSE:  Check the slope kernels, then every implementation and variant
+            of the tests and classification over the synthetic scene and
+            over the scene with random values.  The tests are checked with
+            the default thresholds of each sensor and with thresholds of
+            neither, each with equal and unequal scale factors.
+
+  RETURN VALUE:  Type = bool
+      Value    Description
+      -------  ---------------------------------------------------------------
+      false    An implementation differs from the scalar reference, or the
+               memory for the checks could not be allocated.
+      true     Every implementation is identical to the scalar reference.
+*****************************************************************************/
+static bool
+run_checks
+(
+    Bench_Scene_t *scene,
+    const Classifier_t *classifier,
+    const Dswe_Tests_Parameters_t *defaults /* I: fill values and L8 default
+                                                  thresholds */
+)
+{
+    size_t pixel_count = (size_t) scene->lines * scene->samples;
+    Dswe_Tests_Parameters_t params;
+    const Dswe_Tests_Parameters_t *thresholds;
+    Slope_Kernel_t kernel;
+    uint8_t *reference_tests;
+    uint8_t *band_tests;
+    uint8_t *outputs;
+    char scene_name[120];
+    bool identical;
+    int random_scene;
+    int profile;
+    int equal_scale;
+    int line;
+
+    reference_tests = malloc (pixel_count);
+    band_tests = malloc (pixel_count);
+    outputs = malloc (10 * pixel_count);
+    if (reference_tests == NULL || band_tests == NULL || outputs == NULL)
+    {
+        free (reference_tests);
+        free (band_tests);
+        free (outputs);
+        ERROR_MESSAGE ("Failed allocating memory for the checks",
+                       MODULE_NAME);
+        return false;
+    }
+
+    /* The classification uses the slope threshold results of every line */
+    init_slope_kernel (false, SLOPE_DOUBLE, SIMD_SCALAR, BENCH_PIXEL_SIZE,
+                       BENCH_PIXEL_SIZE, BENCH_PERCENT_SLOPE, &kernel);
+    for (line = 0; line < scene->lines; line++)
+    {
+        build_slope_exceeded_line (&kernel, scene->band_elevation, 0, line,
+                                   scene->lines, scene->samples, 0,
+                                   scene->samples, scene->slope_work,
+                                   &scene->band_exceeded[(size_t) line
+                                                         * scene->samples]);
+    }
+
+    identical = check_slope_kernels ();
+
+    for (random_scene = 0; random_scene < 2 && identical; random_scene++)
+    {
+        if (random_scene)
+            randomize_bench_scene (scene);
+
+        for (profile = 0; profile < MAX_THRESHOLDS_PROFILES && identical;
+             profile++)
+        {
+            for (equal_scale = 0; equal_scale < 2 && identical;
+                 equal_scale++)
+            {
+                params = *defaults;
+                if (profile == THRESHOLDS_GENERIC)
+                {
+                    /* Thresholds of neither sensor */
+                    params.wigt = 0.05;
+                    params.awgt = 37.5;
+                    params.pswt_1 = -0.4;
+                    params.pswt_2 = -0.6;
+                    params.pswnt_1 = 1200;
+                    params.pswnt_2 = 2200;
+                    params.pswst_1 = 900;
+                    params.pswst_2 = 1100;
+                }
+                else
+                {
+                    thresholds = profile_thresholds (defaults, profile);
+                    params.wigt = thresholds->wigt;
+                    params.awgt = thresholds->awgt;
+                    params.pswt_1 = thresholds->pswt_1;
+                    params.pswt_2 = thresholds->pswt_2;
+                    params.pswnt_1 = thresholds->pswnt_1;
+                    params.pswnt_2 = thresholds->pswnt_2;
+                    params.pswst_1 = thresholds->pswst_1;
+                    params.pswst_2 = thresholds->pswst_2;
+                }
+                if (!equal_scale)
+                    params.swir1_scale_factor = 0.0002;
+
+                snprintf (scene_name, sizeof (scene_name), "the %s scene"
+                          " with %s thresholds and %s scale factors",
+                          random_scene ? "random" : "synthetic",
+                          thresholds_profile_name (profile),
+                          equal_scale ? "equal" : "unequal");
+                identical = check_dswe_tests (scene, &params, profile,
+                                              scene_name, reference_tests,
+                                              band_tests);
+            }
+        }
+
+        /* Classify the test bits of the last tests checked */
+        if (identical)
+        {
+            identical = check_classify (scene, classifier, reference_tests,
+                                        random_scene ? "random"
+                                                     : "synthetic",
+                                        outputs);
+        }
+    }
+
+    free (reference_tests);
+    free (band_tests);
+    free (outputs);
+
+    return identical;
+}
+
+
+/*****************************************************************************
+  NAME:  main
+
+  PURPOSE:  Runs the microbenchmark of each stage over a synthetic scene,
+            for each instruction set the processor supports, and writes the
+            results to stdout as JSON.
+
+  RETURN VALUE:  Type = int
+      Value           Description
+      --------------  --------------------------------------------------------
+      EXIT_FAILURE    An unrecoverable error occured during processing.
+      EXIT_SUCCESS    No errors encountered processing succesfull.
+*****************************************************************************/
+int
+main (int argc, char *argv[])
+{
+    static const Simd_Target_e targets[] = {
+        SIMD_SCALAR, SIMD_SSE2, SIMD_AVX2, SIMD_AVX512
+    };
+    static const Slope_Precision_e precisions[] = {SLOPE_DOUBLE, SLOPE_FLOAT};
+    int lines = BENCH_LINES;
+    int samples = BENCH_SAMPLES;
+    int repeat = BENCH_REPEAT;
+    Bench_Scene_t scene;
+    Dswe_Tests_Parameters_t params;
+    Dswe_Tests_Function_t dswe_tests;
+    Classifier_t classifier;
+    Slope_Kernel_t kernel;
+    Simd_Target_e selected_target;
+    bool first_result;
+    int target;
+    int precision;
+    int zeven_thorne;
+    char variant[80];
+    double seconds;
+    bool check_flag = false;
+    int c;
+    int option_index;
+    struct option long_options[] = {
+        {"lines", required_argument, 0, 'l'},
+        {"samples", required_argument, 0, 's'},
+        {"repeat", required_argument, 0, 'r'},
+        {"check", no_argument, 0, 'c'},
+        {"help", no_argument, 0, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    while ((c = getopt_long (argc, argv, "", long_options, &option_index))
+           != -1)
+    {
+        switch (c)
+        {
+            case 'l':
+                lines = atoi (optarg);
+                break;
+            case 's':
+                samples = atoi (optarg);
+                break;
+            case 'r':
+                repeat = atoi (optarg);
+                break;
+            case 'c':
+                check_flag = true;
+                break;
+            case 'h':
+                bench_usage ();
+                return EXIT_SUCCESS;
+            default:
+                bench_usage ();
+                return EXIT_FAILURE;
+        }
+    }
+    if (lines < 4 || samples < 4 || repeat < 1)
+    {
+        ERROR_MESSAGE ("The lines and samples must be at least 4, and the"
+                       " repeat at least 1", MODULE_NAME);
+        return EXIT_FAILURE;
+    }
+
+    if (create_bench_scene (lines, samples, &scene) != SUCCESS)
+        return EXIT_FAILURE;
+
+    if (build_classifier (NULL, &classifier) != SUCCESS)
+    {
+        free_bench_scene (&scene);
+        return EXIT_FAILURE;
+    }
+
+    /* The L8 defaults */
+    memset (&params, 0, sizeof (params));
+    params.green_scale_factor = 0.0001;
+    params.swir1_scale_factor = 0.0001;
+    params.wigt = 0.1163;
+    params.awgt = 0.0;
+    params.pswt_1 = -0.67;
+    params.pswt_2 = -0.67;
+    params.pswnt_1 = 1500;
+    params.pswnt_2 = 2000;
+    params.pswst_1 = 1000;
+    params.pswst_2 = 1000;
+    params.blue_fill_value = -9999;
+    params.green_fill_value = -9999;
+    params.red_fill_value = -9999;
+    params.nir_fill_value = -9999;
+    params.swir1_fill_value = -9999;
+    params.swir2_fill_value = -9999;
+    params.cfmask_fill_value = BENCH_CFMASK_FILL;
+
+    if (check_flag)
+    {
+        if (!run_checks (&scene, &classifier, &params))
+        {
+            free_bench_scene (&scene);
+            return EXIT_FAILURE;
+        }
+
+        free_bench_scene (&scene);
+        return EXIT_SUCCESS;
+    }
+
+    printf ("{\n  \"benchmark\": \"dswe\",\n  \"lines\": %d,\n"
+            "  \"samples\": %d,\n  \"repeat\": %d,\n  \"stages\": [",
+            lines, samples, repeat);
+    first_result = true;
+
+    report_stage ("fill_index", "scalar", &scene,
+                  bench_fill_index (&scene, repeat), &first_result);
+
+    for (target = 0; target < 4; target++)
+    {
+        dswe_tests = select_dswe_tests (targets[target], &selected_target);
+        if (dswe_tests == NULL)
+            continue;
+
+        report_stage ("dswe_tests", simd_target_name (targets[target]),
+                      &scene, bench_dswe_tests (&scene, dswe_tests, &params,
+                                                repeat),
+                      &first_result);
+    }
+
+    /* The slope has no SSE2 version, so it is left out */
+    for (zeven_thorne = 0; zeven_thorne < 2; zeven_thorne++)
+    {
+        for (precision = 0; precision < 2; precision++)
+        {
+            for (target = 0; target < 4; target++)
+            {
+                if (targets[target] == SIMD_SSE2
+                    || select_dswe_tests (targets[target], &selected_target)
+                       == NULL)
+                {
+                    continue;
+                }
+
+                init_slope_kernel (zeven_thorne, precisions[precision],
+                                   targets[target], BENCH_PIXEL_SIZE,
+                                   BENCH_PIXEL_SIZE, BENCH_PERCENT_SLOPE,
+                                   &kernel);
+
+                snprintf (variant, sizeof (variant), "%s_%s_%s",
+                          zeven_thorne ? "zeven_thorne" : "horn",
+                          precision ? "float" : "double",
+                          simd_target_name (targets[target]));
+                report_stage ("percent_slope", variant, &scene,
+                              bench_slope (&scene, &kernel, false, repeat),
+                              &first_result);
+                report_stage ("slope_threshold", variant, &scene,
+                              bench_slope (&scene, &kernel, true, repeat),
+                              &first_result);
+            }
+        }
+    }
+
+    /* The recode uses the test bits and slope results from above */
+    report_stage ("recode", "all_products", &scene,
+                  bench_recode (&scene, &classifier, repeat),
+                  &first_result);
+
+    seconds = bench_write_output (&scene, repeat);
+    if (seconds > 0.0)
+    {
+        report_stage ("write_output", "uint8", &scene, seconds,
+                      &first_result);
+    }
+    else
+    {
+        WARNING_MESSAGE ("Failed writing the temporary output file, the"
+                         " write_output stage is left out", MODULE_NAME);
+    }
+
+    printf ("\n  ],\n  \"slope_accuracy\": [");
+    first_result = true;
+    for (zeven_thorne = 0; zeven_thorne < 2; zeven_thorne++)
+    {
+        for (precision = 0; precision < 2; precision++)
+        {
+            init_slope_kernel (zeven_thorne, precisions[precision],
+                               SIMD_SCALAR, BENCH_PIXEL_SIZE,
+                               BENCH_PIXEL_SIZE, BENCH_PERCENT_SLOPE,
+                               &kernel);
+            report_slope_accuracy (&scene, &kernel, &first_result);
+        }
+    }
+    printf ("\n  ]\n}\n");
+
+    free_bench_scene (&scene);
+
+    return EXIT_SUCCESS;
+}
@@ -7,20 +7,277 @@
 #include <stdint.h>
 
 
-void build_slope_band
+#include "dswe_tests.h"
+
+
+/* Precision used for computing the percent slope */
+typedef enum
+{
+    SLOPE_DOUBLE, /* Identical to the reference algorithms */
+    SLOPE_FLOAT
+} Slope_Precision_e;
+
+
+typedef struct Slope_Kernel_s Slope_Kernel_t;
+
+
+/* Computes the percent slope for a row of slope numerators */
+typedef void (*Slope_Row_Function_t)
+(
+    const Slope_Kernel_t *kernel, /* I: slope kernel settings */
+    const int32_t *x_numerator,   /* I: east/west slope numerators */
+    const int32_t *y_numerator,   /* I: north/south slope numerators */
+    int count,                    /* I: number of pixels */
+    float *line_ps                /* O: percent slope for each pixel */
+);
+
+
+/* Determines where the percent slope is at or above the threshold for a row
+   of slope numerators */
+typedef void (*Slope_Exceeds_Function_t)
+(
+    const Slope_Kernel_t *kernel, /* I: slope kernel settings */
+    const int32_t *x_numerator,   /* I: east/west slope numerators */
+    const int32_t *y_numerator,   /* I: north/south slope numerators */
+    int count,                    /* I: number of pixels */
+    uint8_t *line_exceeded        /* O: 0xff where the slope is at or above
+                                        the threshold, 0 otherwise */
+);
+
+
+/* Settings for generating the percent slope */
+struct Slope_Kernel_s
+{
+    bool use_zeven_thorne_flag;  /* Zevenbergen & Thorne instead of Horn */
+    Slope_Precision_e precision; /* Precision of the computations */
+    double x_divisor;            /* Divides the numerators to give the */
+    double y_divisor;            /* slopes in double precision */
+    float x_scale;               /* Multiplies the numerators to give the */
+    float y_scale;               /* slopes in single precision */
+    double double_threshold;     /* Smallest squared slope at or above the
+                                    percent slope threshold */
+    float float_threshold;       /* Single precision version */
+    uint8_t border_exceeded;     /* Result for the lines and samples which
+                                    are not processed */
+    Slope_Row_Function_t slope_row;
+    Slope_Exceeds_Function_t exceeds_row;
+};
+
+
+double calculate_slope_horn
+(
+    double *elevation_window, /* I: 3x3 array of elevation values in meters */
+    double ew_resolution,     /* I: east/west resolution of the elevation
+                                    data in meters */
+    double ns_resolution      /* I: north/south resolution of the elevation
+                                    data in meters */
+);
+
+
+double calculate_slope_zevenbergen_thorne
+(
+    double *elevation_window, /* I: 3x3 array of elevation values in meters */
+    double ew_resolution,     /* I: east/west resolution of the elevation
+                                    data in meters */
+    double ns_resolution      /* I: north/south resolution of the elevation
+                                    data in meters */
+);
+
+
+void slope_row_double_scalar
+(
+    const Slope_Kernel_t *kernel, /* I: slope kernel settings */
+    const int32_t *x_numerator,   /* I: east/west slope numerators */
+    const int32_t *y_numerator,   /* I: north/south slope numerators */
+    int count,                    /* I: number of pixels */
+    float *line_ps                /* O: percent slope for each pixel */
+);
+
+
+void slope_exceeds_double_scalar
+(
+    const Slope_Kernel_t *kernel, /* I: slope kernel settings */
+    const int32_t *x_numerator,   /* I: east/west slope numerators */
+    const int32_t *y_numerator,   /* I: north/south slope numerators */
+    int count,                    /* I: number of pixels */
+    uint8_t *line_exceeded        /* O: 0xff where the slope is at or above
+                                        the threshold, 0 otherwise */
+);
+
+
+void slope_row_float_scalar
+(
+    const Slope_Kernel_t *kernel, /* I: slope kernel settings */
+    const int32_t *x_numerator,   /* I: east/west slope numerators */
+    const int32_t *y_numerator,   /* I: north/south slope numerators */
+    int count,                    /* I: number of pixels */
+    float *line_ps                /* O: percent slope for each pixel */
+);
+
+
+void slope_exceeds_float_scalar
+(
+    const Slope_Kernel_t *kernel, /* I: slope kernel settings */
+    const int32_t *x_numerator,   /* I: east/west slope numerators */
+    const int32_t *y_numerator,   /* I: north/south slope numerators */
+    int count,                    /* I: number of pixels */
+    uint8_t *line_exceeded        /* O: 0xff where the slope is at or above
+                                        the threshold, 0 otherwise */
+);
+
+
+#ifdef DSWE_SIMD_X86
+void slope_row_double_avx2
+(
+    const Slope_Kernel_t *kernel, /* I: slope kernel settings */
+    const int32_t *x_numerator,   /* I: east/west slope numerators */
+    const int32_t *y_numerator,   /* I: north/south slope numerators */
+    int count,                    /* I: number of pixels */
+    float *line_ps                /* O: percent slope for each pixel */
+);
+
+
+void slope_exceeds_double_avx2
+(
+    const Slope_Kernel_t *kernel, /* I: slope kernel settings */
+    const int32_t *x_numerator,   /* I: east/west slope numerators */
+    const int32_t *y_numerator,   /* I: north/south slope numerators */
+    int count,                    /* I: number of pixels */
+    uint8_t *line_exceeded        /* O: 0xff where the slope is at or above
+                                        the threshold, 0 otherwise */
+);
+
+
+void slope_row_float_avx2
+(
+    const Slope_Kernel_t *kernel, /* I: slope kernel settings */
+    const int32_t *x_numerator,   /* I: east/west slope numerators */
+    const int32_t *y_numerator,   /* I: north/south slope numerators */
+    int count,                    /* I: number of pixels */
+    float *line_ps                /* O: percent slope for each pixel */
+);
+
+
+void slope_exceeds_float_avx2
+(
+    const Slope_Kernel_t *kernel, /* I: slope kernel settings */
+    const int32_t *x_numerator,   /* I: east/west slope numerators */
+    const int32_t *y_numerator,   /* I: north/south slope numerators */
+    int count,                    /* I: number of pixels */
+    uint8_t *line_exceeded        /* O: 0xff where the slope is at or above
+                                        the threshold, 0 otherwise */
+);
+
+
+void slope_row_double_avx512
+(
+    const Slope_Kernel_t *kernel, /* I: slope kernel settings */
+    const int32_t *x_numerator,   /* I: east/west slope numerators */
+    const int32_t *y_numerator,   /* I: north/south slope numerators */
+    int count,                    /* I: number of pixels */
+    float *line_ps                /* O: percent slope for each pixel */
+);
+
+
+void slope_exceeds_double_avx512
 (
-    int16_t *band_dem,    /* I: the elevation data to use in meters */
-    int num_lines,        /* I: the number of lines in the data */
+    const Slope_Kernel_t *kernel, /* I: slope kernel settings */
+    const int32_t *x_numerator,   /* I: east/west slope numerators */
+    const int32_t *y_numerator,   /* I: north/south slope numerators */
+    int count,                    /* I: number of pixels */
+    uint8_t *line_exceeded        /* O: 0xff where the slope is at or above
+                                        the threshold, 0 otherwise */
+);
+
+
+void slope_row_float_avx512
+(
+    const Slope_Kernel_t *kernel, /* I: slope kernel settings */
+    const int32_t *x_numerator,   /* I: east/west slope numerators */
+    const int32_t *y_numerator,   /* I: north/south slope numerators */
+    int count,                    /* I: number of pixels */
+    float *line_ps                /* O: percent slope for each pixel */
+);
+
+
+void slope_exceeds_float_avx512
+(
+    const Slope_Kernel_t *kernel, /* I: slope kernel settings */
+    const int32_t *x_numerator,   /* I: east/west slope numerators */
+    const int32_t *y_numerator,   /* I: north/south slope numerators */
+    int count,                    /* I: number of pixels */
+    uint8_t *line_exceeded        /* O: 0xff where the slope is at or above
+                                        the threshold, 0 otherwise */
+);
+#endif
+
+
+void init_slope_kernel
+(
+    bool use_zeven_thorne_flag, /* I: use Zevenbergen & Thorne's algorithm
+                                      instead of Horn's */
+    Slope_Precision_e precision, /* I: precision of the computations */
+    Simd_Target_e simd_target,  /* I: instruction set to use */
+    double ew_resolution,       /* I: east/west resolution of the elevation
+                                      data in meters */
+    double ns_resolution,       /* I: north/south resolution of the
+                                      elevation data in meters */
+    float percent_slope,        /* I: percent slope threshold */
+    Slope_Kernel_t *kernel      /* O: the slope kernel */
+);
+
+
+void build_slope_line
+(
+    const Slope_Kernel_t *kernel, /* I: slope kernel settings */
+    const int16_t *band_dem, /* I: the elevation data to use in meters,
+                                   starting at first_dem_line */
+    int first_dem_line,   /* I: the line of the full band held in the first
+                                line of band_dem */
+    int line,             /* I: the line to generate the slope for */
+    int num_lines,        /* I: the number of lines in the full band */
     int num_samples,      /* I: the number of samples in the data */
-    double ew_resolution, /* I: east/west resolution of the elevation data in
-                                meters */
-    double ns_resolution, /* I: north/south resolution of the elevation data
-                                in meters */
-    bool use_zeven_thorne_flag, /* I: wether or not to use this algorithm
-                                      for the percent slope calculation */
-    float *band_ps        /* O: the percent slope band generated from the
+    int32_t *slope_work,  /* I: work space of 4 * num_samples */
+    float *line_ps        /* O: the percent slope line generated from the
                                 DEM */
 );
 
 
+void build_slope_exceeded_line
+(
+    const Slope_Kernel_t *kernel, /* I: slope kernel settings */
+    const int16_t *band_dem, /* I: the elevation data to use in meters,
+                                   starting at first_dem_line */
+    int first_dem_line,   /* I: the line of the full band held in the first
+                                line of band_dem */
+    int line,             /* I: the line to generate the slope for */
+    int num_lines,        /* I: the number of lines in the full band */
+    int num_samples,      /* I: the number of samples in the data */
+    int first_sample,     /* I: first sample to determine */
+    int end_sample,       /* I: one past the last sample to determine */
+    int32_t *slope_work,  /* I: work space of 4 * num_samples */
+    uint8_t *line_exceeded /* O: 0xff where the slope is at or above the
+                                 threshold, 0 otherwise */
+);
+
+
+void build_slope_exceeded_candidates
+(
+    const Slope_Kernel_t *kernel, /* I: slope kernel settings */
+    const int16_t *band_dem, /* I: the elevation data to use in meters,
+                                   starting at first_dem_line */
+    int first_dem_line,   /* I: the line of the full band held in the first
+                                line of band_dem */
+    int line,             /* I: the line to generate the slope for */
+    int num_lines,        /* I: the number of lines in the full band */
+    int num_samples,      /* I: the number of samples in the data */
+    int first_sample,     /* I: first sample to determine */
+    int end_sample,       /* I: one past the last sample to determine */
+    int32_t *slope_work,  /* I: work space of 4 * num_samples */
+    uint8_t *line_exceeded /* I/O: non-zero for the candidate samples in,
+                                  for those 0xff where the slope is at or
+                                  above the threshold, 0 otherwise out */
+);
+
+
 #endif /* BUILD_SLOPE_BAND_H */
@@ -0,0 +1,582 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+
+#include "const.h"
+#include "dswe.h"
+#include "utilities.h"
+#include "classify.h"
+
+
+/* Raw DSWE tests value the prototype assigned to cloud, cloud shadow, and
+   snow pixels before recoding them */
+#define CFMASK_RECODE_VALUE 11999
+
+/* More ranges than any reasonable recode file contains */
+#define MAX_RECODE_RANGES 256
+
+
+/* A single line from an ESPA recode file */
+typedef struct
+{
+    int low;   /* Lowest raw DSWE tests value in the range */
+    int high;  /* Highest raw DSWE tests value in the range */
+    int value; /* Value assigned to the range */
+} Recode_Range_t;
+
+
+/*****************************************************************************
+  NAME:  recode_raw_dswe_value
+
+  PURPOSE:  Recodes the raw DSWE tests value to fit an 8bit output product
+            using the built in recode.
+
+  RETURN VALUE:  Type = uint8_t
+      Value    Description
+      -------  ---------------------------------------------------------------
+      0 - 3    The recoded DSWE value
+*****************************************************************************/
+static uint8_t
+recode_raw_dswe_value
+(
+    int16_t raw_dswe_value /* I: raw DSWE tests value */
+)
+{
+    switch (raw_dswe_value)
+    {
+        /* From ESPA_recode.rmp prototype
+           11999 11999 : 9    ** Not included here it is only for
+                              ** cfmask tests performed after this
+         */
+
+        /* 11001 11111 : 1 */
+        case 11111:
+        case 11110:
+        case 11101:
+        case 11100:
+        case 11011:
+        case 11010:
+        case 11001:
+        /* 10111 10999 : 1 */
+        case 10111:
+        /* 1111 1111 : 1 */
+        case 1111:
+            return DSWE_WATER_HIGH_CONFIDENCE;
+
+        /* 11000 11000 : 3 */
+        case 11000:
+        /* 10000 10000 : 3 */
+        case 10000:
+        /* 1000 1000 : 3 */
+        case 1000:
+            return DSWE_PARTIAL_SURFACE_WATER_PIXEL;
+
+        /* 10012 10110 : 2 */
+        case 10110:
+        case 10101:
+        case 10100:
+        /* 10011 10011 : 2 */
+        case 10011:
+        /* 10001 10010 : 2 */
+        case 10010:
+        case 10001:
+        /* 1001 1110 : 2 */
+        case 1110:
+        case 1101:
+        case 1100:
+        case 1011:
+        case 1010:
+        case 1001:
+        /* 10 111 : 2 */
+        case 111:
+        case 110:
+        case 101:
+        case 100:
+        case 11:
+        case 10:
+            return DSWE_WATER_MODERATE_CONFIDENCE;
+
+        /* 0 9 : 0 */
+        case 1:
+        case 0:
+        default:
+            return DSWE_NOT_WATER;
+    }
+}
+
+
+/*****************************************************************************
+  NAME:  read_recode_file
+
+  PURPOSE:  Reads an ESPA recode file, such as ESPA_recode.rmp from the
+            prototype.  Each line contains a range of raw DSWE tests values
+            and the value assigned to them in the form "low high : value".
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      SUCCESS  No errors were encountered.
+      ERROR    An error was encountered.
+*****************************************************************************/
+static int
+read_recode_file
+(
+    const char *recode_filename, /* I: ESPA recode file */
+    Recode_Range_t *ranges,      /* O: the ranges read from the file */
+    int *range_count             /* O: the number of ranges read */
+)
+{
+    FILE *recode_fd = NULL;
+    char line[STR_SIZE];
+    char msg[256];
+    int line_number = 0;
+    int low;
+    int high;
+    int value;
+    char extra;
+
+    *range_count = 0;
+
+    recode_fd = fopen (recode_filename, "r");
+    if (recode_fd == NULL)
+    {
+        snprintf (msg, sizeof (msg), "Failed opening recode file %s",
+                  recode_filename);
+        RETURN_ERROR (msg, MODULE_NAME, ERROR);
+    }
+
+    while (fgets (line, sizeof (line), recode_fd) != NULL)
+    {
+        line_number++;
+
+        /* Skip blank lines */
+        if (strspn (line, " \t\r\n") == strlen (line))
+            continue;
+
+        if (sscanf (line, "%d %d : %d %c", &low, &high, &value, &extra) != 3
+            || low > high || value < 0 || value >= DSWE_NO_DATA_VALUE)
+        {
+            fclose (recode_fd);
+            snprintf (msg, sizeof (msg), "Invalid recode on line %d of %s",
+                      line_number, recode_filename);
+            RETURN_ERROR (msg, MODULE_NAME, ERROR);
+        }
+
+        if (*range_count == MAX_RECODE_RANGES)
+        {
+            fclose (recode_fd);
+            snprintf (msg, sizeof (msg), "Too many recode ranges in %s",
+                      recode_filename);
+            RETURN_ERROR (msg, MODULE_NAME, ERROR);
+        }
+
+        ranges[*range_count].low = low;
+        ranges[*range_count].high = high;
+        ranges[*range_count].value = value;
+        (*range_count)++;
+    }
+
+    fclose (recode_fd);
+
+    if (*range_count == 0)
+    {
+        snprintf (msg, sizeof (msg), "No recode ranges found in %s",
+                  recode_filename);
+        RETURN_ERROR (msg, MODULE_NAME, ERROR);
+    }
+
+    return SUCCESS;
+}
+
+
+/*****************************************************************************
+  NAME:  find_recode_value
+
+  PURPOSE:  Finds the first range containing the raw DSWE tests value.
+
+  RETURN VALUE:  Type = bool
+      Value    Description
+      -------  ---------------------------------------------------------------
+      true     The value was found and returned in recoded_value
+      false    No range contains the value
+*****************************************************************************/
+static bool
+find_recode_value
+(
+    const Recode_Range_t *ranges, /* I: the recode ranges */
+    int range_count,              /* I: the number of ranges */
+    int raw_dswe_value,           /* I: raw DSWE tests value */
+    uint8_t *recoded_value        /* O: the value assigned to the range */
+)
+{
+    int index;
+
+    for (index = 0; index < range_count; index++)
+    {
+        if (raw_dswe_value >= ranges[index].low
+            && raw_dswe_value <= ranges[index].high)
+        {
+            *recoded_value = ranges[index].value;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+/*****************************************************************************
+  NAME:  build_classifier
+
+  PURPOSE:  Populates the lookup tables used to classify each pixel.  The
+            classification table is indexed by the test bits (including the
+            fill bit), the cfmask class, and the percent slope bit, and holds
+            the raw, ccss, and psccss output values for that combination.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      SUCCESS  No errors were encountered.
+      ERROR    An error was encountered.
+
+  NOTES:
+    1. When a recode file is used, raw DSWE tests values not covered by any
+       range are recoded as not water.  If the file contains the value the
+       prototype used for cloud, cloud shadow, and snow (11999), that range
+       provides the value for those pixels in the ccss and psccss outputs.
+*****************************************************************************/
+int
+build_classifier
+(
+    const char *recode_filename, /* I: ESPA recode file or NULL to use the
+                                       built in recode */
+    Classifier_t *classifier     /* O: the populated lookup tables */
+)
+{
+    Recode_Range_t ranges[MAX_RECODE_RANGES];
+    int range_count = 0;
+    int tests;
+    int class_index;
+    int16_t raw_dswe_value;
+    uint8_t raw_value;
+    uint8_t ccss_value;
+    uint8_t psccss_value;
+    uint8_t cfmask_value = DSWE_CLOUD_CLOUD_SHADOW_SNOW;
+    int value;
+
+    if (recode_filename != NULL)
+    {
+        if (read_recode_file (recode_filename, ranges, &range_count)
+            != SUCCESS)
+        {
+            RETURN_ERROR ("Failed reading the recode file", MODULE_NAME,
+                          ERROR);
+        }
+
+        find_recode_value (ranges, range_count, CFMASK_RECODE_VALUE,
+                           &cfmask_value);
+    }
+
+    /* Only cloud, cloud shadow, and snow affect the outputs */
+    for (value = 0; value < 256; value++)
+    {
+        if (value == CFMASK_CLOUD
+            || value == CFMASK_CLOUD_SHADOW
+            || value == CFMASK_SNOW)
+        {
+            classifier->cfmask_class[value] = CLASS_CFMASK_BIT;
+        }
+        else
+        {
+            classifier->cfmask_class[value] = 0;
+        }
+    }
+
+    for (tests = 0; tests < TESTS_INDEX_COUNT; tests++)
+    {
+        if (tests & DSWE_TEST_FILL)
+        {
+            /* If any of the input is fill, make the output fill */
+            classifier->tests_value[tests] = TESTS_NO_DATA_VALUE;
+            raw_value = DSWE_NO_DATA_VALUE;
+        }
+        else
+        {
+            /* Each test sets its own digit of the raw tests value */
+            raw_dswe_value = 0;
+            if (tests & DSWE_TEST_MNDWI)
+                raw_dswe_value += 1; /* Set the ones digit */
+            if (tests & DSWE_TEST_MBSR)
+                raw_dswe_value += 10; /* Set the tens digit */
+            if (tests & DSWE_TEST_AWESH)
+                raw_dswe_value += 100; /* Set the hundreds digit */
+            if (tests & DSWE_TEST_PSW1)
+                raw_dswe_value += 1000; /* Set the thousands digit */
+            if (tests & DSWE_TEST_PSW2)
+                raw_dswe_value += 10000; /* Set the ten thousands digit */
+
+            classifier->tests_value[tests] = raw_dswe_value;
+
+            /* Recode the value to fit an 8bit output product */
+            if (recode_filename == NULL)
+            {
+                raw_value = recode_raw_dswe_value (raw_dswe_value);
+            }
+            else if (!find_recode_value (ranges, range_count,
+                                         raw_dswe_value, &raw_value))
+            {
+                raw_value = DSWE_NOT_WATER;
+            }
+        }
+
+        /* The following produce the paths to the output products.
+
+           raw -> output
+           raw -> cloud -> cloud shadow -> snow -> output
+           raw -> percent-slope -> cloud -> cloud shadow -> snow -> output
+        */
+        for (class_index = tests; class_index < CLASS_INDEX_COUNT;
+             class_index += TESTS_INDEX_COUNT)
+        {
+            ccss_value = raw_value;
+            psccss_value = raw_value;
+
+            if (!(tests & DSWE_TEST_FILL))
+            {
+                /* Apply the Percent Slope constraint to the Percent Slope,
+                   Cloud, Cloud Shadow, and Snow output */
+                if (class_index & CLASS_SLOPE_BIT)
+                    psccss_value = DSWE_NOT_WATER;
+
+                /* Apply the CFMASK Cloud, Cloud Shadow, and Snow constraint
+                   to both filtered outputs */
+                if (class_index & CLASS_CFMASK_BIT)
+                {
+                    ccss_value = cfmask_value;
+                    psccss_value = cfmask_value;
+                }
+            }
+
+            classifier->outputs[class_index] = (uint32_t) raw_value
+                                             | ((uint32_t) ccss_value << 8)
+                                             | ((uint32_t) psccss_value << 16);
+        }
+    }
+
+    /* The slope only matters where it changes an output, which is water
+       in the psccss that is not cloud, cloud shadow, or snow */
+    for (class_index = 0; class_index < CLASS_SLOPE_BIT; class_index++)
+    {
+        if (classifier->outputs[class_index]
+            != classifier->outputs[class_index | CLASS_SLOPE_BIT])
+        {
+            classifier->slope_candidate[class_index] = 0xff;
+        }
+        else
+        {
+            classifier->slope_candidate[class_index] = 0;
+        }
+    }
+
+    return SUCCESS;
+}
+
+
+/*****************************************************************************
+  NAME:  classify_line
+
+  PURPOSE:  Replace the test bits of each pixel with its raw DSWE value,
+            and assign the other selected outputs, from the test bits,
+            cfmask, and percent slope threshold results.
+
+  RETURN VALUE:  None
+
+  NOTES:
+    1. This is the body of classify_pixels and its variants.  The flags are
+       constants in each variant, so the outputs it does not generate are
+       not checked for each pixel.
+    2. The cfmask is used for either filtered output and the slope only for
+       the psccss, the raw output does not depend on them.
+*****************************************************************************/
+static inline __attribute__ ((always_inline)) void
+classify_line
+(
+    const Classifier_t *classifier,
+    const uint8_t *band_cfmask,
+    const uint8_t *line_exceeded,
+    int pixel_count,
+    uint8_t *band_dswe_raw,
+    uint8_t *band_dswe_ccss,
+    uint8_t *band_dswe_psccss,
+    int16_t *band_dswe_diag,
+    bool use_cfmask_flag,     /* I: band_cfmask is used */
+    bool use_slope_flag,      /* I: line_exceeded is used */
+    bool include_ccss_flag,   /* I: band_dswe_ccss is assigned */
+    bool include_psccss_flag, /* I: band_dswe_psccss is assigned */
+    bool include_diag_flag    /* I: band_dswe_diag is assigned */
+)
+{
+    int index;
+    uint8_t tests;
+    int class_index;
+    uint32_t outputs;
+
+    for (index = 0; index < pixel_count; index++)
+    {
+        tests = band_dswe_raw[index];
+
+        /* Assign it to the tests band */
+        if (include_diag_flag)
+            band_dswe_diag[index] = classifier->tests_value[tests];
+
+        /* Look up the recoded values for all of the outputs, from the
+           tests, cfmask, and percent slope */
+        class_index = tests;
+        if (use_cfmask_flag)
+            class_index |= classifier->cfmask_class[band_cfmask[index]];
+        if (use_slope_flag)
+            class_index |= line_exceeded[index] & CLASS_SLOPE_BIT;
+        outputs = classifier->outputs[class_index];
+
+        /* Assign the values to the selected output bands, the raw band
+           always holds the value since it held the tests */
+        band_dswe_raw[index] = CLASS_RAW (outputs);
+        if (include_ccss_flag)
+            band_dswe_ccss[index] = CLASS_CCSS (outputs);
+        if (include_psccss_flag)
+            band_dswe_psccss[index] = CLASS_PSCCSS (outputs);
+    }
+}
+
+
+/*****************************************************************************
+  NAME:  classify_pixels
+
+  PURPOSE:  Replace the test bits of each pixel with its raw DSWE value,
+            and assign the other selected outputs, from the test bits,
+            cfmask, and percent slope threshold results.  The inputs and
+            outputs which are NULL are not used.
+
+  RETURN VALUE:  None
+*****************************************************************************/
+void
+classify_pixels
+(
+    const Classifier_t *classifier,
+    const uint8_t *band_cfmask,
+    const uint8_t *line_exceeded,
+    int pixel_count,
+    uint8_t *band_dswe_raw,
+    uint8_t *band_dswe_ccss,
+    uint8_t *band_dswe_psccss,
+    int16_t *band_dswe_diag
+)
+{
+    classify_line (classifier, band_cfmask, line_exceeded, pixel_count,
+                   band_dswe_raw, band_dswe_ccss, band_dswe_psccss,
+                   band_dswe_diag, band_cfmask != NULL, line_exceeded != NULL,
+                   band_dswe_ccss != NULL, band_dswe_psccss != NULL,
+                   band_dswe_diag != NULL);
+}
+
+
+/* Defines a variant of classify_pixels for a set of outputs */
+#define CLASSIFY_VARIANT(name, include_ccss_flag, include_psccss_flag,      \
+                         include_diag_flag)                                \
+    static void                                                           \
+    name                                                                  \
+    (                                                                     \
+        const Classifier_t *classifier,                                   \
+        const uint8_t *band_cfmask,                                       \
+        const uint8_t *line_exceeded,                                     \
+        int pixel_count,                                                  \
+        uint8_t *band_dswe_raw,                                           \
+        uint8_t *band_dswe_ccss,                                          \
+        uint8_t *band_dswe_psccss,                                        \
+        int16_t *band_dswe_diag                                           \
+    )                                                                     \
+    {                                                                     \
+        classify_line (classifier, band_cfmask, line_exceeded,            \
+                       pixel_count, band_dswe_raw, band_dswe_ccss,        \
+                       band_dswe_psccss, band_dswe_diag,                  \
+                       (include_ccss_flag) || (include_psccss_flag),      \
+                       include_psccss_flag, include_ccss_flag,            \
+                       include_psccss_flag, include_diag_flag);           \
+    }
+
+CLASSIFY_VARIANT (classify_raw, false, false, false)
+CLASSIFY_VARIANT (classify_ccss, true, false, false)
+CLASSIFY_VARIANT (classify_psccss, false, true, false)
+CLASSIFY_VARIANT (classify_ccss_psccss, true, true, false)
+CLASSIFY_VARIANT (classify_raw_diag, false, false, true)
+CLASSIFY_VARIANT (classify_ccss_diag, true, false, true)
+CLASSIFY_VARIANT (classify_psccss_diag, false, true, true)
+CLASSIFY_VARIANT (classify_ccss_psccss_diag, true, true, true)
+
+
+/*****************************************************************************
+  NAME:  mark_slope_candidates
+
+  PURPOSE:  Mark the pixels whose outputs depend on the percent slope, from
+            their test bits and cfmask, so the slope is only determined for
+            them.
+
+  RETURN VALUE:  Type = int
+      The number of candidate pixels.
+*****************************************************************************/
+int
+mark_slope_candidates
+(
+    const Classifier_t *classifier,
+    const uint8_t *band_cfmask,
+    const uint8_t *band_dswe_raw,
+    int pixel_count,
+    uint8_t *line_candidate
+)
+{
+    int index;
+    int count = 0;
+    uint8_t candidate;
+
+    for (index = 0; index < pixel_count; index++)
+    {
+        candidate = classifier->slope_candidate[band_dswe_raw[index]
+            | classifier->cfmask_class[band_cfmask[index]]];
+        line_candidate[index] = candidate;
+        count += candidate & 1;
+    }
+
+    return count;
+}
+
+
+/*****************************************************************************
+  NAME:  select_classify_pixels
+
+  PURPOSE:  Selects the variant of classify_pixels for the outputs of a
+            scene.  The variant uses the cfmask when either filtered output
+            is generated and the percent slope when the psccss is.
+
+  RETURN VALUE:  Type = Classify_Pixels_Function_t
+*****************************************************************************/
+Classify_Pixels_Function_t
+select_classify_pixels
+(
+    bool include_ccss_flag,
+    bool include_psccss_flag,
+    bool include_diag_flag
+)
+{
+    static const Classify_Pixels_Function_t variants[2][2][2] = {
+        {{classify_raw, classify_raw_diag},
+         {classify_psccss, classify_psccss_diag}},
+        {{classify_ccss, classify_ccss_diag},
+         {classify_ccss_psccss, classify_ccss_psccss_diag}}
+    };
+
+    return variants[include_ccss_flag ? 1 : 0][include_psccss_flag ? 1 : 0]
+                   [include_diag_flag ? 1 : 0];
+}
@@ -0,0 +1,107 @@
+#ifndef CLASSIFY_H
+#define CLASSIFY_H
+
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+#include "dswe_tests.h"
+
+
+/* The test bits, including the fill bit, form the low bits of the index
+   into the classification table */
+#define TESTS_INDEX_COUNT 64
+
+/* Bits of the classification table index above the test bits */
+#define CLASS_CFMASK_BIT 0x40 /* cfmask is cloud, cloud shadow, or snow */
+#define CLASS_SLOPE_BIT  0x80 /* percent slope is at or above the
+                                 threshold */
+#define CLASS_INDEX_COUNT 256
+
+/* Extract the output bands from a classification table entry */
+#define CLASS_RAW(entry)     ((uint8_t) ((entry) & 0xff))
+#define CLASS_CCSS(entry)    ((uint8_t) (((entry) >> 8) & 0xff))
+#define CLASS_PSCCSS(entry)  ((uint8_t) (((entry) >> 16) & 0xff))
+
+
+/* Lookup tables for classifying a pixel from its test bits, cfmask value,
+   and whether the percent slope threshold was exceeded */
+typedef struct
+{
+    int16_t tests_value[TESTS_INDEX_COUNT]; /* Raw DSWE tests value */
+    uint8_t cfmask_class[256];   /* CLASS_CFMASK_BIT or zero for each
+                                    cfmask value */
+    uint32_t outputs[CLASS_INDEX_COUNT]; /* The raw, ccss, and psccss values
+                                            packed into one entry */
+    uint8_t slope_candidate[CLASS_SLOPE_BIT]; /* 0xff where the percent
+                                                 slope changes the outputs,
+                                                 0 otherwise */
+} Classifier_t;
+
+
+/* All of the variants of classify_pixels have its signature */
+typedef void (*Classify_Pixels_Function_t)
+(
+    const Classifier_t *classifier, /* I: the lookup tables */
+    const uint8_t *band_cfmask,     /* I: cfmask of each pixel, NULL when
+                                          the cfmask is not used */
+    const uint8_t *line_exceeded,   /* I: 0xff where the percent slope is at
+                                          or above the threshold, NULL when
+                                          the slope is not used */
+    int pixel_count,                /* I: number of pixels */
+    uint8_t *band_dswe_raw,         /* I/O: test bits in, raw DSWE out */
+    uint8_t *band_dswe_ccss,        /* O: ccss output or NULL */
+    uint8_t *band_dswe_psccss,      /* O: psccss output or NULL */
+    int16_t *band_dswe_diag         /* O: raw tests output or NULL */
+);
+
+
+int
+build_classifier
+(
+    const char *recode_filename, /* I: ESPA recode file or NULL to use the
+                                       built in recode */
+    Classifier_t *classifier     /* O: the populated lookup tables */
+);
+
+
+void
+classify_pixels
+(
+    const Classifier_t *classifier, /* I: the lookup tables */
+    const uint8_t *band_cfmask,     /* I: cfmask of each pixel, NULL when
+                                          the cfmask is not used */
+    const uint8_t *line_exceeded,   /* I: 0xff where the percent slope is at
+                                          or above the threshold, NULL when
+                                          the slope is not used */
+    int pixel_count,                /* I: number of pixels */
+    uint8_t *band_dswe_raw,         /* I/O: test bits in, raw DSWE out */
+    uint8_t *band_dswe_ccss,        /* O: ccss output or NULL */
+    uint8_t *band_dswe_psccss,      /* O: psccss output or NULL */
+    int16_t *band_dswe_diag         /* O: raw tests output or NULL */
+);
+
+
+int
+mark_slope_candidates
+(
+    const Classifier_t *classifier, /* I: the lookup tables */
+    const uint8_t *band_cfmask,     /* I: cfmask of each pixel */
+    const uint8_t *band_dswe_raw,   /* I: test bits of each pixel */
+    int pixel_count,                /* I: number of pixels */
+    uint8_t *line_candidate         /* O: 0xff where the percent slope is
+                                          needed, 0 otherwise */
+);
+
+
+Classify_Pixels_Function_t
+select_classify_pixels
+(
+    bool include_ccss_flag,   /* I: the ccss output is generated */
+    bool include_psccss_flag, /* I: the psccss output is generated */
+    bool include_diag_flag    /* I: the raw tests output is generated */
+);
+
+
+#endif /* CLASSIFY_H */
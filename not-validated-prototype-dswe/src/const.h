@@ -32,6 +32,24 @@
 #define PS_SC_LONG_NAME "dynamic surface water extent: filtered by: percent slope - cloud - cloud shadow - snow"
 
 
+/* The output products which can be selected, as bits so any combination
+   can be requested */
+#define PRODUCT_RAW 0x01
+#define PRODUCT_CCSS 0x02
+#define PRODUCT_PSCCSS 0x04
+#define PRODUCT_DIAG 0x08
+#define PRODUCT_PS 0x10
+#define PRODUCT_WATER_QA 0x20 /* The Level2 QA band with the water pixels */
+#define PRODUCT_DEFAULT (PRODUCT_RAW | PRODUCT_CCSS | PRODUCT_PSCCSS)
+
+
+/* Without a memory budget a scene of more pixels than an int can count is
+   not held in memory at once, it is processed in strips within this
+   budget in megabytes */
+#define LARGE_SCENE_PIXELS 2147483647L
+#define LARGE_SCENE_MAX_MEMORY 1024
+
+
 /* These are used in arrays, and they are position dependent */
 typedef enum
 {
@@ -42,7 +60,12 @@ typedef enum
     I_BAND_SWIR1,
     I_BAND_SWIR2,
     I_BAND_CFMASK,
-    I_BAND_ELEVATION, /* This band and above are all from the XML */
+    I_BAND_ELEVATION,
+    I_BAND_L2QA,      /* The Level2 QA and the TOA red and nir are only
+                         opened for the water QA, the TOA bands only when
+                         the tests use the SR bands */
+    I_BAND_TOA_RED,
+    I_BAND_TOA_NIR,   /* This band and above are all from the XML */
     MAX_INPUT_BANDS
 } Input_Bands_e;
 
@@ -51,4 +74,16 @@ typedef enum
 #define TESTS_NO_DATA_VALUE -9999
 
 
+#define CFMASK_CLOUD_SHADOW 2
+#define CFMASK_SNOW 3
+#define CFMASK_CLOUD 4
+
+
+#define DSWE_NOT_WATER 0
+#define DSWE_WATER_HIGH_CONFIDENCE 1
+#define DSWE_WATER_MODERATE_CONFIDENCE 2
+#define DSWE_PARTIAL_SURFACE_WATER_PIXEL 3
+#define DSWE_CLOUD_CLOUD_SHADOW_SNOW 9
+
+
 #endif /* CONST_H */
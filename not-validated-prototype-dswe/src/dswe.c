@@ -6,6 +6,11 @@
 #include <getopt.h>
 #include <error.h>
 #include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#ifdef _OPENMP
+    #include <omp.h>
+#endif
 
 #include "error_handler.h"
 #include "espa_metadata.h"
@@ -22,18 +27,78 @@
 #include "input.h"
 #include "output.h"
 #include "build_slope_band.h"
-
-
-#define CFMASK_CLOUD_SHADOW 2
-#define CFMASK_SNOW 3
-#define CFMASK_CLOUD 4
-
-
-#define DSWE_NOT_WATER 0
-#define DSWE_WATER_HIGH_CONFIDENCE 1
-#define DSWE_WATER_MODERATE_CONFIDENCE 2
-#define DSWE_PARTIAL_SURFACE_WATER_PIXEL 3
-#define DSWE_CLOUD_CLOUD_SHADOW_SNOW 9
+#include "dswe_tests.h"
+#include "classify.h"
+#include "slope_cache.h"
+#include "fill_index.h"
+#include "batch.h"
+#include "arena.h"
+#include "run_report.h"
+#include "water_test.h"
+#include "clear_estimate.h"
+
+
+/* The settings which are the same for every scene */
+typedef struct
+{
+    bool use_zeven_thorne_flag;
+    bool use_toa_flag;
+    unsigned int products;       /* Output products to generate */
+    float percent_slope;
+    int max_memory;
+    int num_threads;
+    Simd_Target_e simd_target;            /* Instruction set for the tests */
+    Slope_Precision_e slope_precision;    /* Precision for the slope */
+    char *slope_cache_dir;                /* Directory for the slope cache */
+    Input_Method_e input_method;
+    int prefetch_depth;
+    bool mask_first_flag;                 /* Read the cfmask first and skip
+                                             the pixels it masks */
+    float min_percent_clear;              /* Scenes estimated to have less
+                                             of their pixels clear are not
+                                             tested, zero for none */
+    bool skip_low_clear_flag;             /* Skip those scenes instead of
+                                             writing cloud and fill */
+    bool huge_pages_flag;                 /* Back the buffers with huge
+                                             pages */
+    bool verbose_flag;
+    bool report_flag;                     /* Count the output classes for
+                                             the run report */
+    Water_Test_Function_t water_test;     /* Implementation of the water
+                                             test for the water QA */
+    Classifier_t classifier;              /* Lookup tables for the
+                                             outputs */
+} Dswe_Options_t;
+
+
+/* The processing and output buffers, they are kept between the scenes of a
+   batch and only reallocated when a scene needs more than they hold */
+typedef struct
+{
+    unsigned int products;       /* Products the buffers are allocated for */
+    long pixel_count;            /* Pixels held by each strip buffer */
+    int line_pixel_count;        /* Pixels held by each line buffer, a line
+                                    for each thread */
+    float *line_ps;              /* The percent slope for the line each
+                                    thread is classifying */
+    int32_t *slope_work;         /* Slope numerators for each thread */
+    uint8_t *line_slope_exceeded; /* Where the percent slope is at or above
+                                     the threshold for the line each thread
+                                     is classifying */
+    int16_t *band_ps;            /* Output percent slope band data */
+    int16_t *band_dswe_diag;     /* Output Raw DSWE tests band data */
+    uint8_t *band_dswe_raw;      /* Output Raw DSWE band data */
+    uint8_t *band_dswe_ccss;     /* Output Raw DSWE band data with Cloud and
+                                    Cloud Shadow filtering applied */
+    uint8_t *band_dswe_psccss;   /* Output Raw DSWE band data with Percent
+                                    Slope, Cloud, and Cloud Shadow filtering
+                                    applied */
+    uint8_t *band_water_qa;      /* Output Level2 QA band data with the
+                                    water pixels */
+    Fill_Index_t fill_index;     /* Span of each line which is not fill */
+    Arena_t arena;               /* Holds every buffer above except the fill
+                                    index */
+} Band_Memory_t;
 
 
 /*****************************************************************************
@@ -46,250 +111,1716 @@
 void
 free_band_memory
 (
-    int16_t *band_blue,
-    int16_t *band_green,
-    int16_t *band_red,
-    int16_t *band_nir,
-    int16_t *band_swir1,
-    int16_t *band_swir2,
-    int16_t *band_elevation,
-    uint8_t *band_cfmask,
-    float *band_ps,
-    int16_t *band_dswe_diag,
-    uint8_t *band_dswe_raw,
-    uint8_t *band_dswe_ccss,
-    uint8_t *band_dswe_psccss
+    Band_Memory_t *memory
 )
 {
-    free (band_blue);
-    free (band_green);
-    free (band_red);
-    free (band_nir);
-    free (band_swir1);
-    free (band_swir2);
-    free (band_elevation);
-    free (band_cfmask);
-    free (band_ps);
-    free (band_dswe_diag);
-    free (band_dswe_raw);
-    free (band_dswe_ccss);
-    free (band_dswe_psccss);
+    free_arena (&memory->arena);
+    free_fill_index (&memory->fill_index);
+
+    memset (memory, 0, sizeof (*memory));
 }
 
 
 /*****************************************************************************
   NAME:  allocate_band_memory
 
-  PURPOSE:  Allocate memory for all the input bands.
+  PURPOSE:  Allocate memory for the processing and output bands.  The
+            buffers only need to hold a strip of lines, and only the
+            selected products get one.  The raw DSWE band is always
+            allocated since it holds the test bits before they are
+            classified.  When the slope is needed, the percent slope is only
+            held a line at a time for each thread, unless the percent slope
+            band is being generated.  Each thread also gets work space for
+            the slope numerators and a line of percent slope threshold
+            results.  The water QA gets a strip of the Level2 QA with the
+            water pixels.
+
+            The buffers are all carved out of a single arena, aligned for
+            vector loads and not cleared, since every one of them is written
+            before it is read.  The buffers already held are kept when they
+            are large enough, otherwise they are replaced with ones large
+            enough for this and the previous scenes.
 
-  RETURN VALUE:  Type = bool
+  RETURN VALUE:  Type = int
       Value    Description
       -------  ---------------------------------------------------------------
-      true     Success with allocating all of the memory needed for the input
-               bands.
-      false    Failed to allocate memory for an input band.
+      ERROR    Failed to allocate memory for the bands.
+      SUCCESS  No errors encountered.
 *****************************************************************************/
 int
 allocate_band_memory
 (
-    bool include_tests_flag,
-    int16_t **band_blue,
-    int16_t **band_green,
-    int16_t **band_red,
-    int16_t **band_nir,
-    int16_t **band_swir1,
-    int16_t **band_swir2,
-    int16_t **band_elevation,
-    uint8_t **band_cfmask,
-    float **band_ps,
-    int16_t **band_dswe_diag,
-    uint8_t **band_dswe_raw,
-    uint8_t **band_dswe_ccss,
-    uint8_t **band_dswe_psccss,
-    int pixel_count
+    unsigned int products,
+    int lines,
+    long pixel_count,
+    int line_pixel_count,
+    bool huge_pages,
+    Band_Memory_t *memory
 )
 {
-    *band_blue = calloc (pixel_count, sizeof (int16_t));
-    if (*band_blue == NULL)
+    bool use_slope_flag;
+    size_t arena_size;
+
+    if ((products & ~memory->products) == 0
+        && pixel_count <= memory->pixel_count
+        && line_pixel_count <= memory->line_pixel_count
+        && lines <= memory->fill_index.lines)
     {
-        ERROR_MESSAGE ("Failed allocating memory for BLUE band", MODULE_NAME);
+        return SUCCESS;
+    }
+
+    products |= memory->products;
+    if (pixel_count < memory->pixel_count)
+        pixel_count = memory->pixel_count;
+    if (line_pixel_count < memory->line_pixel_count)
+        line_pixel_count = memory->line_pixel_count;
+    if (lines < memory->fill_index.lines)
+        lines = memory->fill_index.lines;
+    free_band_memory (memory);
 
-        /* No free because we have not allocated any memory yet */
+    use_slope_flag = (products & (PRODUCT_PSCCSS | PRODUCT_PS)) != 0;
+
+    /* Size the arena for every buffer, so handing them out can not fail */
+    arena_size = ARENA_ROUND ((size_t) pixel_count * sizeof (uint8_t));
+    if (use_slope_flag)
+    {
+        arena_size += ARENA_ROUND ((size_t) line_pixel_count * sizeof (float))
+            + ARENA_ROUND ((size_t) 4 * line_pixel_count * sizeof (int32_t))
+            + ARENA_ROUND ((size_t) line_pixel_count * sizeof (uint8_t));
+    }
+    if (products & PRODUCT_PS)
+        arena_size += ARENA_ROUND ((size_t) pixel_count * sizeof (int16_t));
+    if (products & PRODUCT_DIAG)
+        arena_size += ARENA_ROUND ((size_t) pixel_count * sizeof (int16_t));
+    if (products & PRODUCT_CCSS)
+        arena_size += ARENA_ROUND ((size_t) pixel_count * sizeof (uint8_t));
+    if (products & PRODUCT_PSCCSS)
+        arena_size += ARENA_ROUND ((size_t) pixel_count * sizeof (uint8_t));
+    if (products & PRODUCT_WATER_QA)
+        arena_size += ARENA_ROUND ((size_t) pixel_count * sizeof (uint8_t));
+
+    if (create_arena (arena_size, huge_pages, &memory->arena) != SUCCESS)
+    {
+        ERROR_MESSAGE ("Failed allocating memory for the band buffers",
+                       MODULE_NAME);
         return ERROR;
     }
 
-    *band_green = calloc (pixel_count, sizeof (int16_t));
-    if (*band_green == NULL)
+    if (use_slope_flag)
+    {
+        memory->line_ps = arena_alloc (&memory->arena,
+                                       line_pixel_count * sizeof (float));
+        memory->slope_work = arena_alloc (&memory->arena,
+                                          4 * line_pixel_count
+                                          * sizeof (int32_t));
+        memory->line_slope_exceeded =
+            arena_alloc (&memory->arena, line_pixel_count * sizeof (uint8_t));
+    }
+    if (products & PRODUCT_PS)
+    {
+        memory->band_ps = arena_alloc (&memory->arena,
+                                       pixel_count * sizeof (int16_t));
+    }
+    if (products & PRODUCT_DIAG)
+    {
+        memory->band_dswe_diag = arena_alloc (&memory->arena,
+                                              pixel_count * sizeof (int16_t));
+    }
+    memory->band_dswe_raw = arena_alloc (&memory->arena,
+                                         pixel_count * sizeof (uint8_t));
+    if (products & PRODUCT_CCSS)
+    {
+        memory->band_dswe_ccss = arena_alloc (&memory->arena,
+                                              pixel_count * sizeof (uint8_t));
+    }
+    if (products & PRODUCT_PSCCSS)
+    {
+        memory->band_dswe_psccss =
+            arena_alloc (&memory->arena, pixel_count * sizeof (uint8_t));
+    }
+    if (products & PRODUCT_WATER_QA)
+    {
+        memory->band_water_qa =
+            arena_alloc (&memory->arena, pixel_count * sizeof (uint8_t));
+    }
+
+    /* The span of each line which is not fill is found from the cfmask as
+       each strip is read */
+    if (allocate_fill_index (lines, &memory->fill_index) != SUCCESS)
     {
-        ERROR_MESSAGE ("Failed allocating memory for GREEN band", MODULE_NAME);
+        ERROR_MESSAGE ("Failed allocating the fill index", MODULE_NAME);
 
-        /* Free allocated memory */
-        free_band_memory (*band_blue, *band_green, *band_red, *band_nir,
-                          *band_swir1, *band_swir2, *band_elevation,
-                          *band_cfmask, *band_ps, *band_dswe_diag,
-                          *band_dswe_raw, *band_dswe_ccss, *band_dswe_psccss);
+        /* Cleanup memory */
+        free_band_memory (memory);
         return ERROR;
     }
 
-    *band_red = calloc (pixel_count, sizeof (int16_t));
-    if (*band_red == NULL)
+    memory->products = products;
+    memory->pixel_count = pixel_count;
+    memory->line_pixel_count = line_pixel_count;
+
+    return SUCCESS;
+}
+
+
+
+/*****************************************************************************
+  NAME:  write_fill_samples
+
+  PURPOSE:  Write the fill values for a range of samples to each generated
+            output band, for the samples outside the span of a line which is
+            not fill.
+
+  RETURN VALUE:  None
+*****************************************************************************/
+void
+write_fill_samples
+(
+    uint32_t fill_outputs,      /* I: the classifier outputs for fill */
+    int16_t fill_tests_value,   /* I: the tests value for fill */
+    int first_sample,           /* I: first sample to write */
+    int end_sample,             /* I: one past the last sample to write */
+    uint8_t *band_dswe_raw,     /* O: raw DSWE line */
+    uint8_t *band_dswe_ccss,    /* O: ccss line, or NULL */
+    uint8_t *band_dswe_psccss,  /* O: psccss line, or NULL */
+    int16_t *band_dswe_diag     /* O: tests line, or NULL */
+)
+{
+    int index;
+    int count = end_sample - first_sample;
+
+    if (count <= 0)
+        return;
+
+    memset (&band_dswe_raw[first_sample], CLASS_RAW (fill_outputs), count);
+    if (band_dswe_ccss != NULL)
+    {
+        memset (&band_dswe_ccss[first_sample], CLASS_CCSS (fill_outputs),
+                count);
+    }
+    if (band_dswe_psccss != NULL)
+    {
+        memset (&band_dswe_psccss[first_sample], CLASS_PSCCSS (fill_outputs),
+                count);
+    }
+    if (band_dswe_diag != NULL)
     {
-        ERROR_MESSAGE ("Failed allocating memory for RED band", MODULE_NAME);
+        for (index = first_sample; index < end_sample; index++)
+            band_dswe_diag[index] = fill_tests_value;
+    }
+}
 
-        /* Free allocated memory */
-        free_band_memory (*band_blue, *band_green, *band_red, *band_nir,
-                          *band_swir1, *band_swir2, *band_elevation,
-                          *band_cfmask, *band_ps, *band_dswe_diag,
-                          *band_dswe_raw, *band_dswe_ccss, *band_dswe_psccss);
-        return ERROR;
+
+/*****************************************************************************
+  NAME:  write_low_clear_samples
+
+  PURPOSE:  Write the outputs for a range of samples of a scene which is not
+            tested for having too few clear pixels.  The samples which the
+            cfmask marks as fill are fill, the others get the outputs of a
+            pixel known only from its cfmask.
+
+  RETURN VALUE:  None
+*****************************************************************************/
+static void
+write_low_clear_samples
+(
+    uint32_t fill_outputs,      /* I: the classifier outputs for fill */
+    uint32_t low_clear_outputs, /* I: the outputs for the other pixels */
+    int16_t fill_tests_value,   /* I: the tests value for fill, and for the
+                                      pixels which are not tested */
+    uint8_t cfmask_fill_value,  /* I: fill value of the cfmask */
+    const uint8_t *line_cfmask, /* I: cfmask line */
+    int first_sample,           /* I: first sample to write */
+    int end_sample,             /* I: one past the last sample to write */
+    uint8_t *band_dswe_raw,     /* O: raw DSWE line */
+    uint8_t *band_dswe_ccss,    /* O: ccss line, or NULL */
+    uint8_t *band_dswe_psccss,  /* O: psccss line, or NULL */
+    int16_t *band_dswe_diag     /* O: tests line, or NULL */
+)
+{
+    int run_start = first_sample;
+    int run_end;
+
+    /* Alternate between the runs of pixels which are not fill and of
+       fill */
+    while (run_start < end_sample)
+    {
+        for (run_end = run_start; run_end < end_sample
+             && line_cfmask[run_end] != cfmask_fill_value; run_end++)
+            ;
+        write_fill_samples (low_clear_outputs, fill_tests_value, run_start,
+                            run_end, band_dswe_raw, band_dswe_ccss,
+                            band_dswe_psccss, band_dswe_diag);
+
+        for (run_start = run_end; run_start < end_sample
+             && line_cfmask[run_start] == cfmask_fill_value; run_start++)
+            ;
+        write_fill_samples (fill_outputs, fill_tests_value, run_end,
+                            run_start, band_dswe_raw, band_dswe_ccss,
+                            band_dswe_psccss, band_dswe_diag);
     }
+}
+
 
-    *band_nir = calloc (pixel_count, sizeof (int16_t));
-    if (*band_nir == NULL)
+/*****************************************************************************
+  NAME:  determine_strip_lines
+
+  PURPOSE:  Determine how many lines can be processed at a time while keeping
+            the band buffers within the memory budget.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      1 - lines  The number of lines to process in each strip.
+*****************************************************************************/
+int
+determine_strip_lines
+(
+    int lines,               /* I: number of lines in the scene */
+    int samples,             /* I: number of samples in the scene */
+    int max_memory,          /* I: memory budget in megabytes, zero means
+                                   process the whole scene at once unless
+                                   it has more than LARGE_SCENE_PIXELS */
+    int prefetch_depth,      /* I: strips of the input bands read ahead */
+    unsigned int products    /* I: output products generated */
+)
+{
+    long long budget;
+    long long input_bytes;
+    long long line_bytes;
+    long long halo_bytes;
+    long long index_bytes;
+    long long strip_lines;
+    char msg[256];
+
+    if (max_memory == 0)
     {
-        ERROR_MESSAGE ("Failed allocating memory for NIR band", MODULE_NAME);
+        if ((long) lines * samples <= LARGE_SCENE_PIXELS)
+            return lines;
 
-        /* Free allocated memory */
-        free_band_memory (*band_blue, *band_green, *band_red, *band_nir,
-                          *band_swir1, *band_swir2, *band_elevation,
-                          *band_cfmask, *band_ps, *band_dswe_diag,
-                          *band_dswe_raw, *band_dswe_ccss, *band_dswe_psccss);
-        return ERROR;
+        snprintf (msg, sizeof (msg), "Processing the scene of %ld pixels in"
+                  " strips within %d MB", (long) lines * samples,
+                  LARGE_SCENE_MAX_MEMORY);
+        LOG_MESSAGE (msg, MODULE_NAME);
+
+        max_memory = LARGE_SCENE_MAX_MEMORY;
+    }
+
+    /* Six reflectance bands are held for each line of the strip and of
+       the strips read ahead, along with the cfmask, and the elevation when
+       the slope is needed */
+    input_bytes = 6 * sizeof (int16_t) + sizeof (uint8_t);
+    if (products & (PRODUCT_PSCCSS | PRODUCT_PS))
+        input_bytes += sizeof (int16_t);
+
+    /* The water QA reads the Level2 QA, and the TOA red and nir unless the
+       tests already use them, they are counted either way */
+    if (products & PRODUCT_WATER_QA)
+        input_bytes += sizeof (uint8_t) + 2 * sizeof (int16_t);
+    line_bytes = (long long) samples * input_bytes * (1 + prefetch_depth);
+
+    /* The raw DSWE band holds the test bits so it is always held, along
+       with the other selected output bands */
+    line_bytes += (long long) samples * sizeof (uint8_t);
+    if (products & PRODUCT_CCSS)
+        line_bytes += (long long) samples * sizeof (uint8_t);
+    if (products & PRODUCT_PSCCSS)
+        line_bytes += (long long) samples * sizeof (uint8_t);
+    if (products & PRODUCT_DIAG)
+        line_bytes += (long long) samples * sizeof (int16_t);
+    if (products & PRODUCT_PS)
+        line_bytes += (long long) samples * sizeof (int16_t);
+    if (products & PRODUCT_WATER_QA)
+        line_bytes += (long long) samples * sizeof (uint8_t);
+
+    /* The elevation halo lines above and below each strip */
+    halo_bytes = 0;
+    if (products & (PRODUCT_PSCCSS | PRODUCT_PS))
+        halo_bytes = 2LL * samples * sizeof (int16_t) * (1 + prefetch_depth);
+
+    /* The span of each line which is not fill is held for every line of
+       the scene */
+    index_bytes = (long long) lines * 2 * sizeof (int);
+
+    budget = (long long) max_memory * 1024 * 1024;
+
+    strip_lines = (budget - halo_bytes - index_bytes) / line_bytes;
+    if (strip_lines < 1)
+    {
+        snprintf (msg, sizeof (msg), "Max Memory of %d MB is too small for"
+                  " a single line, processing one line at a time",
+                  max_memory);
+        WARNING_MESSAGE (msg, MODULE_NAME);
+
+        strip_lines = 1;
+    }
+
+    if (strip_lines > lines)
+        strip_lines = lines;
+
+    return (int) strip_lines;
+}
+
+
+/*****************************************************************************
+  NAME:  determine_strip_extent
+
+  PURPOSE:  Determine the lines of the strip starting at first_line, and the
+            elevation lines needed for it.  The elevation includes the halo
+            lines above and below the strip, where they exist, so the slope
+            is the same as for the whole scene.
+
+  RETURN VALUE:  None
+*****************************************************************************/
+void
+determine_strip_extent
+(
+    int lines,                 /* I: number of lines in the scene */
+    int strip_lines,           /* I: number of lines in each strip */
+    int first_line,            /* I: first line of the strip */
+    int *line_count,           /* O: number of lines in the strip */
+    int *first_elevation_line, /* O: first elevation line needed */
+    int *elevation_line_count  /* O: number of elevation lines needed */
+)
+{
+    *line_count = strip_lines;
+    if (first_line + *line_count > lines)
+        *line_count = lines - first_line;
+
+    *first_elevation_line = first_line;
+    if (*first_elevation_line > 0)
+        (*first_elevation_line)--;
+    *elevation_line_count = first_line + *line_count + 1;
+    if (*elevation_line_count > lines)
+        *elevation_line_count = lines;
+    *elevation_line_count -= *first_elevation_line;
+}
+
+
+
+
+/*****************************************************************************
+  NAME:  close_output_files
+
+  PURPOSE:  Close the output image files which were opened.  A Level2 QA
+            with the water pixels which is still open was not completed, so
+            it is removed, it only replaces the Level2 QA band once it is
+            complete.
+
+  RETURN VALUE:  None
+*****************************************************************************/
+void
+close_output_files
+(
+    FILE *fd_dswe_raw,
+    FILE *fd_dswe_ccss,
+    FILE *fd_dswe_psccss,
+    FILE *fd_dswe_diag,
+    FILE *fd_ps,
+    FILE *fd_water_qa,
+    const char *water_qa_filename
+)
+{
+    if (fd_dswe_raw != NULL)
+        fclose (fd_dswe_raw);
+    if (fd_dswe_ccss != NULL)
+        fclose (fd_dswe_ccss);
+    if (fd_dswe_psccss != NULL)
+        fclose (fd_dswe_psccss);
+    if (fd_dswe_diag != NULL)
+        fclose (fd_dswe_diag);
+    if (fd_ps != NULL)
+        fclose (fd_ps);
+    if (fd_water_qa != NULL)
+    {
+        fclose (fd_water_qa);
+        unlink (water_qa_filename);
     }
+}
+
+
+/*****************************************************************************
+  NAME:  find_cfmask_band
 
-    *band_swir1 = calloc (pixel_count, sizeof (int16_t));
-    if (*band_swir1 == NULL)
+  PURPOSE:  Finds the metadata of the cfmask band of a scene.
+
+  RETURN VALUE:  Type = const Espa_band_meta_t *
+      Value    Description
+      -------  ---------------------------------------------------------------
+      NULL     The scene has no cfmask band.
+      *        The metadata of the cfmask band.
+*****************************************************************************/
+static const Espa_band_meta_t *
+find_cfmask_band
+(
+    const Espa_internal_meta_t *xml_metadata /* I: the metadata of the
+                                                   scene */
+)
+{
+    int index;
+
+    for (index = 0; index < xml_metadata->nbands; index++)
     {
-        ERROR_MESSAGE ("Failed allocating memory for SWIR1 band", MODULE_NAME);
+        if (!strcmp (xml_metadata->band[index].product, "cfmask")
+            && !strcmp (xml_metadata->band[index].name, "cfmask"))
+        {
+            return &xml_metadata->band[index];
+        }
+    }
+
+    return NULL;
+}
+
+
+/*****************************************************************************
+  NAME:  process_scene
 
-        /* Free allocated memory */
-        free_band_memory (*band_blue, *band_green, *band_red, *band_nir,
-                          *band_swir1, *band_swir2, *band_elevation,
-                          *band_cfmask, *band_ps, *band_dswe_diag,
-                          *band_dswe_raw, *band_dswe_ccss, *band_dswe_psccss);
+  PURPOSE:  Generates the selected DSWE products for a scene and adds them
+            to its XML file.  For the water QA, the water pixels are added
+            to the Level2 QA band and its clear and water percentages are
+            updated in the same write of the XML file.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      ERROR    The scene could not be processed, everything opened or
+               allocated for it has been released.
+      SCENE_SKIPPED  The scene has less than the minimum percent clear and
+               skipping is selected, nothing was written for it.
+      SUCCESS  No errors encountered.
+
+  NOTES:
+    1. The metadata structure is taken over by the scene, and is freed
+       before returning.
+    2. The band memory is kept for the next scene.
+    3. The time of each stage, the bytes read and written, and when
+       reporting, the pixels of each output class are added to the scene
+       report.
+    4. A scene with less than the minimum percent clear is not tested, only
+       its cfmask is read.  Its ccss and psccss are cloud, cloud shadow,
+       and snow wherever the cfmask is not fill, its other products are
+       fill, and the Level2 QA is left as it is.
+*****************************************************************************/
+int
+process_scene
+(
+    const Dswe_Options_t *options,        /* I: settings for every scene */
+    char *xml_filename,                   /* I: the XML of the scene */
+    Espa_internal_meta_t *xml_metadata,   /* I: the metadata of the scene */
+    Dswe_Tests_Parameters_t *tests_params, /* I/O: the thresholds, the scale
+                                                   factors and fill values
+                                                   of the scene are added */
+    Band_Memory_t *memory,                /* I/O: buffers for the scene */
+    Scene_Report_t *scene_report          /* I/O: the timing and counts of
+                                                  the scene are added */
+)
+{
+    /* Band data */
+    Input_Data_t *input_data = NULL;
+    const int16_t *band_blue = NULL;  /* TM SR_Band1,  OLI SR_Band2 */
+    const int16_t *band_green = NULL; /* TM SR_Band2,  OLI SR_Band3 */
+    const int16_t *band_red = NULL;   /* TM SR_Band3,  OLI SR_Band4 */
+    const int16_t *band_nir = NULL;   /* TM SR_Band4,  OLI SR_Band5 */
+    const int16_t *band_swir1 = NULL; /* TM SR_Band5,  OLI SR_Band6 */
+    const int16_t *band_swir2 = NULL; /* TM SR_Band7,  OLI SR_Band7 */
+    const int16_t *band_elevation = NULL; /* Contains the elevation band */
+    const uint8_t *band_cfmask = NULL; /* CFMASK */
+    const int16_t *band_toa_red = NULL; /* TOA red and nir for the water */
+    const int16_t *band_toa_nir = NULL; /* QA, the same as band_red and
+                                           band_nir when using TOA */
+    const uint8_t *band_l2qa = NULL;  /* Level2 QA for the water QA */
+    float *line_ps = NULL;
+    int32_t *slope_work = NULL;
+    uint8_t *line_slope_exceeded = NULL;
+    int16_t *band_ps = NULL;
+    int16_t *band_dswe_diag = NULL;
+    uint8_t *band_dswe_raw = NULL;
+    uint8_t *band_dswe_ccss = NULL;
+    uint8_t *band_dswe_psccss = NULL;
+    uint8_t *band_water_qa = NULL;
+    Fill_Index_t *fill_index = NULL;
+    const Espa_band_meta_t *cfmask_meta; /* The cfmask band in the XML */
+
+    /* Temp variables */
+    const Classifier_t *classifier = &options->classifier;
+    Metadata_Session_t metadata_session; /* Output bands for the XML */
+    Slope_Kernel_t slope_kernel;          /* Implementation of the slope */
+    Dswe_Tests_Function_t dswe_tests;     /* Variant of the tests and of */
+    Classify_Pixels_Function_t classify;  /* the classification for the
+                                             scene */
+    Thresholds_Profile_e thresholds_profile;
+    bool equal_scale_flag;
+    Slope_Cache_t slope_cache;            /* Slope saved from previous runs */
+    uint32_t fill_outputs;                /* Output values for fill */
+    bool include_raw_flag;                /* The selected products */
+    bool include_ccss_flag;
+    bool include_psccss_flag;
+    bool include_tests_flag;
+    bool include_ps_flag;
+    bool include_water_qa_flag;
+    bool use_slope_flag;                  /* The slope is needed */
+    bool filter_cfmask_flag;              /* The cfmask filters outputs */
+    bool lazy_slope_flag;                 /* The slope is only determined
+                                             where it changes the psccss */
+    bool prefetch_elevation_flag;         /* The elevation is read ahead */
+    bool low_clear_flag = false;          /* Too few clear pixels for the
+                                             scene to be tested */
+    uint32_t low_clear_outputs;           /* Output values for the pixels of
+                                             a scene which is not tested */
+    int16_t fill_tests_value;             /* Tests value for fill */
+    uint8_t cfmask_fill_value;
+    Stage_Clock_t stage_clock;            /* Start of the stage being timed */
+    Stage_Clock_t line_clock;             /* Start of the stage of a line */
+    Stage_Time_t line_time;               /* Time of the stage of a line */
+    double slope_wall_seconds = 0.0;      /* Slope and classify times summed */
+    double slope_cpu_seconds = 0.0;       /* over the threads */
+    double classify_wall_seconds = 0.0;
+    double classify_cpu_seconds = 0.0;
+    Water_Counts_t line_counts;           /* Water QA counts of a line */
+    long image_pixels = 0;                /* Water QA counts summed over */
+    long clear_pixels = 0;                /* the threads */
+    long water_pixels = 0;
+    float percent_clear;
+    float percent_water;
+    int16_t toa_red_fill_value;
+    int16_t toa_nir_fill_value;
+    uint8_t l2qa_fill_value;
+
+    /* Other variables */
+    int status;
+    long index;
+    long pixel_count;
+    int lines;
+    int samples;
+    int strip_lines;
+    int line_count;
+    int first_line;
+    int first_elevation_line;
+    int elevation_line_count;
+    int prefetch_depth = options->prefetch_depth;
+    int prefetch_line;
+    int prefetch_count;
+    int prefetch_elevation_line;
+    int prefetch_elevation_count;
+    int line;
+    long line_start;
+    long line_end;
+    float *thread_ps;
+    int32_t *thread_slope_work;
+    uint8_t *thread_exceeded;
+    int candidate_count;
+    int run_start;
+    int run_end;
+    const uint8_t *line_cfmask;
+    int valid_start;
+    int valid_end;
+    float percent_slope = options->percent_slope;
+    FILE *fd_dswe_diag = NULL;   /* Output image files written a strip at */
+    FILE *fd_dswe_raw = NULL;    /* a time */
+    FILE *fd_dswe_ccss = NULL;
+    FILE *fd_dswe_psccss = NULL;
+    FILE *fd_ps = NULL;
+    FILE *fd_water_qa = NULL;    /* The Level2 QA with the water pixels,
+                                    written to a temp file which replaces
+                                    the band once it is complete */
+    char water_qa_filename[PATH_MAX];
+    char msg[256];
+
+
+    /* Only the work needed by the selected products is done, the slope is
+       only needed to filter by it or output it, and the cfmask classes only
+       to filter by them.  The cfmask is always read for the fill. */
+    include_raw_flag = (options->products & PRODUCT_RAW) != 0;
+    include_ccss_flag = (options->products & PRODUCT_CCSS) != 0;
+    include_psccss_flag = (options->products & PRODUCT_PSCCSS) != 0;
+    include_tests_flag = (options->products & PRODUCT_DIAG) != 0;
+    include_ps_flag = (options->products & PRODUCT_PS) != 0;
+    include_water_qa_flag = (options->products & PRODUCT_WATER_QA) != 0;
+    use_slope_flag = include_psccss_flag || include_ps_flag;
+    filter_cfmask_flag = include_ccss_flag || include_psccss_flag;
+
+    /* -------------------------------------------------------------------- */
+    /* A scene with too few clear pixels for water to be found in is
+       skipped, or given outputs from its cfmask alone */
+    start_stage_clock (false, &stage_clock);
+    if (options->min_percent_clear > 0.0)
+    {
+        cfmask_meta = find_cfmask_band (xml_metadata);
+        if (cfmask_meta == NULL
+            || estimate_percent_clear (cfmask_meta,
+                                       &scene_report->estimated_clear,
+                                       &scene_report->clear_sampled_flag)
+               != SUCCESS)
+        {
+            ERROR_MESSAGE ("Failed estimating the percent clear",
+                           MODULE_NAME);
+
+            /* Cleanup memory */
+            free_metadata (xml_metadata);
+            return ERROR;
+        }
+        scene_report->clear_estimated_flag = true;
+
+        if (options->verbose_flag)
+        {
+            printf ("Estimated Percent Clear = %f (%s)\n",
+                    scene_report->estimated_clear,
+                    scene_report->clear_sampled_flag ? "sampled"
+                                                     : "metadata");
+        }
+
+        if (scene_report->estimated_clear < options->min_percent_clear)
+        {
+            if (options->skip_low_clear_flag)
+            {
+                snprintf (msg, sizeof (msg), "Skipping the scene, an"
+                          " estimated %.2f percent is clear",
+                          scene_report->estimated_clear);
+                LOG_MESSAGE (msg, MODULE_NAME);
+
+                /* Cleanup memory */
+                free_metadata (xml_metadata);
+                stop_stage_clock (&stage_clock,
+                                  &scene_report->stages[STAGE_OPEN]);
+                return SCENE_SKIPPED;
+            }
+
+            snprintf (msg, sizeof (msg), "Writing cloud and fill outputs,"
+                      " an estimated %.2f percent is clear",
+                      scene_report->estimated_clear);
+            LOG_MESSAGE (msg, MODULE_NAME);
+
+            /* Only the cfmask is read, for the fill */
+            low_clear_flag = true;
+            scene_report->low_clear_flag = true;
+            use_slope_flag = false;
+            include_water_qa_flag = false;
+        }
+    }
+
+    /* -------------------------------------------------------------------- */
+    /* Open the input files, a scene which is not tested has its spectral
+       bands opened the way mask-first does, so they are never read */
+    input_data = open_input (xml_metadata, options->use_toa_flag,
+                             include_water_qa_flag, options->input_method,
+                             prefetch_depth,
+                             options->mask_first_flag || low_clear_flag);
+    if (input_data == NULL)
+    {
+        ERROR_MESSAGE ("Failed opening input files", MODULE_NAME);
+
+        /* Cleanup memory */
+        free_metadata (xml_metadata);
         return ERROR;
     }
 
-    *band_swir2 = calloc (pixel_count, sizeof (int16_t));
-    if (*band_swir2 == NULL)
+    /* -------------------------------------------------------------------- */
+    /* Create the output image files, they are written a strip at a time */
+    if (include_raw_flag)
     {
-        ERROR_MESSAGE ("Failed allocating memory for brightness temp band",
-                       MODULE_NAME);
+        fd_dswe_raw = open_band_product (xml_metadata, options->use_toa_flag,
+                                         RAW_BAND_NAME);
+    }
+    if (include_ccss_flag)
+    {
+        fd_dswe_ccss = open_band_product (xml_metadata,
+                                          options->use_toa_flag,
+                                          SC_BAND_NAME);
+    }
+    if (include_psccss_flag)
+    {
+        fd_dswe_psccss = open_band_product (xml_metadata,
+                                            options->use_toa_flag,
+                                            PS_SC_BAND_NAME);
+    }
+    if (include_tests_flag)
+    {
+        fd_dswe_diag = open_band_product (xml_metadata,
+                                          options->use_toa_flag,
+                                          RAW_DIAG_BAND_NAME);
+    }
+    if (include_ps_flag)
+    {
+        fd_ps = open_band_product (xml_metadata, options->use_toa_flag,
+                                   PS_BAND_NAME);
+    }
+    if (include_water_qa_flag)
+    {
+        snprintf (water_qa_filename, sizeof (water_qa_filename), "temp_%s",
+                  input_data->band_name[I_BAND_L2QA]);
+        fd_water_qa = fopen (water_qa_filename, "w");
+    }
+    if ((include_raw_flag && fd_dswe_raw == NULL)
+        || (include_ccss_flag && fd_dswe_ccss == NULL)
+        || (include_psccss_flag && fd_dswe_psccss == NULL)
+        || (include_tests_flag && fd_dswe_diag == NULL)
+        || (include_ps_flag && fd_ps == NULL)
+        || (include_water_qa_flag && fd_water_qa == NULL))
+    {
+        ERROR_MESSAGE ("Failed creating output files", MODULE_NAME);
+
+        /* Cleanup memory */
+        close_output_files (fd_dswe_raw, fd_dswe_ccss, fd_dswe_psccss,
+                            fd_dswe_diag, fd_ps, fd_water_qa,
+                            water_qa_filename);
+        free_metadata (xml_metadata);
+        close_input (input_data);
+        free (input_data);
 
-        /* Free allocated memory */
-        free_band_memory (*band_blue, *band_green, *band_red, *band_nir,
-                          *band_swir1, *band_swir2, *band_elevation,
-                          *band_cfmask, *band_ps, *band_dswe_diag,
-                          *band_dswe_raw, *band_dswe_ccss, *band_dswe_psccss);
         return ERROR;
     }
 
-    *band_elevation = calloc (pixel_count, sizeof (int16_t));
-    if (*band_elevation == NULL)
+    /* The metadata session takes over the metadata structure, the output
+       bands are added to it once they are written */
+    if (open_metadata_session (xml_filename, xml_metadata,
+                               options->use_toa_flag,
+                               (include_raw_flag ? 1 : 0)
+                                 + (include_ccss_flag ? 1 : 0)
+                                 + (include_psccss_flag ? 1 : 0)
+                                 + (include_tests_flag ? 1 : 0)
+                                 + (include_ps_flag ? 1 : 0),
+                               &metadata_session)
+        != SUCCESS)
     {
-        ERROR_MESSAGE ("Failed allocating memory for elevation band",
-                       MODULE_NAME);
+        ERROR_MESSAGE ("Failed starting the metadata session", MODULE_NAME);
+
+        /* Cleanup memory */
+        close_output_files (fd_dswe_raw, fd_dswe_ccss, fd_dswe_psccss,
+                            fd_dswe_diag, fd_ps, fd_water_qa,
+                            water_qa_filename);
+        close_input (input_data);
+        free (input_data);
 
-        /* Free allocated memory */
-        free_band_memory (*band_blue, *band_green, *band_red, *band_nir,
-                          *band_swir1, *band_swir2, *band_elevation,
-                          *band_cfmask, *band_ps, *band_dswe_diag,
-                          *band_dswe_raw, *band_dswe_ccss, *band_dswe_psccss);
         return ERROR;
     }
+    stop_stage_clock (&stage_clock, &scene_report->stages[STAGE_OPEN]);
 
-    *band_cfmask = calloc (pixel_count, sizeof (uint8_t));
-    if (*band_cfmask == NULL)
+    /* -------------------------------------------------------------------- */
+    /* Figure out the number of lines to process at a time */
+    lines = input_data->lines;
+    samples = input_data->samples;
+    strip_lines = determine_strip_lines (lines, samples, options->max_memory,
+                                         prefetch_depth, options->products);
+    pixel_count = (long) strip_lines * samples;
+
+    scene_report->lines = lines;
+    scene_report->samples = samples;
+    scene_report->strip_lines = strip_lines;
+
+    if (options->verbose_flag)
     {
-        ERROR_MESSAGE ("Failed allocating memory for CFMASK band",
-                       MODULE_NAME);
+        printf ("      Strip Lines: %d\n", strip_lines);
+    }
+
+    /* Get memory buffers for temp processing and output, the input bands
+       are provided by the input module */
+    if (allocate_band_memory (options->products, lines, pixel_count,
+                              options->num_threads * samples,
+                              options->huge_pages_flag, memory)
+        != SUCCESS)
+    {
+        ERROR_MESSAGE ("Failed allocating band memory", MODULE_NAME);
+
+        /* Cleanup memory */
+        close_output_files (fd_dswe_raw, fd_dswe_ccss, fd_dswe_psccss,
+                            fd_dswe_diag, fd_ps, fd_water_qa,
+                            water_qa_filename);
+        close_metadata_session (&metadata_session);
+        close_input (input_data);
+        free (input_data);
 
-        /* Free allocated memory */
-        free_band_memory (*band_blue, *band_green, *band_red, *band_nir,
-                          *band_swir1, *band_swir2, *band_elevation,
-                          *band_cfmask, *band_ps, *band_dswe_diag,
-                          *band_dswe_raw, *band_dswe_ccss, *band_dswe_psccss);
         return ERROR;
     }
+    line_ps = memory->line_ps;
+    slope_work = memory->slope_work;
+    line_slope_exceeded = memory->line_slope_exceeded;
+    band_ps = memory->band_ps;
+    band_dswe_diag = memory->band_dswe_diag;
+    band_dswe_raw = memory->band_dswe_raw;
+    band_dswe_ccss = memory->band_dswe_ccss;
+    band_dswe_psccss = memory->band_dswe_psccss;
+    band_water_qa = memory->band_water_qa;
+    fill_index = &memory->fill_index;
+
+    /* -------------------------------------------------------------------- */
+    /* Place the scale factors and fill values where the tests can get to
+       them, the thresholds are already there */
+    tests_params->green_scale_factor =
+        input_data->scale_factor[I_BAND_GREEN];
+    tests_params->swir1_scale_factor =
+        input_data->scale_factor[I_BAND_SWIR1];
+
+    tests_params->blue_fill_value = input_data->fill_value[I_BAND_BLUE];
+    tests_params->green_fill_value = input_data->fill_value[I_BAND_GREEN];
+    tests_params->red_fill_value = input_data->fill_value[I_BAND_RED];
+    tests_params->nir_fill_value = input_data->fill_value[I_BAND_NIR];
+    tests_params->swir1_fill_value = input_data->fill_value[I_BAND_SWIR1];
+    tests_params->swir2_fill_value = input_data->fill_value[I_BAND_SWIR2];
+    tests_params->cfmask_fill_value = input_data->fill_value[I_BAND_CFMASK];
+
+    /* Pick the variants of the tests and the classification specialized for
+       the thresholds, scale factors, and outputs of the scene */
+    dswe_tests = select_dswe_tests_variant (options->simd_target,
+                                            tests_params,
+                                            &thresholds_profile,
+                                            &equal_scale_flag);
+    classify = select_classify_pixels (include_ccss_flag,
+                                       include_psccss_flag,
+                                       include_tests_flag);
+    if (options->verbose_flag)
+    {
+        printf ("    Tests Variant: %s thresholds%s\n",
+                thresholds_profile_name (thresholds_profile),
+                equal_scale_flag ? ", equal scale factors" : "");
+    }
+
+    /* The water QA uses the TOA red and nir, which are the red and nir of
+       the tests when using TOA */
+    if (options->use_toa_flag)
+    {
+        toa_red_fill_value = input_data->fill_value[I_BAND_RED];
+        toa_nir_fill_value = input_data->fill_value[I_BAND_NIR];
+    }
+    else
+    {
+        toa_red_fill_value = input_data->fill_value[I_BAND_TOA_RED];
+        toa_nir_fill_value = input_data->fill_value[I_BAND_TOA_NIR];
+    }
+    l2qa_fill_value = input_data->fill_value[I_BAND_L2QA];
+
+    /* Fill is the same in every output no matter the cfmask or slope, so
+       the lines outside the spans are written with these */
+    fill_outputs = classifier->outputs[DSWE_TEST_FILL];
+
+    /* The pixels of a scene which is not tested are not fill in the raw
+       DSWE but have nothing but the cfmask to go on, so the filtered
+       outputs are those of a cloud, cloud shadow, or snow pixel without
+       any test passed, and the raw DSWE is fill */
+    low_clear_outputs = (classifier->outputs[CLASS_CFMASK_BIT] & 0xffff00)
+                        | CLASS_RAW (fill_outputs);
+    fill_tests_value = classifier->tests_value[DSWE_TEST_FILL];
+    cfmask_fill_value = (uint8_t) tests_params->cfmask_fill_value;
+
+    /* Set up the slope for the algorithm, precision, and instruction set,
+       the SIMD target has already been resolved for this processor */
+    init_slope_kernel (options->use_zeven_thorne_flag,
+                       options->slope_precision, options->simd_target,
+                       input_data->x_pixel_size, input_data->y_pixel_size,
+                       percent_slope, &slope_kernel);
+
+    /* Use the slope from a previous run on the same DEM, the threshold
+       results are enough unless the percent slope is being output */
+    slope_cache.state = SLOPE_CACHE_BYPASS;
+    if (options->slope_cache_dir != NULL && use_slope_flag)
+    {
+        if (open_slope_cache (options->slope_cache_dir, input_data,
+                              options->use_zeven_thorne_flag,
+                              options->slope_precision,
+                              include_ps_flag ? SLOPE_CACHE_PERCENT_SLOPE
+                                              : SLOPE_CACHE_EXCEEDED,
+                              percent_slope, &slope_cache)
+            != SUCCESS)
+        {
+            ERROR_MESSAGE ("Failed opening the slope cache", MODULE_NAME);
+
+            /* Cleanup memory */
+            close_output_files (fd_dswe_raw, fd_dswe_ccss, fd_dswe_psccss,
+                                fd_dswe_diag, fd_ps, fd_water_qa,
+                                water_qa_filename);
+            close_metadata_session (&metadata_session);
+            close_input (input_data);
+            free (input_data);
+
+            return ERROR;
+        }
+
+        if (slope_cache.state == SLOPE_CACHE_HIT)
+        {
+            LOG_MESSAGE ("Using the percent slope from the slope cache",
+                         MODULE_NAME);
+        }
+    }
+
+    /* Unless the percent slope itself is output or cached, the slope is
+       only determined for the pixels where it changes the psccss, after
+       the tests.  A mapped DEM is then not read ahead, so the lines
+       without any of those pixels are never read. */
+    lazy_slope_flag = use_slope_flag && include_psccss_flag
+                      && !include_ps_flag
+                      && slope_cache.state == SLOPE_CACHE_BYPASS;
+    prefetch_elevation_flag = use_slope_flag
+                              && slope_cache.state != SLOPE_CACHE_HIT
+                              && !(lazy_slope_flag
+                                   && input_data->band_map[I_BAND_ELEVATION]
+                                      != NULL);
+
+    if (options->verbose_flag)
+    {
+        printf ("Pixel Count = %ld\n", (long) lines * samples);
+    }
+
+
+    /* -------------------------------------------------------------------- */
+    /* Start reading the first strip, all the bands are read at the same
+       time */
+    prefetch_line = 0;
+    if (prefetch_depth > 0)
+    {
+        start_stage_clock (false, &stage_clock);
+        determine_strip_extent (lines, strip_lines, prefetch_line,
+                                &prefetch_count, &prefetch_elevation_line,
+                                &prefetch_elevation_count);
+        prefetch_bands (input_data, prefetch_elevation_flag,
+                        prefetch_line, prefetch_count,
+                        prefetch_elevation_line, prefetch_elevation_count);
+        prefetch_line += strip_lines;
+        stop_stage_clock (&stage_clock, &scene_report->stages[STAGE_READ]);
+    }
+
+    /* -------------------------------------------------------------------- */
+    /* Process the scene a strip of lines at a time */
+    for (first_line = 0; first_line < lines; first_line += strip_lines)
+    {
+        determine_strip_extent (lines, strip_lines, first_line, &line_count,
+                                &first_elevation_line,
+                                &elevation_line_count);
+
+        /* ---------------------------------------------------------------- */
+        /* Get the strip from the input files, it was read ahead when
+           prefetching */
+        start_stage_clock (false, &stage_clock);
+        if (read_bands_into_memory (input_data,
+                                    low_clear_flag ? NULL : &band_blue,
+                                    &band_green,
+                                    &band_red, &band_nir, &band_swir1,
+                                    &band_swir2,
+                                    (!use_slope_flag
+                                     || slope_cache.state == SLOPE_CACHE_HIT)
+                                        ? NULL : &band_elevation,
+                                    &band_cfmask,
+                                    &band_toa_red, &band_toa_nir,
+                                    include_water_qa_flag ? &band_l2qa
+                                                          : NULL,
+                                    first_line, line_count,
+                                    first_elevation_line,
+                                    elevation_line_count)
+            != SUCCESS)
+        {
+            ERROR_MESSAGE ("Failed reading bands into memory", MODULE_NAME);
+
+            /* Cleanup memory */
+            if (slope_cache.state != SLOPE_CACHE_BYPASS)
+                close_slope_cache (&slope_cache, false);
+            close_output_files (fd_dswe_raw, fd_dswe_ccss, fd_dswe_psccss,
+                                fd_dswe_diag, fd_ps, fd_water_qa,
+                                water_qa_filename);
+            close_metadata_session (&metadata_session);
+            close_input (input_data);
+            free (input_data);
+
+            return ERROR;
+        }
+
+        /* Read the next strips while this one is processed */
+        while (prefetch_line < lines
+               && prefetch_line <= first_line + prefetch_depth * strip_lines)
+        {
+            determine_strip_extent (lines, strip_lines, prefetch_line,
+                                    &prefetch_count,
+                                    &prefetch_elevation_line,
+                                    &prefetch_elevation_count);
+            prefetch_bands (input_data, prefetch_elevation_flag,
+                            prefetch_line, prefetch_count,
+                            prefetch_elevation_line,
+                            prefetch_elevation_count);
+            prefetch_line += strip_lines;
+        }
+        stop_stage_clock (&stage_clock, &scene_report->stages[STAGE_READ]);
+
+        index_fill_lines (fill_index, band_cfmask,
+                          tests_params->cfmask_fill_value, first_line,
+                          line_count, samples);
+
+        /* ---------------------------------------------------------------- */
+        /* Process through each line of the strip and populate the dswe band
+           memory, every line is independent so the lines are divided among
+           the threads.  The percent slope is generated for each line as it
+           is classified from the elevation lines above and below it.  Each
+           thread times its own lines, the times are summed. */
+#ifdef _OPENMP
+        #pragma omp parallel for schedule(dynamic) \
+            private (thread_ps, thread_slope_work, thread_exceeded, \
+                     candidate_count, run_start, run_end, line_cfmask, \
+                     line_start, line_end, valid_start, valid_end, index, \
+                     line_clock, line_time, line_counts) \
+            reduction (+:slope_wall_seconds, slope_cpu_seconds, \
+                       classify_wall_seconds, classify_cpu_seconds, \
+                       image_pixels, clear_pixels, water_pixels)
+#endif
+        for (line = 0; line < line_count; line++)
+        {
+            line_start = (long) line * samples;
+            line_end = line_start + samples;
+
+            /* Only the span of the line which is not fill is processed */
+            valid_start = fill_index->first_valid[first_line + line];
+            valid_end = fill_index->end_valid[first_line + line];
+
+            if (use_slope_flag)
+            {
+#ifdef _OPENMP
+                thread_ps = &line_ps[omp_get_thread_num () * samples];
+                thread_slope_work =
+                    &slope_work[omp_get_thread_num () * 4 * samples];
+                thread_exceeded =
+                    &line_slope_exceeded[omp_get_thread_num () * samples];
+#else
+                thread_ps = line_ps;
+                thread_slope_work = slope_work;
+                thread_exceeded = line_slope_exceeded;
+#endif
+            }
+            else
+            {
+                thread_ps = NULL;
+                thread_slope_work = NULL;
+                thread_exceeded = NULL;
+            }
+
+            if (use_slope_flag && !lazy_slope_flag)
+            {
+                start_stage_clock (true, &line_clock);
+
+                /* Only compute the percent slope itself when it is being
+                   output, otherwise just determine where it is at or above
+                   the threshold */
+                if (slope_cache.state == SLOPE_CACHE_HIT)
+                {
+                    read_slope_cache_line (&slope_cache, first_line + line,
+                                           thread_ps, thread_exceeded);
+                }
+                else if (include_ps_flag)
+                {
+                    build_slope_line (&slope_kernel, band_elevation,
+                                      first_elevation_line,
+                                      first_line + line, lines, samples,
+                                      thread_slope_work, thread_ps);
+                }
+                else if (slope_cache.state == SLOPE_CACHE_POPULATE)
+                {
+                    /* The cache entry is shared with scenes of other
+                       footprints, so it gets the whole line */
+                    build_slope_exceeded_line (&slope_kernel, band_elevation,
+                                               first_elevation_line,
+                                               first_line + line, lines,
+                                               samples, 0, samples,
+                                               thread_slope_work,
+                                               thread_exceeded);
+                }
+                else
+                {
+                    build_slope_exceeded_line (&slope_kernel, band_elevation,
+                                               first_elevation_line,
+                                               first_line + line, lines,
+                                               samples, valid_start,
+                                               valid_end, thread_slope_work,
+                                               thread_exceeded);
+                }
+
+                if (include_ps_flag)
+                {
+                    for (index = 0; index < samples; index++)
+                    {
+                        if (thread_ps[index] >= percent_slope)
+                            thread_exceeded[index] = 0xff;
+                        else
+                            thread_exceeded[index] = 0;
+                    }
+                }
+
+                if (slope_cache.state == SLOPE_CACHE_POPULATE)
+                {
+                    write_slope_cache_line (&slope_cache, first_line + line,
+                                            thread_ps, thread_exceeded);
+                }
+
+                memset (&line_time, 0, sizeof (line_time));
+                stop_stage_clock (&line_clock, &line_time);
+                slope_wall_seconds += line_time.wall_seconds;
+                slope_cpu_seconds += line_time.cpu_seconds;
+            }
+
+            start_stage_clock (true, &line_clock);
+
+            line_cfmask = &band_cfmask[line_start];
+
+            /* The samples around the span are fill in every output */
+            write_fill_samples (fill_outputs,
+                                classifier->tests_value[DSWE_TEST_FILL],
+                                0, valid_start, &band_dswe_raw[line_start],
+                                include_ccss_flag
+                                    ? &band_dswe_ccss[line_start] : NULL,
+                                include_psccss_flag
+                                    ? &band_dswe_psccss[line_start] : NULL,
+                                include_tests_flag
+                                    ? &band_dswe_diag[line_start] : NULL);
+            write_fill_samples (fill_outputs,
+                                classifier->tests_value[DSWE_TEST_FILL],
+                                valid_end, samples,
+                                &band_dswe_raw[line_start],
+                                include_ccss_flag
+                                    ? &band_dswe_ccss[line_start] : NULL,
+                                include_psccss_flag
+                                    ? &band_dswe_psccss[line_start] : NULL,
+                                include_tests_flag
+                                    ? &band_dswe_diag[line_start] : NULL);
+
+            /* A scene which is not tested has the outputs of its cfmask
+               alone */
+            if (low_clear_flag)
+            {
+                write_low_clear_samples (fill_outputs, low_clear_outputs,
+                                         fill_tests_value, cfmask_fill_value,
+                                         line_cfmask, valid_start, valid_end,
+                                         &band_dswe_raw[line_start],
+                                         include_ccss_flag
+                                             ? &band_dswe_ccss[line_start]
+                                             : NULL,
+                                         include_psccss_flag
+                                             ? &band_dswe_psccss[line_start]
+                                             : NULL,
+                                         include_tests_flag
+                                             ? &band_dswe_diag[line_start]
+                                             : NULL);
+
+                if (include_ps_flag)
+                {
+                    for (index = line_start; index < line_end; index++)
+                        band_ps[index] = TESTS_NO_DATA_VALUE;
+                }
+
+                memset (&line_time, 0, sizeof (line_time));
+                stop_stage_clock (&line_clock, &line_time);
+                classify_wall_seconds += line_time.wall_seconds;
+                classify_cpu_seconds += line_time.cpu_seconds;
+                continue;
+            }
+
+            /* Perform the tests for the span, the test bits are placed in
+               the raw DSWE band memory and replaced below */
+            index = line_start + valid_start;
+            if (options->mask_first_flag)
+            {
+                /* Only the runs of pixels which are not cloud, cloud
+                   shadow, or snow are tested, the others are given no test
+                   bits since the filtered outputs only use their cfmask */
+                run_start = valid_start;
+                while (run_start < valid_end)
+                {
+                    run_end = run_start;
+                    while (run_end < valid_end
+                           && classifier->cfmask_class[line_cfmask[run_end]]
+                              == 0)
+                    {
+                        run_end++;
+                    }
+
+                    if (run_end > run_start)
+                    {
+                        index = line_start + run_start;
+                        dswe_tests (tests_params,
+                                    &band_blue[index], &band_green[index],
+                                    &band_red[index], &band_nir[index],
+                                    &band_swir1[index], &band_swir2[index],
+                                    &line_cfmask[run_start],
+                                    run_end - run_start,
+                                    &band_dswe_raw[index]);
+                    }
+
+                    for (run_start = run_end; run_start < valid_end
+                         && classifier->cfmask_class[line_cfmask[run_start]]
+                            != 0; run_start++)
+                    {
+                        band_dswe_raw[line_start + run_start] = 0;
+                    }
+                }
+                index = line_start + valid_start;
+            }
+            else
+            {
+                dswe_tests (tests_params,
+                            &band_blue[index], &band_green[index],
+                            &band_red[index], &band_nir[index],
+                            &band_swir1[index], &band_swir2[index],
+                            &line_cfmask[valid_start],
+                            valid_end - valid_start,
+                            &band_dswe_raw[index]);
+            }
+
+            /* Determine the slope for the pixels which need it, the
+               lines without any are skipped */
+            if (lazy_slope_flag)
+            {
+                memset (&line_time, 0, sizeof (line_time));
+                stop_stage_clock (&line_clock, &line_time);
+                classify_wall_seconds += line_time.wall_seconds;
+                classify_cpu_seconds += line_time.cpu_seconds;
+                start_stage_clock (true, &line_clock);
+
+                candidate_count =
+                    mark_slope_candidates (classifier, &band_cfmask[index],
+                                           &band_dswe_raw[index],
+                                           valid_end - valid_start,
+                                           &thread_exceeded[valid_start]);
+                if (candidate_count > 0)
+                {
+                    build_slope_exceeded_candidates (&slope_kernel,
+                                                     band_elevation,
+                                                     first_elevation_line,
+                                                     first_line + line,
+                                                     lines, samples,
+                                                     valid_start, valid_end,
+                                                     thread_slope_work,
+                                                     thread_exceeded);
+                }
+
+                memset (&line_time, 0, sizeof (line_time));
+                stop_stage_clock (&line_clock, &line_time);
+                slope_wall_seconds += line_time.wall_seconds;
+                slope_cpu_seconds += line_time.cpu_seconds;
+                start_stage_clock (true, &line_clock);
+            }
+
+            /* Replace the test bits with the recoded outputs */
+            classify (classifier,
+                      filter_cfmask_flag ? &band_cfmask[index] : NULL,
+                      use_slope_flag ? &thread_exceeded[valid_start] : NULL,
+                      valid_end - valid_start, &band_dswe_raw[index],
+                      include_ccss_flag ? &band_dswe_ccss[index] : NULL,
+                      include_psccss_flag ? &band_dswe_psccss[index] : NULL,
+                      include_tests_flag ? &band_dswe_diag[index] : NULL);
+
+            /* Convert to a scaled 16bit integer value */
+            if (include_ps_flag)
+            {
+                for (index = line_start; index < line_end; index++)
+                {
+                    band_ps[index] = (int16_t)
+                        ((thread_ps[index - line_start] * 100.0) + 0.5);
+                }
+            }
+
+            /* The water test handles the fill itself, so it is given the
+               whole line */
+            if (include_water_qa_flag)
+            {
+                memset (&line_counts, 0, sizeof (line_counts));
+                options->water_test (&band_toa_red[line_start],
+                                     &band_toa_nir[line_start],
+                                     &band_l2qa[line_start],
+                                     toa_red_fill_value, toa_nir_fill_value,
+                                     l2qa_fill_value, samples,
+                                     &band_water_qa[line_start],
+                                     &line_counts);
+                image_pixels += line_counts.image_pixels;
+                clear_pixels += line_counts.clear_pixels;
+                water_pixels += line_counts.water_pixels;
+            }
+
+            memset (&line_time, 0, sizeof (line_time));
+            stop_stage_clock (&line_clock, &line_time);
+            classify_wall_seconds += line_time.wall_seconds;
+            classify_cpu_seconds += line_time.cpu_seconds;
+        }
+
+        /* Count the pixels of each class for the run report */
+        if (options->report_flag)
+        {
+            if (include_raw_flag)
+            {
+                count_class_values (band_dswe_raw,
+                                    (long) line_count * samples,
+                                    scene_report->class_counts[COUNT_RAW]);
+            }
+            if (include_ccss_flag)
+            {
+                count_class_values (band_dswe_ccss,
+                                    (long) line_count * samples,
+                                    scene_report->class_counts[COUNT_CCSS]);
+            }
+            if (include_psccss_flag)
+            {
+                count_class_values (band_dswe_psccss,
+                                    (long) line_count * samples,
+                                    scene_report->class_counts[COUNT_PSCCSS]);
+            }
+        }
+
+        /* ---------------------------------------------------------------- */
+        /* Append the strip to the output image files */
+        status = SUCCESS;
+        if (include_raw_flag)
+        {
+            start_stage_clock (false, &stage_clock);
+            status = write_band_product_lines (fd_dswe_raw, line_count,
+                                               samples, sizeof (uint8_t),
+                                               band_dswe_raw);
+            stop_stage_clock (&stage_clock,
+                              &scene_report->stages[STAGE_WRITE_RAW]);
+            scene_report->bytes_written +=
+                (long long) line_count * samples * sizeof (uint8_t);
+        }
+        if (status == SUCCESS && include_ccss_flag)
+        {
+            start_stage_clock (false, &stage_clock);
+            status = write_band_product_lines (fd_dswe_ccss, line_count,
+                                               samples, sizeof (uint8_t),
+                                               band_dswe_ccss);
+            stop_stage_clock (&stage_clock,
+                              &scene_report->stages[STAGE_WRITE_CCSS]);
+            scene_report->bytes_written +=
+                (long long) line_count * samples * sizeof (uint8_t);
+        }
+        if (status == SUCCESS && include_psccss_flag)
+        {
+            start_stage_clock (false, &stage_clock);
+            status = write_band_product_lines (fd_dswe_psccss, line_count,
+                                               samples, sizeof (uint8_t),
+                                               band_dswe_psccss);
+            stop_stage_clock (&stage_clock,
+                              &scene_report->stages[STAGE_WRITE_PSCCSS]);
+            scene_report->bytes_written +=
+                (long long) line_count * samples * sizeof (uint8_t);
+        }
+        if (status == SUCCESS && include_tests_flag)
+        {
+            start_stage_clock (false, &stage_clock);
+            status = write_band_product_lines (fd_dswe_diag, line_count,
+                                               samples, sizeof (int16_t),
+                                               band_dswe_diag);
+            stop_stage_clock (&stage_clock,
+                              &scene_report->stages[STAGE_WRITE_DIAG]);
+            scene_report->bytes_written +=
+                (long long) line_count * samples * sizeof (int16_t);
+        }
+        if (status == SUCCESS && include_ps_flag)
+        {
+            start_stage_clock (false, &stage_clock);
+            status = write_band_product_lines (fd_ps, line_count, samples,
+                                               sizeof (int16_t), band_ps);
+            stop_stage_clock (&stage_clock,
+                              &scene_report->stages[STAGE_WRITE_PS]);
+            scene_report->bytes_written +=
+                (long long) line_count * samples * sizeof (int16_t);
+        }
+        if (status == SUCCESS && include_water_qa_flag)
+        {
+            start_stage_clock (false, &stage_clock);
+            status = write_band_product_lines (fd_water_qa, line_count,
+                                               samples, sizeof (uint8_t),
+                                               band_water_qa);
+            stop_stage_clock (&stage_clock,
+                              &scene_report->stages[STAGE_WRITE_WATER_QA]);
+            scene_report->bytes_written +=
+                (long long) line_count * samples * sizeof (uint8_t);
+        }
+        if (status != SUCCESS)
+        {
+            ERROR_MESSAGE ("Failed writing output band data", MODULE_NAME);
+
+            /* Cleanup memory */
+            if (slope_cache.state != SLOPE_CACHE_BYPASS)
+                close_slope_cache (&slope_cache, false);
+            close_output_files (fd_dswe_raw, fd_dswe_ccss, fd_dswe_psccss,
+                                fd_dswe_diag, fd_ps, fd_water_qa,
+                                water_qa_filename);
+            close_metadata_session (&metadata_session);
+            close_input (input_data);
+            free (input_data);
+
+            return ERROR;
+        }
+
+        /* Let the user know where we are in the processing */
+        printf ("\r");
+        printf ("Processed data element %ld",
+                (long) (first_line + line_count) * samples);
+        fflush (stdout);
+    }
+    printf ("\n");
+
+    scene_report->stages[STAGE_SLOPE].wall_seconds += slope_wall_seconds;
+    scene_report->stages[STAGE_SLOPE].cpu_seconds += slope_cpu_seconds;
+    scene_report->stages[STAGE_CLASSIFY].wall_seconds +=
+        classify_wall_seconds;
+    scene_report->stages[STAGE_CLASSIFY].cpu_seconds += classify_cpu_seconds;
+    scene_report->counted_flag[COUNT_RAW] = include_raw_flag;
+    scene_report->counted_flag[COUNT_CCSS] = include_ccss_flag;
+    scene_report->counted_flag[COUNT_PSCCSS] = include_psccss_flag;
+    scene_report->bytes_read = input_data->bytes_read;
+
+    /* Every line has been processed, so a populated slope cache entry is
+       complete */
+    if (slope_cache.state != SLOPE_CACHE_BYPASS)
+        close_slope_cache (&slope_cache, true);
+
+    /* -------------------------------------------------------------------- */
+    /* Replace the Level2 QA band with the one with the water pixels, and
+       update its percentages for the XML file */
+    if (include_water_qa_flag)
+    {
+        percent_clear = 100.0 * (float) clear_pixels / (float) image_pixels;
+        percent_water = 100.0 * (float) water_pixels / (float) image_pixels;
+        if (options->verbose_flag)
+        {
+            printf ("Total Image Pixels = %ld\n", image_pixels);
+            printf ("Total Clear Pixels = %ld\n", clear_pixels);
+            printf ("Total Water Pixels = %ld\n", water_pixels);
+            printf ("Percent Clear Pixels = %f\n", percent_clear);
+            printf ("Percent Water Pixels = %f\n", percent_water);
+        }
+
+        status = fclose (fd_water_qa);
+        fd_water_qa = NULL;
+        if (status != 0
+            || rename (water_qa_filename,
+                       input_data->band_name[I_BAND_L2QA]) == -1)
+        {
+            ERROR_MESSAGE ("Failed over-writing L2 QA band data with new"
+                           " results", MODULE_NAME);
+
+            /* Cleanup memory */
+            unlink (water_qa_filename);
+            close_output_files (fd_dswe_raw, fd_dswe_ccss, fd_dswe_psccss,
+                                fd_dswe_diag, fd_ps, NULL, NULL);
+            close_metadata_session (&metadata_session);
+            close_input (input_data);
+            free (input_data);
+
+            return ERROR;
+        }
+
+        set_l2qa_percentages (&metadata_session, input_data->l2qa_meta_index,
+                              percent_clear, percent_water);
+    }
+
+    /* -------------------------------------------------------------------- */
+    /* Close the input files */
+    if (close_input (input_data) != SUCCESS)
+    {
+        WARNING_MESSAGE ("Failed closing input files", MODULE_NAME);
+    }
+
+    /* Free memory no longer needed */
+    free (input_data);
+    input_data = NULL;
+
+    /* Close the output image files */
+    close_output_files (fd_dswe_raw, fd_dswe_ccss, fd_dswe_psccss,
+                        fd_dswe_diag, fd_ps, NULL, NULL);
+
+    /* Add the DSWE bands to the metadata file and generate the ENVI
+       header files */
+    start_stage_clock (false, &stage_clock);
+    if (include_raw_flag)
+    {
+        if (add_dswe_band_product (&metadata_session,
+                                   RAW_PRODUCT_NAME, RAW_BAND_NAME,
+                                   RAW_SHORT_NAME, RAW_LONG_NAME,
+                                   DSWE_NOT_WATER,
+                                   DSWE_PARTIAL_SURFACE_WATER_PIXEL)
+            != SUCCESS)
+        {
+            ERROR_MESSAGE ("Failed adding Raw DSWE band product", MODULE_NAME);
+
+            /* Cleanup memory */
+            close_metadata_session (&metadata_session);
+
+            return ERROR;
+        }
+    }
+
+    if (include_ccss_flag)
+    {
+        if (add_dswe_band_product (&metadata_session,
+                                   SC_PRODUCT_NAME, SC_BAND_NAME,
+                                   SC_SHORT_NAME, SC_LONG_NAME,
+                                   DSWE_NOT_WATER,
+                                   DSWE_CLOUD_CLOUD_SHADOW_SNOW)
+            != SUCCESS)
+        {
+            ERROR_MESSAGE ("Failed adding DSWE SHADOW CLOUD band product",
+                           MODULE_NAME);
+
+            /* Cleanup memory */
+            close_metadata_session (&metadata_session);
+
+            return ERROR;
+        }
+    }
 
-    *band_ps = calloc (pixel_count, sizeof (float));
-    if (*band_ps == NULL)
+    if (include_psccss_flag)
     {
-        ERROR_MESSAGE ("Failed allocating memory for percent slope band",
-                       MODULE_NAME);
+        if (add_dswe_band_product (&metadata_session,
+                                   PS_SC_PRODUCT_NAME, PS_SC_BAND_NAME,
+                                   PS_SC_SHORT_NAME, PS_SC_LONG_NAME,
+                                   DSWE_NOT_WATER,
+                                   DSWE_CLOUD_CLOUD_SHADOW_SNOW)
+            != SUCCESS)
+        {
+            ERROR_MESSAGE ("Failed adding DSWE PERCENT-SLOPE SHADOW CLOUD band"
+                           " product", MODULE_NAME);
 
-        /* Free allocated memory */
-        free_band_memory (*band_blue, *band_green, *band_red, *band_nir,
-                          *band_swir1, *band_swir2, *band_elevation,
-                          *band_cfmask, *band_ps, *band_dswe_diag,
-                          *band_dswe_raw, *band_dswe_ccss, *band_dswe_psccss);
-        return ERROR;
+            /* Cleanup memory */
+            close_metadata_session (&metadata_session);
+
+            return ERROR;
+        }
     }
 
     if (include_tests_flag)
     {
-        *band_dswe_diag = calloc (pixel_count, sizeof (int16_t));
-        if (band_dswe_diag == NULL)
+        if (add_test_band_product (&metadata_session,
+                                   RAW_DIAG_PRODUCT_NAME, RAW_DIAG_BAND_NAME,
+                                   RAW_DIAG_SHORT_NAME, RAW_DIAG_LONG_NAME,
+                                   0, 11111)
+            != SUCCESS)
         {
-            ERROR_MESSAGE ("Failed allocating memory for Raw DSWE tests band",
+            ERROR_MESSAGE ("Failed adding RAW TESTS DSWE band product",
                            MODULE_NAME);
 
             /* Cleanup memory */
-            free_band_memory (*band_blue, *band_green, *band_red, *band_nir,
-                              *band_swir1, *band_swir2, *band_elevation,
-                              *band_cfmask, *band_ps, *band_dswe_diag,
-                              *band_dswe_raw, *band_dswe_ccss,
-                              *band_dswe_psccss);
+            close_metadata_session (&metadata_session);
+
             return ERROR;
         }
     }
 
-    *band_dswe_raw = calloc (pixel_count, sizeof (uint8_t));
-    if (band_dswe_raw == NULL)
+    if (include_ps_flag)
     {
-        ERROR_MESSAGE ("Failed allocating memory for Raw DSWE band",
-                       MODULE_NAME);
+        if (add_ps_band_product (&metadata_session,
+                                 PS_PRODUCT_NAME, PS_BAND_NAME,
+                                 PS_SHORT_NAME, PS_LONG_NAME,
+                                 0, 10000)
+            != SUCCESS)
+        {
+            ERROR_MESSAGE ("Failed adding DSWE PERCENT-SLOPE band product",
+                           MODULE_NAME);
 
-        /* Cleanup memory */
-        free_band_memory (*band_blue, *band_green, *band_red, *band_nir,
-                          *band_swir1, *band_swir2, *band_elevation,
-                          *band_cfmask, *band_ps, *band_dswe_diag,
-                          *band_dswe_raw, *band_dswe_ccss, *band_dswe_psccss);
-        return ERROR;
+            /* Cleanup memory */
+            close_metadata_session (&metadata_session);
+
+            return ERROR;
+        }
     }
 
-    *band_dswe_ccss = calloc (pixel_count, sizeof (uint8_t));
-    if (band_dswe_ccss == NULL)
+    /* Write all the output bands to the XML file at once */
+    if (commit_metadata_session (&metadata_session) != SUCCESS)
     {
-        ERROR_MESSAGE ("Failed allocating memory for Raw Shadow Cloud DSWE"
-                       " band", MODULE_NAME);
+        ERROR_MESSAGE ("Failed adding the DSWE band products to the XML"
+                       " file", MODULE_NAME);
 
         /* Cleanup memory */
-        free_band_memory (*band_blue, *band_green, *band_red, *band_nir,
-                          *band_swir1, *band_swir2, *band_elevation,
-                          *band_cfmask, *band_ps, *band_dswe_diag,
-                          *band_dswe_raw, *band_dswe_ccss, *band_dswe_psccss);
+        close_metadata_session (&metadata_session);
+
         return ERROR;
     }
+    close_metadata_session (&metadata_session);
+    stop_stage_clock (&stage_clock, &scene_report->stages[STAGE_METADATA]);
+
+    return SUCCESS;
+}
 
-    *band_dswe_psccss = calloc (pixel_count, sizeof (uint8_t));
-    if (band_dswe_psccss == NULL)
+
+/*****************************************************************************
+  NAME:  set_test_thresholds
+
+  PURPOSE:  Place the thresholds of a scene where the tests can get to them.
+
+  RETURN VALUE:  None
+*****************************************************************************/
+void
+set_test_thresholds
+(
+    char *xml_filename,
+    float wigt,
+    float awgt,
+    float pswt_1,
+    float pswt_2,
+    int pswnt_1,
+    int pswnt_2,
+    int pswst_1,
+    int pswst_2,
+    bool verbose_flag,
+    Dswe_Tests_Parameters_t *tests_params
+)
+{
+    if (verbose_flag)
     {
-        ERROR_MESSAGE ("Failed allocating memory for Raw Shadow Cloud PS DSWE"
-                       " band", MODULE_NAME);
+        printf ("   XML Input File: %s\n", xml_filename);
+        printf ("             WIGT: %0.3f\n", wigt);
+        printf ("             AWGT: %0.3f\n", awgt);
+        printf ("           PSWT_1: %0.3f\n", pswt_1);
+        printf ("           PSWT_2: %0.3f\n", pswt_2);
+        printf ("          PSWNT_1: %d\n", pswnt_1);
+        printf ("          PSWNT_2: %d\n", pswnt_2);
+        printf ("          PSWST_1: %d\n", pswst_1);
+        printf ("          PSWST_2: %d\n", pswst_2);
+    }
 
-        /* Cleanup memory */
-        free_band_memory (*band_blue, *band_green, *band_red, *band_nir,
-                          *band_swir1, *band_swir2, *band_elevation,
-                          *band_cfmask, *band_ps, *band_dswe_diag,
-                          *band_dswe_raw, *band_dswe_ccss, *band_dswe_psccss);
+    tests_params->wigt = wigt;
+    tests_params->awgt = awgt;
+    tests_params->pswt_1 = pswt_1;
+    tests_params->pswt_2 = pswt_2;
+
+    /* Just convert to float */
+    tests_params->pswnt_1 = pswnt_1;
+    tests_params->pswnt_2 = pswnt_2;
+    tests_params->pswst_1 = pswst_1;
+    tests_params->pswst_2 = pswst_2;
+}
+
+
+/*****************************************************************************
+  NAME:  make_path_absolute
+
+  PURPOSE:  Prefix a relative path with the current directory, so it still
+            refers to the same place after changing to a scene directory.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      ERROR    The current directory could not be determined.
+      SUCCESS  No errors encountered.
+*****************************************************************************/
+int
+make_path_absolute
+(
+    char **path   /* I/O: the path, replaced when it is relative */
+)
+{
+    char cwd[PATH_MAX];
+    char *absolute_path;
+
+    if (*path == NULL || (*path)[0] == '/')
+        return SUCCESS;
+
+    if (getcwd (cwd, sizeof (cwd)) == NULL)
         return ERROR;
-    }
+
+    absolute_path = malloc (strlen (cwd) + strlen (*path) + 2);
+    if (absolute_path == NULL)
+        return ERROR;
+    sprintf (absolute_path, "%s/%s", cwd, *path);
+
+    free (*path);
+    *path = absolute_path;
 
     return SUCCESS;
 }
 
 
+
 /*****************************************************************************
   NAME:  main
 
@@ -314,586 +1845,462 @@ allocate_band_memory
   RETURN VALUE:  Type = int
       Value           Description
       --------------  --------------------------------------------------------
-      EXIT_FAILURE    An unrecoverable error occured during processing.
+      EXIT_FAILURE    An unrecoverable error occured during processing, for
+                      a batch at least one of the scenes failed.
+      EXIT_SKIPPED    No errors, but at least one scene was skipped for
+                      having less than the minimum percent clear.
       EXIT_SUCCESS    No errors encountered processing succesfull.
+
+  NOTES:
+    1. A batch runs every scene in the same process, so the band memory,
+       the threads, the classifier, and the metadata schema are set up once
+       and shared by the scenes.  A scene which fails is reported and the
+       batch continues with the next one.
+    2. Each scene of a batch is processed from the directory of its XML
+       file, which is where the outputs are written, just as when it is
+       processed by itself.
 *****************************************************************************/
 int
 main (int argc, char *argv[])
 {
     /* Command line parameters */
     char *xml_filename = NULL;  /* filename for the XML input */
+    char *batch_filename = NULL; /* filename for a batch manifest */
+    char *recode_filename = NULL; /* filename for an ESPA recode file */
+    char *report_filename = NULL; /* filename for the JSON run report */
     Espa_internal_meta_t xml_metadata;  /* XML metadata structure */
-    bool use_zeven_thorne_flag = false;
-    bool use_toa_flag = false;
-    bool include_tests_flag = false;
-    bool include_ps_flag = false;
+    Dswe_Options_t options;     /* Settings for every scene */
     float wigt;
     float awgt;
     float pswt_1;
     float pswt_2;
-    float percent_slope;
     int pswnt_1;
     int pswnt_2;
     int pswst_1;
     int pswst_2;
-    bool verbose_flag = false;
-
-    /* Band data */
-    Input_Data_t *input_data = NULL;
-    int16_t *band_blue = NULL;  /* TM SR_Band1,  OLI SR_Band2 */
-    int16_t *band_green = NULL; /* TM SR_Band2,  OLI SR_Band3 */
-    int16_t *band_red = NULL;   /* TM SR_Band3,  OLI SR_Band4 */
-    int16_t *band_nir = NULL;   /* TM SR_Band4,  OLI SR_Band5 */
-    int16_t *band_swir1 = NULL; /* TM SR_Band5,  OLI SR_Band6 */
-    int16_t *band_swir2 = NULL; /* TM SR_Band7,  OLI SR_Band7 */
-    int16_t *band_elevation = NULL; /* Contains the elevation band */
-    uint8_t *band_cfmask = NULL; /* CFMASK */
-    float *band_ps = NULL;       /* Contains the generated percent slope */
-    int16_t *band_dswe_diag = NULL;   /* Output Raw DSWE tests band data */
-    uint8_t *band_dswe_raw = NULL;    /* Output Raw DSWE band data */
-    uint8_t *band_dswe_ccss = NULL;   /* Output Raw DSWE band data with Cloud
-                                         and Cloud Shadow filtering applied */
-    uint8_t *band_dswe_psccss = NULL; /* Output Raw DSWE band data with Percent
-                                         Slope, Cloud, and Cloud Shadow
-                                         filtering applied */
 
     /* Temp variables */
-    float mndwi;                /* (green - swir1) / (green + swir1) */
-    float mbsrv;                /* (green + red) */
-    float mbsrn;                /* (nir + swir1) */
-    float awesh;                /* (blue
-                                   + (2.5 * green)
-                                   - (1.5 * MBSRN)
-                                   - (0.25 * bt)) */
-
-    float band_blue_float;
-    float band_green_float;
-    float band_red_float;
-    float band_nir_float;
-    float band_swir1_float;
-    float band_swir2_float;
-
-    float band_green_scaled;
-    float band_swir1_scaled;
-
-    float green_scale_factor;
-    float swir1_scale_factor;
-
-    int16_t blue_fill_value;
-    int16_t green_fill_value;
-    int16_t red_fill_value;
-    int16_t nir_fill_value;
-    int16_t swir1_fill_value;
-    int16_t swir2_fill_value;
-    uint8_t cfmask_fill_value;
-
-    int16_t raw_dswe_value;
-    uint8_t raw_ccss_dswe_value;
-    uint8_t raw_ps_ccss_dswe_value;
-
-    float pswnt_1_float;
-    float pswnt_2_float;
-    float pswst_1_float;
-    float pswst_2_float;
+    Dswe_Tests_Parameters_t tests_params; /* Thresholds for the tests */
+    Band_Memory_t band_memory;            /* Buffers shared by the scenes */
+    Run_Report_t run_report;              /* Timing and counts of the run */
+    Scene_Report_t *scene_report;         /* Report of the current scene */
+    Stage_Clock_t parse_clock;            /* Start of parsing the XML */
+    Stage_Time_t parse_time;              /* Time parsing the XML */
+    const char *water_test_name;          /* Implementation of the water
+                                             test */
+
+    /* Batch variables */
+    char **scene_filenames = NULL; /* The XML files listed in the batch */
+    char *scene_filename;          /* XML file within its directory */
+    int scene_count = 0;
+    int scene_failures = 0;
+    int scene_skips = 0;
+    int scene;
+    int previous_dir_fd;
+    float scene_wigt;
+    float scene_awgt;
+    float scene_pswt_1;
+    float scene_pswt_2;
+    int scene_pswnt_1;
+    int scene_pswnt_2;
+    int scene_pswst_1;
+    int scene_pswst_2;
 
     /* Other variables */
     int status;
-    int index;
-    int pixel_count;
+    char msg[PATH_MAX + 80];
 
 
+    /* The run, and for a single scene parsing its XML, starts with getting
+       the command line arguments */
+    init_run_report (&run_report);
+    memset (&parse_time, 0, sizeof (parse_time));
+    start_stage_clock (false, &parse_clock);
+
     /* Get the command line arguments */
     status = get_args (argc, argv,
                        &xml_filename,
+                       &batch_filename,
                        &xml_metadata,
-                       &use_zeven_thorne_flag,
-                       &use_toa_flag,
-                       &include_tests_flag,
-                       &include_ps_flag,
+                       &options.use_zeven_thorne_flag,
+                       &options.use_toa_flag,
+                       &options.products,
                        &wigt,
                        &awgt,
                        &pswt_1,
                        &pswt_2,
-                       &percent_slope,
+                       &options.percent_slope,
                        &pswnt_1,
                        &pswnt_2,
                        &pswst_1,
                        &pswst_2,
-                       &verbose_flag);
+                       &options.max_memory,
+                       &options.num_threads,
+                       &options.simd_target,
+                       &recode_filename,
+                       &options.slope_precision,
+                       &options.slope_cache_dir,
+                       &options.input_method,
+                       &options.prefetch_depth,
+                       &options.mask_first_flag,
+                       &options.min_percent_clear,
+                       &options.skip_low_clear_flag,
+                       &options.huge_pages_flag,
+                       &report_filename,
+                       &options.verbose_flag);
     if (status != SUCCESS)
     {
         /* get_args generates all the error messages we need */
         return EXIT_FAILURE;
     }
+    stop_stage_clock (&parse_clock, &parse_time);
+    options.report_flag = report_filename != NULL;
 
     LOG_MESSAGE ("Starting dynamic surface water extent processing ...",
                  MODULE_NAME);
 
     /* -------------------------------------------------------------------- */
     /* Provide user information if verbose is turned on */
-    if (verbose_flag)
+    if (options.verbose_flag)
     {
-        printf ("   XML Input File: %s\n", xml_filename);
-        printf ("             WIGT: %0.3f\n", wigt);
-        printf ("             AWGT: %0.3f\n", awgt);
-        printf ("           PSWT_1: %0.3f\n", pswt_1);
-        printf ("           PSWT_2: %0.3f\n", pswt_2);
-        printf ("          PSWNT_1: %d\n", pswnt_1);
-        printf ("          PSWNT_2: %d\n", pswnt_2);
-        printf ("          PSWST_1: %d\n", pswst_1);
-        printf ("          PSWST_2: %d\n", pswst_2);
-        printf ("    Percent Slope: %0.1f\n", percent_slope);
+        if (batch_filename != NULL)
+            printf ("   Batch Manifest: %s\n", batch_filename);
+        printf ("    Percent Slope: %0.1f\n", options.percent_slope);
+        printf ("    Max Memory MB: %d\n", options.max_memory);
+        printf ("          Threads: %d\n", options.num_threads);
+
+        printf ("         Products:");
+        if (options.products & PRODUCT_RAW)
+            printf (" raw");
+        if (options.products & PRODUCT_CCSS)
+            printf (" ccss");
+        if (options.products & PRODUCT_PSCCSS)
+            printf (" psccss");
+        if (options.products & PRODUCT_DIAG)
+            printf (" diag");
+        if (options.products & PRODUCT_PS)
+            printf (" ps");
+        if (options.products & PRODUCT_WATER_QA)
+            printf (" water_qa");
+        printf ("\n");
 
         printf (" Use Zeven Thorne:");
-        if (use_zeven_thorne_flag)
+        if (options.use_zeven_thorne_flag)
             printf (" TRUE\n");
         else
             printf (" FALSE\n");
 
         printf (" Use Top Of Atmos:");
-        if (use_toa_flag)
+        if (options.use_toa_flag)
             printf (" TRUE\n");
         else
             printf (" FALSE\n");
-    }
 
-    /* -------------------------------------------------------------------- */
-    /* Open the input files */
-    input_data = open_input (&xml_metadata, use_toa_flag);
-    if (input_data == NULL)
-    {
-        ERROR_MESSAGE ("Failed opening input files", MODULE_NAME);
+        printf ("  Slope Precision:");
+        if (options.slope_precision == SLOPE_FLOAT)
+            printf (" FLOAT\n");
+        else
+            printf (" DOUBLE\n");
 
-        /* Cleanup memory */
-        free_metadata (&xml_metadata);
-        return EXIT_FAILURE;
-    }
+        if (recode_filename != NULL)
+            printf ("      Recode File: %s\n", recode_filename);
 
-    /* Free the metadata structure */
-    /* ******** NO LONGER NEEDED IN THIS MAIN CODE ******** */
-    free_metadata (&xml_metadata);
+        if (options.slope_cache_dir != NULL)
+            printf ("      Slope Cache: %s\n", options.slope_cache_dir);
 
-    /* -------------------------------------------------------------------- */
-    /* Figure out the number of elements in the data */
-    pixel_count = input_data->lines * input_data->samples;
-
-    /* Allocate memory buffers for input and temp processing */
-    if (allocate_band_memory (include_tests_flag, &band_blue, &band_green,
-                              &band_red, &band_nir, &band_swir1, &band_swir2,
-                              &band_elevation, &band_cfmask, &band_ps,
-                              &band_dswe_diag, &band_dswe_raw,
-                              &band_dswe_ccss, &band_dswe_psccss,
-                              pixel_count)
-        != SUCCESS)
-    {
-        ERROR_MESSAGE ("Failed reading bands into memory", MODULE_NAME);
+        printf ("     Input Method:");
+        if (options.input_method == INPUT_READ)
+            printf (" READ\n");
+        else
+            printf (" MAP\n");
+        printf ("   Prefetch Depth: %d\n", options.prefetch_depth);
 
-        return EXIT_FAILURE;
+        printf ("       Mask First:");
+        if (options.mask_first_flag)
+            printf (" TRUE\n");
+        else
+            printf (" FALSE\n");
+
+        printf ("Min Percent Clear: %f\n", options.min_percent_clear);
+        printf ("   Skip Low Clear:");
+        if (options.skip_low_clear_flag)
+            printf (" TRUE\n");
+        else
+            printf (" FALSE\n");
+
+        printf ("       Huge Pages:");
+        if (options.huge_pages_flag)
+            printf (" TRUE\n");
+        else
+            printf (" FALSE\n");
+
+        if (report_filename != NULL)
+            printf ("           Report: %s\n", report_filename);
     }
 
     /* -------------------------------------------------------------------- */
-    /* Read the input files into the buffers */
-    if (read_bands_into_memory (input_data, band_blue, band_green, band_red,
-                                band_nir, band_swir1, band_swir2,
-                                band_elevation, band_cfmask, pixel_count)
-        != SUCCESS)
+    /* Set the number of threads used for the pixel processing, the same
+       threads are used for every scene of a batch */
+#ifdef _OPENMP
+    omp_set_num_threads (options.num_threads);
+#endif
+
+    /* -------------------------------------------------------------------- */
+    /* Select the implementation of the DSWE tests */
+    if (select_dswe_tests (options.simd_target, &options.simd_target)
+        == NULL)
     {
-        ERROR_MESSAGE ("Failed reading bands into memory", MODULE_NAME);
+        ERROR_MESSAGE ("The requested SIMD instruction set is not supported"
+                       " on this processor", MODULE_NAME);
 
         /* Cleanup memory */
-        free_band_memory (band_blue, band_green, band_red, band_nir,
-                          band_swir1, band_swir2, band_elevation, band_cfmask,
-                          band_ps, band_dswe_diag, band_dswe_raw,
-                          band_dswe_ccss, band_dswe_psccss);
+        if (xml_filename != NULL)
+            free_metadata (&xml_metadata);
         free (xml_filename);
-        free (input_data);
+        free (batch_filename);
+        free (recode_filename);
+        free (report_filename);
+        free (options.slope_cache_dir);
 
         return EXIT_FAILURE;
     }
 
-    /* -------------------------------------------------------------------- */
-    /* Close the input files */
-    if (close_input (input_data) != SUCCESS)
+    if (options.verbose_flag)
     {
-        WARNING_MESSAGE ("Failed closing input files", MODULE_NAME);
+        printf ("      SIMD Target: %s\n",
+                simd_target_name (options.simd_target));
     }
 
-    /* -------------------------------------------------------------------- */
-    build_slope_band (band_elevation, input_data->lines, input_data->samples,
-                      input_data->x_pixel_size, input_data->y_pixel_size,
-                      use_zeven_thorne_flag, band_ps);
-
-    /* -------------------------------------------------------------------- */
-    /* Place the scale factor values into local variables mostly for code
-       clarity */
-    green_scale_factor = input_data->scale_factor[I_BAND_GREEN];
-    swir1_scale_factor = input_data->scale_factor[I_BAND_SWIR1];
-
-    blue_fill_value = input_data->fill_value[I_BAND_BLUE];
-    green_fill_value = input_data->fill_value[I_BAND_GREEN];
-    red_fill_value = input_data->fill_value[I_BAND_RED];
-    nir_fill_value = input_data->fill_value[I_BAND_NIR];
-    swir1_fill_value = input_data->fill_value[I_BAND_SWIR1];
-    swir2_fill_value = input_data->fill_value[I_BAND_SWIR2];
-    cfmask_fill_value = input_data->fill_value[I_BAND_CFMASK];
-
-    /* Free memory no longer needed */
-    free (input_data);
-    input_data = NULL;
-
-    /* Just convert to float */
-    pswnt_1_float = pswnt_1;
-    pswnt_2_float = pswnt_2;
-    pswst_1_float = pswst_1;
-    pswst_2_float = pswst_2;
-
-    /* -------------------------------------------------------------------- */
-    /* Process through each data element and populate the dswe band memory */
-    if (verbose_flag)
-    {
-        printf ("Pixel Count = %d\n", pixel_count);
-    }
-    for (index = 0; index < pixel_count; index++)
+    /* The water test of the water QA picks its own implementation */
+    if (options.products & PRODUCT_WATER_QA)
     {
-        /* If any of the input is fill, make the output fill */
-        if (band_blue[index] == blue_fill_value ||
-            band_green[index] == green_fill_value ||
-            band_red[index] == red_fill_value ||
-            band_nir[index] == nir_fill_value ||
-            band_swir1[index] == swir1_fill_value ||
-            band_swir2[index] == swir2_fill_value ||
-            band_cfmask[index] == cfmask_fill_value)
-        {
-            if (include_tests_flag)
-            {
-                band_dswe_diag[index] = TESTS_NO_DATA_VALUE;
-            }
-            band_dswe_raw[index] = DSWE_NO_DATA_VALUE;
-            band_dswe_ccss[index] = DSWE_NO_DATA_VALUE;
-            band_dswe_psccss[index] = DSWE_NO_DATA_VALUE;
-            continue;
-        }
-
-        /* Apply the scaling to these bands accordingly */
-        band_green_scaled = band_green[index] * green_scale_factor;
-        band_swir1_scaled = band_swir1[index] * swir1_scale_factor;
-
-        /* Just convert to float for now */
-        band_blue_float = band_blue[index];
-        band_green_float = band_green[index];
-        band_red_float = band_red[index];
-        band_nir_float = band_nir[index];
-        band_swir1_float = band_swir1[index];
-        band_swir2_float = band_swir2[index];
-
-        /* Modified Normalized Difference Wetness Index (MNDWI) */
-        mndwi = (band_green_scaled - band_swir1_scaled) /
-                (band_green_scaled + band_swir1_scaled);
-
-        /* Multi-band Spectral Relationship Visible (MBSRV) */
-        mbsrv = band_green_float + band_red_float;
-
-        /* Multi-band Spectral Relationship Near-Infrared (MBSRN) */
-        mbsrn = band_nir_float + band_swir1_float;
-
-        /* Automated Water Extent Shadow (AWEsh) */
-        awesh = (band_blue_float
-                 + (2.5 * band_green_float)
-                 - (1.5 * mbsrn)
-                 - (0.25 * band_swir2_float));
-
-        /* Initialize to 0 or 1 on the first test */
-        if (mndwi > wigt)
-            raw_dswe_value = 1; /* > wigt */  /* Set the ones digit */
-        else
-            raw_dswe_value = 0;
-
-        if (mbsrv > mbsrn)
-            raw_dswe_value += 10; /* Set the tens digit */
-
-        if (awesh > awgt)
-            raw_dswe_value += 100; /* Set the hundreds digit */
-
-        /* Partial Surface Water 1 (PSW1)
-           The logic in the if results in a true/false called PSW1 */
-        if (mndwi > pswt_1 &&
-            band_swir1_float < pswst_1_float &&
-            band_nir_float < pswnt_1_float)
-        {
-            raw_dswe_value += 1000; /* Set the thousands digit */
-        }
-
-        /* Partial Surface Water 2 (PSW2)
-           The logic in the if results in a true/false called PSW2 */
-        if (mndwi > pswt_2 &&
-            band_swir2_float < pswst_2_float &&
-            band_nir_float < pswnt_2_float)
-        {
-            raw_dswe_value += 10000; /* Set the ten thousands digit */
-        }
-
-        /* Assign it to the tests band */
-        if (include_tests_flag)
-        {
-            band_dswe_diag[index] = raw_dswe_value;
-        }
-
-        /* Recode the value to fit an 8bit output product */
-        switch (raw_dswe_value)
-        {
-            /* From ESPA_recode.rmp prototype
-               11999 11999 : 9    ** Not included here it is only for
-                                  ** cfmask tests performed after this
-             */
-
-            /* 11001 11111 : 1 */
-            case 11111:
-            case 11110:
-            case 11101:
-            case 11100:
-            case 11011:
-            case 11010:
-            case 11001:
-            /* 10111 10999 : 1 */
-            case 10111:
-            /* 1111 1111 : 1 */
-            case 1111:
-                raw_dswe_value = DSWE_WATER_HIGH_CONFIDENCE;
-                break;
-
-            /* 11000 11000 : 3 */
-            case 11000:
-            /* 10000 10000 : 3 */
-            case 10000:
-            /* 1000 1000 : 3 */
-            case 1000:
-                raw_dswe_value = DSWE_PARTIAL_SURFACE_WATER_PIXEL;
-                break;
-
-            /* 10012 10110 : 2 */
-            case 10110:
-            case 10101:
-            case 10100:
-            /* 10011 10011 : 2 */
-            case 10011:
-            /* 10001 10010 : 2 */
-            case 10010:
-            case 10001:
-            /* 1001 1110 : 2 */
-            case 1110:
-            case 1101:
-            case 1100:
-            case 1011:
-            case 1010:
-            case 1001:
-            /* 10 111 : 2 */
-            case 111:
-            case 110:
-            case 101:
-            case 100:
-            case 11:
-            case 10:
-                raw_dswe_value = DSWE_WATER_MODERATE_CONFIDENCE;
-                break;
-
-            /* 0 9 : 0 */
-            case 1:
-            case 0:
-            default:
-                raw_dswe_value = DSWE_NOT_WATER;
-                break;
-        }
-
-        /* The following few chunks of code produce the following paths to the
-           output products.
-
-           raw -> output
-           raw -> cloud -> cloud shadow -> snow -> output
-           raw -> percent-slope -> cloud -> cloud shadow -> snow -> output
-        */
-
-        /* Default the
-           Cloud, Cloud Shadow, and Snow output
-           and the
-           Percent Slope, Cloud, Cloud Shadow, and Snow output
-           to the Raw DSWE value */
-        raw_ccss_dswe_value = raw_dswe_value;
-        raw_ps_ccss_dswe_value = raw_dswe_value;
-
-        /* Apply the Percent Slope constraint to the
-           Percent Slope, Cloud, Cloud Shadow, and Snow output */
-        if (band_ps[index] >= percent_slope)
-        {
-            raw_ps_ccss_dswe_value = DSWE_NOT_WATER;
-        }
-
-        /* Apply the CFMASK Cloud constraint to both the
-           Cloud, Cloud Shadow, and Snow output
-           and the
-           Percent Slope, Cloud, Cloud Shadow, and Snow output */
-        if (band_cfmask[index] == CFMASK_CLOUD)
-        {
-            /* classified as 11999 in prototype code using 9 due to recode */
-            raw_ccss_dswe_value = DSWE_CLOUD_CLOUD_SHADOW_SNOW;
-            raw_ps_ccss_dswe_value = DSWE_CLOUD_CLOUD_SHADOW_SNOW;
-        }
-
-        /* Apply the CFMASK Cloud Shadow constraint to both the
-           Cloud, Cloud Shadow, and Snow output
-           and the
-           Percent Slope, Cloud, Cloud Shadow, and Snow output */
-        if (band_cfmask[index] == CFMASK_CLOUD_SHADOW)
-        {
-            /* classified as 11999 in prototype code using 9 due to recode */
-            raw_ccss_dswe_value = DSWE_CLOUD_CLOUD_SHADOW_SNOW;
-            raw_ps_ccss_dswe_value = DSWE_CLOUD_CLOUD_SHADOW_SNOW;
-        }
-
-        /* Apply the CFMASK Snow constraint to both the
-           Cloud, Cloud Shadow, and Snow output
-           and the
-           Percent Slope, Cloud, Cloud Shadow, and Snow output */
-        if (band_cfmask[index] == CFMASK_SNOW)
-        {
-            /* classified as 11999 in prototype code using 9 due to recode */
-            raw_ccss_dswe_value = DSWE_CLOUD_CLOUD_SHADOW_SNOW;
-            raw_ps_ccss_dswe_value = DSWE_CLOUD_CLOUD_SHADOW_SNOW;
-        }
-
-        /* Assign the values to the correct output band */
-        band_dswe_raw[index] = raw_dswe_value;
-        band_dswe_ccss[index] = raw_ccss_dswe_value;
-        band_dswe_psccss[index] = raw_ps_ccss_dswe_value;
-
-        /* Let the use know where we are in the processing */
-        if (index%99999 == 0)
-        {
-            printf ("\r");
-            printf ("Processed data element %d", index);
-        }
+        options.water_test = select_water_test (&water_test_name);
+        if (options.verbose_flag)
+            printf ("       Water Test: %s\n", water_test_name);
     }
-    /* Status output cleanup to match the final output size */
-    printf ("\r");
-    printf ("Processed data element %d", index);
-    printf ("\n");
 
-    /* Add the DSWE bands to the metadata file and generate the ENVI images
-       and header files */
-    if (add_dswe_band_product (xml_filename, use_toa_flag,
-                               RAW_PRODUCT_NAME, RAW_BAND_NAME,
-                               RAW_SHORT_NAME, RAW_LONG_NAME, DSWE_NOT_WATER,
-                               DSWE_PARTIAL_SURFACE_WATER_PIXEL,
-                               band_dswe_raw)
-        != SUCCESS)
+    /* -------------------------------------------------------------------- */
+    /* Determine the outputs for every combination of the tests, cfmask,
+       and percent slope */
+    if (build_classifier (recode_filename, &options.classifier) != SUCCESS)
     {
-        ERROR_MESSAGE ("Failed adding Raw DSWE band product", MODULE_NAME);
+        ERROR_MESSAGE ("Failed building the DSWE classifier", MODULE_NAME);
 
         /* Cleanup memory */
+        if (xml_filename != NULL)
+            free_metadata (&xml_metadata);
         free (xml_filename);
+        free (batch_filename);
+        free (recode_filename);
+        free (report_filename);
+        free (options.slope_cache_dir);
 
         return EXIT_FAILURE;
     }
 
-    if (add_dswe_band_product (xml_filename, use_toa_flag,
-                               SC_PRODUCT_NAME, SC_BAND_NAME,
-                               SC_SHORT_NAME, SC_LONG_NAME,
-                               DSWE_NOT_WATER, DSWE_CLOUD_CLOUD_SHADOW_SNOW,
-                               band_dswe_ccss)
-        != SUCCESS)
-    {
-        ERROR_MESSAGE ("Failed adding DSWE SHADOW CLOUD band product",
-                       MODULE_NAME);
+    memset (&band_memory, 0, sizeof (band_memory));
 
-        /* Cleanup memory */
-        free (xml_filename);
+    if (batch_filename == NULL)
+    {
+        /* ---------------------------------------------------------------- */
+        /* A single scene, its metadata was read by get_args */
+        set_test_thresholds (xml_filename, wigt, awgt, pswt_1, pswt_2,
+                             pswnt_1, pswnt_2, pswst_1, pswst_2,
+                             options.verbose_flag, &tests_params);
+
+        scene_report = add_scene_report (&run_report, xml_filename);
+        if (scene_report == NULL)
+        {
+            ERROR_MESSAGE ("Failed starting the scene report", MODULE_NAME);
+            free_metadata (&xml_metadata);
+            scene_failures++;
+        }
+        else
+        {
+            scene_report->stages[STAGE_PARSE_XML] = parse_time;
 
-        return EXIT_FAILURE;
+            status = process_scene (&options, xml_filename, &xml_metadata,
+                                    &tests_params, &band_memory,
+                                    scene_report);
+            finish_scene_report (scene_report, status);
+            if (status == SCENE_SKIPPED)
+            {
+                scene_skips++;
+            }
+            else if (status != SUCCESS)
+            {
+                ERROR_MESSAGE ("Failed processing the scene", MODULE_NAME);
+                scene_failures++;
+            }
+        }
     }
-
-    if (add_dswe_band_product (xml_filename, use_toa_flag,
-                               PS_SC_PRODUCT_NAME, PS_SC_BAND_NAME,
-                               PS_SC_SHORT_NAME, PS_SC_LONG_NAME,
-                               DSWE_NOT_WATER, DSWE_CLOUD_CLOUD_SHADOW_SNOW,
-                               band_dswe_psccss)
-        != SUCCESS)
+    else
     {
-        ERROR_MESSAGE ("Failed adding DSWE PERCENT-SLOPE SHADOW CLOUD band"
-                       " product", MODULE_NAME);
+        /* ---------------------------------------------------------------- */
+        /* Each scene is processed from its own directory, so the slope
+           cache and the report need to be found from any of them */
+        if (make_path_absolute (&options.slope_cache_dir) != SUCCESS
+            || make_path_absolute (&report_filename) != SUCCESS)
+        {
+            ERROR_MESSAGE ("Failed determining the slope cache directory or"
+                           " the report file", MODULE_NAME);
 
-        /* Cleanup memory */
-        free (xml_filename);
+            /* Cleanup memory */
+            free (batch_filename);
+            free (recode_filename);
+            free (report_filename);
+            free (options.slope_cache_dir);
 
-        return EXIT_FAILURE;
-    }
+            return EXIT_FAILURE;
+        }
 
-    if (include_tests_flag)
-    {
-        if (add_test_band_product (xml_filename, use_toa_flag,
-                                   RAW_DIAG_PRODUCT_NAME, RAW_DIAG_BAND_NAME,
-                                   RAW_DIAG_SHORT_NAME, RAW_DIAG_LONG_NAME,
-                                   0, 11111, band_dswe_diag)
+        if (read_batch_manifest (batch_filename, &scene_filenames,
+                                 &scene_count)
             != SUCCESS)
         {
-            ERROR_MESSAGE ("Failed adding RAW TESTS DSWE band product",
+            ERROR_MESSAGE ("Failed reading the batch manifest",
                            MODULE_NAME);
 
             /* Cleanup memory */
-            free (xml_filename);
+            free (batch_filename);
+            free (recode_filename);
+            free (report_filename);
+            free (options.slope_cache_dir);
 
             return EXIT_FAILURE;
         }
-    }
 
-    if (include_ps_flag)
-    {
-        /* Convert to a scaled 16bit integer value */
-        for (index = 0; index < pixel_count; index++)
-        {
-            band_dswe_diag[index] = (int16_t)((band_ps[index] * 100.0) + 0.5);
-        }
+        /* The schema is parsed once for every scene, without it each
+           scene is validated the way a single scene is */
+        load_metadata_schema ();
 
-        if (add_ps_band_product (xml_filename, use_toa_flag,
-                                 PS_PRODUCT_NAME, PS_BAND_NAME,
-                                 PS_SHORT_NAME, PS_LONG_NAME,
-                                 0, 10000, band_dswe_diag)
-            != SUCCESS)
+        for (scene = 0; scene < scene_count; scene++)
         {
-            ERROR_MESSAGE ("Failed adding DSWE PERCENT-SLOPE band product",
-                           MODULE_NAME);
+            snprintf (msg, sizeof (msg), "Processing scene %d of %d: %s",
+                      scene + 1, scene_count, scene_filenames[scene]);
+            LOG_MESSAGE (msg, MODULE_NAME);
 
-            /* Cleanup memory */
-            free (xml_filename);
+            scene_report = add_scene_report (&run_report,
+                                             scene_filenames[scene]);
+            if (scene_report == NULL)
+            {
+                ERROR_MESSAGE ("Failed starting the scene report",
+                               MODULE_NAME);
+                scene_failures++;
+                continue;
+            }
 
-            return EXIT_FAILURE;
+            if (enter_scene_directory (scene_filenames[scene],
+                                       &scene_filename, &previous_dir_fd)
+                != SUCCESS)
+            {
+                ERROR_MESSAGE ("Failed changing to the scene directory",
+                               MODULE_NAME);
+                finish_scene_report (scene_report, ERROR);
+                scene_failures++;
+                continue;
+            }
+
+            /* Thresholds not given on the command line get the defaults
+               of the satellite of each scene */
+            scene_wigt = wigt;
+            scene_awgt = awgt;
+            scene_pswt_1 = pswt_1;
+            scene_pswt_2 = pswt_2;
+            scene_pswnt_1 = pswnt_1;
+            scene_pswnt_2 = pswnt_2;
+            scene_pswst_1 = pswst_1;
+            scene_pswst_2 = pswst_2;
+
+            start_stage_clock (false, &parse_clock);
+            status = get_scene_args (scene_filename, &xml_metadata,
+                                     &scene_wigt, &scene_awgt, &scene_pswt_1,
+                                     &scene_pswt_2, &scene_pswnt_1,
+                                     &scene_pswnt_2, &scene_pswst_1,
+                                     &scene_pswst_2);
+            stop_stage_clock (&parse_clock,
+                              &scene_report->stages[STAGE_PARSE_XML]);
+            if (status != SUCCESS)
+            {
+                ERROR_MESSAGE ("Failed reading the scene metadata",
+                               MODULE_NAME);
+                finish_scene_report (scene_report, ERROR);
+                scene_failures++;
+            }
+            else
+            {
+                set_test_thresholds (scene_filename, scene_wigt, scene_awgt,
+                                     scene_pswt_1, scene_pswt_2,
+                                     scene_pswnt_1, scene_pswnt_2,
+                                     scene_pswst_1, scene_pswst_2,
+                                     options.verbose_flag, &tests_params);
+
+                status = process_scene (&options, scene_filename,
+                                        &xml_metadata, &tests_params,
+                                        &band_memory, scene_report);
+                finish_scene_report (scene_report, status);
+                if (status == SCENE_SKIPPED)
+                {
+                    scene_skips++;
+                }
+                else if (status != SUCCESS)
+                {
+                    ERROR_MESSAGE ("Failed processing the scene",
+                                   MODULE_NAME);
+                    scene_failures++;
+                }
+            }
+            free (scene_filename);
+
+            /* Without the original directory the rest of the manifest can
+               not be found */
+            if (leave_scene_directory (previous_dir_fd) != SUCCESS)
+            {
+                ERROR_MESSAGE ("Failed returning from the scene directory",
+                               MODULE_NAME);
+                scene_failures += scene_count - scene - 1;
+                break;
+            }
         }
+
+        snprintf (msg, sizeof (msg), "Processed %d of %d scenes, %d skipped",
+                  scene_count - scene_failures - scene_skips, scene_count,
+                  scene_skips);
+        LOG_MESSAGE (msg, MODULE_NAME);
+
+        free_batch_manifest (scene_filenames, scene_count);
+        free_metadata_schema ();
     }
 
     /* CLEANUP & EXIT ----------------------------------------------------- */
 
-    /* Cleanup all the input band memory */
-    free_band_memory (band_blue, band_green, band_red, band_nir, band_swir1,
-                      band_swir2, band_elevation, band_cfmask, band_ps,
-                      band_dswe_diag, band_dswe_raw, band_dswe_ccss,
-                      band_dswe_psccss);
-    band_blue = NULL;
-    band_green = NULL;
-    band_red = NULL;
-    band_nir = NULL;
-    band_swir1 = NULL;
-    band_swir2 = NULL;
-    band_elevation = NULL;
-    band_cfmask = NULL;
-    band_ps = NULL;
-    band_dswe_diag = NULL;
-    band_dswe_raw = NULL;
-    band_dswe_ccss = NULL;
-    band_dswe_psccss = NULL;
+    /* Cleanup all the band memory */
+    free_band_memory (&band_memory);
+
+    /* The report covers every scene, including the ones which failed */
+    if (report_filename != NULL
+        && write_run_report (report_filename, &run_report,
+                             options.num_threads) != SUCCESS)
+    {
+        ERROR_MESSAGE ("Failed writing the run report", MODULE_NAME);
+        scene_failures++;
+    }
+    free_run_report (&run_report);
 
     /* Free remaining allocated memory */
     free (xml_filename);
+    free (batch_filename);
+    free (recode_filename);
+    free (report_filename);
+    free (options.slope_cache_dir);
+
+    if (scene_failures > 0)
+        return EXIT_FAILURE;
 
     LOG_MESSAGE ("Processing complete.", MODULE_NAME);
 
+    if (scene_skips > 0)
+        return EXIT_SKIPPED;
+
     return EXIT_SUCCESS;
 }
-
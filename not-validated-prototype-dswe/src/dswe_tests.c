@@ -0,0 +1,433 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+
+#include "dswe_tests.h"
+
+
+/*****************************************************************************
+  NAME:  scalar_tests
+
+  PURPOSE:  Performs the DSWE tests for each pixel one at a time and sets the
+            corresponding bit in the test results for each test that passes.
+            If any of the inputs are fill only the fill bit is set.
+
+  RETURN VALUE:  Type = None
+
+  NOTES:
+    1. This is the body of the reference implementation and its variants,
+       all of the SIMD implementations must produce identical results.
+    2. The thresholds are held in locals, since the stores of the test bits
+       could otherwise alias the parameters and reload them for each pixel.
+*****************************************************************************/
+static inline __attribute__ ((always_inline)) void
+scalar_tests
+(
+    const Dswe_Tests_Parameters_t *params, /* I: thresholds and fill */
+    Thresholds_Profile_e profile, /* I: thresholds to use */
+    bool equal_scale_flag,      /* I: the green and swir1 scale factors are
+                                      equal */
+    const int16_t *band_blue,   /* I: blue band pixels */
+    const int16_t *band_green,  /* I: green band pixels */
+    const int16_t *band_red,    /* I: red band pixels */
+    const int16_t *band_nir,    /* I: nir band pixels */
+    const int16_t *band_swir1,  /* I: swir1 band pixels */
+    const int16_t *band_swir2,  /* I: swir2 band pixels */
+    const uint8_t *band_cfmask, /* I: cfmask band pixels */
+    int pixel_count,            /* I: number of pixels to test */
+    uint8_t *band_tests         /* O: test bits for each pixel */
+)
+{
+    int index;
+    uint8_t tests;
+
+    float mndwi;                /* (green - swir1) / (green + swir1) */
+    float mbsrv;                /* (green + red) */
+    float mbsrn;                /* (nir + swir1) */
+    float awesh;                /* (blue
+                                   + (2.5 * green)
+                                   - (1.5 * MBSRN)
+                                   - (0.25 * bt)) */
+
+    float band_blue_float;
+    float band_green_float;
+    float band_red_float;
+    float band_nir_float;
+    float band_swir1_float;
+    float band_swir2_float;
+
+    float band_green_scaled;
+    float band_swir1_scaled;
+
+    const Dswe_Tests_Parameters_t *thresholds =
+        profile_thresholds (params, profile);
+    const float green_scale_factor = params->green_scale_factor;
+    const float swir1_scale_factor =
+        equal_scale_flag ? green_scale_factor : params->swir1_scale_factor;
+    const float wigt = thresholds->wigt;
+    const float awgt = thresholds->awgt;
+    const float pswt_1 = thresholds->pswt_1;
+    const float pswt_2 = thresholds->pswt_2;
+    const float pswnt_1 = thresholds->pswnt_1;
+    const float pswnt_2 = thresholds->pswnt_2;
+    const float pswst_1 = thresholds->pswst_1;
+    const float pswst_2 = thresholds->pswst_2;
+
+    for (index = 0; index < pixel_count; index++)
+    {
+        /* If any of the input is fill, make the output fill */
+        if (band_blue[index] == params->blue_fill_value ||
+            band_green[index] == params->green_fill_value ||
+            band_red[index] == params->red_fill_value ||
+            band_nir[index] == params->nir_fill_value ||
+            band_swir1[index] == params->swir1_fill_value ||
+            band_swir2[index] == params->swir2_fill_value ||
+            band_cfmask[index] == params->cfmask_fill_value)
+        {
+            band_tests[index] = DSWE_TEST_FILL;
+            continue;
+        }
+
+        /* Apply the scaling to these bands accordingly */
+        band_green_scaled = band_green[index] * green_scale_factor;
+        band_swir1_scaled = band_swir1[index] * swir1_scale_factor;
+
+        /* Just convert to float for now */
+        band_blue_float = band_blue[index];
+        band_green_float = band_green[index];
+        band_red_float = band_red[index];
+        band_nir_float = band_nir[index];
+        band_swir1_float = band_swir1[index];
+        band_swir2_float = band_swir2[index];
+
+        /* Modified Normalized Difference Wetness Index (MNDWI) */
+        mndwi = (band_green_scaled - band_swir1_scaled) /
+                (band_green_scaled + band_swir1_scaled);
+
+        /* Multi-band Spectral Relationship Visible (MBSRV) */
+        mbsrv = band_green_float + band_red_float;
+
+        /* Multi-band Spectral Relationship Near-Infrared (MBSRN) */
+        mbsrn = band_nir_float + band_swir1_float;
+
+        /* Automated Water Extent Shadow (AWEsh) */
+        awesh = (band_blue_float
+                 + (2.5 * band_green_float)
+                 - (1.5 * mbsrn)
+                 - (0.25 * band_swir2_float));
+
+        tests = 0;
+
+        if (mndwi > wigt)
+            tests |= DSWE_TEST_MNDWI;
+
+        if (mbsrv > mbsrn)
+            tests |= DSWE_TEST_MBSR;
+
+        if (awesh > awgt)
+            tests |= DSWE_TEST_AWESH;
+
+        /* Partial Surface Water 1 (PSW1) */
+        if (mndwi > pswt_1 &&
+            band_swir1_float < pswst_1 &&
+            band_nir_float < pswnt_1)
+        {
+            tests |= DSWE_TEST_PSW1;
+        }
+
+        /* Partial Surface Water 2 (PSW2) */
+        if (mndwi > pswt_2 &&
+            band_swir2_float < pswst_2 &&
+            band_nir_float < pswnt_2)
+        {
+            tests |= DSWE_TEST_PSW2;
+        }
+
+        band_tests[index] = tests;
+    }
+}
+
+
+/*****************************************************************************
+  NAME:  dswe_tests_scalar
+
+  PURPOSE:  Performs the DSWE tests one pixel at a time with any thresholds
+            and scale factors.
+
+  RETURN VALUE:  Type = None
+
+  NOTES:
+    1. This is the reference implementation, all of the SIMD implementations
+       must produce identical results.
+*****************************************************************************/
+void
+dswe_tests_scalar
+(
+    const Dswe_Tests_Parameters_t *params, /* I: thresholds and fill */
+    const int16_t *band_blue,   /* I: blue band pixels */
+    const int16_t *band_green,  /* I: green band pixels */
+    const int16_t *band_red,    /* I: red band pixels */
+    const int16_t *band_nir,    /* I: nir band pixels */
+    const int16_t *band_swir1,  /* I: swir1 band pixels */
+    const int16_t *band_swir2,  /* I: swir2 band pixels */
+    const uint8_t *band_cfmask, /* I: cfmask band pixels */
+    int pixel_count,            /* I: number of pixels to test */
+    uint8_t *band_tests         /* O: test bits for each pixel */
+)
+{
+    scalar_tests (params, THRESHOLDS_GENERIC, false, band_blue, band_green,
+                  band_red, band_nir, band_swir1, band_swir2, band_cfmask,
+                  pixel_count, band_tests);
+}
+
+
+/* The specialized variants of the scalar implementation */
+DSWE_TESTS_VARIANT (scalar_tests_equal_scale, scalar_tests,
+                    THRESHOLDS_GENERIC, true)
+DSWE_TESTS_VARIANT (scalar_tests_l47, scalar_tests, THRESHOLDS_L47, false)
+DSWE_TESTS_VARIANT (scalar_tests_l47_equal_scale, scalar_tests,
+                    THRESHOLDS_L47, true)
+DSWE_TESTS_VARIANT (scalar_tests_l8, scalar_tests, THRESHOLDS_L8, false)
+DSWE_TESTS_VARIANT (scalar_tests_l8_equal_scale, scalar_tests,
+                    THRESHOLDS_L8, true)
+
+const Dswe_Tests_Variants_t dswe_tests_scalar_variants = {
+    {dswe_tests_scalar, scalar_tests_equal_scale},
+    {scalar_tests_l47, scalar_tests_l47_equal_scale},
+    {scalar_tests_l8, scalar_tests_l8_equal_scale}
+};
+
+
+/*****************************************************************************
+  NAME:  cpu_supports_target
+
+  PURPOSE:  Determines if the processor supports the specified instruction
+            set and the tests were built for it.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      1        The instruction set can be used
+      0        The instruction set can not be used
+*****************************************************************************/
+static int
+cpu_supports_target
+(
+    Simd_Target_e target /* I: instruction set */
+)
+{
+    switch (target)
+    {
+        case SIMD_SCALAR:
+            return 1;
+#ifdef DSWE_SIMD_X86
+        case SIMD_SSE2:
+            __builtin_cpu_init ();
+            return __builtin_cpu_supports ("sse2");
+        case SIMD_AVX2:
+            __builtin_cpu_init ();
+            return __builtin_cpu_supports ("avx2");
+        case SIMD_AVX512:
+            __builtin_cpu_init ();
+            return __builtin_cpu_supports ("avx512f");
+#endif
+        default:
+            return 0;
+    }
+}
+
+
+/*****************************************************************************
+  NAME:  select_dswe_tests
+
+  PURPOSE:  Selects the implementation of the DSWE tests to use.  For
+            SIMD_AUTO the widest instruction set supported by the processor
+            is selected.
+
+  RETURN VALUE:  Type = Dswe_Tests_Function_t
+      Value    Description
+      -------  ---------------------------------------------------------------
+      NULL     The requested instruction set is not available
+      non-NULL The function implementing the tests
+*****************************************************************************/
+Dswe_Tests_Function_t
+select_dswe_tests
+(
+    Simd_Target_e requested_target, /* I: instruction set requested */
+    Simd_Target_e *selected_target  /* O: instruction set selected */
+)
+{
+    Simd_Target_e target = requested_target;
+
+    if (target == SIMD_AUTO)
+    {
+        if (cpu_supports_target (SIMD_AVX512))
+            target = SIMD_AVX512;
+        else if (cpu_supports_target (SIMD_AVX2))
+            target = SIMD_AVX2;
+        else if (cpu_supports_target (SIMD_SSE2))
+            target = SIMD_SSE2;
+        else
+            target = SIMD_SCALAR;
+    }
+
+    if (!cpu_supports_target (target))
+        return NULL;
+
+    *selected_target = target;
+
+    switch (target)
+    {
+#ifdef DSWE_SIMD_X86
+        case SIMD_SSE2:
+            return dswe_tests_sse2;
+        case SIMD_AVX2:
+            return dswe_tests_avx2;
+        case SIMD_AVX512:
+            return dswe_tests_avx512;
+#endif
+        default:
+            return dswe_tests_scalar;
+    }
+}
+
+
+/*****************************************************************************
+  NAME:  same_thresholds
+
+  PURPOSE:  Determines if two sets of parameters have the same thresholds.
+
+  RETURN VALUE:  Type = bool
+*****************************************************************************/
+static bool
+same_thresholds
+(
+    const Dswe_Tests_Parameters_t *params,    /* I: thresholds to compare */
+    const Dswe_Tests_Parameters_t *thresholds /* I: thresholds to compare */
+)
+{
+    return params->wigt == thresholds->wigt
+           && params->awgt == thresholds->awgt
+           && params->pswt_1 == thresholds->pswt_1
+           && params->pswt_2 == thresholds->pswt_2
+           && params->pswnt_1 == thresholds->pswnt_1
+           && params->pswnt_2 == thresholds->pswnt_2
+           && params->pswst_1 == thresholds->pswst_1
+           && params->pswst_2 == thresholds->pswst_2;
+}
+
+
+/*****************************************************************************
+  NAME:  select_dswe_tests_variant
+
+  PURPOSE:  Selects the variant of the implementation of the DSWE tests
+            specialized for the thresholds and scale factors of a scene.
+            The thresholds of a sensor profile are constants in its variant,
+            and the variant for equal scale factors uses a single one.
+
+  RETURN VALUE:  Type = Dswe_Tests_Function_t
+      The function implementing the tests for the scene.
+
+  NOTES:
+    1. A scene using the default thresholds of either sensor gets the
+       variant of that profile, whichever sensor it is from, since the
+       results only depend on the values of the thresholds.
+*****************************************************************************/
+Dswe_Tests_Function_t
+select_dswe_tests_variant
+(
+    Simd_Target_e target,
+    const Dswe_Tests_Parameters_t *params,
+    Thresholds_Profile_e *profile,
+    bool *equal_scale_flag
+)
+{
+    const Dswe_Tests_Variants_t *variants;
+
+    if (same_thresholds (params, profile_thresholds (params, THRESHOLDS_L8)))
+        *profile = THRESHOLDS_L8;
+    else if (same_thresholds (params,
+                              profile_thresholds (params, THRESHOLDS_L47)))
+        *profile = THRESHOLDS_L47;
+    else
+        *profile = THRESHOLDS_GENERIC;
+
+    *equal_scale_flag =
+        params->green_scale_factor == params->swir1_scale_factor;
+
+    switch (target)
+    {
+#ifdef DSWE_SIMD_X86
+        case SIMD_SSE2:
+            variants = &dswe_tests_sse2_variants;
+            break;
+        case SIMD_AVX2:
+            variants = &dswe_tests_avx2_variants;
+            break;
+        case SIMD_AVX512:
+            variants = &dswe_tests_avx512_variants;
+            break;
+#endif
+        default:
+            variants = &dswe_tests_scalar_variants;
+            break;
+    }
+
+    return (*variants)[*profile][*equal_scale_flag ? 1 : 0];
+}
+
+
+/*****************************************************************************
+  NAME:  thresholds_profile_name
+
+  PURPOSE:  Provides the name of a thresholds profile for messages.
+
+  RETURN VALUE:  Type = const char *
+*****************************************************************************/
+const char *
+thresholds_profile_name
+(
+    Thresholds_Profile_e profile /* I: thresholds profile */
+)
+{
+    switch (profile)
+    {
+        case THRESHOLDS_L47:
+            return "L4-7 default";
+        case THRESHOLDS_L8:
+            return "L8 default";
+        default:
+            return "generic";
+    }
+}
+
+
+/*****************************************************************************
+  NAME:  simd_target_name
+
+  PURPOSE:  Provides the name of the instruction set as used on the command
+            line.
+
+  RETURN VALUE:  Type = const char *
+*****************************************************************************/
+const char *
+simd_target_name
+(
+    Simd_Target_e target /* I: instruction set */
+)
+{
+    switch (target)
+    {
+        case SIMD_AUTO:
+            return "auto";
+        case SIMD_SSE2:
+            return "sse2";
+        case SIMD_AVX2:
+            return "avx2";
+        case SIMD_AVX512:
+            return "avx512";
+        default:
+            return "scalar";
+    }
+}
@@ -0,0 +1,283 @@
+#ifndef DSWE_TESTS_H
+#define DSWE_TESTS_H
+
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+/* Bits set in the test results for a pixel, one for each of the DSWE tests
+   which correspond to the digits of the raw DSWE tests value */
+#define DSWE_TEST_MNDWI 0x01 /* MNDWI > wigt, the ones digit */
+#define DSWE_TEST_MBSR  0x02 /* MBSRV > MBSRN, the tens digit */
+#define DSWE_TEST_AWESH 0x04 /* AWEsh > awgt, the hundreds digit */
+#define DSWE_TEST_PSW1  0x08 /* Partial Surface Water 1, the thousands digit */
+#define DSWE_TEST_PSW2  0x10 /* Partial Surface Water 2, the ten thousands
+                                digit */
+#define DSWE_TEST_FILL  0x20 /* One of the inputs is fill, no tests were
+                                performed */
+
+/* Number of different combinations of the test bits, not including fill */
+#define DSWE_TEST_COMBINATIONS 32
+
+
+/* The thresholds and input information needed by the tests */
+typedef struct
+{
+    float green_scale_factor;
+    float swir1_scale_factor;
+
+    float wigt;
+    float awgt;
+    float pswt_1;
+    float pswt_2;
+    float pswnt_1;  /* The integer thresholds are compared as floats */
+    float pswnt_2;
+    float pswst_1;
+    float pswst_2;
+
+    int16_t blue_fill_value;
+    int16_t green_fill_value;
+    int16_t red_fill_value;
+    int16_t nir_fill_value;
+    int16_t swir1_fill_value;
+    int16_t swir2_fill_value;
+    uint8_t cfmask_fill_value;
+} Dswe_Tests_Parameters_t;
+
+
+/* The default thresholds of each sensor, which the tests have variants
+   with as constants */
+#define DSWE_L47_WIGT 0.0123f
+#define DSWE_L47_AWGT 0.0f
+#define DSWE_L47_PSWT_1 -0.5f
+#define DSWE_L47_PSWT_2 -0.5f
+#define DSWE_L47_PSWNT_1 1500
+#define DSWE_L47_PSWNT_2 2000
+#define DSWE_L47_PSWST_1 1000
+#define DSWE_L47_PSWST_2 1000
+
+#define DSWE_L8_WIGT 0.1163f
+#define DSWE_L8_AWGT 0.0f
+#define DSWE_L8_PSWT_1 -0.67f
+#define DSWE_L8_PSWT_2 -0.67f
+#define DSWE_L8_PSWNT_1 1500
+#define DSWE_L8_PSWNT_2 2000
+#define DSWE_L8_PSWST_1 1000
+#define DSWE_L8_PSWST_2 1000
+
+
+/* The thresholds the variants of the tests are specialized for */
+typedef enum
+{
+    THRESHOLDS_GENERIC, /* Any thresholds, from the parameters */
+    THRESHOLDS_L47,     /* The L4-7 defaults */
+    THRESHOLDS_L8,      /* The L8 defaults */
+    MAX_THRESHOLDS_PROFILES
+} Thresholds_Profile_e;
+
+
+/*****************************************************************************
+  NAME:  profile_thresholds
+
+  PURPOSE:  Provides the thresholds of a profile, which are the parameters
+            for the generic profile.  The bodies of the implementations of
+            the tests are inlined into a variant for each profile, so the
+            thresholds of the sensor profiles become constants.
+
+  RETURN VALUE:  Type = const Dswe_Tests_Parameters_t *
+      Only the thresholds are set for the sensor profiles.
+*****************************************************************************/
+static inline const Dswe_Tests_Parameters_t *
+profile_thresholds
+(
+    const Dswe_Tests_Parameters_t *params, /* I: thresholds and fill */
+    Thresholds_Profile_e profile           /* I: thresholds to provide */
+)
+{
+    static const Dswe_Tests_Parameters_t l47_thresholds = {
+        .wigt = DSWE_L47_WIGT, .awgt = DSWE_L47_AWGT,
+        .pswt_1 = DSWE_L47_PSWT_1, .pswt_2 = DSWE_L47_PSWT_2,
+        .pswnt_1 = DSWE_L47_PSWNT_1, .pswnt_2 = DSWE_L47_PSWNT_2,
+        .pswst_1 = DSWE_L47_PSWST_1, .pswst_2 = DSWE_L47_PSWST_2
+    };
+    static const Dswe_Tests_Parameters_t l8_thresholds = {
+        .wigt = DSWE_L8_WIGT, .awgt = DSWE_L8_AWGT,
+        .pswt_1 = DSWE_L8_PSWT_1, .pswt_2 = DSWE_L8_PSWT_2,
+        .pswnt_1 = DSWE_L8_PSWNT_1, .pswnt_2 = DSWE_L8_PSWNT_2,
+        .pswst_1 = DSWE_L8_PSWST_1, .pswst_2 = DSWE_L8_PSWST_2
+    };
+
+    switch (profile)
+    {
+        case THRESHOLDS_L47:
+            return &l47_thresholds;
+        case THRESHOLDS_L8:
+            return &l8_thresholds;
+        default:
+            return params;
+    }
+}
+
+
+/* Instruction sets the tests are available for */
+typedef enum
+{
+    SIMD_AUTO,  /* Select the best one supported by the processor */
+    SIMD_SCALAR,
+    SIMD_SSE2,
+    SIMD_AVX2,
+    SIMD_AVX512
+} Simd_Target_e;
+
+
+/* All of the implementations of the tests have this signature */
+typedef void (*Dswe_Tests_Function_t)
+(
+    const Dswe_Tests_Parameters_t *params, /* I: thresholds and fill */
+    const int16_t *band_blue,   /* I: blue band pixels */
+    const int16_t *band_green,  /* I: green band pixels */
+    const int16_t *band_red,    /* I: red band pixels */
+    const int16_t *band_nir,    /* I: nir band pixels */
+    const int16_t *band_swir1,  /* I: swir1 band pixels */
+    const int16_t *band_swir2,  /* I: swir2 band pixels */
+    const uint8_t *band_cfmask, /* I: cfmask band pixels */
+    int pixel_count,            /* I: number of pixels to test */
+    uint8_t *band_tests         /* O: test bits for each pixel */
+);
+
+
+/* Defines a variant of an implementation of the tests, which calls the
+   inlined body of the implementation with the thresholds profile and
+   whether the green and swir1 scale factors are equal */
+#define DSWE_TESTS_VARIANT(name, body, profile, equal_scale_flag)          \
+    static void                                                           \
+    name                                                                  \
+    (                                                                     \
+        const Dswe_Tests_Parameters_t *params,                            \
+        const int16_t *band_blue,                                         \
+        const int16_t *band_green,                                        \
+        const int16_t *band_red,                                          \
+        const int16_t *band_nir,                                          \
+        const int16_t *band_swir1,                                        \
+        const int16_t *band_swir2,                                        \
+        const uint8_t *band_cfmask,                                       \
+        int pixel_count,                                                  \
+        uint8_t *band_tests                                               \
+    )                                                                     \
+    {                                                                     \
+        body (params, profile, equal_scale_flag, band_blue, band_green,   \
+              band_red, band_nir, band_swir1, band_swir2, band_cfmask,    \
+              pixel_count, band_tests);                                   \
+    }
+
+
+/* The variants of an implementation, by thresholds profile and then by
+   whether the green and swir1 scale factors are equal */
+typedef Dswe_Tests_Function_t
+    Dswe_Tests_Variants_t[MAX_THRESHOLDS_PROFILES][2];
+
+
+void dswe_tests_scalar
+(
+    const Dswe_Tests_Parameters_t *params, /* I: thresholds and fill */
+    const int16_t *band_blue,   /* I: blue band pixels */
+    const int16_t *band_green,  /* I: green band pixels */
+    const int16_t *band_red,    /* I: red band pixels */
+    const int16_t *band_nir,    /* I: nir band pixels */
+    const int16_t *band_swir1,  /* I: swir1 band pixels */
+    const int16_t *band_swir2,  /* I: swir2 band pixels */
+    const uint8_t *band_cfmask, /* I: cfmask band pixels */
+    int pixel_count,            /* I: number of pixels to test */
+    uint8_t *band_tests         /* O: test bits for each pixel */
+);
+
+
+extern const Dswe_Tests_Variants_t dswe_tests_scalar_variants;
+
+
+#ifdef DSWE_SIMD_X86
+void dswe_tests_sse2
+(
+    const Dswe_Tests_Parameters_t *params, /* I: thresholds and fill */
+    const int16_t *band_blue,   /* I: blue band pixels */
+    const int16_t *band_green,  /* I: green band pixels */
+    const int16_t *band_red,    /* I: red band pixels */
+    const int16_t *band_nir,    /* I: nir band pixels */
+    const int16_t *band_swir1,  /* I: swir1 band pixels */
+    const int16_t *band_swir2,  /* I: swir2 band pixels */
+    const uint8_t *band_cfmask, /* I: cfmask band pixels */
+    int pixel_count,            /* I: number of pixels to test */
+    uint8_t *band_tests         /* O: test bits for each pixel */
+);
+
+
+void dswe_tests_avx2
+(
+    const Dswe_Tests_Parameters_t *params, /* I: thresholds and fill */
+    const int16_t *band_blue,   /* I: blue band pixels */
+    const int16_t *band_green,  /* I: green band pixels */
+    const int16_t *band_red,    /* I: red band pixels */
+    const int16_t *band_nir,    /* I: nir band pixels */
+    const int16_t *band_swir1,  /* I: swir1 band pixels */
+    const int16_t *band_swir2,  /* I: swir2 band pixels */
+    const uint8_t *band_cfmask, /* I: cfmask band pixels */
+    int pixel_count,            /* I: number of pixels to test */
+    uint8_t *band_tests         /* O: test bits for each pixel */
+);
+
+
+void dswe_tests_avx512
+(
+    const Dswe_Tests_Parameters_t *params, /* I: thresholds and fill */
+    const int16_t *band_blue,   /* I: blue band pixels */
+    const int16_t *band_green,  /* I: green band pixels */
+    const int16_t *band_red,    /* I: red band pixels */
+    const int16_t *band_nir,    /* I: nir band pixels */
+    const int16_t *band_swir1,  /* I: swir1 band pixels */
+    const int16_t *band_swir2,  /* I: swir2 band pixels */
+    const uint8_t *band_cfmask, /* I: cfmask band pixels */
+    int pixel_count,            /* I: number of pixels to test */
+    uint8_t *band_tests         /* O: test bits for each pixel */
+);
+
+
+extern const Dswe_Tests_Variants_t dswe_tests_sse2_variants;
+extern const Dswe_Tests_Variants_t dswe_tests_avx2_variants;
+extern const Dswe_Tests_Variants_t dswe_tests_avx512_variants;
+#endif
+
+
+Dswe_Tests_Function_t select_dswe_tests
+(
+    Simd_Target_e requested_target, /* I: instruction set requested */
+    Simd_Target_e *selected_target  /* O: instruction set selected */
+);
+
+
+Dswe_Tests_Function_t select_dswe_tests_variant
+(
+    Simd_Target_e target,                  /* I: instruction set selected
+                                                 by select_dswe_tests */
+    const Dswe_Tests_Parameters_t *params, /* I: thresholds and scale
+                                                 factors of the scene */
+    Thresholds_Profile_e *profile,         /* O: thresholds profile of the
+                                                 variant */
+    bool *equal_scale_flag                 /* O: the variant is for equal
+                                                 scale factors */
+);
+
+
+const char *thresholds_profile_name
+(
+    Thresholds_Profile_e profile /* I: thresholds profile */
+);
+
+
+const char *simd_target_name
+(
+    Simd_Target_e target /* I: instruction set */
+);
+
+
+#endif /* DSWE_TESTS_H */
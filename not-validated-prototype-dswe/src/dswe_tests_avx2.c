@@ -0,0 +1,239 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+
+#include "dswe_tests.h"
+
+
+#ifdef DSWE_SIMD_X86
+
+
+#include <immintrin.h>
+
+
+/* Load eight 16bit pixels sign extended to 32bit */
+#define LOAD_EPI16(p) \
+    _mm256_cvtepi16_epi32 (_mm_loadu_si128 ((const __m128i *) (p)))
+
+
+/*****************************************************************************
+  NAME:  avx2_tests
+
+  PURPOSE:  Performs the DSWE tests eight pixels at a time using AVX2.
+
+  RETURN VALUE:  Type = None
+
+  NOTES:
+    1. This is the body of the implementation and its variants.
+    2. AWEsh is computed as an integer scaled by four.  All of its terms are
+       multiples of 0.25 and fit in a float, so the float conversion is exact
+       and matches the scalar implementation.
+*****************************************************************************/
+static inline __attribute__ ((always_inline)) void
+avx2_tests
+(
+    const Dswe_Tests_Parameters_t *params, /* I: thresholds and fill */
+    Thresholds_Profile_e profile, /* I: thresholds to use */
+    bool equal_scale_flag,      /* I: the green and swir1 scale factors are
+                                      equal */
+    const int16_t *band_blue,   /* I: blue band pixels */
+    const int16_t *band_green,  /* I: green band pixels */
+    const int16_t *band_red,    /* I: red band pixels */
+    const int16_t *band_nir,    /* I: nir band pixels */
+    const int16_t *band_swir1,  /* I: swir1 band pixels */
+    const int16_t *band_swir2,  /* I: swir2 band pixels */
+    const uint8_t *band_cfmask, /* I: cfmask band pixels */
+    int pixel_count,            /* I: number of pixels to test */
+    uint8_t *band_tests         /* O: test bits for each pixel */
+)
+{
+    int index;
+    __m256i blue;
+    __m256i green;
+    __m256i red;
+    __m256i nir;
+    __m256i swir1;
+    __m256i swir2;
+    __m256i cfmask;
+    __m256i fill;
+    __m256i mbsrn_int;
+    __m256i awesh_x4;
+    __m256i tests;
+    __m256 green_float;
+    __m256 red_float;
+    __m256 nir_float;
+    __m256 swir1_float;
+    __m256 swir2_float;
+    __m256 green_scaled;
+    __m256 swir1_scaled;
+    __m256 mndwi;
+    __m256 mbsrv;
+    __m256 mbsrn;
+    __m256 awesh;
+    __m256 psw;
+    __m128i packed;
+
+    const Dswe_Tests_Parameters_t *thresholds =
+        profile_thresholds (params, profile);
+    const __m256 green_scale_factor =
+        _mm256_set1_ps (params->green_scale_factor);
+    const __m256 swir1_scale_factor = equal_scale_flag ? green_scale_factor
+        : _mm256_set1_ps (params->swir1_scale_factor);
+    const __m256 wigt = _mm256_set1_ps (thresholds->wigt);
+    const __m256 awgt = _mm256_set1_ps (thresholds->awgt);
+    const __m256 pswt_1 = _mm256_set1_ps (thresholds->pswt_1);
+    const __m256 pswt_2 = _mm256_set1_ps (thresholds->pswt_2);
+    const __m256 pswnt_1 = _mm256_set1_ps (thresholds->pswnt_1);
+    const __m256 pswnt_2 = _mm256_set1_ps (thresholds->pswnt_2);
+    const __m256 pswst_1 = _mm256_set1_ps (thresholds->pswst_1);
+    const __m256 pswst_2 = _mm256_set1_ps (thresholds->pswst_2);
+
+    for (index = 0; index + 8 <= pixel_count; index += 8)
+    {
+        blue = LOAD_EPI16 (&band_blue[index]);
+        green = LOAD_EPI16 (&band_green[index]);
+        red = LOAD_EPI16 (&band_red[index]);
+        nir = LOAD_EPI16 (&band_nir[index]);
+        swir1 = LOAD_EPI16 (&band_swir1[index]);
+        swir2 = LOAD_EPI16 (&band_swir2[index]);
+        cfmask = _mm256_cvtepu8_epi32 (
+            _mm_loadl_epi64 ((const __m128i *) &band_cfmask[index]));
+
+        /* If any of the input is fill, make the output fill */
+        fill = _mm256_cmpeq_epi32 (blue,
+            _mm256_set1_epi32 (params->blue_fill_value));
+        fill = _mm256_or_si256 (fill, _mm256_cmpeq_epi32 (green,
+            _mm256_set1_epi32 (params->green_fill_value)));
+        fill = _mm256_or_si256 (fill, _mm256_cmpeq_epi32 (red,
+            _mm256_set1_epi32 (params->red_fill_value)));
+        fill = _mm256_or_si256 (fill, _mm256_cmpeq_epi32 (nir,
+            _mm256_set1_epi32 (params->nir_fill_value)));
+        fill = _mm256_or_si256 (fill, _mm256_cmpeq_epi32 (swir1,
+            _mm256_set1_epi32 (params->swir1_fill_value)));
+        fill = _mm256_or_si256 (fill, _mm256_cmpeq_epi32 (swir2,
+            _mm256_set1_epi32 (params->swir2_fill_value)));
+        fill = _mm256_or_si256 (fill, _mm256_cmpeq_epi32 (cfmask,
+            _mm256_set1_epi32 (params->cfmask_fill_value)));
+
+        green_float = _mm256_cvtepi32_ps (green);
+        red_float = _mm256_cvtepi32_ps (red);
+        nir_float = _mm256_cvtepi32_ps (nir);
+        swir1_float = _mm256_cvtepi32_ps (swir1);
+        swir2_float = _mm256_cvtepi32_ps (swir2);
+
+        green_scaled = _mm256_mul_ps (green_float, green_scale_factor);
+        swir1_scaled = _mm256_mul_ps (swir1_float, swir1_scale_factor);
+
+        /* Modified Normalized Difference Wetness Index (MNDWI) */
+        mndwi = _mm256_div_ps (_mm256_sub_ps (green_scaled, swir1_scaled),
+                               _mm256_add_ps (green_scaled, swir1_scaled));
+
+        /* Multi-band Spectral Relationship Visible and Near-Infrared */
+        mbsrv = _mm256_add_ps (green_float, red_float);
+        mbsrn = _mm256_add_ps (nir_float, swir1_float);
+
+        /* Automated Water Extent Shadow (AWEsh)
+           4 * blue + 10 * green - 6 * mbsrn - swir2 */
+        mbsrn_int = _mm256_add_epi32 (nir, swir1);
+        awesh_x4 = _mm256_slli_epi32 (blue, 2);
+        awesh_x4 = _mm256_add_epi32 (awesh_x4,
+            _mm256_mullo_epi32 (green, _mm256_set1_epi32 (10)));
+        awesh_x4 = _mm256_sub_epi32 (awesh_x4,
+            _mm256_mullo_epi32 (mbsrn_int, _mm256_set1_epi32 (6)));
+        awesh_x4 = _mm256_sub_epi32 (awesh_x4, swir2);
+        awesh = _mm256_mul_ps (_mm256_cvtepi32_ps (awesh_x4),
+                               _mm256_set1_ps (0.25f));
+
+        tests = _mm256_and_si256 (
+            _mm256_castps_si256 (_mm256_cmp_ps (mndwi, wigt, _CMP_GT_OQ)),
+            _mm256_set1_epi32 (DSWE_TEST_MNDWI));
+
+        tests = _mm256_or_si256 (tests, _mm256_and_si256 (
+            _mm256_castps_si256 (_mm256_cmp_ps (mbsrv, mbsrn, _CMP_GT_OQ)),
+            _mm256_set1_epi32 (DSWE_TEST_MBSR)));
+
+        tests = _mm256_or_si256 (tests, _mm256_and_si256 (
+            _mm256_castps_si256 (_mm256_cmp_ps (awesh, awgt, _CMP_GT_OQ)),
+            _mm256_set1_epi32 (DSWE_TEST_AWESH)));
+
+        /* Partial Surface Water 1 (PSW1) */
+        psw = _mm256_and_ps (_mm256_cmp_ps (mndwi, pswt_1, _CMP_GT_OQ),
+            _mm256_and_ps (_mm256_cmp_ps (swir1_float, pswst_1, _CMP_LT_OQ),
+                           _mm256_cmp_ps (nir_float, pswnt_1, _CMP_LT_OQ)));
+        tests = _mm256_or_si256 (tests, _mm256_and_si256 (
+            _mm256_castps_si256 (psw), _mm256_set1_epi32 (DSWE_TEST_PSW1)));
+
+        /* Partial Surface Water 2 (PSW2) */
+        psw = _mm256_and_ps (_mm256_cmp_ps (mndwi, pswt_2, _CMP_GT_OQ),
+            _mm256_and_ps (_mm256_cmp_ps (swir2_float, pswst_2, _CMP_LT_OQ),
+                           _mm256_cmp_ps (nir_float, pswnt_2, _CMP_LT_OQ)));
+        tests = _mm256_or_si256 (tests, _mm256_and_si256 (
+            _mm256_castps_si256 (psw), _mm256_set1_epi32 (DSWE_TEST_PSW2)));
+
+        /* Fill pixels only get the fill bit */
+        tests = _mm256_blendv_epi8 (tests,
+                                    _mm256_set1_epi32 (DSWE_TEST_FILL), fill);
+
+        /* Narrow the eight 32bit results to bytes */
+        packed = _mm_packs_epi32 (_mm256_castsi256_si128 (tests),
+                                  _mm256_extracti128_si256 (tests, 1));
+        _mm_storel_epi64 ((__m128i *) &band_tests[index],
+                          _mm_packus_epi16 (packed, packed));
+    }
+
+    /* Finish the remaining pixels with the same variant of the scalar
+       implementation */
+    dswe_tests_scalar_variants[profile][equal_scale_flag ? 1 : 0] (params,
+        &band_blue[index], &band_green[index], &band_red[index],
+        &band_nir[index], &band_swir1[index], &band_swir2[index],
+        &band_cfmask[index], pixel_count - index, &band_tests[index]);
+}
+
+
+/*****************************************************************************
+  NAME:  dswe_tests_avx2
+
+  PURPOSE:  Performs the DSWE tests eight pixels at a time using AVX2 with any
+            thresholds and scale factors.
+
+  RETURN VALUE:  Type = None
+*****************************************************************************/
+void
+dswe_tests_avx2
+(
+    const Dswe_Tests_Parameters_t *params, /* I: thresholds and fill */
+    const int16_t *band_blue,   /* I: blue band pixels */
+    const int16_t *band_green,  /* I: green band pixels */
+    const int16_t *band_red,    /* I: red band pixels */
+    const int16_t *band_nir,    /* I: nir band pixels */
+    const int16_t *band_swir1,  /* I: swir1 band pixels */
+    const int16_t *band_swir2,  /* I: swir2 band pixels */
+    const uint8_t *band_cfmask, /* I: cfmask band pixels */
+    int pixel_count,            /* I: number of pixels to test */
+    uint8_t *band_tests         /* O: test bits for each pixel */
+)
+{
+    avx2_tests (params, THRESHOLDS_GENERIC, false, band_blue, band_green,
+                band_red, band_nir, band_swir1, band_swir2, band_cfmask,
+                pixel_count, band_tests);
+}
+
+
+/* The specialized variants of the AVX2 implementation */
+DSWE_TESTS_VARIANT (avx2_tests_equal_scale, avx2_tests,
+                    THRESHOLDS_GENERIC, true)
+DSWE_TESTS_VARIANT (avx2_tests_l47, avx2_tests, THRESHOLDS_L47, false)
+DSWE_TESTS_VARIANT (avx2_tests_l47_equal_scale, avx2_tests,
+                    THRESHOLDS_L47, true)
+DSWE_TESTS_VARIANT (avx2_tests_l8, avx2_tests, THRESHOLDS_L8, false)
+DSWE_TESTS_VARIANT (avx2_tests_l8_equal_scale, avx2_tests,
+                    THRESHOLDS_L8, true)
+
+const Dswe_Tests_Variants_t dswe_tests_avx2_variants = {
+    {dswe_tests_avx2, avx2_tests_equal_scale},
+    {avx2_tests_l47, avx2_tests_l47_equal_scale},
+    {avx2_tests_l8, avx2_tests_l8_equal_scale}
+};
+
+
+#endif /* DSWE_SIMD_X86 */
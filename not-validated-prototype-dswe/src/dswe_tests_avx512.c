@@ -0,0 +1,236 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+
+#include "dswe_tests.h"
+
+
+#ifdef DSWE_SIMD_X86
+
+
+#include <immintrin.h>
+
+
+/* Load sixteen 16bit pixels sign extended to 32bit */
+#define LOAD_EPI16(p) \
+    _mm512_cvtepi16_epi32 (_mm256_loadu_si256 ((const __m256i *) (p)))
+
+
+/*****************************************************************************
+  NAME:  avx512_tests
+
+  PURPOSE:  Performs the DSWE tests sixteen pixels at a time using AVX-512F.
+
+  RETURN VALUE:  Type = None
+
+  NOTES:
+    1. This is the body of the implementation and its variants.
+    2. AWEsh is computed as an integer scaled by four.  All of its terms are
+       multiples of 0.25 and fit in a float, so the float conversion is exact
+       and matches the scalar implementation.
+*****************************************************************************/
+static inline __attribute__ ((always_inline)) void
+avx512_tests
+(
+    const Dswe_Tests_Parameters_t *params, /* I: thresholds and fill */
+    Thresholds_Profile_e profile, /* I: thresholds to use */
+    bool equal_scale_flag,      /* I: the green and swir1 scale factors are
+                                      equal */
+    const int16_t *band_blue,   /* I: blue band pixels */
+    const int16_t *band_green,  /* I: green band pixels */
+    const int16_t *band_red,    /* I: red band pixels */
+    const int16_t *band_nir,    /* I: nir band pixels */
+    const int16_t *band_swir1,  /* I: swir1 band pixels */
+    const int16_t *band_swir2,  /* I: swir2 band pixels */
+    const uint8_t *band_cfmask, /* I: cfmask band pixels */
+    int pixel_count,            /* I: number of pixels to test */
+    uint8_t *band_tests         /* O: test bits for each pixel */
+)
+{
+    int index;
+    __m512i blue;
+    __m512i green;
+    __m512i red;
+    __m512i nir;
+    __m512i swir1;
+    __m512i swir2;
+    __m512i cfmask;
+    __m512i mbsrn_int;
+    __m512i awesh_x4;
+    __m512i tests;
+    __m512 green_float;
+    __m512 red_float;
+    __m512 nir_float;
+    __m512 swir1_float;
+    __m512 swir2_float;
+    __m512 green_scaled;
+    __m512 swir1_scaled;
+    __m512 mndwi;
+    __m512 mbsrv;
+    __m512 mbsrn;
+    __m512 awesh;
+    __mmask16 fill;
+    __mmask16 psw;
+
+    const Dswe_Tests_Parameters_t *thresholds =
+        profile_thresholds (params, profile);
+    const __m512 green_scale_factor =
+        _mm512_set1_ps (params->green_scale_factor);
+    const __m512 swir1_scale_factor = equal_scale_flag ? green_scale_factor
+        : _mm512_set1_ps (params->swir1_scale_factor);
+    const __m512 wigt = _mm512_set1_ps (thresholds->wigt);
+    const __m512 awgt = _mm512_set1_ps (thresholds->awgt);
+    const __m512 pswt_1 = _mm512_set1_ps (thresholds->pswt_1);
+    const __m512 pswt_2 = _mm512_set1_ps (thresholds->pswt_2);
+    const __m512 pswnt_1 = _mm512_set1_ps (thresholds->pswnt_1);
+    const __m512 pswnt_2 = _mm512_set1_ps (thresholds->pswnt_2);
+    const __m512 pswst_1 = _mm512_set1_ps (thresholds->pswst_1);
+    const __m512 pswst_2 = _mm512_set1_ps (thresholds->pswst_2);
+
+    for (index = 0; index + 16 <= pixel_count; index += 16)
+    {
+        blue = LOAD_EPI16 (&band_blue[index]);
+        green = LOAD_EPI16 (&band_green[index]);
+        red = LOAD_EPI16 (&band_red[index]);
+        nir = LOAD_EPI16 (&band_nir[index]);
+        swir1 = LOAD_EPI16 (&band_swir1[index]);
+        swir2 = LOAD_EPI16 (&band_swir2[index]);
+        cfmask = _mm512_cvtepu8_epi32 (
+            _mm_loadu_si128 ((const __m128i *) &band_cfmask[index]));
+
+        /* If any of the input is fill, make the output fill */
+        fill = _mm512_cmpeq_epi32_mask (blue,
+                   _mm512_set1_epi32 (params->blue_fill_value))
+             | _mm512_cmpeq_epi32_mask (green,
+                   _mm512_set1_epi32 (params->green_fill_value))
+             | _mm512_cmpeq_epi32_mask (red,
+                   _mm512_set1_epi32 (params->red_fill_value))
+             | _mm512_cmpeq_epi32_mask (nir,
+                   _mm512_set1_epi32 (params->nir_fill_value))
+             | _mm512_cmpeq_epi32_mask (swir1,
+                   _mm512_set1_epi32 (params->swir1_fill_value))
+             | _mm512_cmpeq_epi32_mask (swir2,
+                   _mm512_set1_epi32 (params->swir2_fill_value))
+             | _mm512_cmpeq_epi32_mask (cfmask,
+                   _mm512_set1_epi32 (params->cfmask_fill_value));
+
+        green_float = _mm512_cvtepi32_ps (green);
+        red_float = _mm512_cvtepi32_ps (red);
+        nir_float = _mm512_cvtepi32_ps (nir);
+        swir1_float = _mm512_cvtepi32_ps (swir1);
+        swir2_float = _mm512_cvtepi32_ps (swir2);
+
+        green_scaled = _mm512_mul_ps (green_float, green_scale_factor);
+        swir1_scaled = _mm512_mul_ps (swir1_float, swir1_scale_factor);
+
+        /* Modified Normalized Difference Wetness Index (MNDWI) */
+        mndwi = _mm512_div_ps (_mm512_sub_ps (green_scaled, swir1_scaled),
+                               _mm512_add_ps (green_scaled, swir1_scaled));
+
+        /* Multi-band Spectral Relationship Visible and Near-Infrared */
+        mbsrv = _mm512_add_ps (green_float, red_float);
+        mbsrn = _mm512_add_ps (nir_float, swir1_float);
+
+        /* Automated Water Extent Shadow (AWEsh)
+           4 * blue + 10 * green - 6 * mbsrn - swir2 */
+        mbsrn_int = _mm512_add_epi32 (nir, swir1);
+        awesh_x4 = _mm512_slli_epi32 (blue, 2);
+        awesh_x4 = _mm512_add_epi32 (awesh_x4,
+            _mm512_mullo_epi32 (green, _mm512_set1_epi32 (10)));
+        awesh_x4 = _mm512_sub_epi32 (awesh_x4,
+            _mm512_mullo_epi32 (mbsrn_int, _mm512_set1_epi32 (6)));
+        awesh_x4 = _mm512_sub_epi32 (awesh_x4, swir2);
+        awesh = _mm512_mul_ps (_mm512_cvtepi32_ps (awesh_x4),
+                               _mm512_set1_ps (0.25f));
+
+        tests = _mm512_maskz_mov_epi32 (
+            _mm512_cmp_ps_mask (mndwi, wigt, _CMP_GT_OQ),
+            _mm512_set1_epi32 (DSWE_TEST_MNDWI));
+
+        tests = _mm512_mask_or_epi32 (tests,
+            _mm512_cmp_ps_mask (mbsrv, mbsrn, _CMP_GT_OQ),
+            tests, _mm512_set1_epi32 (DSWE_TEST_MBSR));
+
+        tests = _mm512_mask_or_epi32 (tests,
+            _mm512_cmp_ps_mask (awesh, awgt, _CMP_GT_OQ),
+            tests, _mm512_set1_epi32 (DSWE_TEST_AWESH));
+
+        /* Partial Surface Water 1 (PSW1) */
+        psw = _mm512_cmp_ps_mask (mndwi, pswt_1, _CMP_GT_OQ)
+            & _mm512_cmp_ps_mask (swir1_float, pswst_1, _CMP_LT_OQ)
+            & _mm512_cmp_ps_mask (nir_float, pswnt_1, _CMP_LT_OQ);
+        tests = _mm512_mask_or_epi32 (tests, psw,
+            tests, _mm512_set1_epi32 (DSWE_TEST_PSW1));
+
+        /* Partial Surface Water 2 (PSW2) */
+        psw = _mm512_cmp_ps_mask (mndwi, pswt_2, _CMP_GT_OQ)
+            & _mm512_cmp_ps_mask (swir2_float, pswst_2, _CMP_LT_OQ)
+            & _mm512_cmp_ps_mask (nir_float, pswnt_2, _CMP_LT_OQ);
+        tests = _mm512_mask_or_epi32 (tests, psw,
+            tests, _mm512_set1_epi32 (DSWE_TEST_PSW2));
+
+        /* Fill pixels only get the fill bit */
+        tests = _mm512_mask_mov_epi32 (tests, fill,
+                                       _mm512_set1_epi32 (DSWE_TEST_FILL));
+
+        /* Narrow the sixteen 32bit results to bytes */
+        _mm_storeu_si128 ((__m128i *) &band_tests[index],
+                          _mm512_cvtepi32_epi8 (tests));
+    }
+
+    /* Finish the remaining pixels with the same variant of the scalar
+       implementation */
+    dswe_tests_scalar_variants[profile][equal_scale_flag ? 1 : 0] (params,
+        &band_blue[index], &band_green[index], &band_red[index],
+        &band_nir[index], &band_swir1[index], &band_swir2[index],
+        &band_cfmask[index], pixel_count - index, &band_tests[index]);
+}
+
+
+/*****************************************************************************
+  NAME:  dswe_tests_avx512
+
+  PURPOSE:  Performs the DSWE tests sixteen pixels at a time using AVX-512F
+            with any thresholds and scale factors.
+
+  RETURN VALUE:  Type = None
+*****************************************************************************/
+void
+dswe_tests_avx512
+(
+    const Dswe_Tests_Parameters_t *params, /* I: thresholds and fill */
+    const int16_t *band_blue,   /* I: blue band pixels */
+    const int16_t *band_green,  /* I: green band pixels */
+    const int16_t *band_red,    /* I: red band pixels */
+    const int16_t *band_nir,    /* I: nir band pixels */
+    const int16_t *band_swir1,  /* I: swir1 band pixels */
+    const int16_t *band_swir2,  /* I: swir2 band pixels */
+    const uint8_t *band_cfmask, /* I: cfmask band pixels */
+    int pixel_count,            /* I: number of pixels to test */
+    uint8_t *band_tests         /* O: test bits for each pixel */
+)
+{
+    avx512_tests (params, THRESHOLDS_GENERIC, false, band_blue, band_green,
+                  band_red, band_nir, band_swir1, band_swir2, band_cfmask,
+                  pixel_count, band_tests);
+}
+
+
+/* The specialized variants of the AVX-512F implementation */
+DSWE_TESTS_VARIANT (avx512_tests_equal_scale, avx512_tests,
+                    THRESHOLDS_GENERIC, true)
+DSWE_TESTS_VARIANT (avx512_tests_l47, avx512_tests, THRESHOLDS_L47, false)
+DSWE_TESTS_VARIANT (avx512_tests_l47_equal_scale, avx512_tests,
+                    THRESHOLDS_L47, true)
+DSWE_TESTS_VARIANT (avx512_tests_l8, avx512_tests, THRESHOLDS_L8, false)
+DSWE_TESTS_VARIANT (avx512_tests_l8_equal_scale, avx512_tests,
+                    THRESHOLDS_L8, true)
+
+const Dswe_Tests_Variants_t dswe_tests_avx512_variants = {
+    {dswe_tests_avx512, avx512_tests_equal_scale},
+    {avx512_tests_l47, avx512_tests_l47_equal_scale},
+    {avx512_tests_l8, avx512_tests_l8_equal_scale}
+};
+
+
+#endif /* DSWE_SIMD_X86 */
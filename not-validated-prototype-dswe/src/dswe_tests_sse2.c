@@ -0,0 +1,278 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+
+#include "dswe_tests.h"
+
+
+#ifdef DSWE_SIMD_X86
+
+
+#include <emmintrin.h>
+
+
+/*****************************************************************************
+  NAME:  tests_sse2_4
+
+  PURPOSE:  Performs the DSWE tests for four pixels held as 32bit integers.
+
+  RETURN VALUE:  Type = __m128i
+      The test bits for each of the four pixels as 32bit integers.
+
+  NOTES:
+    1. AWEsh is computed as an integer scaled by four.  All of its terms are
+       multiples of 0.25 and fit in a float, so the float conversion is exact
+       and matches the scalar implementation.
+*****************************************************************************/
+static inline __attribute__ ((always_inline)) __m128i
+tests_sse2_4
+(
+    const Dswe_Tests_Parameters_t *params,     /* I: scale factors */
+    const Dswe_Tests_Parameters_t *thresholds, /* I: thresholds */
+    bool equal_scale_flag, /* I: the green and swir1 scale factors are
+                                 equal */
+    __m128i blue,  /* I: blue pixels */
+    __m128i green, /* I: green pixels */
+    __m128i red,   /* I: red pixels */
+    __m128i nir,   /* I: nir pixels */
+    __m128i swir1, /* I: swir1 pixels */
+    __m128i swir2  /* I: swir2 pixels */
+)
+{
+    __m128 green_float = _mm_cvtepi32_ps (green);
+    __m128 red_float = _mm_cvtepi32_ps (red);
+    __m128 nir_float = _mm_cvtepi32_ps (nir);
+    __m128 swir1_float = _mm_cvtepi32_ps (swir1);
+    __m128 swir2_float = _mm_cvtepi32_ps (swir2);
+    __m128 green_scaled;
+    __m128 swir1_scaled;
+    __m128 mndwi;
+    __m128 mbsrv;
+    __m128 mbsrn;
+    __m128 awesh;
+    __m128i mbsrn_int;
+    __m128i awesh_x4;
+    __m128i tests;
+    __m128 psw;
+
+    green_scaled = _mm_mul_ps (green_float,
+                               _mm_set1_ps (params->green_scale_factor));
+    swir1_scaled = _mm_mul_ps (swir1_float,
+                               _mm_set1_ps (equal_scale_flag
+                                            ? params->green_scale_factor
+                                            : params->swir1_scale_factor));
+
+    /* Modified Normalized Difference Wetness Index (MNDWI) */
+    mndwi = _mm_div_ps (_mm_sub_ps (green_scaled, swir1_scaled),
+                        _mm_add_ps (green_scaled, swir1_scaled));
+
+    /* Multi-band Spectral Relationship Visible and Near-Infrared */
+    mbsrv = _mm_add_ps (green_float, red_float);
+    mbsrn = _mm_add_ps (nir_float, swir1_float);
+
+    /* Automated Water Extent Shadow (AWEsh)
+       4 * blue + 10 * green - 6 * mbsrn - swir2 */
+    mbsrn_int = _mm_add_epi32 (nir, swir1);
+    awesh_x4 = _mm_slli_epi32 (blue, 2);
+    awesh_x4 = _mm_add_epi32 (awesh_x4, _mm_slli_epi32 (green, 3));
+    awesh_x4 = _mm_add_epi32 (awesh_x4, _mm_slli_epi32 (green, 1));
+    awesh_x4 = _mm_sub_epi32 (awesh_x4, _mm_slli_epi32 (mbsrn_int, 2));
+    awesh_x4 = _mm_sub_epi32 (awesh_x4, _mm_slli_epi32 (mbsrn_int, 1));
+    awesh_x4 = _mm_sub_epi32 (awesh_x4, swir2);
+    awesh = _mm_mul_ps (_mm_cvtepi32_ps (awesh_x4), _mm_set1_ps (0.25f));
+
+    tests = _mm_and_si128 (
+        _mm_castps_si128 (_mm_cmpgt_ps (mndwi,
+                                        _mm_set1_ps (thresholds->wigt))),
+        _mm_set1_epi32 (DSWE_TEST_MNDWI));
+
+    tests = _mm_or_si128 (tests, _mm_and_si128 (
+        _mm_castps_si128 (_mm_cmpgt_ps (mbsrv, mbsrn)),
+        _mm_set1_epi32 (DSWE_TEST_MBSR)));
+
+    tests = _mm_or_si128 (tests, _mm_and_si128 (
+        _mm_castps_si128 (_mm_cmpgt_ps (awesh,
+                                        _mm_set1_ps (thresholds->awgt))),
+        _mm_set1_epi32 (DSWE_TEST_AWESH)));
+
+    /* Partial Surface Water 1 (PSW1) */
+    psw = _mm_and_ps (
+        _mm_cmpgt_ps (mndwi, _mm_set1_ps (thresholds->pswt_1)),
+        _mm_and_ps (_mm_cmplt_ps (swir1_float,
+                                  _mm_set1_ps (thresholds->pswst_1)),
+                    _mm_cmplt_ps (nir_float,
+                                  _mm_set1_ps (thresholds->pswnt_1))));
+    tests = _mm_or_si128 (tests, _mm_and_si128 (_mm_castps_si128 (psw),
+        _mm_set1_epi32 (DSWE_TEST_PSW1)));
+
+    /* Partial Surface Water 2 (PSW2) */
+    psw = _mm_and_ps (
+        _mm_cmpgt_ps (mndwi, _mm_set1_ps (thresholds->pswt_2)),
+        _mm_and_ps (_mm_cmplt_ps (swir2_float,
+                                  _mm_set1_ps (thresholds->pswst_2)),
+                    _mm_cmplt_ps (nir_float,
+                                  _mm_set1_ps (thresholds->pswnt_2))));
+    tests = _mm_or_si128 (tests, _mm_and_si128 (_mm_castps_si128 (psw),
+        _mm_set1_epi32 (DSWE_TEST_PSW2)));
+
+    return tests;
+}
+
+
+/* Sign extend the low or high four 16bit values to 32bit */
+#define UNPACK_LO_EPI16(v) _mm_srai_epi32 (_mm_unpacklo_epi16 ((v), (v)), 16)
+#define UNPACK_HI_EPI16(v) _mm_srai_epi32 (_mm_unpackhi_epi16 ((v), (v)), 16)
+
+
+/*****************************************************************************
+  NAME:  sse2_tests
+
+  PURPOSE:  Performs the DSWE tests eight pixels at a time using SSE2.
+
+  RETURN VALUE:  Type = None
+
+  NOTES:
+    1. This is the body of the implementation and its variants.
+*****************************************************************************/
+static inline __attribute__ ((always_inline)) void
+sse2_tests
+(
+    const Dswe_Tests_Parameters_t *params, /* I: thresholds and fill */
+    Thresholds_Profile_e profile, /* I: thresholds to use */
+    bool equal_scale_flag,      /* I: the green and swir1 scale factors are
+                                      equal */
+    const int16_t *band_blue,   /* I: blue band pixels */
+    const int16_t *band_green,  /* I: green band pixels */
+    const int16_t *band_red,    /* I: red band pixels */
+    const int16_t *band_nir,    /* I: nir band pixels */
+    const int16_t *band_swir1,  /* I: swir1 band pixels */
+    const int16_t *band_swir2,  /* I: swir2 band pixels */
+    const uint8_t *band_cfmask, /* I: cfmask band pixels */
+    int pixel_count,            /* I: number of pixels to test */
+    uint8_t *band_tests         /* O: test bits for each pixel */
+)
+{
+    int index;
+    __m128i blue;
+    __m128i green;
+    __m128i red;
+    __m128i nir;
+    __m128i swir1;
+    __m128i swir2;
+    __m128i cfmask;
+    __m128i fill;
+    __m128i tests_lo;
+    __m128i tests_hi;
+    __m128i tests;
+
+    const Dswe_Tests_Parameters_t *thresholds =
+        profile_thresholds (params, profile);
+
+    for (index = 0; index + 8 <= pixel_count; index += 8)
+    {
+        blue = _mm_loadu_si128 ((const __m128i *) &band_blue[index]);
+        green = _mm_loadu_si128 ((const __m128i *) &band_green[index]);
+        red = _mm_loadu_si128 ((const __m128i *) &band_red[index]);
+        nir = _mm_loadu_si128 ((const __m128i *) &band_nir[index]);
+        swir1 = _mm_loadu_si128 ((const __m128i *) &band_swir1[index]);
+        swir2 = _mm_loadu_si128 ((const __m128i *) &band_swir2[index]);
+        cfmask = _mm_unpacklo_epi8 (
+            _mm_loadl_epi64 ((const __m128i *) &band_cfmask[index]),
+            _mm_setzero_si128 ());
+
+        /* If any of the input is fill, make the output fill */
+        fill = _mm_cmpeq_epi16 (blue,
+                                _mm_set1_epi16 (params->blue_fill_value));
+        fill = _mm_or_si128 (fill, _mm_cmpeq_epi16 (green,
+                             _mm_set1_epi16 (params->green_fill_value)));
+        fill = _mm_or_si128 (fill, _mm_cmpeq_epi16 (red,
+                             _mm_set1_epi16 (params->red_fill_value)));
+        fill = _mm_or_si128 (fill, _mm_cmpeq_epi16 (nir,
+                             _mm_set1_epi16 (params->nir_fill_value)));
+        fill = _mm_or_si128 (fill, _mm_cmpeq_epi16 (swir1,
+                             _mm_set1_epi16 (params->swir1_fill_value)));
+        fill = _mm_or_si128 (fill, _mm_cmpeq_epi16 (swir2,
+                             _mm_set1_epi16 (params->swir2_fill_value)));
+        fill = _mm_or_si128 (fill, _mm_cmpeq_epi16 (cfmask,
+                             _mm_set1_epi16 (params->cfmask_fill_value)));
+
+        tests_lo = tests_sse2_4 (params, thresholds, equal_scale_flag,
+                                 UNPACK_LO_EPI16 (blue),
+                                 UNPACK_LO_EPI16 (green),
+                                 UNPACK_LO_EPI16 (red),
+                                 UNPACK_LO_EPI16 (nir),
+                                 UNPACK_LO_EPI16 (swir1),
+                                 UNPACK_LO_EPI16 (swir2));
+        tests_hi = tests_sse2_4 (params, thresholds, equal_scale_flag,
+                                 UNPACK_HI_EPI16 (blue),
+                                 UNPACK_HI_EPI16 (green),
+                                 UNPACK_HI_EPI16 (red),
+                                 UNPACK_HI_EPI16 (nir),
+                                 UNPACK_HI_EPI16 (swir1),
+                                 UNPACK_HI_EPI16 (swir2));
+
+        /* Fill pixels only get the fill bit */
+        tests = _mm_packs_epi32 (tests_lo, tests_hi);
+        tests = _mm_or_si128 (_mm_andnot_si128 (fill, tests),
+            _mm_and_si128 (fill, _mm_set1_epi16 (DSWE_TEST_FILL)));
+
+        _mm_storel_epi64 ((__m128i *) &band_tests[index],
+                          _mm_packus_epi16 (tests, tests));
+    }
+
+    /* Finish the remaining pixels with the same variant of the scalar
+       implementation */
+    dswe_tests_scalar_variants[profile][equal_scale_flag ? 1 : 0] (params,
+        &band_blue[index], &band_green[index], &band_red[index],
+        &band_nir[index], &band_swir1[index], &band_swir2[index],
+        &band_cfmask[index], pixel_count - index, &band_tests[index]);
+}
+
+
+/*****************************************************************************
+  NAME:  dswe_tests_sse2
+
+  PURPOSE:  Performs the DSWE tests eight pixels at a time using SSE2 with any
+            thresholds and scale factors.
+
+  RETURN VALUE:  Type = None
+*****************************************************************************/
+void
+dswe_tests_sse2
+(
+    const Dswe_Tests_Parameters_t *params, /* I: thresholds and fill */
+    const int16_t *band_blue,   /* I: blue band pixels */
+    const int16_t *band_green,  /* I: green band pixels */
+    const int16_t *band_red,    /* I: red band pixels */
+    const int16_t *band_nir,    /* I: nir band pixels */
+    const int16_t *band_swir1,  /* I: swir1 band pixels */
+    const int16_t *band_swir2,  /* I: swir2 band pixels */
+    const uint8_t *band_cfmask, /* I: cfmask band pixels */
+    int pixel_count,            /* I: number of pixels to test */
+    uint8_t *band_tests         /* O: test bits for each pixel */
+)
+{
+    sse2_tests (params, THRESHOLDS_GENERIC, false, band_blue, band_green,
+                band_red, band_nir, band_swir1, band_swir2, band_cfmask,
+                pixel_count, band_tests);
+}
+
+
+/* The specialized variants of the SSE2 implementation */
+DSWE_TESTS_VARIANT (sse2_tests_equal_scale, sse2_tests,
+                    THRESHOLDS_GENERIC, true)
+DSWE_TESTS_VARIANT (sse2_tests_l47, sse2_tests, THRESHOLDS_L47, false)
+DSWE_TESTS_VARIANT (sse2_tests_l47_equal_scale, sse2_tests,
+                    THRESHOLDS_L47, true)
+DSWE_TESTS_VARIANT (sse2_tests_l8, sse2_tests, THRESHOLDS_L8, false)
+DSWE_TESTS_VARIANT (sse2_tests_l8_equal_scale, sse2_tests,
+                    THRESHOLDS_L8, true)
+
+const Dswe_Tests_Variants_t dswe_tests_sse2_variants = {
+    {dswe_tests_sse2, sse2_tests_equal_scale},
+    {sse2_tests_l47, sse2_tests_l47_equal_scale},
+    {sse2_tests_l8, sse2_tests_l8_equal_scale}
+};
+
+
+#endif /* DSWE_SIMD_X86 */
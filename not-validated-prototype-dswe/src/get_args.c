@@ -17,35 +17,32 @@
 #include "dswe.h"
 #include "utilities.h"
 #include "get_args.h"
+#include "batch.h"
 
 
-/* Specify default parameter values */
+/* Specify default parameter values, the tests have variants with the
+   defaults of each sensor as constants */
 /* L4-7 defaults */
-static float wigt_l47_default = 0.0123;
-static float awgt_l47_default = 0.0;
-static float pswt_1_l47_default = -0.5;
-static float pswt_2_l47_default = -0.5;
-static int pswst_1_l47_default = 1000;
-static int pswnt_1_l47_default = 1500;
-static int pswst_2_l47_default = 1000;
-static int pswnt_2_l47_default = 2000;
+static float wigt_l47_default = DSWE_L47_WIGT;
+static float awgt_l47_default = DSWE_L47_AWGT;
+static float pswt_1_l47_default = DSWE_L47_PSWT_1;
+static float pswt_2_l47_default = DSWE_L47_PSWT_2;
+static int pswst_1_l47_default = DSWE_L47_PSWST_1;
+static int pswnt_1_l47_default = DSWE_L47_PSWNT_1;
+static int pswst_2_l47_default = DSWE_L47_PSWST_2;
+static int pswnt_2_l47_default = DSWE_L47_PSWNT_2;
 /* L8 defaults */
-static float wigt_l8_default = 0.1163;
-static float awgt_l8_default = 0.0;
-static float pswt_1_l8_default = -0.67;
-static float pswt_2_l8_default = -0.67;
-static int pswst_1_l8_default = 1000;
-static int pswnt_1_l8_default = 1500;
-static int pswst_2_l8_default = 1000;
-static int pswnt_2_l8_default = 2000;
+static float wigt_l8_default = DSWE_L8_WIGT;
+static float awgt_l8_default = DSWE_L8_AWGT;
+static float pswt_1_l8_default = DSWE_L8_PSWT_1;
+static float pswt_2_l8_default = DSWE_L8_PSWT_2;
+static int pswst_1_l8_default = DSWE_L8_PSWST_1;
+static int pswnt_1_l8_default = DSWE_L8_PSWNT_1;
+static int pswst_2_l8_default = DSWE_L8_PSWST_2;
+static int pswnt_2_l8_default = DSWE_L8_PSWNT_2;
 
 static float percent_slope_default = 6.0;
 
-/* Parameter values should never be this, so use it to determine if a
-   parameter was specified or not on the command line before applying the
-   default value */
-#define NOT_SET -9999.0
-
 
 /*****************************************************************************
   NAME:  version
@@ -78,13 +75,22 @@ usage ()
             " from Surface\n"
             "Reflectance input data in ESPA raw binary format.\n\n");
     printf ("usage: dswe"
-            " --xml <input_xml_filename> [--help]\n\n");
-    printf ("where the following parameters are required:\n");
+            " --xml <input_xml_filename> [--help]\n");
+    printf ("       dswe"
+            " --batch <manifest_filename> [--help]\n\n");
+    printf ("where one of the following parameters is required:\n");
     printf ("    --xml: Name of the input XML file which contains the surface"
             " reflectance,\n"
             "           and top of atmos files output from LEDAPS in raw"
             " binary\n"
             "           (envi) format\n");
+    printf ("    --batch: Name of a file listing the input XML files to"
+            " process, one per\n"
+            "             line.  Each scene is processed in the directory"
+            " of its XML file\n"
+            "             with the defaults for its satellite, a scene"
+            " which fails does not\n"
+            "             stop the others\n");
 
     printf ("where the following parameters are optional:\n");
     printf ("    --wigt: Modified Normalized Difference Wetness Index"
@@ -128,6 +134,134 @@ usage ()
     printf ("    --percent-slope: Threshold between 0.00 and 100.00"
             " (default value is %0.1f)\n", percent_slope_default);
 
+    printf ("    --max-memory: Memory budget in megabytes for the band"
+            " buffers.  The scene is\n"
+            "                  processed in strips of lines sized to fit"
+            " the budget\n"
+            "                  (default is 0, meaning the whole scene is"
+            " processed at once,\n"
+            "                  except a scene of more than 2^31 pixels is"
+            " processed\n"
+            "                  within %d MB)\n", LARGE_SCENE_MAX_MEMORY);
+
+    printf ("    --threads: Number of threads used to process the pixels"
+            " (default is 1)\n"
+            "               Requires building with ENABLE_THREADING=yes\n");
+
+    printf ("    --simd: Instruction set used for the DSWE tests, one of"
+            " auto, scalar,\n"
+            "            sse2, avx2, or avx512.  All produce identical"
+            " output.\n"
+            "            (default is auto, meaning the best one supported"
+            " by the\n"
+            "            processor)\n");
+
+    printf ("    --recode: ESPA recode file (.rmp) providing the recode of"
+            " the raw DSWE\n"
+            "              tests values, each line is \"low high : value\"\n"
+            "              (default is the built in recode from"
+            " ESPA_recode.rmp)\n");
+
+    printf ("    --slope-precision: Precision used for the percent slope,"
+            " one of double\n"
+            "                       or float.  Float is faster but can"
+            " differ from the\n"
+            "                       double precision slope in the last"
+            " digits\n"
+            "                       (default is double)\n");
+
+    printf ("    --slope-cache: Directory holding the percent slope computed"
+            " for each DEM,\n"
+            "                   shared between runs and processes using the"
+            " same DEM\n"
+            "                   (default is to compute the percent slope"
+            " every run)\n");
+
+    printf ("    --input-method: How the input bands are accessed, one of"
+            " map or read.\n"
+            "                    Mapped bands are not copied, a band which"
+            " can not be\n"
+            "                    mapped is read (default is map)\n");
+
+    printf ("    --prefetch-depth: Number of strips of the input bands read"
+            " ahead of the\n"
+            "                      strip being processed, each read band"
+            " holds this many\n"
+            "                      more strips in memory (default is 1)\n");
+
+    printf ("    --mask-first: Read the cfmask first and skip the spectral"
+            " reads and the\n"
+            "                  tests of its cloud, cloud shadow, and snow"
+            " pixels.  Only\n"
+            "                  for the ccss, psccss, and ps products,"
+            " assumes the\n"
+            "                  spectral bands are only fill where the cfmask"
+            " is\n"
+            "                  (default is false)\n");
+
+    printf ("    --min-percent-clear: Scenes with a smaller percent of the"
+            " pixels which are\n"
+            "                         not fill clear or water are not"
+            " tested, their ccss\n"
+            "                         and psccss are cloud, cloud shadow, and"
+            " snow where\n"
+            "                         the cfmask is not fill and the other"
+            " products are\n"
+            "                         fill.  Estimated from the coverage of"
+            " the cfmask\n"
+            "                         band in the XML, or from a sample of its"
+            " lines\n"
+            "                         (default is 0, meaning every scene is"
+            " tested)\n");
+
+    printf ("    --skip-low-clear: Skip the scenes under --min-percent-clear"
+            " without writing\n"
+            "                      any outputs, the exit status is 2 when"
+            " scenes were\n"
+            "                      skipped and none failed (default is"
+            " false)\n");
+
+    printf ("    --huge-pages: Back the band buffers with huge pages,"
+            " explicit huge pages\n"
+            "                  when the system has them reserved, otherwise"
+            " transparent\n"
+            "                  huge pages (default is normal pages)\n");
+
+    printf ("    --report: Name of a JSON file to write a report of the run"
+            " to, with the\n"
+            "              wall and CPU time of each stage, the bytes read"
+            " and written,\n"
+            "              the pixels of each output class, and the peak"
+            " memory use of\n"
+            "              each scene (default is no report)\n");
+
+    printf ("    --products: Comma separated list of the output products to"
+            " generate, any of\n"
+            "                raw, ccss, psccss, diag, or ps.  Only the"
+            " inputs and work\n"
+            "                needed by the listed products are done, the"
+            " slope is only\n"
+            "                computed for psccss or ps and the cfmask is only"
+            " read for\n"
+            "                ccss or psccss.  Without ps or a slope cache the"
+            " slope is\n"
+            "                only computed for the pixels where it changes the"
+            " psccss\n"
+            "                (default is raw,ccss,psccss)\n");
+
+    printf ("    --include-tests: Also generate the diag product\n");
+
+    printf ("    --include-ps: Also generate the ps product\n");
+
+    printf ("    --water-qa: Also add the water pixels to the Level2 QA band"
+            " and update its\n"
+            "                clear and water percentages in the XML, as"
+            " cfmask_water_detection\n"
+            "                does, while the scene is open for DSWE.  The"
+            " TOA red and nir\n"
+            "                are read once for both when --use-toa is"
+            " given\n");
+
     printf ("    --use_zeven_thorne: Should Zevenbergen&Thorne's slope"
             " algorithm be used?\n"
             "                        (default is false, meaning Horn's slope"
@@ -152,6 +286,187 @@ usage ()
 }
 
 
+/*****************************************************************************
+  NAME:  parse_products
+
+  PURPOSE:  Converts a comma separated list of output product names into
+            the product bits.  Either the short names or the band names can
+            be used.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      ERROR    An unknown product name or an empty list was specified.
+      SUCCESS  No errors encountered.
+*****************************************************************************/
+static int
+parse_products
+(
+    const char *list,       /* I: comma separated product names */
+    unsigned int *products  /* O: the product bits */
+)
+{
+    char *copy;
+    char *name;
+    char *save_ptr = NULL;
+    char msg[256];
+
+    copy = strdup (list);
+    if (copy == NULL)
+    {
+        ERROR_MESSAGE ("Failed allocating memory for the product list",
+                       MODULE_NAME);
+        return ERROR;
+    }
+
+    *products = 0;
+    for (name = strtok_r (copy, ",", &save_ptr); name != NULL;
+         name = strtok_r (NULL, ",", &save_ptr))
+    {
+        if (strcmp (name, "raw") == 0 || strcmp (name, RAW_BAND_NAME) == 0)
+            *products |= PRODUCT_RAW;
+        else if (strcmp (name, "ccss") == 0
+                 || strcmp (name, SC_BAND_NAME) == 0)
+            *products |= PRODUCT_CCSS;
+        else if (strcmp (name, "psccss") == 0
+                 || strcmp (name, PS_SC_BAND_NAME) == 0)
+            *products |= PRODUCT_PSCCSS;
+        else if (strcmp (name, "diag") == 0
+                 || strcmp (name, RAW_DIAG_BAND_NAME) == 0)
+            *products |= PRODUCT_DIAG;
+        else if (strcmp (name, "ps") == 0
+                 || strcmp (name, PS_BAND_NAME) == 0)
+            *products |= PRODUCT_PS;
+        else
+        {
+            snprintf (msg, sizeof (msg), "Unknown output product %s\n\n",
+                      name);
+            ERROR_MESSAGE (msg, MODULE_NAME);
+            free (copy);
+            return ERROR;
+        }
+    }
+    free (copy);
+
+    if (*products == 0)
+    {
+        ERROR_MESSAGE ("No output products were specified\n\n",
+                       MODULE_NAME);
+        return ERROR;
+    }
+
+    return SUCCESS;
+}
+
+
+/*****************************************************************************
+  NAME:  get_scene_args
+
+  PURPOSE:  Reads the XML metadata of a scene and assigns the defaults for
+            the scene's satellite to the thresholds which were not specified
+            on the command line.  Called for each scene of a batch, so L4-7
+            and L8 scenes can be mixed.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      ERROR    Error validating or reading the XML metadata.
+      SUCCESS  No errors encountered.
+*****************************************************************************/
+int
+get_scene_args
+(
+    char *xml_filename,          /* I: input XML filename */
+    Espa_internal_meta_t *xml_metadata, /* O: input metadata */
+    float *wigt,                 /* I/O: tolerance value, NOT_SET for the
+                                         default */
+    float *awgt,                 /* I/O: tolerance value */
+    float *pswt_1,               /* I/O: tolerance value */
+    float *pswt_2,               /* I/O: tolerance value */
+    int *pswnt_1,                /* I/O: tolerance value */
+    int *pswnt_2,                /* I/O: tolerance value */
+    int *pswst_1,                /* I/O: tolerance value */
+    int *pswst_2                 /* I/O: tolerance value */
+)
+{
+    /* Validate the input XML metadata file */
+    if (validate_metadata (xml_filename) != SUCCESS)
+    {
+        /* Error messages already written */
+        return ERROR;
+    }
+
+    /* Initialize the metadata structure */
+    init_metadata_struct (xml_metadata);
+
+    /* Parse the metadata file into our internal metadata structure; also
+       allocates space as needed for various pointers in the global and band
+       metadata */
+    if (parse_metadata (xml_filename, xml_metadata) != SUCCESS)
+    {
+        /* Error messages already written */
+        free_metadata (xml_metadata);
+        return ERROR;
+    }
+
+    /* Assign the default values if not provided on the command line */
+    if (strcmp(xml_metadata->global.satellite, "LANDSAT_8") == 0)
+    {
+        if (*wigt == NOT_SET)
+            *wigt = wigt_l8_default;
+
+        if (*awgt == NOT_SET)
+            *awgt = awgt_l8_default;
+
+        if (*pswt_1 == NOT_SET)
+            *pswt_1 = pswt_1_l8_default;
+
+        if (*pswt_2 == NOT_SET)
+            *pswt_2 = pswt_2_l8_default;
+
+        if (*pswnt_1 == NOT_SET)
+            *pswnt_1 = pswnt_1_l8_default;
+
+        if (*pswnt_2 == NOT_SET)
+            *pswnt_2 = pswnt_2_l8_default;
+
+        if (*pswst_1 == NOT_SET)
+            *pswst_1 = pswst_1_l8_default;
+
+        if (*pswst_2 == NOT_SET)
+            *pswst_2 = pswst_2_l8_default;
+    }
+    else
+    {
+        if (*wigt == NOT_SET)
+            *wigt = wigt_l47_default;
+
+        if (*awgt == NOT_SET)
+            *awgt = awgt_l47_default;
+
+        if (*pswt_1 == NOT_SET)
+            *pswt_1 = pswt_1_l47_default;
+
+        if (*pswt_2 == NOT_SET)
+            *pswt_2 = pswt_2_l47_default;
+
+        if (*pswnt_1 == NOT_SET)
+            *pswnt_1 = pswnt_1_l47_default;
+
+        if (*pswnt_2 == NOT_SET)
+            *pswnt_2 = pswnt_2_l47_default;
+
+        if (*pswst_1 == NOT_SET)
+            *pswst_1 = pswst_1_l47_default;
+
+        if (*pswst_2 == NOT_SET)
+            *pswst_2 = pswst_2_l47_default;
+    }
+
+    return SUCCESS;
+}
+
+
 /*****************************************************************************
   NAME:  get_args
 
@@ -170,13 +485,17 @@ get_args
 (
     int argc,                    /* I: number of cmd-line args */
     char *argv[],                /* I: string of cmd-line args */
-    char **xml_filename,         /* O: input XML filename */
-    Espa_internal_meta_t *xml_metadata, /* O: input metadata */
+    char **xml_filename,         /* O: input XML filename, NULL for a
+                                       batch */
+    char **batch_filename,       /* O: batch manifest filename, NULL for a
+                                       single scene */
+    Espa_internal_meta_t *xml_metadata, /* O: input metadata, only read for
+                                              a single scene */
     bool *use_zeven_thorne_flag, /* O: use zeven thorne */
     bool *use_toa_flag,          /* O: process using TOA */
-    bool *include_tests_flag,    /* O: include raw DSWE with output */
-    bool *include_ps_flag,       /* O: include ps with output */
-    float *wigt,                 /* O: tolerance value */
+    unsigned int *products,      /* O: output products to generate */
+    float *wigt,                 /* O: tolerance value, NOT_SET for the
+                                       scene defaults of a batch */
     float *awgt,                 /* O: tolerance value */
     float *pswt_1,               /* O: tolerance value */
     float *pswt_2,               /* O: tolerance value */
@@ -185,6 +504,22 @@ get_args
     int *pswnt_2,                /* O: tolerance value */
     int *pswst_1,                /* O: tolerance value */
     int *pswst_2,                /* O: tolerance value */
+    int *max_memory,             /* O: memory budget in megabytes */
+    int *num_threads,            /* O: number of processing threads */
+    Simd_Target_e *simd_target,  /* O: instruction set for the tests */
+    char **recode_filename,      /* O: ESPA recode filename or NULL */
+    Slope_Precision_e *slope_precision, /* O: precision for the slope */
+    char **slope_cache_dir,      /* O: slope cache directory or NULL */
+    Input_Method_e *input_method, /* O: how the input is accessed */
+    int *prefetch_depth,         /* O: strips read ahead */
+    bool *mask_first_flag,       /* O: read the cfmask first and skip the
+                                       pixels it masks */
+    float *min_percent_clear,    /* O: scenes with less clear are not
+                                       tested */
+    bool *skip_low_clear_flag,   /* O: skip those scenes instead of writing
+                                       cloud and fill */
+    bool *huge_pages_flag,       /* O: back the buffers with huge pages */
+    char **report_filename,      /* O: JSON run report filename or NULL */
     bool * verbose_flag          /* O: verbose messaging */
 )
 {
@@ -193,9 +528,13 @@ get_args
     char msg[256];
     int tmp_zeven_thorne_flag = false;
     int tmp_toa_flag = false;
+    int tmp_water_qa_flag = false;
     int tmp_verbose_flag = false;
     int tmp_include_tests_flag = false;
     int tmp_include_ps_flag = false;
+    int tmp_huge_pages_flag = false;
+    int tmp_mask_first_flag = false;
+    int tmp_skip_low_clear_flag = false;
 
     struct option long_options[] = {
         /* These options set a flag */
@@ -205,8 +544,15 @@ get_args
         {"include-tests", no_argument, &tmp_include_tests_flag, true},
         {"include-ps", no_argument, &tmp_include_ps_flag, true},
 
+        {"water-qa", no_argument, &tmp_water_qa_flag, true},
+
+        {"huge-pages", no_argument, &tmp_huge_pages_flag, true},
+        {"mask-first", no_argument, &tmp_mask_first_flag, true},
+        {"skip-low-clear", no_argument, &tmp_skip_low_clear_flag, true},
+
         /* These options provide values */
         {"xml", required_argument, 0, 'x'},
+        {"batch", required_argument, 0, 'b'},
 
         {"wigt", required_argument, 0, 'w'},
         {"awgt", required_argument, 0, 'a'},
@@ -222,6 +568,18 @@ get_args
 
         {"percent-slope", required_argument, 0, 't'},
 
+        {"max-memory", required_argument, 0, 'm'},
+        {"threads", required_argument, 0, 'c'},
+        {"simd", required_argument, 0, 'i'},
+        {"recode", required_argument, 0, 'e'},
+        {"slope-precision", required_argument, 0, 'l'},
+        {"slope-cache", required_argument, 0, 'k'},
+        {"input-method", required_argument, 0, 'g'},
+        {"prefetch-depth", required_argument, 0, 'f'},
+        {"min-percent-clear", required_argument, 0, 'u'},
+        {"products", required_argument, 0, 'd'},
+        {"report", required_argument, 0, 'j'},
+
         /* Special options */
         {"verbose", no_argument, &tmp_verbose_flag, true},
         {"version", no_argument, 0, 'v'},
@@ -253,6 +611,37 @@ get_args
     *pswst_1 = NOT_SET;
     *pswst_2 = NOT_SET;
 
+    /* Zero means process the whole scene at once */
+    *max_memory = 0;
+
+    /* Serial processing unless more threads are requested */
+    *num_threads = 1;
+
+    /* Use the best instruction set available unless told otherwise */
+    *simd_target = SIMD_AUTO;
+
+    /* Use the built in recode unless a file is specified */
+    *recode_filename = NULL;
+
+    /* Match the reference slope algorithms unless told otherwise */
+    *slope_precision = SLOPE_DOUBLE;
+
+    /* Compute the slope every run unless a cache is specified */
+    *slope_cache_dir = NULL;
+
+    /* Map the input and have the next strip read while one is processed */
+    *input_method = INPUT_MAP;
+    *prefetch_depth = 1;
+
+    /* Every scene is tested unless a minimum is given */
+    *min_percent_clear = 0.0;
+
+    /* Generate the three DSWE bands unless told otherwise */
+    *products = PRODUCT_DEFAULT;
+
+    /* Only write a run report when asked */
+    *report_filename = NULL;
+
     /* loop through all the cmd-line options */
     opterr = 0; /* turn off getopt_long error msgs as we'll print our own */
     while (1)
@@ -284,6 +673,9 @@ get_args
         case 'x':
             *xml_filename = strdup (optarg);
             break;
+        case 'b':
+            *batch_filename = strdup (optarg);
+            break;
 
         case 'w':
             *wigt = atof (optarg);
@@ -316,6 +708,83 @@ get_args
         case 't':
             *percent_slope = atof (optarg);
             break;
+
+        case 'm':
+            *max_memory = atoi (optarg);
+            break;
+        case 'c':
+            *num_threads = atoi (optarg);
+            break;
+        case 'i':
+            if (strcmp (optarg, "auto") == 0)
+                *simd_target = SIMD_AUTO;
+            else if (strcmp (optarg, "scalar") == 0)
+                *simd_target = SIMD_SCALAR;
+            else if (strcmp (optarg, "sse2") == 0)
+                *simd_target = SIMD_SSE2;
+            else if (strcmp (optarg, "avx2") == 0)
+                *simd_target = SIMD_AVX2;
+            else if (strcmp (optarg, "avx512") == 0)
+                *simd_target = SIMD_AVX512;
+            else
+            {
+                snprintf (msg, sizeof (msg),
+                          "Unknown SIMD instruction set %s\n\n", optarg);
+                ERROR_MESSAGE (msg, MODULE_NAME);
+                usage ();
+                return ERROR;
+            }
+            break;
+        case 'e':
+            *recode_filename = strdup (optarg);
+            break;
+        case 'l':
+            if (strcmp (optarg, "double") == 0)
+                *slope_precision = SLOPE_DOUBLE;
+            else if (strcmp (optarg, "float") == 0)
+                *slope_precision = SLOPE_FLOAT;
+            else
+            {
+                snprintf (msg, sizeof (msg),
+                          "Unknown slope precision %s\n\n", optarg);
+                ERROR_MESSAGE (msg, MODULE_NAME);
+                usage ();
+                return ERROR;
+            }
+            break;
+        case 'k':
+            *slope_cache_dir = strdup (optarg);
+            break;
+        case 'g':
+            if (strcmp (optarg, "map") == 0)
+                *input_method = INPUT_MAP;
+            else if (strcmp (optarg, "read") == 0)
+                *input_method = INPUT_READ;
+            else
+            {
+                snprintf (msg, sizeof (msg),
+                          "Unknown input method %s\n\n", optarg);
+                ERROR_MESSAGE (msg, MODULE_NAME);
+                usage ();
+                return ERROR;
+            }
+            break;
+        case 'f':
+            *prefetch_depth = atoi (optarg);
+            break;
+        case 'u':
+            *min_percent_clear = atof (optarg);
+            break;
+        case 'd':
+            if (parse_products (optarg, products) != SUCCESS)
+            {
+                usage ();
+                return ERROR;
+            }
+            break;
+        case 'j':
+            *report_filename = strdup (optarg);
+            break;
         case '?':
         default:
             snprintf (msg, sizeof (msg),
@@ -338,102 +807,79 @@ get_args
     else
         *use_toa_flag = false;
 
+    /* The older options add their band to the selected products */
     if (tmp_include_tests_flag)
-        *include_tests_flag = true;
-    else
-        *include_tests_flag = false;
+        *products |= PRODUCT_DIAG;
 
     if (tmp_include_ps_flag)
-        *include_ps_flag = true;
+        *products |= PRODUCT_PS;
+
+    if (tmp_water_qa_flag)
+        *products |= PRODUCT_WATER_QA;
+
+    if (tmp_huge_pages_flag)
+        *huge_pages_flag = true;
+    else
+        *huge_pages_flag = false;
+
+    if (tmp_mask_first_flag)
+        *mask_first_flag = true;
     else
-        *include_ps_flag = false;
+        *mask_first_flag = false;
+
+    if (tmp_skip_low_clear_flag)
+        *skip_low_clear_flag = true;
+    else
+        *skip_low_clear_flag = false;
 
     if (tmp_verbose_flag)
         *verbose_flag = true;
     else
         *verbose_flag = false;
 
-    /* Make sure the XML was specified */
-    if (*xml_filename == NULL)
+    /* The raw and diag products and the water QA need every pixel
+       tested, and mask-first needs a filtered output to be generated */
+    if (*mask_first_flag
+        && ((*products & (PRODUCT_RAW | PRODUCT_DIAG | PRODUCT_WATER_QA))
+            != 0
+            || (*products & (PRODUCT_CCSS | PRODUCT_PSCCSS)) == 0))
     {
-        ERROR_MESSAGE ("XML input file is a required command line"
-                       " argument\n\n", MODULE_NAME);
+        ERROR_MESSAGE ("Mask first only generates the ccss, psccss, and ps"
+                       " products\n\n", MODULE_NAME);
 
         usage ();
         return ERROR;
     }
 
-    /* Validate the input XML metadata file */
-    if (validate_xml_file (*xml_filename) != SUCCESS)
+    /* Make sure the XML or a batch was specified, but not both */
+    if (*xml_filename == NULL && *batch_filename == NULL)
     {
-        /* Error messages already written */
-        return ERROR;
-    }
-
-    /* Initialize the metadata structure */
-    init_metadata_struct (xml_metadata);
+        ERROR_MESSAGE ("XML input file is a required command line"
+                       " argument\n\n", MODULE_NAME);
 
-    /* Parse the metadata file into our internal metadata structure; also
-       allocates space as needed for various pointers in the global and band
-       metadata */
-    if (parse_metadata (*xml_filename, xml_metadata) != SUCCESS)
-    {
-        /* Error messages already written */
+        usage ();
         return ERROR;
     }
-
-    /* Assign the default values if not provided on the command line */
-    if (strcmp(xml_metadata->global.satellite, "LANDSAT_8") == 0)
+    if (*xml_filename != NULL && *batch_filename != NULL)
     {
-        if (*wigt == NOT_SET)
-            *wigt = wigt_l8_default;
+        ERROR_MESSAGE ("Only one of an XML input file or a batch manifest"
+                       " can be specified\n\n", MODULE_NAME);
 
-        if (*awgt == NOT_SET)
-            *awgt = awgt_l8_default;
-
-        if (*pswt_1 == NOT_SET)
-            *pswt_1 = pswt_1_l8_default;
-
-        if (*pswt_2 == NOT_SET)
-            *pswt_2 = pswt_2_l8_default;
-
-        if (*pswnt_1 == NOT_SET)
-            *pswnt_1 = pswnt_1_l8_default;
-
-        if (*pswnt_2 == NOT_SET)
-            *pswnt_2 = pswnt_2_l8_default;
-
-        if (*pswst_1 == NOT_SET)
-            *pswst_1 = pswst_1_l8_default;
-
-        if (*pswst_2 == NOT_SET)
-            *pswst_2 = pswst_2_l8_default;
+        usage ();
+        return ERROR;
     }
-    else
-    {
-        if (*wigt == NOT_SET)
-            *wigt = wigt_l47_default;
 
-        if (*awgt == NOT_SET)
-            *awgt = awgt_l47_default;
-
-        if (*pswt_1 == NOT_SET)
-            *pswt_1 = pswt_1_l47_default;
-
-        if (*pswt_2 == NOT_SET)
-            *pswt_2 = pswt_2_l47_default;
-
-        if (*pswnt_1 == NOT_SET)
-            *pswnt_1 = pswnt_1_l47_default;
-
-        if (*pswnt_2 == NOT_SET)
-            *pswnt_2 = pswnt_2_l47_default;
-
-        if (*pswst_1 == NOT_SET)
-            *pswst_1 = pswst_1_l47_default;
-
-        if (*pswst_2 == NOT_SET)
-            *pswst_2 = pswst_2_l47_default;
+    /* A single scene is processed from the XML, a batch has its scenes
+       processed one at a time by the caller */
+    if (*xml_filename != NULL)
+    {
+        if (get_scene_args (*xml_filename, xml_metadata, wigt, awgt, pswt_1,
+                            pswt_2, pswnt_1, pswnt_2, pswst_1, pswst_2)
+            != SUCCESS)
+        {
+            /* Error messages already written */
+            return ERROR;
+        }
     }
 
     if (*percent_slope == NOT_SET)
@@ -441,7 +887,9 @@ get_args
 
 
     /* ---------- Validate the parameters ---------- */
-    if ((*wigt < 0.0) || (*wigt > 2.0))
+    /* The thresholds not specified get the defaults for each scene, which
+       are always in range */
+    if (*wigt != NOT_SET && (((*wigt < 0.0) || (*wigt > 2.0))))
     {
         ERROR_MESSAGE ("WIGT is out of range\n\n", MODULE_NAME);
 
@@ -449,7 +897,7 @@ get_args
         return ERROR;
     }
 
-    if ((*awgt < -2.0) || (*awgt > 2.0))
+    if (*awgt != NOT_SET && (((*awgt < -2.0) || (*awgt > 2.0))))
     {
         ERROR_MESSAGE ("AWGT is out of range\n\n", MODULE_NAME);
 
@@ -457,7 +905,7 @@ get_args
         return ERROR;
     }
 
-    if ((*pswt_1 < -2.0) || (*pswt_1 > 2.0))
+    if (*pswt_1 != NOT_SET && (((*pswt_1 < -2.0) || (*pswt_1 > 2.0))))
     {
         ERROR_MESSAGE ("PSWT_1 is out of range\n\n", MODULE_NAME);
 
@@ -465,7 +913,7 @@ get_args
         return ERROR;
     }
 
-    if ((*pswt_2 < -2.0) || (*pswt_2 > 2.0))
+    if (*pswt_2 != NOT_SET && (((*pswt_2 < -2.0) || (*pswt_2 > 2.0))))
     {
         ERROR_MESSAGE ("PSWT_2 is out of range\n\n", MODULE_NAME);
 
@@ -474,7 +922,7 @@ get_args
     }
 
     /* Only checking the low side here */
-    if (*pswnt_1 < 0)
+    if (*pswnt_1 != NOT_SET && *pswnt_1 < 0)
     {
         ERROR_MESSAGE ("PSWNT_1 is out of range\n\n", MODULE_NAME);
 
@@ -483,7 +931,7 @@ get_args
     }
 
     /* Only checking the low side here */
-    if (*pswnt_2 < 0)
+    if (*pswnt_2 != NOT_SET && *pswnt_2 < 0)
     {
         ERROR_MESSAGE ("PSWNT_2 is out of range\n\n", MODULE_NAME);
 
@@ -492,7 +940,7 @@ get_args
     }
 
     /* Only checking the low side here */
-    if (*pswst_1 < 0)
+    if (*pswst_1 != NOT_SET && *pswst_1 < 0)
     {
         ERROR_MESSAGE ("PSWST_1 is out of range\n\n", MODULE_NAME);
 
@@ -501,7 +949,7 @@ get_args
     }
 
     /* Only checking the low side here */
-    if (*pswst_2 < 0)
+    if (*pswst_2 != NOT_SET && *pswst_2 < 0)
     {
         ERROR_MESSAGE ("PSWST_2 is out of range\n\n", MODULE_NAME);
 
@@ -517,5 +965,50 @@ get_args
         return ERROR;
     }
 
+    if (*max_memory < 0)
+    {
+        ERROR_MESSAGE ("Max Memory is out of range\n\n", MODULE_NAME);
+
+        usage ();
+        return ERROR;
+    }
+
+    if (*num_threads < 1)
+    {
+        ERROR_MESSAGE ("Threads is out of range\n\n", MODULE_NAME);
+
+        usage ();
+        return ERROR;
+    }
+
+#ifndef _OPENMP
+    if (*num_threads > 1)
+    {
+        ERROR_MESSAGE ("Threading support is not compiled in, build with"
+                       " ENABLE_THREADING=yes for more than one thread\n\n",
+                       MODULE_NAME);
+
+        usage ();
+        return ERROR;
+    }
+#endif
+
+    if (*prefetch_depth < 0)
+    {
+        ERROR_MESSAGE ("Prefetch Depth is out of range\n\n", MODULE_NAME);
+
+        usage ();
+        return ERROR;
+    }
+
+    if ((*min_percent_clear < 0.0) || (*min_percent_clear > 100.0))
+    {
+        ERROR_MESSAGE ("Min Percent Clear is out of range\n\n",
+                       MODULE_NAME);
+
+        usage ();
+        return ERROR;
+    }
+
     return SUCCESS;
 }
@@ -9,15 +9,26 @@
 #include "espa_metadata.h"
 
 
+#include "dswe_tests.h"
+#include "build_slope_band.h"
+#include "input.h"
+
+
+/* Parameter values should never be this, so use it to determine if a
+   parameter was specified or not on the command line before applying the
+   default value */
+#define NOT_SET -9999.0
+
+
 int
 get_args (int argc,                    /* I: number of cmd-line args */
           char *argv[],                /* I: string of cmd-line args */
           char **xml_filename,         /* O: input XML filename */
+          char **batch_filename,       /* O: batch manifest filename */
           Espa_internal_meta_t *xml_metadata, /* O: input metadata */
           bool *use_zeven_thorne_flag, /* O: use zeven thorne */
           bool *use_toa_flag,          /* O: process using TOA */
-          bool *include_tests_flag,    /* O: include raw DSWE with output */
-          bool *include_ps_flag,       /* O: include ps with output */
+          unsigned int *products,      /* O: output products to generate */
           float *wigt,                 /* O: tolerance value */
           float *awgt,                 /* O: tolerance value */
           float *pswt_1,               /* O: tolerance value */
@@ -27,7 +38,38 @@ get_args (int argc,                    /* I: number of cmd-line args */
           int *pswnt_2,                /* O: tolerance value */
           int *pswst_1,                /* O: tolerance value */
           int *pswst_2,                /* O: tolerance value */
+          int *max_memory,             /* O: memory budget in megabytes */
+          int *num_threads,            /* O: number of processing threads */
+          Simd_Target_e *simd_target,  /* O: instruction set for the tests */
+          char **recode_filename,      /* O: ESPA recode filename or NULL */
+          Slope_Precision_e *slope_precision, /* O: precision for the slope */
+          char **slope_cache_dir,      /* O: slope cache directory or NULL */
+          Input_Method_e *input_method, /* O: how the input is accessed */
+          int *prefetch_depth,         /* O: strips read ahead */
+          bool *mask_first_flag,       /* O: read the cfmask first and skip
+                                             the pixels it masks */
+          float *min_percent_clear,    /* O: scenes with less clear are not
+                                             tested */
+          bool *skip_low_clear_flag,   /* O: skip those scenes instead of
+                                             writing cloud and fill */
+          bool *huge_pages_flag,       /* O: back the buffers with huge
+                                             pages */
+          char **report_filename,      /* O: JSON run report filename or
+                                             NULL */
           bool * verbose_flag);        /* O: verbose messaging */
 
 
+int
+get_scene_args (char *xml_filename,   /* I: input XML filename */
+                Espa_internal_meta_t *xml_metadata, /* O: input metadata */
+                float *wigt,          /* I/O: tolerance value */
+                float *awgt,          /* I/O: tolerance value */
+                float *pswt_1,        /* I/O: tolerance value */
+                float *pswt_2,        /* I/O: tolerance value */
+                int *pswnt_1,         /* I/O: tolerance value */
+                int *pswnt_2,         /* I/O: tolerance value */
+                int *pswst_1,         /* I/O: tolerance value */
+                int *pswst_2);        /* I/O: tolerance value */
+
+
 #endif /* GET_ARGS_H */
@@ -1,9 +1,21 @@
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 
 #include "dswe.h"
 #include "utilities.h"
 #include "input.h"
+#include "arena.h"
+
+
+/* Pixels of the spectral bands closer than this many bytes apart are read
+   together under mask-first, instead of with a read for each */
+#define MASK_FIRST_READ_GAP 4096
 
 
 /*****************************************************************************
@@ -56,10 +68,12 @@ GetXMLInput
 (
     Espa_internal_meta_t *metadata, /* I: input metadata */
     bool use_toa_flag,              /* I: use TOA or SR data */
+    bool water_qa_flag,             /* I: open the bands of the water QA */
     Input_Data_t *input_data        /* O: updated with information from XML */
 )
 {
     int index;
+    bool required_flag;
     char msg[256];
 
     char product_name[30];
@@ -69,12 +83,18 @@ GetXMLInput
     char nir_band_name[30];
     char swir1_band_name[30];
     char swir2_band_name[30];
+    char toa_red_band_name[30];
+    char toa_nir_band_name[30];
 
     /* Figure out the band names and product name to use */
     if ((strcmp (metadata->global.satellite, "LANDSAT_4") == 0)
         || (strcmp (metadata->global.satellite, "LANDSAT_5") == 0)
         || (strcmp (metadata->global.satellite, "LANDSAT_7") == 0))
     {
+        /* The water QA always uses the TOA red and nir */
+        snprintf (toa_red_band_name, sizeof (toa_red_band_name), "toa_band3");
+        snprintf (toa_nir_band_name, sizeof (toa_nir_band_name), "toa_band4");
+
         if (use_toa_flag)
         {
             snprintf (product_name, sizeof (product_name), "toa_refl");
@@ -100,6 +120,10 @@ GetXMLInput
     }
     else if (strcmp (metadata->global.satellite, "LANDSAT_8") == 0)
     {
+        /* The water QA always uses the TOA red and nir */
+        snprintf (toa_red_band_name, sizeof (toa_red_band_name), "toa_band4");
+        snprintf (toa_nir_band_name, sizeof (toa_nir_band_name), "toa_band5");
+
         if (use_toa_flag)
         {
             snprintf (product_name, sizeof (product_name), "toa_refl");
@@ -319,13 +343,100 @@ GetXMLInput
                     metadata->band[index].fill_value;
             }
         }
+
+        if (!water_qa_flag)
+            continue;
+
+        /* Search for the Level2 QA band, its percentages are updated */
+        if (!strcmp (metadata->band[index].product, "l2qa"))
+        {
+            if (!strcmp (metadata->band[index].name, "l2qa"))
+            {
+                open_band (metadata->band[index].file_name, input_data,
+                           I_BAND_L2QA);
+
+                if (metadata->band[index].data_type != ESPA_UINT8)
+                {
+                    RETURN_ERROR("l2qa incompatable data type expecting"
+                                 " UINT8", MODULE_NAME, ERROR);
+                }
+
+                /* Default to a no-op since L2QA doesn't have a scale
+                   factor */
+                input_data->scale_factor[I_BAND_L2QA] = 1.0;
+
+                /* Grab the fill value for this band */
+                input_data->fill_value[I_BAND_L2QA] =
+                    metadata->band[index].fill_value;
+
+                /* Grab the metadata index value for this band */
+                input_data->l2qa_meta_index = index;
+            }
+        }
+
+        /* Search for the TOA red and nir bands, unless the tests already
+           use them */
+        if (!use_toa_flag
+            && !strcmp (metadata->band[index].product, "toa_refl"))
+        {
+            if (!strcmp (metadata->band[index].name, toa_red_band_name))
+            {
+                open_band (metadata->band[index].file_name, input_data,
+                           I_BAND_TOA_RED);
+
+                if (metadata->band[index].data_type != ESPA_INT16)
+                {
+                    snprintf (msg, sizeof (msg),
+                              "%s incompatable data type expecting INT16",
+                              toa_red_band_name);
+                    RETURN_ERROR(msg, MODULE_NAME, ERROR);
+                }
+
+                /* Grab the scale factor for this band */
+                input_data->scale_factor[I_BAND_TOA_RED] =
+                    metadata->band[index].scale_factor;
+
+                /* Grab the fill value for this band */
+                input_data->fill_value[I_BAND_TOA_RED] =
+                    metadata->band[index].fill_value;
+            }
+            else if (!strcmp (metadata->band[index].name, toa_nir_band_name))
+            {
+                open_band (metadata->band[index].file_name, input_data,
+                           I_BAND_TOA_NIR);
+
+                if (metadata->band[index].data_type != ESPA_INT16)
+                {
+                    snprintf (msg, sizeof (msg),
+                              "%s incompatable data type expecting INT16",
+                              toa_nir_band_name);
+                    RETURN_ERROR(msg, MODULE_NAME, ERROR);
+                }
+
+                /* Grab the scale factor for this band */
+                input_data->scale_factor[I_BAND_TOA_NIR] =
+                    metadata->band[index].scale_factor;
+
+                /* Grab the fill value for this band */
+                input_data->fill_value[I_BAND_TOA_NIR] =
+                    metadata->band[index].fill_value;
+            }
+        }
     }
 
-    /* Verify all the bands have something (all are required for DSWE) */
+    /* Verify all the bands have something (all are required for DSWE, and
+       the water QA bands for the water QA) */
     for (index = 0; index < MAX_INPUT_BANDS; index++)
     {
-        if (input_data->band_fd[index] == NULL ||
-            input_data->band_name[index] == NULL)
+        if (index == I_BAND_L2QA)
+            required_flag = water_qa_flag;
+        else if (index == I_BAND_TOA_RED || index == I_BAND_TOA_NIR)
+            required_flag = water_qa_flag && !use_toa_flag;
+        else
+            required_flag = true;
+
+        if (required_flag && (input_data->band_fd[index] == NULL ||
+                              input_data->band_name[index] == NULL))
         {
             ERROR_MESSAGE ("Error opening required input data", MODULE_NAME);
 
@@ -338,11 +449,87 @@ GetXMLInput
 }
 
 
+/*****************************************************************************
+  NAME:  map_band
+
+  PURPOSE:  Memory map the image of the specified band, so its lines can be
+            handed out without copying them from the page cache.  When the
+            image can not be mapped, or is smaller than the metadata says,
+            the band is left unmapped and its lines are read instead.
+
+  RETURN VALUE:  None
+*****************************************************************************/
+static void
+map_band
+(
+    Input_Data_t *input_data, /* IO: updated with the mapping */
+    Input_Bands_e band_index  /* I: band to map */
+)
+{
+    struct stat file_stat;
+    size_t band_size;
+    void *map;
+    char msg[256];
+
+    band_size = (size_t) input_data->lines * input_data->samples
+                * input_data->data_size[band_index];
+    if (band_size == 0)
+        return;
+
+    /* Accessing a mapping beyond the end of the file faults, so a short
+       file is left for the reads to report */
+    if (fstat (fileno (input_data->band_fd[band_index]), &file_stat) != 0
+        || file_stat.st_size < (off_t) band_size)
+    {
+        return;
+    }
+
+    map = mmap (NULL, band_size, PROT_READ, MAP_PRIVATE,
+                fileno (input_data->band_fd[band_index]), 0);
+    if (map == MAP_FAILED)
+    {
+        snprintf (msg, sizeof (msg), "Failed mapping (%s), reading it instead",
+                  input_data->band_name[band_index]);
+        WARNING_MESSAGE (msg, MODULE_NAME);
+        return;
+    }
+
+    /* The lines are processed in order, so let the kernel read ahead
+       aggressively */
+    madvise (map, band_size, MADV_SEQUENTIAL);
+
+    input_data->band_map[band_index] = map;
+    input_data->band_map_size[band_index] = band_size;
+}
+
+
+/*****************************************************************************
+  NAME: is_spectral_band
+
+  PURPOSE: To determine if a band is one of the spectral bands used by the
+           tests.
+
+  RETURN VALUE:  Type = bool
+*****************************************************************************/
+static bool
+is_spectral_band
+(
+    int band_index /* I: band to check */
+)
+{
+    return band_index >= I_BAND_BLUE && band_index <= I_BAND_SWIR2;
+}
+
+
 /*****************************************************************************
   NAME: open_input
 
   PURPOSE:  Open all the input files and allocate associated memory for the
-            filenames that reside in the data structure.
+            filenames that reside in the data structure.  The images are
+            mapped, or read with reader threads fetching the strips ahead of
+            their use when prefetch_depth is not zero.  With mask_first_flag
+            only the parts of the spectral images the cfmask does not mask
+            are read.
 
   RETURN VALUE:  Type = Input_Data_t *
       Value    Description
@@ -354,10 +541,18 @@ Input_Data_t *
 open_input
 (
     Espa_internal_meta_t *metadata, /* I: input metadata */
-    bool use_toa_flag               /* I: use TOA or SR data */
+    bool use_toa_flag,              /* I: use TOA or SR data */
+    bool water_qa_flag,             /* I: open the bands of the water QA */
+    Input_Method_e input_method,    /* I: how the images are accessed */
+    int prefetch_depth,             /* I: strips read ahead of the one in
+                                          use, zero for none */
+    bool mask_first_flag            /* I: read the cfmask first and only the
+                                          spectral bands it does not mask */
 )
 {
     int index;
+    int read_fds[MAX_INPUT_BANDS];
+    bool read_flag;
     Input_Data_t *input_data = NULL;
 
     input_data = (Input_Data_t *) malloc (sizeof (Input_Data_t));
@@ -368,18 +563,37 @@ open_input
         return NULL;
     }
 
+    input_data->bytes_read = 0;
+
     /* Initialize the band fields */
     for (index = 0; index < MAX_INPUT_BANDS; index++)
     {
         input_data->band_name[index] = NULL;
         input_data->band_fd[index] = NULL;
+        input_data->band_map[index] = NULL;
+        input_data->band_map_size[index] = 0;
+        input_data->band_map_released[index] = 0;
+        input_data->band_buffer[index] = NULL;
+        input_data->band_buffer_size[index] = 0;
+
+        /* GetXMLInput verifies all the bands are INT16 except CFMASK and
+           L2QA */
+        input_data->data_size[index] = sizeof (int16_t);
     }
+    input_data->data_size[I_BAND_CFMASK] = sizeof (uint8_t);
+    input_data->data_size[I_BAND_L2QA] = sizeof (uint8_t);
+    input_data->l2qa_meta_index = -1;
+    input_data->read_ahead = NULL;
+    input_data->mask_first_flag = mask_first_flag;
+    input_data->unmasked_ranges = NULL;
+    input_data->unmasked_range_count = 0;
+    input_data->unmasked_range_capacity = 0;
 
     input_data->lines = 0;
     input_data->samples = 0;
 
     /* Open the input images from the XML file */
-    if (GetXMLInput (metadata, use_toa_flag, input_data)
+    if (GetXMLInput (metadata, use_toa_flag, water_qa_flag, input_data)
         != SUCCESS)
     {
         /* error messages provided by GetXMLInput */
@@ -387,6 +601,53 @@ open_input
         return NULL;
     }
 
+    /* Map the images so they are not copied, any which can not be mapped
+       are read.  Under mask-first the spectral bands are read where the
+       cfmask does not mask them. */
+    if (input_method == INPUT_MAP)
+    {
+        for (index = 0; index < MAX_INPUT_BANDS; index++)
+        {
+            if (input_data->band_fd[index] != NULL
+                && !(mask_first_flag && is_spectral_band (index)))
+            {
+                map_band (input_data, index);
+            }
+        }
+    }
+
+    /* Start a reader thread for each image which is read */
+    if (prefetch_depth > 0)
+    {
+        read_flag = false;
+        for (index = 0; index < MAX_INPUT_BANDS; index++)
+        {
+            if (input_data->band_fd[index] != NULL
+                && input_data->band_map[index] == NULL
+                && !(mask_first_flag && is_spectral_band (index)))
+            {
+                read_fds[index] = fileno (input_data->band_fd[index]);
+                read_flag = true;
+            }
+            else
+                read_fds[index] = -1;
+        }
+
+        if (read_flag)
+        {
+            input_data->read_ahead =
+                start_read_ahead (MAX_INPUT_BANDS, read_fds,
+                                  input_data->band_name, prefetch_depth);
+            if (input_data->read_ahead == NULL)
+            {
+                ERROR_MESSAGE ("Failed starting the input read ahead",
+                               MODULE_NAME);
+                close_input (input_data);
+                return NULL;
+            }
+        }
+    }
+
     return input_data;
 }
 
@@ -414,11 +675,24 @@ close_input
     bool had_issue;
     char msg[256];
 
+    /* The reader threads use the files */
+    stop_read_ahead (input_data->read_ahead);
+    input_data->read_ahead = NULL;
+
     had_issue = false;
     for (index = 0; index < MAX_INPUT_BANDS; index++)
     {
-        if (input_data->band_fd[index] == NULL &&
-            input_data->band_name[index] == NULL)
+        if (input_data->band_map[index] != NULL)
+        {
+            munmap ((void *) input_data->band_map[index],
+                    input_data->band_map_size[index]);
+            input_data->band_map[index] = NULL;
+        }
+        free (input_data->band_buffer[index]);
+        input_data->band_buffer[index] = NULL;
+
+        /* The water QA bands are only opened for the water QA */
+        if (input_data->band_fd[index] != NULL)
         {
             status = fclose (input_data->band_fd[index]);
             if (status != 0)
@@ -430,16 +704,16 @@ close_input
 
                 had_issue = true;
             }
-
-            free (input_data->band_name[index]);
-        }
-        else
-        {
-            fclose (input_data->band_fd[index]);
-            free (input_data->band_name[index]);
+            input_data->band_fd[index] = NULL;
         }
+
+        free (input_data->band_name[index]);
+        input_data->band_name[index] = NULL;
     }
 
+    free (input_data->unmasked_ranges);
+    input_data->unmasked_ranges = NULL;
+
     if (had_issue)
         return ERROR;
 
@@ -448,106 +722,726 @@ close_input
 
 
 /*****************************************************************************
-  NAME: read_bands_into_memory
+  NAME: read_band_lines
 
-  PURPOSE: To read the specified input band data into memory for later
+  PURPOSE: To read the specified lines of an input band into memory for later
            processing.
 
-  RETURN VALUE:  Type = bool
+  RETURN VALUE:  Type = int
       Value    Description
       -------  ---------------------------------------------------------------
-      true     Success with reading all of the bands into memory.
-      false    Failed to read a band into memory.
+      SUCCESS  Success with reading the lines into memory.
+      ERROR    Failed to read the lines into memory.
 *****************************************************************************/
 int
-read_bands_into_memory
+read_band_lines
 (
     Input_Data_t *input_data,
-    int16_t *band_blue,
-    int16_t *band_green,
-    int16_t *band_red,
-    int16_t *band_nir,
-    int16_t *band_swir1,
-    int16_t *band_swir2,
-    int16_t *band_elevation,
-    uint8_t *band_cfmask,
-    int pixel_count
+    Input_Bands_e band_index,
+    int first_line,
+    int line_count,
+    void *data
 )
 {
-    int count;
+    off_t offset;
+    size_t element_count;
+    char msg[256];
+
+    offset = (off_t) first_line * input_data->samples
+             * input_data->data_size[band_index];
+    element_count = (size_t) line_count * input_data->samples;
 
-    count = fread (band_blue, sizeof (int16_t), pixel_count,
-                   input_data->band_fd[I_BAND_BLUE]);
-    if (count != pixel_count)
+    if (fseeko (input_data->band_fd[band_index], offset, SEEK_SET) != 0)
     {
-        ERROR_MESSAGE ("Failed reading blue band data", MODULE_NAME);
+        snprintf (msg, sizeof (msg), "Failed seeking to line %d in (%s)",
+                  first_line, input_data->band_name[band_index]);
+        RETURN_ERROR (msg, MODULE_NAME, ERROR);
+    }
 
-        return ERROR;
+    if (fread (data, input_data->data_size[band_index], element_count,
+               input_data->band_fd[band_index]) != element_count)
+    {
+        snprintf (msg, sizeof (msg), "Failed reading lines %d to %d from (%s)",
+                  first_line, first_line + line_count - 1,
+                  input_data->band_name[band_index]);
+        RETURN_ERROR (msg, MODULE_NAME, ERROR);
     }
 
-    count = fread (band_green, sizeof (int16_t), pixel_count,
-                   input_data->band_fd[I_BAND_GREEN]);
-    if (count != pixel_count)
+    return SUCCESS;
+}
+
+
+/*****************************************************************************
+  NAME: release_mapped_lines
+
+  PURPOSE: To drop the pages of a mapped band before the lines about to be
+           provided.  The lines are provided in order, so those pages are
+           done with, and dropping them keeps a large scene processed in
+           strips from holding every page it has mapped.
+
+  RETURN VALUE:  None
+*****************************************************************************/
+static void
+release_mapped_lines
+(
+    Input_Data_t *input_data, /* I/O: input data record */
+    Input_Bands_e band_index, /* I: mapped band */
+    size_t offset             /* I: offset of the lines to provide */
+)
+{
+    size_t page_size;
+    size_t released;
+    size_t end;
+
+    page_size = sysconf (_SC_PAGESIZE);
+    released = input_data->band_map_released[band_index];
+    end = offset - offset % page_size;
+    if (end <= released)
+        return;
+
+    madvise ((uint8_t *) input_data->band_map[band_index] + released,
+             end - released, MADV_DONTNEED);
+    input_data->band_map_released[band_index] = end;
+}
+
+
+/*****************************************************************************
+  NAME: reserve_band_buffer
+
+  PURPOSE: To make sure the buffer owned by the input data record for a band
+           holds at least the specified size.
+
+  RETURN VALUE:  Type = void *
+      Value    Description
+      -------  ---------------------------------------------------------------
+      NULL     Failed allocating the buffer.
+      *        The buffer.
+*****************************************************************************/
+static void *
+reserve_band_buffer
+(
+    Input_Data_t *input_data, /* I: input data record */
+    Input_Bands_e band_index, /* I: band the buffer is for */
+    size_t size               /* I: size needed */
+)
+{
+    if (size > input_data->band_buffer_size[band_index])
     {
-        ERROR_MESSAGE ("Failed reading green band data", MODULE_NAME);
+        free (input_data->band_buffer[band_index]);
+        input_data->band_buffer_size[band_index] = 0;
 
-        return ERROR;
+        /* Aligned like the other band buffers for the vector loads */
+        if (posix_memalign (&input_data->band_buffer[band_index],
+                            ARENA_ALIGNMENT, size) != 0)
+        {
+            input_data->band_buffer[band_index] = NULL;
+            RETURN_ERROR ("Failed allocating memory for input lines",
+                          MODULE_NAME, NULL);
+        }
+        input_data->band_buffer_size[band_index] = size;
+    }
+
+    return input_data->band_buffer[band_index];
+}
+
+
+/*****************************************************************************
+  NAME: get_band_lines
+
+  PURPOSE: To provide the specified lines of an input band.  For a mapped
+           band this points into the mapping.  Otherwise the lines come from
+           the read ahead when they were prefetched, or are read into a
+           buffer owned by the input data record, which is reused for the
+           next lines of the band.
+
+  RETURN VALUE:  Type = const void *
+      Value    Description
+      -------  ---------------------------------------------------------------
+      NULL     Failed to provide the lines.
+      *        The lines, valid until the next lines of the band are
+               provided or the input is closed.
+*****************************************************************************/
+const void *
+get_band_lines
+(
+    Input_Data_t *input_data,
+    Input_Bands_e band_index,
+    int first_line,
+    int line_count
+)
+{
+    size_t line_size;
+    size_t size;
+    const void *lines;
+
+    line_size = (size_t) input_data->samples
+                * input_data->data_size[band_index];
+
+    input_data->bytes_read += (long long) line_count * line_size;
+
+    if (input_data->band_map[band_index] != NULL)
+    {
+        release_mapped_lines (input_data, band_index,
+                              first_line * line_size);
+        return (const uint8_t *) input_data->band_map[band_index]
+               + first_line * line_size;
     }
 
-    count = fread (band_red, sizeof (int16_t), pixel_count,
-                   input_data->band_fd[I_BAND_RED]);
-    if (count != pixel_count)
+    size = line_count * line_size;
+
+    /* Use the lines when they were read ahead */
+    if (input_data->read_ahead != NULL)
     {
-        ERROR_MESSAGE ("Failed reading red band data", MODULE_NAME);
+        if (take_read_ahead (input_data->read_ahead, band_index,
+                             (off_t) first_line * line_size, size, &lines)
+            != SUCCESS)
+        {
+            /* error messages provided by take_read_ahead */
+            return NULL;
+        }
 
-        return ERROR;
+        if (lines != NULL)
+            return lines;
     }
 
-    count = fread (band_nir, sizeof (int16_t), pixel_count,
-                   input_data->band_fd[I_BAND_NIR]);
-    if (count != pixel_count)
+    if (reserve_band_buffer (input_data, band_index, size) == NULL)
     {
-        ERROR_MESSAGE ("Failed reading nir band data", MODULE_NAME);
+        /* error messages provided by reserve_band_buffer */
+        return NULL;
+    }
 
-        return ERROR;
+    if (read_band_lines (input_data, band_index, first_line, line_count,
+                         input_data->band_buffer[band_index]) != SUCCESS)
+    {
+        /* error messages provided by read_band_lines */
+        return NULL;
     }
 
-    count = fread (band_swir1, sizeof (int16_t), pixel_count,
-                   input_data->band_fd[I_BAND_SWIR1]);
-    if (count != pixel_count)
+    return input_data->band_buffer[band_index];
+}
+
+
+/*****************************************************************************
+  NAME: prefetch_band_lines
+
+  PURPOSE: To start reading the specified lines of an input band ahead of
+           their use.  For a mapped band the kernel is asked to read the
+           pages in, otherwise the lines are queued for the reader thread of
+           the band.
+
+  RETURN VALUE:  None
+*****************************************************************************/
+void
+prefetch_band_lines
+(
+    Input_Data_t *input_data,
+    Input_Bands_e band_index,
+    int first_line,
+    int line_count
+)
+{
+    size_t line_size;
+    size_t start;
+    size_t end;
+    size_t page_size;
+
+    line_size = (size_t) input_data->samples
+                * input_data->data_size[band_index];
+
+    if (input_data->band_map[band_index] != NULL)
     {
-        ERROR_MESSAGE ("Failed reading swir1 band data", MODULE_NAME);
+        /* madvise needs a page aligned start */
+        page_size = sysconf (_SC_PAGESIZE);
+        start = first_line * line_size;
+        end = start + line_count * line_size;
+        start -= start % page_size;
+
+        madvise ((uint8_t *) input_data->band_map[band_index] + start,
+                 end - start, MADV_WILLNEED);
+    }
+    else if (input_data->read_ahead != NULL)
+    {
+        queue_read_ahead (input_data->read_ahead, band_index,
+                          (off_t) first_line * line_size,
+                          line_count * line_size);
+    }
+}
 
-        return ERROR;
+
+/*****************************************************************************
+  NAME: prefetch_bands
+
+  PURPOSE: To start reading a strip of lines from the input bands ahead of
+           their use by read_bands_into_memory.
+
+  RETURN VALUE:  None
+*****************************************************************************/
+void
+prefetch_bands
+(
+    Input_Data_t *input_data,
+    bool include_elevation_flag,
+    int first_line,
+    int line_count,
+    int first_elevation_line,
+    int elevation_line_count
+)
+{
+    int index;
+
+    for (index = 0; index < MAX_INPUT_BANDS; index++)
+    {
+        if (index == I_BAND_ELEVATION)
+        {
+            if (include_elevation_flag)
+            {
+                prefetch_band_lines (input_data, index, first_elevation_line,
+                                     elevation_line_count);
+            }
+        }
+        else if (input_data->band_fd[index] != NULL
+                 && !(input_data->mask_first_flag
+                      && is_spectral_band (index)))
+        {
+            /* The water QA bands are only read ahead when opened, the
+               spectral bands under mask-first are only read once the
+               cfmask is known */
+            prefetch_band_lines (input_data, index, first_line, line_count);
+        }
     }
+}
+
 
-    count = fread (band_swir2, sizeof (int16_t), pixel_count,
-                   input_data->band_fd[I_BAND_SWIR2]);
-    if (count != pixel_count)
+/*****************************************************************************
+  NAME: find_unmasked_ranges
+
+  PURPOSE: To find the ranges of a strip where the spectral bands are
+           needed, which is where the cfmask is not cloud, cloud shadow,
+           snow, or fill.  Pixels closer together than MASK_FIRST_READ_GAP
+           bytes of a spectral band are put in one range, which includes the
+           pixels between them.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      SUCCESS  The ranges were found, none when the strip is fully masked.
+      ERROR    Failed allocating the ranges.
+*****************************************************************************/
+static int
+find_unmasked_ranges
+(
+    Input_Data_t *input_data,  /* I/O: input data record, holds the ranges */
+    const uint8_t *band_cfmask, /* I: the cfmask lines of the strip */
+    size_t pixel_count         /* I: pixels in the strip */
+)
+{
+    bool needed[256];
+    size_t gap_pixels;
+    size_t index;
+    size_t start;
+    size_t end;
+    size_t next;
+    size_t *ranges;
+    int capacity;
+    int value;
+
+    for (value = 0; value < 256; value++)
     {
-        ERROR_MESSAGE ("Failed reading swir2 band data", MODULE_NAME);
+        needed[value] = value != CFMASK_CLOUD
+                        && value != CFMASK_CLOUD_SHADOW
+                        && value != CFMASK_SNOW
+                        && value != input_data->fill_value[I_BAND_CFMASK];
+    }
 
-        return ERROR;
+    gap_pixels = MASK_FIRST_READ_GAP / sizeof (int16_t);
+    input_data->unmasked_range_count = 0;
+
+    index = 0;
+    while (index < pixel_count)
+    {
+        /* Find the next pixel which is needed */
+        start = index;
+        while (start < pixel_count && !needed[band_cfmask[start]])
+            start++;
+        if (start == pixel_count)
+            break;
+
+        /* Extend the range over the needed pixels which follow within the
+           gap */
+        end = start + 1;
+        for (next = end; next < pixel_count && next - end <= gap_pixels;
+             next++)
+        {
+            if (needed[band_cfmask[next]])
+                end = next + 1;
+        }
+
+        if (input_data->unmasked_range_count
+            == input_data->unmasked_range_capacity)
+        {
+            capacity = input_data->unmasked_range_capacity * 2;
+            if (capacity == 0)
+                capacity = 64;
+
+            ranges = realloc (input_data->unmasked_ranges,
+                              capacity * 2 * sizeof (*ranges));
+            if (ranges == NULL)
+            {
+                RETURN_ERROR ("Failed allocating the unmasked ranges",
+                              MODULE_NAME, ERROR);
+            }
+            input_data->unmasked_ranges = ranges;
+            input_data->unmasked_range_capacity = capacity;
+        }
+
+        input_data->unmasked_ranges[2 * input_data->unmasked_range_count] =
+            start;
+        input_data->unmasked_ranges[2 * input_data->unmasked_range_count
+                                    + 1] = end;
+        input_data->unmasked_range_count++;
+
+        index = end;
     }
 
-    count = fread (band_elevation, sizeof (int16_t), pixel_count,
-                   input_data->band_fd[I_BAND_ELEVATION]);
-    if (count != pixel_count)
+    return SUCCESS;
+}
+
+
+/*****************************************************************************
+  NAME: pread_fully
+
+  PURPOSE: To read a range of a file, retrying the reads which are
+           interrupted or come up short.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      SUCCESS  The whole range was read.
+      ERROR    Failed reading, or the file ends before the range does.
+*****************************************************************************/
+static int
+pread_fully
+(
+    int fd,        /* I: file to read */
+    void *data,    /* O: the range read */
+    size_t size,   /* I: size of the range */
+    off_t offset   /* I: start of the range in the file */
+)
+{
+    ssize_t count;
+
+    while (size > 0)
     {
-        ERROR_MESSAGE ("Failed reading elevation band data", MODULE_NAME);
+        count = pread (fd, data, size, offset);
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count <= 0)
+            return ERROR;
 
-        return ERROR;
+        data = (uint8_t *) data + count;
+        size -= count;
+        offset += count;
+    }
+
+    return SUCCESS;
+}
+
+
+/*****************************************************************************
+  NAME: read_unmasked_band_lines
+
+  PURPOSE: To read the ranges of the specified lines of a spectral band
+           found by find_unmasked_ranges.
+
+  RETURN VALUE:  Type = const int16_t *
+      Value    Description
+      -------  ---------------------------------------------------------------
+      NULL     Failed to read the lines.
+      *        The lines, valid until the next lines of the band are read or
+               the input is closed.
+
+  NOTES:
+    1. The pixels which are not read are given a value other than the fill
+       value of the band.  The tests are not run on the cloud, cloud
+       shadow, and snow pixels, and the cfmask makes the fill pixels fill,
+       so only the fill check sees them.  This relies on the cfmask being
+       fill wherever the spectral bands are.
+*****************************************************************************/
+static const int16_t *
+read_unmasked_band_lines
+(
+    Input_Data_t *input_data, /* I: input data record */
+    Input_Bands_e band_index, /* I: spectral band to read */
+    int first_line,           /* I: first line to read */
+    int line_count            /* I: how many lines are to be read */
+)
+{
+    int16_t *data;
+    int16_t unread_value;
+    size_t pixel_count;
+    size_t index;
+    size_t start;
+    size_t end;
+    off_t offset;
+    int range;
+    char msg[256];
+
+    pixel_count = (size_t) line_count * input_data->samples;
+    offset = (off_t) first_line * input_data->samples * sizeof (int16_t);
+
+    data = reserve_band_buffer (input_data, band_index,
+                                pixel_count * sizeof (int16_t));
+    if (data == NULL)
+    {
+        /* error messages provided by reserve_band_buffer */
+        return NULL;
+    }
+
+    unread_value = 0;
+    if (input_data->fill_value[band_index] == 0)
+        unread_value = 1;
+
+    index = 0;
+    for (range = 0; range < input_data->unmasked_range_count; range++)
+    {
+        start = input_data->unmasked_ranges[2 * range];
+        end = input_data->unmasked_ranges[2 * range + 1];
+
+        for (; index < start; index++)
+            data[index] = unread_value;
+
+        if (pread_fully (fileno (input_data->band_fd[band_index]),
+                         &data[start], (end - start) * sizeof (int16_t),
+                         offset + start * sizeof (int16_t)) != SUCCESS)
+        {
+            snprintf (msg, sizeof (msg), "Failed reading lines %d to %d"
+                      " from (%s)", first_line, first_line + line_count - 1,
+                      input_data->band_name[band_index]);
+            RETURN_ERROR (msg, MODULE_NAME, NULL);
+        }
+        input_data->bytes_read += (end - start) * sizeof (int16_t);
+
+        index = end;
     }
 
-    count = fread (band_cfmask, sizeof (uint8_t), pixel_count,
-                   input_data->band_fd[I_BAND_CFMASK]);
-    if (count != pixel_count)
+    for (; index < pixel_count; index++)
+        data[index] = unread_value;
+
+    return data;
+}
+
+
+/*****************************************************************************
+  NAME: get_spectral_lines
+
+  PURPOSE: To provide the specified lines of a spectral band, only reading
+           the ranges not masked by the cfmask under mask-first.
+
+  RETURN VALUE:  Type = const void *
+      Value    Description
+      -------  ---------------------------------------------------------------
+      NULL     Failed to provide the lines.
+      *        The lines, valid until the next lines of the band are
+               provided or the input is closed.
+*****************************************************************************/
+static const void *
+get_spectral_lines
+(
+    Input_Data_t *input_data, /* I: input data record */
+    Input_Bands_e band_index, /* I: spectral band to provide */
+    int first_line,           /* I: first line to provide */
+    int line_count            /* I: how many lines are to be provided */
+)
+{
+    if (input_data->mask_first_flag)
+    {
+        return read_unmasked_band_lines (input_data, band_index, first_line,
+                                         line_count);
+    }
+
+    return get_band_lines (input_data, band_index, first_line, line_count);
+}
+
+
+/*****************************************************************************
+  NAME: read_bands_into_memory
+
+  PURPOSE: To provide a strip of lines from the specified input bands for
+           later processing.  The elevation band is provided with its own
+           line range so the strip can carry the halo lines needed for the
+           slope calculation.  For the water QA the TOA red and nir are
+           the red and nir of the tests when those are TOA, so they are
+           only provided once.  Under mask-first the cfmask is provided
+           first and only the spectral bands it does not mask are read.
+           Without the blue band none of the spectral bands are provided.
+
+  RETURN VALUE:  Type = bool
+      Value    Description
+      -------  ---------------------------------------------------------------
+      true     Success with providing all of the bands.
+      false    Failed to provide a band.
+*****************************************************************************/
+int
+read_bands_into_memory
+(
+    Input_Data_t *input_data,
+    const int16_t **band_blue,
+    const int16_t **band_green,
+    const int16_t **band_red,
+    const int16_t **band_nir,
+    const int16_t **band_swir1,
+    const int16_t **band_swir2,
+    const int16_t **band_elevation,
+    const uint8_t **band_cfmask,
+    const int16_t **band_toa_red,
+    const int16_t **band_toa_nir,
+    const uint8_t **band_l2qa,
+    int first_line,
+    int line_count,
+    int first_elevation_line,
+    int elevation_line_count
+)
+{
+    *band_cfmask = get_band_lines (input_data, I_BAND_CFMASK, first_line,
+                                   line_count);
+    if (*band_cfmask == NULL)
     {
         ERROR_MESSAGE ("Failed reading CFMASK band data", MODULE_NAME);
 
         return ERROR;
     }
 
+    /* The spectral bands are not needed for a scene which is not tested
+       for having too few clear pixels */
+    if (band_blue != NULL)
+    {
+        /* Under mask-first the cfmask determines where the spectral bands
+           are read */
+        if (input_data->mask_first_flag)
+        {
+            if (find_unmasked_ranges (input_data, *band_cfmask,
+                                      (size_t) line_count
+                                      * input_data->samples)
+                != SUCCESS)
+            {
+                ERROR_MESSAGE ("Failed finding the unmasked pixels",
+                               MODULE_NAME);
+
+                return ERROR;
+            }
+        }
+
+        *band_blue = get_spectral_lines (input_data, I_BAND_BLUE, first_line,
+                                         line_count);
+        if (*band_blue == NULL)
+        {
+            ERROR_MESSAGE ("Failed reading blue band data", MODULE_NAME);
+
+            return ERROR;
+        }
+
+        *band_green = get_spectral_lines (input_data, I_BAND_GREEN, first_line,
+                                          line_count);
+        if (*band_green == NULL)
+        {
+            ERROR_MESSAGE ("Failed reading green band data", MODULE_NAME);
+
+            return ERROR;
+        }
+
+        *band_red = get_spectral_lines (input_data, I_BAND_RED, first_line,
+                                        line_count);
+        if (*band_red == NULL)
+        {
+            ERROR_MESSAGE ("Failed reading red band data", MODULE_NAME);
+
+            return ERROR;
+        }
+
+        *band_nir = get_spectral_lines (input_data, I_BAND_NIR, first_line,
+                                        line_count);
+        if (*band_nir == NULL)
+        {
+            ERROR_MESSAGE ("Failed reading nir band data", MODULE_NAME);
+
+            return ERROR;
+        }
+
+        *band_swir1 = get_spectral_lines (input_data, I_BAND_SWIR1, first_line,
+                                          line_count);
+        if (*band_swir1 == NULL)
+        {
+            ERROR_MESSAGE ("Failed reading swir1 band data", MODULE_NAME);
+
+            return ERROR;
+        }
+
+        *band_swir2 = get_spectral_lines (input_data, I_BAND_SWIR2, first_line,
+                                          line_count);
+        if (*band_swir2 == NULL)
+        {
+            ERROR_MESSAGE ("Failed reading swir2 band data", MODULE_NAME);
+
+            return ERROR;
+        }
+    }
+
+    /* The elevation is not needed when the slope comes from the cache */
+    if (band_elevation != NULL)
+    {
+        *band_elevation = get_band_lines (input_data, I_BAND_ELEVATION,
+                                          first_elevation_line,
+                                          elevation_line_count);
+        if (*band_elevation == NULL)
+        {
+            ERROR_MESSAGE ("Failed reading elevation band data",
+                           MODULE_NAME);
+
+            return ERROR;
+        }
+    }
+
+    /* The water QA bands are only provided for the water QA */
+    if (band_l2qa != NULL)
+    {
+        *band_l2qa = get_band_lines (input_data, I_BAND_L2QA, first_line,
+                                     line_count);
+        if (*band_l2qa == NULL)
+        {
+            ERROR_MESSAGE ("Failed reading L2QA band data", MODULE_NAME);
+
+            return ERROR;
+        }
+
+        /* The tests already have the TOA red and nir when they use TOA */
+        if (input_data->band_fd[I_BAND_TOA_RED] == NULL)
+        {
+            *band_toa_red = *band_red;
+            *band_toa_nir = *band_nir;
+        }
+        else
+        {
+            *band_toa_red = get_band_lines (input_data, I_BAND_TOA_RED,
+                                            first_line, line_count);
+            if (*band_toa_red == NULL)
+            {
+                ERROR_MESSAGE ("Failed reading TOA red band data",
+                               MODULE_NAME);
+
+                return ERROR;
+            }
+
+            *band_toa_nir = get_band_lines (input_data, I_BAND_TOA_NIR,
+                                            first_line, line_count);
+            if (*band_toa_nir == NULL)
+            {
+                ERROR_MESSAGE ("Failed reading TOA nir band data",
+                               MODULE_NAME);
+
+                return ERROR;
+            }
+        }
+    }
+
     return SUCCESS;
 }
-
@@ -3,11 +3,22 @@
 #define INPUT_H
 
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 #include "espa_metadata.h"
 
 #include "const.h"
+#include "read_ahead.h"
+
+
+/* How the input images are accessed */
+typedef enum
+{
+    INPUT_MAP, /* Memory mapped, read when an image can not be mapped */
+    INPUT_READ /* Read */
+} Input_Method_e;
 
 
 /* Structure for the 'input' data */
@@ -19,8 +30,33 @@ typedef struct
     double y_pixel_size;
     char *band_name[MAX_INPUT_BANDS];    /* Name of the input image files */
     FILE *band_fd[MAX_INPUT_BANDS];      /* Open fd's for the image */
+    int data_size[MAX_INPUT_BANDS];      /* Size of a single data element */
     float scale_factor[MAX_INPUT_BANDS]; /* Scale factors from the metadata */
     int fill_value[MAX_INPUT_BANDS];     /* Fill value from the metadata */
+    const void *band_map[MAX_INPUT_BANDS]; /* Read-only mapping of the image,
+                                              NULL when it is read instead */
+    size_t band_map_size[MAX_INPUT_BANDS]; /* Size of the mapping */
+    size_t band_map_released[MAX_INPUT_BANDS]; /* Bytes at the start of the
+                                                  mapping already dropped */
+    void *band_buffer[MAX_INPUT_BANDS];  /* Lines read from an image which is
+                                            not mapped */
+    size_t band_buffer_size[MAX_INPUT_BANDS]; /* Size of the read buffer */
+    Read_Ahead_t *read_ahead;            /* Reads the images which are not
+                                            mapped ahead of their use, NULL
+                                            when not reading ahead */
+    long long bytes_read;                /* Bytes of the bands provided, read
+                                            or mapped */
+    bool mask_first_flag;                /* Only read the spectral bands
+                                            where the cfmask is not cloud,
+                                            cloud shadow, snow, or fill */
+    size_t *unmasked_ranges;             /* Start and end pixel of each
+                                            range of the strip read from the
+                                            spectral bands */
+    int unmasked_range_count;            /* Ranges in the strip */
+    int unmasked_range_capacity;         /* Ranges the array holds */
+    int l2qa_meta_index;                 /* Index of the Level2 QA band in
+                                            the metadata, -1 when it is not
+                                            opened */
 } Input_Data_t;
 
 
@@ -28,7 +64,15 @@ Input_Data_t *
 open_input
 (
     Espa_internal_meta_t *metadata, /* I: input metadata */
-    bool use_toa_flag               /* I: use TOA or SR data */
+    bool use_toa_flag,              /* I: use TOA or SR data */
+    bool water_qa_flag,             /* I: also open the Level2 QA and the
+                                          TOA red and nir for the water
+                                          QA */
+    Input_Method_e input_method,    /* I: how the images are accessed */
+    int prefetch_depth,             /* I: strips read ahead of the one in
+                                          use, zero for none */
+    bool mask_first_flag            /* I: read the cfmask first and only the
+                                          spectral bands it does not mask */
 );
 
 
@@ -40,18 +84,83 @@ close_input
 
 
 int
-read_bands_into_memory
+read_band_lines
+(
+    Input_Data_t *input_data, /* I: input data record */
+    Input_Bands_e band_index, /* I: band to read from */
+    int first_line,           /* I: first line to read */
+    int line_count,           /* I: how many lines are to be read in */
+    void *data                /* O: pointer to allocated memory */
+);
+
+
+const void *
+get_band_lines
+(
+    Input_Data_t *input_data, /* I: input data record */
+    Input_Bands_e band_index, /* I: band to provide */
+    int first_line,           /* I: first line to provide */
+    int line_count            /* I: how many lines are to be provided */
+);
+
+
+void
+prefetch_band_lines
 (
     Input_Data_t *input_data, /* I: input data record */
-    int16_t *band_blue,       /* I: pointer to allocated memory */
-    int16_t *band_green,      /* I: pointer to allocated memory */
-    int16_t *band_red,        /* I: pointer to allocated memory */
-    int16_t *band_nir,        /* I: pointer to allocated memory */
-    int16_t *band_swir1,      /* I: pointer to allocated memory */
-    int16_t *band_swir2,      /* I: pointer to allocated memory */
-    int16_t *band_elevation,  /* I: pointer to allocated memory */
-    uint8_t *band_cfmask,     /* I: pointer to allocated memory */
-    int pixel_count           /* I: how many pixel are to be read in */
+    Input_Bands_e band_index, /* I: band to read ahead */
+    int first_line,           /* I: first line to read ahead */
+    int line_count            /* I: how many lines are to be read ahead */
+);
+
+
+void
+prefetch_bands
+(
+    Input_Data_t *input_data,       /* I: input data record */
+    bool include_elevation_flag,    /* I: read ahead the elevation band */
+    int first_line,                 /* I: first line of the strip to read
+                                          ahead */
+    int line_count,                 /* I: how many lines are to be read
+                                          ahead */
+    int first_elevation_line,       /* I: first elevation line to read ahead,
+                                          this includes the halo line above
+                                          the strip */
+    int elevation_line_count        /* I: how many elevation lines are to be
+                                          read ahead, including the halo
+                                          lines */
+);
+
+
+int
+read_bands_into_memory
+(
+    Input_Data_t *input_data,       /* I: input data record */
+    const int16_t **band_blue,      /* O: the strip of the band, or NULL
+                                          to skip the spectral bands */
+    const int16_t **band_green,     /* O: the strip of the band */
+    const int16_t **band_red,       /* O: the strip of the band */
+    const int16_t **band_nir,       /* O: the strip of the band */
+    const int16_t **band_swir1,     /* O: the strip of the band */
+    const int16_t **band_swir2,     /* O: the strip of the band */
+    const int16_t **band_elevation, /* O: the elevation lines, or NULL to
+                                          skip the elevation band */
+    const uint8_t **band_cfmask,    /* O: the strip of the band */
+    const int16_t **band_toa_red,   /* O: the strip of the TOA red for the
+                                          water QA */
+    const int16_t **band_toa_nir,   /* O: the strip of the TOA nir for the
+                                          water QA */
+    const uint8_t **band_l2qa,      /* O: the strip of the band, or NULL to
+                                          skip the water QA bands */
+    int first_line,                 /* I: first line of the strip to
+                                          provide */
+    int line_count,                 /* I: how many lines are to be provided */
+    int first_elevation_line,       /* I: first elevation line to provide,
+                                          this includes the halo line above
+                                          the strip */
+    int elevation_line_count        /* I: how many elevation lines are to be
+                                          provided, including the halo
+                                          lines */
 );
 
 
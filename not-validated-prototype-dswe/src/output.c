@@ -3,6 +3,7 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <string.h>
 #include <limits.h>
 #include <time.h>
 
@@ -10,20 +11,19 @@
 #include "parse_metadata.h"
 #include "write_metadata.h"
 #include "envi_header.h"
-#include "raw_binary_io.h"
 
 #include "const.h"
 #include "dswe.h"
 #include "utilities.h"
-
-
-#define MAX_DATE_LEN 28
+#include "output.h"
 
 
 /*****************************************************************************
-  NAME:  write_u8bit_dswe_product
+  NAME:  determine_image_filename
 
-  PURPOSE:  Create the *.img file and the associated ENVI header.
+  PURPOSE:  Find the representative band for metadata information and build
+            the output image filename for the specified band name from the
+            scene name.
 
   RETURN VALUE:  Type = int
       Value    Description
@@ -31,88 +31,167 @@
       SUCCESS  No errors were encountered.
       ERROR    An error was encountered.
 *****************************************************************************/
-int
-write_u8bit_dswe_product
+static int
+determine_image_filename
 (
-    char *output_filename,
-    int element_count,
-    uint8_t *data
+    Espa_internal_meta_t *in_meta, /* I: the input metadata */
+    bool use_toa_flag,             /* I: use TOA or SR data */
+    char *band_name,               /* I: name of the output band */
+    char *image_filename,          /* O: the output image filename */
+    int image_filename_size,       /* I: size of image_filename */
+    int *src_index                 /* O: index of the representative band */
 )
 {
-    FILE *fd = NULL;
-    char msg[512];
+    int count;
+    int band_index;
+    char scene_name[PATH_MAX];
+    char search_string[PATH_MAX];
+    char *my_char = NULL;
 
-    fd = fopen(output_filename, "w");
-    if (fd == NULL)
+    /* Find the representative band for metadata information */
+    *src_index = -1;
+    for (band_index = 0; band_index < in_meta->nbands; band_index++)
     {
-        snprintf (msg, sizeof (msg), "Failed creating file %s",
-                  output_filename);
-        RETURN_ERROR (msg, MODULE_NAME, ERROR);
+        if (use_toa_flag)
+        {
+            if (!strcmp (in_meta->band[band_index].name, "toa_band1") &&
+                !strcmp (in_meta->band[band_index].product, "toa_refl"))
+            {
+                /* this is the index we'll use for reflectance band info */
+                *src_index = band_index;
+                break;
+            }
+        }
+        else
+        {
+            if (!strcmp (in_meta->band[band_index].name, "sr_band1") &&
+                !strcmp (in_meta->band[band_index].product, "sr_refl"))
+            {
+                /* this is the index we'll use for reflectance band info */
+                *src_index = band_index;
+                break;
+            }
+        }
     }
 
-    if (write_raw_binary(fd, 1, element_count, sizeof (uint8_t), data)
-        != SUCCESS)
+    if (*src_index == -1)
     {
-        snprintf (msg, sizeof (msg), "Failed writing file %s",
-                  output_filename);
-        RETURN_ERROR (msg, MODULE_NAME, ERROR);
+        RETURN_ERROR ("Failed finding the representative band", MODULE_NAME,
+                      ERROR);
     }
 
-    fclose(fd);
+    /* Figure out the scene name */
+    snprintf (scene_name, sizeof(scene_name), "%s",
+              in_meta->band[*src_index].file_name);
+    snprintf (search_string, sizeof(search_string), "_%s",
+              in_meta->band[*src_index].name);
+    my_char = strstr(scene_name, search_string);
+    if (my_char != NULL)
+        *my_char = '\0';
+
+    /* Figure out the output filename */
+    count = snprintf (image_filename, image_filename_size,
+                      "%s_%s.img", scene_name, band_name);
+    if (count < 0 || count >= image_filename_size)
+    {
+        RETURN_ERROR ("Failed creating output filename", MODULE_NAME, ERROR);
+    }
 
     return SUCCESS;
 }
 
 
 /*****************************************************************************
-  NAME:  write_16bit_dswe_product
+  NAME:  open_band_product
 
-  PURPOSE:  Create the *.img file and the associated ENVI header.
+  PURPOSE:  Create the output *.img file for the specified band, so the band
+            data can be written to it a strip of lines at a time.
 
-  RETURN VALUE:  Type = int
+  RETURN VALUE:  Type = FILE *
       Value    Description
       -------  ---------------------------------------------------------------
-      SUCCESS  No errors were encountered.
-      ERROR    An error was encountered.
+      NULL     An error was encountered.
+      *        The opened output image file.
 *****************************************************************************/
-int
-write_16bit_dswe_product
+FILE *
+open_band_product
 (
-    char *output_filename,
-    int element_count,
-    int16_t *data
+    Espa_internal_meta_t *in_meta,
+    bool use_toa_flag,
+    char *band_name
 )
 {
+    int src_index;
+    char image_filename[PATH_MAX];
+    char msg[PATH_MAX + 40];
     FILE *fd = NULL;
-    char msg[512];
 
-    fd = fopen(output_filename, "w");
+    if (determine_image_filename (in_meta, use_toa_flag, band_name,
+                                  image_filename, sizeof (image_filename),
+                                  &src_index)
+        != SUCCESS)
+    {
+        RETURN_ERROR ("Failed determining the output filename", MODULE_NAME,
+                      NULL);
+    }
+
+    fd = fopen (image_filename, "w");
     if (fd == NULL)
     {
         snprintf (msg, sizeof (msg), "Failed creating file %s",
-                  output_filename);
-        RETURN_ERROR (msg, MODULE_NAME, ERROR);
+                  image_filename);
+        RETURN_ERROR (msg, MODULE_NAME, NULL);
     }
 
-    if (write_raw_binary(fd, 1, element_count, sizeof (int16_t), data)
-        != SUCCESS)
+    return fd;
+}
+
+
+/*****************************************************************************
+  NAME:  write_band_product_lines
+
+  PURPOSE:  Append a strip of lines to an output *.img file created by
+            open_band_product.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      SUCCESS  No errors were encountered.
+      ERROR    An error was encountered.
+
+  NOTES:
+    1. The strip is written with fwrite instead of write_raw_binary, which
+       counts the pixels of the strip in an int and so can not write a strip
+       of more than 2^31 pixels.
+*****************************************************************************/
+int
+write_band_product_lines
+(
+    FILE *fd,
+    int line_count,
+    int samples,
+    int data_size,
+    void *data
+)
+{
+    size_t pixel_count = (size_t) line_count * samples;
+
+    if (fwrite (data, data_size, pixel_count, fd) != pixel_count)
     {
-        snprintf (msg, sizeof (msg), "Failed writing file %s",
-                  output_filename);
-        RETURN_ERROR (msg, MODULE_NAME, ERROR);
+        RETURN_ERROR ("Failed writing output band lines", MODULE_NAME, ERROR);
     }
 
-    fclose(fd);
-
     return SUCCESS;
 }
 
 
 /*****************************************************************************
-  NAME:  add_dswe_band_product
+  NAME:  open_metadata_session
 
-  PURPOSE:  Create a new envi output file including envi header and add the
-            associated information to the XML metadata file.
+  PURPOSE:  Start adding output bands to the XML metadata file.  The session
+            takes over the already parsed input metadata, so the XML file is
+            not parsed again, and determines the production date shared by
+            all the output bands.
 
   RETURN VALUE:  Type = int
       Value    Description
@@ -121,255 +200,195 @@ write_16bit_dswe_product
       ERROR    An error was encountered.
 *****************************************************************************/
 int
-add_dswe_band_product
+open_metadata_session
 (
     char *xml_filename,
+    Espa_internal_meta_t *in_meta,
     bool use_toa_flag,
-    char *product_name,
-    char *band_name,
-    char *short_name,
-    char *long_name,
-    int min_range,
-    int max_range,
-    uint8_t *data
+    int max_bands,
+    Metadata_Session_t *session
 )
 {
-    int count;
-    int band_index = -1;
-    int src_index = -1;
-    int element_count;
-    char scene_name[PATH_MAX];
-    char image_filename[PATH_MAX];
-    char *my_char = NULL;
-    Espa_internal_meta_t in_meta;
-    Espa_internal_meta_t tmp_meta;
-    Espa_band_meta_t *bmeta = NULL; /* pointer to the band metadata array
-                                       within the output structure */
     time_t tp;                   /* time structure */
     struct tm *tm = NULL;        /* time structure for UTC time */
-    char production_date[MAX_DATE_LEN+1]; /* current date/time for production */
-    Envi_header_t envi_hdr;   /* output ENVI header information */
-    char envi_file[PATH_MAX];
-    int class_count;
-    char search_string[PATH_MAX];
 
-    /* Initialize the input metadata structure */
-    init_metadata_struct (&in_meta);
+    session->xml_filename = xml_filename;
+    session->use_toa_flag = use_toa_flag;
+    session->band_count = 0;
+    session->in_meta_changed_flag = false;
 
-    /* Parse the metadata file into our internal metadata structure; also
-       allocates space as needed for various pointers in the global and band
-       metadata */
-    if (parse_metadata (xml_filename, &in_meta) != SUCCESS)
-    {
-        /* Error messages already written */
-        return ERROR;
-    }
+    /* Take over the input metadata, leaving nothing for the caller to
+       free */
+    session->in_meta = *in_meta;
+    init_metadata_struct (in_meta);
 
-    /* Find the representative band for metadata information */
-    for (band_index = 0; band_index < in_meta.nbands; band_index++)
+    /* Initialize the internal metadata for the output bands. The global
+       metadata won't be updated, however the band metadata will be updated
+       and used later for appending to the original XML file. */
+    init_metadata_struct (&session->out_meta);
+    if (allocate_band_metadata (&session->out_meta, max_bands) != SUCCESS)
     {
-        if (use_toa_flag)
-        {
-            if (!strcmp (in_meta.band[band_index].name, "toa_band1") &&
-                !strcmp (in_meta.band[band_index].product, "toa_refl"))
-            {
-                /* this is the index we'll use for reflectance band info */
-                src_index = band_index;
-                break;
-            }
-        }
-        else
-        {
-            if (!strcmp (in_meta.band[band_index].name, "sr_band1") &&
-                !strcmp (in_meta.band[band_index].product, "sr_refl"))
-            {
-                /* this is the index we'll use for reflectance band info */
-                src_index = band_index;
-                break;
-            }
-        }
+        free_metadata (&session->in_meta);
+        RETURN_ERROR ("allocating band metadata", MODULE_NAME, ERROR);
     }
 
-    /* Figure out the scene name */
-    strcpy (scene_name, in_meta.band[src_index].file_name);
-    snprintf (search_string, sizeof(search_string), "_%s",
-              in_meta.band[src_index].name);
-    my_char = strstr(scene_name, search_string);
-    if (my_char != NULL)
-        *my_char = '\0';
-
     /* Get the current date/time (UTC) for the production date of each band */
     if (time (&tp) == -1)
     {
+        close_metadata_session (session);
         RETURN_ERROR ("unable to obtain current time", MODULE_NAME, ERROR);
     }
 
     tm = gmtime (&tp);
     if (tm == NULL)
     {
+        close_metadata_session (session);
         RETURN_ERROR ("converting time to UTC", MODULE_NAME, ERROR);
     }
 
-    if (strftime (production_date, MAX_DATE_LEN, "%Y-%m-%dT%H:%M:%SZ", tm)
-        == 0)
+    if (strftime (session->production_date, MAX_DATE_LEN,
+                  "%Y-%m-%dT%H:%M:%SZ", tm) == 0)
     {
+        close_metadata_session (session);
         RETURN_ERROR ("formatting the production date/time", MODULE_NAME,
                       ERROR);
     }
 
-    /* Figure out the output filename */
-    count = snprintf (image_filename, sizeof (image_filename),
-                      "%s_%s.img", scene_name, band_name);
-    if (count < 0 || count >= sizeof (image_filename))
-    {
-        RETURN_ERROR ("Failed creating output filename", MODULE_NAME, ERROR);
-    }
+    return SUCCESS;
+}
 
-    /* Figure out how many elements are in the data */
-    element_count = in_meta.band[src_index].nlines *
-                    in_meta.band[src_index].nsamps;
 
-    /* First write out the ENVI band and header files */
-    if (write_u8bit_dswe_product (image_filename, element_count, data)
-        != SUCCESS)
-    {
-        RETURN_ERROR ("Failed creating output ENVI files", MODULE_NAME,
-                      ERROR);
-    }
+/*****************************************************************************
+  NAME:  set_l2qa_percentages
 
-    /* Gather all the band information from the representative band */
+  PURPOSE:  Update the clear and water percentages of the Level2 QA band in
+            the input metadata, which is written back to the XML metadata
+            file when the session is committed.
 
-    /* Initialize the internal metadata for the output product. The global
-       metadata won't be updated, however the band metadata will be updated
-       and used later for appending to the original XML file. */
-    init_metadata_struct (&tmp_meta);
-
-    /* Allocate memory for the output band */
-    if (allocate_band_metadata (&tmp_meta, 1) != SUCCESS)
-        RETURN_ERROR("allocating band metadata", MODULE_NAME, ERROR);
-    bmeta = tmp_meta.band;
-
-    snprintf (bmeta[0].short_name, sizeof (bmeta[0].short_name),
-              "%s", in_meta.band[src_index].short_name);
-    bmeta[0].short_name[3] = '\0';
-    strcat (bmeta[0].short_name, short_name);
-    snprintf (bmeta[0].product, sizeof (bmeta[0].product),
-              "%s", product_name);
-    snprintf (bmeta[0].source, sizeof (bmeta[0].source), "sr_refl");
-    snprintf (bmeta[0].category, sizeof (bmeta[0].category), "qa");
-    bmeta[0].nlines = in_meta.band[src_index].nlines;
-    bmeta[0].nsamps = in_meta.band[src_index].nsamps;
-    bmeta[0].pixel_size[0] = in_meta.band[src_index].pixel_size[0];
-    bmeta[0].pixel_size[1] = in_meta.band[src_index].pixel_size[1];
-    snprintf (bmeta[0].pixel_units, sizeof (bmeta[0].pixel_units), "meters");
-    snprintf (bmeta[0].app_version, sizeof (bmeta[0].app_version),
-              "dswe_%s", DSWE_VERSION);
-    snprintf (bmeta[0].production_date, sizeof (bmeta[0].production_date),
-              "%s", production_date);
-    bmeta[0].data_type = ESPA_UINT8;
-    bmeta[0].fill_value = DSWE_NO_DATA_VALUE;
-    bmeta[0].valid_range[0] = min_range;
-    bmeta[0].valid_range[1] = max_range;
-    snprintf (bmeta[0].name, sizeof (bmeta[0].name),
-              "%s", band_name);
-    snprintf (bmeta[0].long_name, sizeof (bmeta[0].long_name),
-              "%s", long_name);
-    snprintf (bmeta[0].data_units, sizeof (bmeta[0].data_units),
-              "quality/feature classification");
-    snprintf (bmeta[0].file_name, sizeof (bmeta[0].file_name),
-              "%s", image_filename);
+  RETURN VALUE:  None
+*****************************************************************************/
+void
+set_l2qa_percentages
+(
+    Metadata_Session_t *session, /* I/O: the metadata session */
+    int l2qa_meta_index,         /* I: index of the Level2 QA band */
+    float percent_clear,         /* I: percent of clear pixels */
+    float percent_water          /* I: percent of water pixels */
+)
+{
+    Espa_band_meta_t *l2qa_band = &session->in_meta.band[l2qa_meta_index];
+    int cover_index;
 
-    /* Figure out how many classes we have */
-    if (max_range == 9)
+    for (cover_index = 0; cover_index < l2qa_band->ncover; cover_index++)
     {
-        class_count = 6;
-    }
-    else
-    {
-        class_count = 5;
+        if (strcmp (l2qa_band->percent_cover[cover_index].description,
+                    "clear") == 0)
+        {
+            l2qa_band->percent_cover[cover_index].percent = percent_clear;
+        }
+        else if (strcmp (l2qa_band->percent_cover[cover_index].description,
+                         "water") == 0)
+        {
+            l2qa_band->percent_cover[cover_index].percent = percent_water;
+        }
     }
 
-    /* Set up class values information */
-    if (allocate_class_metadata (&bmeta[0], class_count) != SUCCESS)
-        RETURN_ERROR ("allocating dswe classes", MODULE_NAME, ERROR);
-
-    bmeta[0].class_values[0].class = 0;
-    snprintf (bmeta[0].class_values[0].description,
-              sizeof (bmeta[0].class_values[0].description),
-              "not water");
-
-    bmeta[0].class_values[1].class = 1;
-    snprintf (bmeta[0].class_values[1].description,
-              sizeof (bmeta[0].class_values[1].description),
-              "water - high confidence");
+    session->in_meta_changed_flag = true;
+}
 
-    bmeta[0].class_values[2].class = 2;
-    snprintf (bmeta[0].class_values[2].description,
-              sizeof (bmeta[0].class_values[2].description),
-              "water - moderate confidence");
 
-    bmeta[0].class_values[3].class = 3;
-    snprintf (bmeta[0].class_values[3].description,
-              sizeof (bmeta[0].class_values[3].description),
-              "partial surface water pixel");
-
-    if (class_count == 6)
-    {
-        bmeta[0].class_values[4].class = 9;
-        snprintf (bmeta[0].class_values[4].description,
-                  sizeof (bmeta[0].class_values[4].description),
-                  "cloud, cloud shadow, and snow");
-    }
+/*****************************************************************************
+  NAME:  commit_metadata_session
 
-    bmeta[0].class_values[class_count-1].class = DSWE_NO_DATA_VALUE;
-    snprintf (bmeta[0].class_values[class_count-1].description,
-              sizeof (bmeta[0].class_values[class_count-1].description),
-              "fill");
+  PURPOSE:  Append all the output bands added to the session to the XML
+            metadata file, with a single write of the file.  When the input
+            metadata was changed, the whole XML file is written from it with
+            the output bands following its bands.
 
-    /* Create the ENVI header file this band */
-    if (create_envi_struct (&bmeta[0], &in_meta.global, &envi_hdr) != SUCCESS)
-    {
-        RETURN_ERROR ("Failed to create ENVI header structure.", MODULE_NAME,
-                      ERROR);
-    }
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      SUCCESS  No errors were encountered.
+      ERROR    An error was encountered.
+*****************************************************************************/
+int
+commit_metadata_session
+(
+    Metadata_Session_t *session
+)
+{
+    Espa_internal_meta_t combined_meta; /* The input and output bands */
+    int in_count = session->in_meta.nbands;
+    int status;
+
+    if (session->in_meta_changed_flag)
+    {
+        /* The bands are only borrowed, so only the list of them is freed */
+        combined_meta = session->in_meta;
+        combined_meta.nbands = in_count + session->band_count;
+        combined_meta.band = malloc (combined_meta.nbands
+                                     * sizeof (Espa_band_meta_t));
+        if (combined_meta.band == NULL)
+        {
+            RETURN_ERROR ("allocating the combined band metadata",
+                          MODULE_NAME, ERROR);
+        }
+        memcpy (combined_meta.band, session->in_meta.band,
+                in_count * sizeof (Espa_band_meta_t));
+        memcpy (&combined_meta.band[in_count], session->out_meta.band,
+                session->band_count * sizeof (Espa_band_meta_t));
+
+        status = write_metadata (&combined_meta, session->xml_filename);
+        free (combined_meta.band);
+        if (status != SUCCESS)
+        {
+            RETURN_ERROR ("Writing the XML file", MODULE_NAME, ERROR);
+        }
 
-    /* Write the ENVI header */
-    snprintf (envi_file, sizeof(envi_file), "%s", bmeta[0].file_name);
-    my_char = strchr (envi_file, '.');
-    if (my_char == NULL)
-    {
-        RETURN_ERROR ("Failed creating ENVI header filename", MODULE_NAME,
-                      ERROR);
+        return SUCCESS;
     }
 
-    sprintf (my_char, ".hdr");
-    if (write_envi_hdr (envi_file, &envi_hdr) != SUCCESS)
-    {
-        RETURN_ERROR ("Failed writing ENVI header file", MODULE_NAME, ERROR);
-    }
+    if (session->band_count == 0)
+        return SUCCESS;
 
-    /* Append the DSWE band to the XML file */
-    if (append_metadata (1, bmeta, xml_filename)
+    /* Append the DSWE bands to the XML file */
+    if (append_metadata (session->band_count, session->out_meta.band,
+                         session->xml_filename)
         != SUCCESS)
     {
         RETURN_ERROR ("Appending spectral index bands to XML file",
                        MODULE_NAME, ERROR);
     }
 
-    free_metadata (&in_meta);
-    free_metadata (&tmp_meta);
-
     return SUCCESS;
 }
 
 
 /*****************************************************************************
-  NAME:  add_test_band_product
+  NAME:  close_metadata_session
 
-  PURPOSE:  Create a new envi output file including envi header and add the
-            associated information to the XML metadata file.
+  PURPOSE:  Free the metadata held by the session.
+
+  RETURN VALUE:  None
+*****************************************************************************/
+void
+close_metadata_session
+(
+    Metadata_Session_t *session
+)
+{
+    free_metadata (&session->in_meta);
+    free_metadata (&session->out_meta);
+    session->band_count = 0;
+}
 
-  NOTE: Only for the Raw "test" DSWE band output.
+
+/*****************************************************************************
+  NAME:  new_band_metadata
+
+  PURPOSE:  Take the next output band of the session and fill in the
+            information common to all the DSWE output bands from the
+            representative band.
 
   RETURN VALUE:  Type = int
       Value    Description
@@ -377,174 +396,112 @@ add_dswe_band_product
       SUCCESS  No errors were encountered.
       ERROR    An error was encountered.
 *****************************************************************************/
-int
-add_test_band_product
+static int
+new_band_metadata
 (
-    char *xml_filename,
-    bool use_toa_flag,
-    char *product_name,
-    char *band_name,
-    char *short_name,
-    char *long_name,
-    int min_range,
-    int max_range,
-    int16_t *data
+    Metadata_Session_t *session, /* I: the metadata session */
+    char *product_name,          /* I: product of the band */
+    char *band_name,             /* I: name of the band */
+    char *short_name,            /* I: short name suffix of the band */
+    char *long_name,             /* I: long name of the band */
+    int min_range,               /* I: minimum valid value */
+    int max_range,               /* I: maximum valid value */
+    Espa_band_meta_t **band_meta /* O: the band metadata */
 )
 {
-    int count;
-    int band_index = -1;
     int src_index = -1;
-    int element_count;
-    char scene_name[PATH_MAX];
     char image_filename[PATH_MAX];
-    char *my_char = NULL;
-    Espa_internal_meta_t in_meta;
-    Espa_internal_meta_t tmp_meta;
-    Espa_band_meta_t *bmeta = NULL; /* pointer to the band metadata array
-                                       within the output structure */
-    time_t tp;                   /* time structure */
-    struct tm *tm = NULL;        /* time structure for UTC time */
-    char production_date[MAX_DATE_LEN+1]; /* current date/time for production */
-    Envi_header_t envi_hdr;   /* output ENVI header information */
-    char envi_file[PATH_MAX];
-    char search_string[PATH_MAX];
-
-    /* Initialize the input metadata structure */
-    init_metadata_struct (&in_meta);
+    Espa_internal_meta_t *in_meta = &session->in_meta;
+    Espa_band_meta_t *bmeta = NULL;
 
-    /* Parse the metadata file into our internal metadata structure; also
-       allocates space as needed for various pointers in the global and band
-       metadata */
-    if (parse_metadata (xml_filename, &in_meta) != SUCCESS)
+    if (session->band_count >= session->out_meta.nbands)
     {
-        /* Error messages already written */
-        return ERROR;
+        RETURN_ERROR ("Too many output bands for the metadata session",
+                      MODULE_NAME, ERROR);
     }
 
-    /* Find the representative band for metadata information */
-    for (band_index = 0; band_index < in_meta.nbands; band_index++)
-    {
-        if (use_toa_flag)
-        {
-            if (!strcmp (in_meta.band[band_index].name, "toa_band1") &&
-                !strcmp (in_meta.band[band_index].product, "toa_refl"))
-            {
-                /* this is the index we'll use for reflectance band info */
-                src_index = band_index;
-                break;
-            }
-        }
-        else
-        {
-            if (!strcmp (in_meta.band[band_index].name, "sr_band1") &&
-                !strcmp (in_meta.band[band_index].product, "sr_refl"))
-            {
-                /* this is the index we'll use for reflectance band info */
-                src_index = band_index;
-                break;
-            }
-        }
-    }
-
-    /* Figure out the scene name */
-    snprintf (scene_name, sizeof(scene_name), "%s",
-              in_meta.band[src_index].file_name);
-    snprintf (search_string, sizeof(search_string), "_%s",
-              in_meta.band[src_index].name);
-    my_char = strstr(scene_name, search_string);
-    if (my_char != NULL)
-        *my_char = '\0';
-
-    /* Get the current date/time (UTC) for the production date of each band */
-    if (time (&tp) == -1)
-    {
-        RETURN_ERROR ("unable to obtain current time", MODULE_NAME, ERROR);
-    }
-
-    tm = gmtime (&tp);
-    if (tm == NULL)
-    {
-        RETURN_ERROR ("converting time to UTC", MODULE_NAME, ERROR);
-    }
-
-    if (strftime (production_date, MAX_DATE_LEN, "%Y-%m-%dT%H:%M:%SZ", tm)
-        == 0)
-    {
-        RETURN_ERROR ("formatting the production date/time", MODULE_NAME,
-                      ERROR);
-    }
-
-    /* Figure out the output filename */
-    count = snprintf (image_filename, sizeof (image_filename),
-                      "%s_%s.img", scene_name, band_name);
-    if (count < 0 || count >= sizeof (image_filename))
-    {
-        RETURN_ERROR ("Failed creating output filename", MODULE_NAME, ERROR);
-    }
-
-    /* Figure out how many elements are in the data */
-    element_count = in_meta.band[src_index].nlines *
-                    in_meta.band[src_index].nsamps;
-
-    /* First write out the ENVI band and header files */
-    if (write_16bit_dswe_product (image_filename, element_count, data)
+    /* Figure out the output filename, the image itself has already been
+       written a strip at a time */
+    if (determine_image_filename (in_meta, session->use_toa_flag, band_name,
+                                  image_filename, sizeof (image_filename),
+                                  &src_index)
         != SUCCESS)
     {
-        RETURN_ERROR ("Failed creating output ENVI files", MODULE_NAME,
+        RETURN_ERROR ("Failed determining the output filename", MODULE_NAME,
                       ERROR);
     }
 
     /* Gather all the band information from the representative band */
+    bmeta = &session->out_meta.band[session->band_count];
 
-    /* Initialize the internal metadata for the output product. The global
-       metadata won't be updated, however the band metadata will be updated
-       and used later for appending to the original XML file. */
-    init_metadata_struct (&tmp_meta);
-
-    /* Allocate memory for the output band */
-    if (allocate_band_metadata (&tmp_meta, 1) != SUCCESS)
-        RETURN_ERROR("allocating band metadata", MODULE_NAME, ERROR);
-    bmeta = tmp_meta.band;
-
-    snprintf (bmeta[0].short_name, sizeof (bmeta[0].short_name),
-              "%s", in_meta.band[src_index].short_name);
-    bmeta[0].short_name[3] = '\0';
-    strcat (bmeta[0].short_name, short_name);
-    snprintf (bmeta[0].product, sizeof (bmeta[0].product),
+    snprintf (bmeta->short_name, sizeof (bmeta->short_name),
+              "%s", in_meta->band[src_index].short_name);
+    bmeta->short_name[3] = '\0';
+    strcat (bmeta->short_name, short_name);
+    snprintf (bmeta->product, sizeof (bmeta->product),
               "%s", product_name);
-    snprintf (bmeta[0].source, sizeof (bmeta[0].source), "sr_refl");
-    snprintf (bmeta[0].category, sizeof (bmeta[0].category), "qa");
-    bmeta[0].nlines = in_meta.band[src_index].nlines;
-    bmeta[0].nsamps = in_meta.band[src_index].nsamps;
-    bmeta[0].pixel_size[0] = in_meta.band[src_index].pixel_size[0];
-    bmeta[0].pixel_size[1] = in_meta.band[src_index].pixel_size[1];
-    snprintf (bmeta[0].pixel_units, sizeof (bmeta[0].pixel_units), "meters");
-    snprintf (bmeta[0].app_version, sizeof (bmeta[0].app_version),
+    snprintf (bmeta->source, sizeof (bmeta->source), "sr_refl");
+    bmeta->nlines = in_meta->band[src_index].nlines;
+    bmeta->nsamps = in_meta->band[src_index].nsamps;
+    bmeta->pixel_size[0] = in_meta->band[src_index].pixel_size[0];
+    bmeta->pixel_size[1] = in_meta->band[src_index].pixel_size[1];
+    snprintf (bmeta->pixel_units, sizeof (bmeta->pixel_units), "meters");
+    snprintf (bmeta->app_version, sizeof (bmeta->app_version),
               "dswe_%s", DSWE_VERSION);
-    snprintf (bmeta[0].production_date, sizeof (bmeta[0].production_date),
-              "%s", production_date);
-    bmeta[0].data_type = ESPA_INT16;
-    bmeta[0].fill_value = TESTS_NO_DATA_VALUE;
-    bmeta[0].valid_range[0] = min_range;
-    bmeta[0].valid_range[1] = max_range;
-    snprintf (bmeta[0].name, sizeof (bmeta[0].name),
+    snprintf (bmeta->production_date, sizeof (bmeta->production_date),
+              "%s", session->production_date);
+    bmeta->valid_range[0] = min_range;
+    bmeta->valid_range[1] = max_range;
+    snprintf (bmeta->name, sizeof (bmeta->name),
               "%s", band_name);
-    snprintf (bmeta[0].long_name, sizeof (bmeta[0].long_name),
+    snprintf (bmeta->long_name, sizeof (bmeta->long_name),
               "%s", long_name);
-    snprintf (bmeta[0].data_units, sizeof (bmeta[0].data_units),
+    snprintf (bmeta->data_units, sizeof (bmeta->data_units),
               "quality/feature classification");
-    snprintf (bmeta[0].file_name, sizeof (bmeta[0].file_name),
+    snprintf (bmeta->file_name, sizeof (bmeta->file_name),
               "%s", image_filename);
 
+    *band_meta = bmeta;
+
+    return SUCCESS;
+}
+
+
+/*****************************************************************************
+  NAME:  add_band_to_session
+
+  PURPOSE:  Create the envi header for an output band whose metadata is
+            complete, and keep the band for appending to the XML metadata
+            file when the session is committed.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      SUCCESS  No errors were encountered.
+      ERROR    An error was encountered.
+*****************************************************************************/
+static int
+add_band_to_session
+(
+    Metadata_Session_t *session, /* I: the metadata session */
+    Espa_band_meta_t *bmeta      /* I: the band metadata from
+                                       new_band_metadata */
+)
+{
+    char *my_char = NULL;
+    Envi_header_t envi_hdr;   /* output ENVI header information */
+    char envi_file[PATH_MAX];
+
     /* Create the ENVI header file this band */
-    if (create_envi_struct (&bmeta[0], &in_meta.global, &envi_hdr) != SUCCESS)
+    if (create_envi_struct (bmeta, &session->in_meta.global, &envi_hdr)
+        != SUCCESS)
     {
         RETURN_ERROR ("Failed to create ENVI header structure.", MODULE_NAME,
                       ERROR);
     }
 
     /* Write the ENVI header */
-    snprintf (envi_file, sizeof(envi_file), "%s", bmeta[0].file_name);
+    snprintf (envi_file, sizeof(envi_file), "%s", bmeta->file_name);
     my_char = strchr (envi_file, '.');
     if (my_char == NULL)
     {
@@ -558,28 +515,20 @@ add_test_band_product
         RETURN_ERROR ("Failed writing ENVI header file", MODULE_NAME, ERROR);
     }
 
-    /* Append the DSWE band to the XML file */
-    if (append_metadata (1, bmeta, xml_filename)
-        != SUCCESS)
-    {
-        RETURN_ERROR ("Appending spectral index bands to XML file",
-                       MODULE_NAME, ERROR);
-    }
-
-    free_metadata (&in_meta);
-    free_metadata (&tmp_meta);
+    /* The band is appended to the XML file when the session is
+       committed */
+    session->band_count++;
 
     return SUCCESS;
 }
 
 
 /*****************************************************************************
-  NAME:  add_ps_band_product
-
-  PURPOSE:  Create a new envi output file including envi header and add the
-            associated information to the XML metadata file.
+  NAME:  add_dswe_band_product
 
-  NOTE: Only for the Percent-Slope DSWE band output.
+  PURPOSE:  Create the envi header for an output band, whose image has been
+            written by write_band_product_lines, and add the associated
+            information to the metadata session.
 
   RETURN VALUE:  Type = int
       Value    Description
@@ -588,196 +537,172 @@ add_test_band_product
       ERROR    An error was encountered.
 *****************************************************************************/
 int
-add_ps_band_product
+add_dswe_band_product
 (
-    char *xml_filename,
-    bool use_toa_flag,
+    Metadata_Session_t *session,
     char *product_name,
     char *band_name,
     char *short_name,
     char *long_name,
     int min_range,
-    int max_range,
-    int16_t *data
+    int max_range
 )
 {
-    int count;
-    int band_index = -1;
-    int src_index = -1;
-    int element_count;
-    char scene_name[PATH_MAX];
-    char image_filename[PATH_MAX];
-    char *my_char = NULL;
-    Espa_internal_meta_t in_meta;
-    Espa_internal_meta_t tmp_meta;
-    Espa_band_meta_t *bmeta = NULL; /* pointer to the band metadata array
-                                       within the output structure */
-    time_t tp;                   /* time structure */
-    struct tm *tm = NULL;        /* time structure for UTC time */
-    char production_date[MAX_DATE_LEN+1]; /* current date/time for production */
-    Envi_header_t envi_hdr;   /* output ENVI header information */
-    char envi_file[PATH_MAX];
-    char search_string[PATH_MAX];
-
-    /* Initialize the input metadata structure */
-    init_metadata_struct (&in_meta);
+    Espa_band_meta_t *bmeta = NULL; /* pointer to the band metadata within
+                                       the session */
+    int class_count;
 
-    /* Parse the metadata file into our internal metadata structure; also
-       allocates space as needed for various pointers in the global and band
-       metadata */
-    if (parse_metadata (xml_filename, &in_meta) != SUCCESS)
+    if (new_band_metadata (session, product_name, band_name, short_name,
+                           long_name, min_range, max_range, &bmeta)
+        != SUCCESS)
     {
         /* Error messages already written */
         return ERROR;
     }
 
-    /* Find the representative band for metadata information */
-    for (band_index = 0; band_index < in_meta.nbands; band_index++)
-    {
-        if (use_toa_flag)
-        {
-            if (!strcmp (in_meta.band[band_index].name, "toa_band1") &&
-                !strcmp (in_meta.band[band_index].product, "toa_refl"))
-            {
-                /* this is the index we'll use for reflectance band info */
-                src_index = band_index;
-                break;
-            }
-        }
-        else
-        {
-            if (!strcmp (in_meta.band[band_index].name, "sr_band1") &&
-                !strcmp (in_meta.band[band_index].product, "sr_refl"))
-            {
-                /* this is the index we'll use for reflectance band info */
-                src_index = band_index;
-                break;
-            }
-        }
-    }
+    snprintf (bmeta->category, sizeof (bmeta->category), "qa");
+    bmeta->data_type = ESPA_UINT8;
+    bmeta->fill_value = DSWE_NO_DATA_VALUE;
 
-    /* Figure out the scene name */
-    strcpy (scene_name, in_meta.band[src_index].file_name);
-    snprintf (search_string, sizeof(search_string), "_%s",
-              in_meta.band[src_index].name);
-    my_char = strstr(scene_name, search_string);
-    if (my_char != NULL)
-        *my_char = '\0';
-
-    /* Get the current date/time (UTC) for the production date of each band */
-    if (time (&tp) == -1)
+    /* Figure out how many classes we have */
+    if (max_range == 9)
     {
-        RETURN_ERROR ("unable to obtain current time", MODULE_NAME, ERROR);
+        class_count = 6;
     }
-
-    tm = gmtime (&tp);
-    if (tm == NULL)
+    else
     {
-        RETURN_ERROR ("converting time to UTC", MODULE_NAME, ERROR);
+        class_count = 5;
     }
 
-    if (strftime (production_date, MAX_DATE_LEN, "%Y-%m-%dT%H:%M:%SZ", tm)
-        == 0)
-    {
-        RETURN_ERROR ("formatting the production date/time", MODULE_NAME,
-                      ERROR);
-    }
+    /* Set up class values information */
+    if (allocate_class_metadata (bmeta, class_count) != SUCCESS)
+        RETURN_ERROR ("allocating dswe classes", MODULE_NAME, ERROR);
 
-    /* Figure out the output filename */
-    count = snprintf (image_filename, sizeof (image_filename),
-                      "%s_%s.img", scene_name, band_name);
-    if (count < 0 || count >= sizeof (image_filename))
+    bmeta->class_values[0].class = 0;
+    snprintf (bmeta->class_values[0].description,
+              sizeof (bmeta->class_values[0].description),
+              "not water");
+
+    bmeta->class_values[1].class = 1;
+    snprintf (bmeta->class_values[1].description,
+              sizeof (bmeta->class_values[1].description),
+              "water - high confidence");
+
+    bmeta->class_values[2].class = 2;
+    snprintf (bmeta->class_values[2].description,
+              sizeof (bmeta->class_values[2].description),
+              "water - moderate confidence");
+
+    bmeta->class_values[3].class = 3;
+    snprintf (bmeta->class_values[3].description,
+              sizeof (bmeta->class_values[3].description),
+              "partial surface water pixel");
+
+    if (class_count == 6)
     {
-        RETURN_ERROR ("Failed creating output filename", MODULE_NAME, ERROR);
+        bmeta->class_values[4].class = 9;
+        snprintf (bmeta->class_values[4].description,
+                  sizeof (bmeta->class_values[4].description),
+                  "cloud, cloud shadow, and snow");
     }
 
-    /* Figure out how many elements are in the data */
-    element_count = in_meta.band[src_index].nlines *
-                    in_meta.band[src_index].nsamps;
+    bmeta->class_values[class_count-1].class = DSWE_NO_DATA_VALUE;
+    snprintf (bmeta->class_values[class_count-1].description,
+              sizeof (bmeta->class_values[class_count-1].description),
+              "fill");
+
+    return add_band_to_session (session, bmeta);
+}
+
 
-    /* First write out the ENVI band and header files */
-    if (write_16bit_dswe_product (image_filename, element_count, data)
+/*****************************************************************************
+  NAME:  add_test_band_product
+
+  PURPOSE:  Create the envi header for an output band, whose image has been
+            written by write_band_product_lines, and add the associated
+            information to the metadata session.
+
+  NOTE: Only for the Raw "test" DSWE band output.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      SUCCESS  No errors were encountered.
+      ERROR    An error was encountered.
+*****************************************************************************/
+int
+add_test_band_product
+(
+    Metadata_Session_t *session,
+    char *product_name,
+    char *band_name,
+    char *short_name,
+    char *long_name,
+    int min_range,
+    int max_range
+)
+{
+    Espa_band_meta_t *bmeta = NULL; /* pointer to the band metadata within
+                                       the session */
+
+    if (new_band_metadata (session, product_name, band_name, short_name,
+                           long_name, min_range, max_range, &bmeta)
         != SUCCESS)
     {
-        RETURN_ERROR ("Failed creating output ENVI files", MODULE_NAME,
-                      ERROR);
+        /* Error messages already written */
+        return ERROR;
     }
 
-    /* Gather all the band information from the representative band */
+    snprintf (bmeta->category, sizeof (bmeta->category), "qa");
+    bmeta->data_type = ESPA_INT16;
+    bmeta->fill_value = TESTS_NO_DATA_VALUE;
 
-    /* Initialize the internal metadata for the output product. The global
-       metadata won't be updated, however the band metadata will be updated
-       and used later for appending to the original XML file. */
-    init_metadata_struct (&tmp_meta);
-
-    /* Allocate memory for the output band */
-    if (allocate_band_metadata (&tmp_meta, 1) != SUCCESS)
-        RETURN_ERROR("allocating band metadata", MODULE_NAME, ERROR);
-    bmeta = tmp_meta.band;
-
-    snprintf (bmeta[0].short_name, sizeof (bmeta[0].short_name),
-              "%s", in_meta.band[src_index].short_name);
-    bmeta[0].short_name[3] = '\0';
-    strcat (bmeta[0].short_name, short_name);
-    snprintf (bmeta[0].product, sizeof (bmeta[0].product),
-              "%s", product_name);
-    snprintf (bmeta[0].source, sizeof (bmeta[0].source), "sr_refl");
-    snprintf (bmeta[0].category, sizeof (bmeta[0].category), "image");
-    bmeta[0].nlines = in_meta.band[src_index].nlines;
-    bmeta[0].nsamps = in_meta.band[src_index].nsamps;
-    bmeta[0].pixel_size[0] = in_meta.band[src_index].pixel_size[0];
-    bmeta[0].pixel_size[1] = in_meta.band[src_index].pixel_size[1];
-    bmeta[0].scale_factor = 0.01;
-    snprintf (bmeta[0].pixel_units, sizeof (bmeta[0].pixel_units), "meters");
-    snprintf (bmeta[0].app_version, sizeof (bmeta[0].app_version),
-              "dswe_%s", DSWE_VERSION);
-    snprintf (bmeta[0].production_date, sizeof (bmeta[0].production_date),
-              "%s", production_date);
-    bmeta[0].data_type = ESPA_INT16;
-    bmeta[0].fill_value = TESTS_NO_DATA_VALUE;
-    bmeta[0].valid_range[0] = min_range;
-    bmeta[0].valid_range[1] = max_range;
-    snprintf (bmeta[0].name, sizeof (bmeta[0].name),
-              "%s", band_name);
-    snprintf (bmeta[0].long_name, sizeof (bmeta[0].long_name),
-              "%s", long_name);
-    snprintf (bmeta[0].data_units, sizeof (bmeta[0].data_units),
-              "quality/feature classification");
-    snprintf (bmeta[0].file_name, sizeof (bmeta[0].file_name),
-              "%s", image_filename);
+    return add_band_to_session (session, bmeta);
+}
 
-    /* Create the ENVI header file this band */
-    if (create_envi_struct (&bmeta[0], &in_meta.global, &envi_hdr) != SUCCESS)
-    {
-        RETURN_ERROR ("Failed to create ENVI header structure.", MODULE_NAME,
-                      ERROR);
-    }
 
-    /* Write the ENVI header */
-    snprintf (envi_file, sizeof(envi_file), "%s", bmeta[0].file_name);
-    my_char = strchr (envi_file, '.');
-    if (my_char == NULL)
-    {
-        RETURN_ERROR ("Failed creating ENVI header filename", MODULE_NAME,
-                      ERROR);
-    }
+/*****************************************************************************
+  NAME:  add_ps_band_product
 
-    sprintf (my_char, ".hdr");
-    if (write_envi_hdr (envi_file, &envi_hdr) != SUCCESS)
-    {
-        RETURN_ERROR ("Failed writing ENVI header file", MODULE_NAME, ERROR);
-    }
+  PURPOSE:  Create the envi header for an output band, whose image has been
+            written by write_band_product_lines, and add the associated
+            information to the metadata session.
+
+  NOTE: Only for the Percent-Slope DSWE band output.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      SUCCESS  No errors were encountered.
+      ERROR    An error was encountered.
+*****************************************************************************/
+int
+add_ps_band_product
+(
+    Metadata_Session_t *session,
+    char *product_name,
+    char *band_name,
+    char *short_name,
+    char *long_name,
+    int min_range,
+    int max_range
+)
+{
+    Espa_band_meta_t *bmeta = NULL; /* pointer to the band metadata within
+                                       the session */
 
-    /* Append the DSWE band to the XML file */
-    if (append_metadata (1, bmeta, xml_filename)
+    if (new_band_metadata (session, product_name, band_name, short_name,
+                           long_name, min_range, max_range, &bmeta)
         != SUCCESS)
     {
-        RETURN_ERROR ("Appending spectral index bands to XML file",
-                       MODULE_NAME, ERROR);
+        /* Error messages already written */
+        return ERROR;
     }
 
-    free_metadata (&in_meta);
-    free_metadata (&tmp_meta);
+    snprintf (bmeta->category, sizeof (bmeta->category), "image");
+    bmeta->scale_factor = 0.01;
+    bmeta->data_type = ESPA_INT16;
+    bmeta->fill_value = TESTS_NO_DATA_VALUE;
 
-    return SUCCESS;
+    return add_band_to_session (session, bmeta);
 }
@@ -3,6 +3,7 @@
 #define OUTPUT_H
 
 
+#include <stdio.h>
 #include <stdbool.h>
 #include <stdint.h>
 
@@ -11,48 +12,118 @@
 #include "const.h"
 
 
+#define MAX_DATE_LEN 28
+
+
+/* The output bands being added to the XML metadata file.  The input metadata
+   is parsed once, and all the output bands are appended to the XML file
+   with a single write when the session is committed.  When the input
+   metadata is changed, it is written with the output bands in that same
+   write. */
+typedef struct
+{
+    char *xml_filename;            /* The XML metadata file */
+    bool use_toa_flag;             /* TOA instead of SR data is used */
+    Espa_internal_meta_t in_meta;  /* The input metadata */
+    Espa_internal_meta_t out_meta; /* The output bands to append */
+    int band_count;                /* Output bands added so far */
+    bool in_meta_changed_flag;     /* The input metadata was changed */
+    char production_date[MAX_DATE_LEN + 1]; /* Production date of all the
+                                               output bands */
+} Metadata_Session_t;
+
+
+FILE *
+open_band_product
+(
+    Espa_internal_meta_t *in_meta,
+    bool use_toa_flag,
+    char *band_name
+);
+
+
 int
-add_dswe_band_product
+write_band_product_lines
+(
+    FILE *fd,
+    int line_count,
+    int samples,
+    int data_size,
+    void *data
+);
+
+
+int
+open_metadata_session
 (
     char *xml_filename,
+    Espa_internal_meta_t *in_meta,
     bool use_toa_flag,
+    int max_bands,
+    Metadata_Session_t *session
+);
+
+
+void
+set_l2qa_percentages
+(
+    Metadata_Session_t *session,
+    int l2qa_meta_index,
+    float percent_clear,
+    float percent_water
+);
+
+
+int
+commit_metadata_session
+(
+    Metadata_Session_t *session
+);
+
+
+void
+close_metadata_session
+(
+    Metadata_Session_t *session
+);
+
+
+int
+add_dswe_band_product
+(
+    Metadata_Session_t *session,
     char *product_name,
     char *band_name,
     char *short_name,
     char *long_name,
     int min_range,
-    int max_range,
-    uint8_t *data
+    int max_range
 );
 
 
 int
 add_test_band_product
 (
-    char *xml_filename,
-    bool use_toa_flag,
+    Metadata_Session_t *session,
     char *product_name,
     char *band_name,
     char *short_name,
     char *long_name,
     int min_range,
-    int max_range,
-    int16_t *data
+    int max_range
 );
 
 
 int
 add_ps_band_product
 (
-    char *xml_filename,
-    bool use_toa_flag,
+    Metadata_Session_t *session,
     char *product_name,
     char *band_name,
     char *short_name,
     char *long_name,
     int min_range,
-    int max_range,
-    int16_t *data
+    int max_range
 );
 
 
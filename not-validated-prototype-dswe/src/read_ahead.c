@@ -0,0 +1,467 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+
+#include "const.h"
+#include "dswe.h"
+#include "utilities.h"
+#include "read_ahead.h"
+#include "arena.h"
+
+
+/* Where a block is in being read ahead */
+typedef enum
+{
+    SLOT_FREE,    /* Not holding a block */
+    SLOT_QUEUED,  /* Waiting for the reader thread */
+    SLOT_READING, /* Being read by the reader thread */
+    SLOT_READY,   /* Read and waiting to be taken */
+    SLOT_FAILED,  /* The read failed */
+    SLOT_TAKEN    /* In use until the next block of the file is taken */
+} Slot_State_e;
+
+
+/* A block of a file being read ahead */
+typedef struct
+{
+    Slot_State_e state;
+    off_t offset;           /* Start of the block in the file */
+    size_t size;            /* Size of the block */
+    unsigned long sequence; /* Order the block was queued in */
+    void *buffer;           /* Holds the block, only touched by the reader
+                               thread while the block is being read */
+    size_t buffer_size;     /* Size of the buffer */
+} Read_Slot_t;
+
+
+/* A file being read ahead by its own reader thread */
+typedef struct
+{
+    Read_Ahead_t *read_ahead; /* The reader threads the file belongs to */
+    int fd;                   /* The file, or -1 when it is not read ahead */
+    const char *filename;     /* Name of the file for messages */
+    bool thread_started;      /* The reader thread is running */
+    pthread_t thread;         /* Reads the queued blocks in order */
+    Read_Slot_t *slots;       /* The blocks of the file */
+} Read_File_t;
+
+
+struct Read_Ahead_s
+{
+    pthread_mutex_t mutex;  /* Protects everything except the buffers */
+    pthread_cond_t queued;  /* Signaled when a block is queued or the
+                               reader threads are stopping */
+    pthread_cond_t done;    /* Signaled when a block has been read */
+    bool stopping;          /* The reader threads are to exit */
+    unsigned long sequence; /* Sequence of the next block queued */
+    int slot_count;         /* Blocks held for each file */
+    int file_count;         /* Number of files */
+    Read_File_t *files;     /* The files */
+};
+
+
+/*****************************************************************************
+  NAME:  read_block
+
+  PURPOSE:  Read a block of a file into the buffer of its slot, growing the
+            buffer as needed.
+
+  RETURN VALUE:  Type = bool
+      Value    Description
+      -------  ---------------------------------------------------------------
+      true     The block was read.
+      false    Failed allocating the buffer or reading the block.
+*****************************************************************************/
+static bool
+read_block
+(
+    const Read_File_t *file, /* I: the file to read from */
+    Read_Slot_t *slot        /* IO: the block to read */
+)
+{
+    size_t done;
+    ssize_t count;
+
+    if (slot->buffer_size < slot->size)
+    {
+        free (slot->buffer);
+        slot->buffer_size = 0;
+
+        /* Aligned like the other band buffers for the vector loads */
+        if (posix_memalign (&slot->buffer, ARENA_ALIGNMENT, slot->size) != 0)
+        {
+            slot->buffer = NULL;
+            return false;
+        }
+        slot->buffer_size = slot->size;
+    }
+
+    done = 0;
+    while (done < slot->size)
+    {
+        count = pread (file->fd, (char *) slot->buffer + done,
+                       slot->size - done, slot->offset + done);
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count <= 0)
+            return false;
+        done += count;
+    }
+
+    return true;
+}
+
+
+/*****************************************************************************
+  NAME:  reader_thread
+
+  PURPOSE:  Reads the queued blocks of a file, oldest first, until the
+            reader threads are stopped.
+
+  RETURN VALUE:  Type = void *
+      Value    Description
+      -------  ---------------------------------------------------------------
+      NULL     Always.
+*****************************************************************************/
+static void *
+reader_thread
+(
+    void *arg /* I: the Read_File_t to read the blocks of */
+)
+{
+    Read_File_t *file = arg;
+    Read_Ahead_t *read_ahead = file->read_ahead;
+    Read_Slot_t *slot;
+    int index;
+    bool read_flag;
+
+    pthread_mutex_lock (&read_ahead->mutex);
+    while (!read_ahead->stopping)
+    {
+        slot = NULL;
+        for (index = 0; index < read_ahead->slot_count; index++)
+        {
+            if (file->slots[index].state == SLOT_QUEUED
+                && (slot == NULL
+                    || file->slots[index].sequence < slot->sequence))
+            {
+                slot = &file->slots[index];
+            }
+        }
+
+        if (slot == NULL)
+        {
+            pthread_cond_wait (&read_ahead->queued, &read_ahead->mutex);
+            continue;
+        }
+
+        /* Read without holding the lock, so the other files are read and
+           the blocks already read can be taken at the same time */
+        slot->state = SLOT_READING;
+        pthread_mutex_unlock (&read_ahead->mutex);
+
+        read_flag = read_block (file, slot);
+
+        pthread_mutex_lock (&read_ahead->mutex);
+        if (read_flag)
+            slot->state = SLOT_READY;
+        else
+            slot->state = SLOT_FAILED;
+        pthread_cond_broadcast (&read_ahead->done);
+    }
+    pthread_mutex_unlock (&read_ahead->mutex);
+
+    return NULL;
+}
+
+
+/*****************************************************************************
+  NAME:  start_read_ahead
+
+  PURPOSE:  Start a reader thread for each of the files, so blocks of the
+            files are read with pread while the blocks read before are being
+            processed.  Each file can have depth blocks queued or read
+            beyond the block in use.
+
+  RETURN VALUE:  Type = Read_Ahead_t *
+      Value    Description
+      -------  ---------------------------------------------------------------
+      NULL     Failed to start the reader threads.
+      *        The reader threads.
+*****************************************************************************/
+Read_Ahead_t *
+start_read_ahead
+(
+    int file_count,
+    const int *fds,
+    char *const *filenames,
+    int depth
+)
+{
+    Read_Ahead_t *read_ahead;
+    Read_File_t *file;
+    int index;
+
+    read_ahead = calloc (1, sizeof (Read_Ahead_t));
+    if (read_ahead == NULL)
+    {
+        RETURN_ERROR ("Failed allocating memory for the read ahead",
+                      MODULE_NAME, NULL);
+    }
+
+    pthread_mutex_init (&read_ahead->mutex, NULL);
+    pthread_cond_init (&read_ahead->queued, NULL);
+    pthread_cond_init (&read_ahead->done, NULL);
+    read_ahead->stopping = false;
+    read_ahead->sequence = 0;
+    read_ahead->slot_count = depth + 1;
+    read_ahead->file_count = file_count;
+
+    read_ahead->files = calloc (file_count, sizeof (Read_File_t));
+    if (read_ahead->files == NULL)
+    {
+        ERROR_MESSAGE ("Failed allocating memory for the read ahead",
+                       MODULE_NAME);
+
+        stop_read_ahead (read_ahead);
+        return NULL;
+    }
+
+    for (index = 0; index < file_count; index++)
+    {
+        file = &read_ahead->files[index];
+        file->read_ahead = read_ahead;
+        file->fd = fds[index];
+        file->filename = filenames[index];
+        file->thread_started = false;
+        if (file->fd == -1)
+            continue;
+
+        /* calloc leaves every slot SLOT_FREE without a buffer */
+        file->slots = calloc (read_ahead->slot_count, sizeof (Read_Slot_t));
+        if (file->slots == NULL)
+        {
+            ERROR_MESSAGE ("Failed allocating memory for the read ahead",
+                           MODULE_NAME);
+
+            stop_read_ahead (read_ahead);
+            return NULL;
+        }
+
+        if (pthread_create (&file->thread, NULL, reader_thread, file) != 0)
+        {
+            ERROR_MESSAGE ("Failed starting a read ahead thread",
+                           MODULE_NAME);
+
+            stop_read_ahead (read_ahead);
+            return NULL;
+        }
+        file->thread_started = true;
+    }
+
+    return read_ahead;
+}
+
+
+/*****************************************************************************
+  NAME:  queue_read_ahead
+
+  PURPOSE:  Queue a block of a file to be read by its reader thread.
+
+  NOTES:
+    1. When the file already has depth blocks queued or read beyond the one
+       in use, the block is not queued and take_read_ahead does not provide
+       it, so it is read when it is needed.
+
+  RETURN VALUE:  None
+*****************************************************************************/
+void
+queue_read_ahead
+(
+    Read_Ahead_t *read_ahead,
+    int file_index,
+    off_t offset,
+    size_t size
+)
+{
+    Read_File_t *file = &read_ahead->files[file_index];
+    Read_Slot_t *slot;
+    int index;
+
+    if (!file->thread_started)
+        return;
+
+    pthread_mutex_lock (&read_ahead->mutex);
+
+    slot = NULL;
+    for (index = 0; index < read_ahead->slot_count; index++)
+    {
+        /* Already queued */
+        if (file->slots[index].state != SLOT_FREE
+            && file->slots[index].state != SLOT_TAKEN
+            && file->slots[index].offset == offset
+            && file->slots[index].size == size)
+        {
+            pthread_mutex_unlock (&read_ahead->mutex);
+            return;
+        }
+
+        if (slot == NULL && file->slots[index].state == SLOT_FREE)
+            slot = &file->slots[index];
+    }
+
+    if (slot != NULL)
+    {
+        slot->offset = offset;
+        slot->size = size;
+        slot->sequence = read_ahead->sequence++;
+        slot->state = SLOT_QUEUED;
+        pthread_cond_broadcast (&read_ahead->queued);
+    }
+
+    pthread_mutex_unlock (&read_ahead->mutex);
+}
+
+
+/*****************************************************************************
+  NAME:  take_read_ahead
+
+  PURPOSE:  Take a block of a file from the reader thread, waiting for it to
+            be read.  The block taken before from the file is released, and
+            so are any blocks queued before this one which were never taken.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      SUCCESS  The block was provided, or was not queued and data is NULL.
+      ERROR    The block was queued but could not be read.
+*****************************************************************************/
+int
+take_read_ahead
+(
+    Read_Ahead_t *read_ahead,
+    int file_index,
+    off_t offset,
+    size_t size,
+    const void **data
+)
+{
+    Read_File_t *file = &read_ahead->files[file_index];
+    Read_Slot_t *slot;
+    int index;
+    char msg[256];
+
+    *data = NULL;
+
+    if (!file->thread_started)
+        return SUCCESS;
+
+    pthread_mutex_lock (&read_ahead->mutex);
+
+    slot = NULL;
+    for (index = 0; index < read_ahead->slot_count; index++)
+    {
+        if (file->slots[index].state == SLOT_TAKEN)
+            file->slots[index].state = SLOT_FREE;
+        else if (file->slots[index].state != SLOT_FREE
+                 && file->slots[index].offset == offset
+                 && file->slots[index].size == size)
+        {
+            slot = &file->slots[index];
+        }
+    }
+
+    if (slot == NULL)
+    {
+        pthread_mutex_unlock (&read_ahead->mutex);
+        return SUCCESS;
+    }
+
+    /* Blocks queued before this one are not going to be taken */
+    for (index = 0; index < read_ahead->slot_count; index++)
+    {
+        if (file->slots[index].sequence < slot->sequence
+            && (file->slots[index].state == SLOT_QUEUED
+                || file->slots[index].state == SLOT_READY
+                || file->slots[index].state == SLOT_FAILED))
+        {
+            file->slots[index].state = SLOT_FREE;
+        }
+    }
+
+    while (slot->state == SLOT_QUEUED || slot->state == SLOT_READING)
+        pthread_cond_wait (&read_ahead->done, &read_ahead->mutex);
+
+    if (slot->state == SLOT_FAILED)
+    {
+        slot->state = SLOT_FREE;
+        pthread_mutex_unlock (&read_ahead->mutex);
+
+        snprintf (msg, sizeof (msg), "Failed reading ahead from (%s)",
+                  file->filename);
+        RETURN_ERROR (msg, MODULE_NAME, ERROR);
+    }
+
+    slot->state = SLOT_TAKEN;
+    *data = slot->buffer;
+
+    pthread_mutex_unlock (&read_ahead->mutex);
+
+    return SUCCESS;
+}
+
+
+/*****************************************************************************
+  NAME:  stop_read_ahead
+
+  PURPOSE:  Stop the reader threads and free the blocks, any block taken is
+            no longer valid.
+
+  RETURN VALUE:  None
+*****************************************************************************/
+void
+stop_read_ahead
+(
+    Read_Ahead_t *read_ahead
+)
+{
+    Read_File_t *file;
+    int index;
+    int slot;
+
+    if (read_ahead == NULL)
+        return;
+
+    pthread_mutex_lock (&read_ahead->mutex);
+    read_ahead->stopping = true;
+    pthread_cond_broadcast (&read_ahead->queued);
+    pthread_mutex_unlock (&read_ahead->mutex);
+
+    if (read_ahead->files != NULL)
+    {
+        for (index = 0; index < read_ahead->file_count; index++)
+        {
+            file = &read_ahead->files[index];
+            if (file->thread_started)
+                pthread_join (file->thread, NULL);
+
+            if (file->slots != NULL)
+            {
+                for (slot = 0; slot < read_ahead->slot_count; slot++)
+                    free (file->slots[slot].buffer);
+                free (file->slots);
+            }
+        }
+        free (read_ahead->files);
+    }
+
+    pthread_cond_destroy (&read_ahead->done);
+    pthread_cond_destroy (&read_ahead->queued);
+    pthread_mutex_destroy (&read_ahead->mutex);
+    free (read_ahead);
+}
@@ -0,0 +1,55 @@
+
+#ifndef READ_AHEAD_H
+#define READ_AHEAD_H
+
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+
+/* Reader threads fetching blocks of the input files ahead of their use */
+typedef struct Read_Ahead_s Read_Ahead_t;
+
+
+Read_Ahead_t *
+start_read_ahead
+(
+    int file_count,         /* I: number of files */
+    const int *fds,         /* I: descriptor of each file, a reader thread
+                                  is started for each one which is not -1 */
+    char *const *filenames, /* I: name of each file for messages */
+    int depth               /* I: how many blocks of each file can be read
+                                  ahead of the one in use */
+);
+
+
+void
+queue_read_ahead
+(
+    Read_Ahead_t *read_ahead, /* I: the reader threads */
+    int file_index,           /* I: file to read from */
+    off_t offset,             /* I: start of the block in the file */
+    size_t size               /* I: size of the block */
+);
+
+
+int
+take_read_ahead
+(
+    Read_Ahead_t *read_ahead, /* I: the reader threads */
+    int file_index,           /* I: file to read from */
+    off_t offset,             /* I: start of the block in the file */
+    size_t size,              /* I: size of the block */
+    const void **data         /* O: the block, NULL when it was not queued */
+);
+
+
+void
+stop_read_ahead
+(
+    Read_Ahead_t *read_ahead /* I: the reader threads */
+);
+
+
+#endif /* READ_AHEAD_H */
@@ -0,0 +1,436 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+
+
+#include "const.h"
+#include "dswe.h"
+#include "utilities.h"
+#include "run_report.h"
+#include "clear_estimate.h"
+
+
+/* Names of the stages and counted products in the JSON */
+static const char *stage_names[MAX_STAGES] = {
+    "parse_xml",
+    "open",
+    "read",
+    "slope",
+    "classify",
+    "write_raw",
+    "write_ccss",
+    "write_psccss",
+    "write_diag",
+    "write_ps",
+    "write_water_qa",
+    "metadata"
+};
+static const char *counted_product_names[MAX_COUNTED_PRODUCTS] = {
+    "raw",
+    "ccss",
+    "psccss"
+};
+
+
+/*****************************************************************************
+  NAME:  seconds_between
+
+  PURPOSE:  Seconds from the start time to the end time.
+
+  RETURN VALUE:  Type = double
+*****************************************************************************/
+static double
+seconds_between
+(
+    const struct timespec *start,
+    const struct timespec *end
+)
+{
+    return (end->tv_sec - start->tv_sec)
+           + (end->tv_nsec - start->tv_nsec) * 1e-9;
+}
+
+
+/*****************************************************************************
+  NAME:  start_stage_clock
+
+  PURPOSE:  Note the wall and CPU time at the start of a stage.  The stages
+            run by the pixel processing threads time the CPU of the thread,
+            so the time of each thread can be added up.
+
+  RETURN VALUE:  None
+*****************************************************************************/
+void
+start_stage_clock
+(
+    bool thread_flag,
+    Stage_Clock_t *clock
+)
+{
+    if (thread_flag)
+        clock->cpu_clock = CLOCK_THREAD_CPUTIME_ID;
+    else
+        clock->cpu_clock = CLOCK_PROCESS_CPUTIME_ID;
+
+    clock_gettime (CLOCK_MONOTONIC, &clock->wall);
+    clock_gettime (clock->cpu_clock, &clock->cpu);
+}
+
+
+/*****************************************************************************
+  NAME:  stop_stage_clock
+
+  PURPOSE:  Add the wall and CPU time since the start of a stage to the time
+            of the stage.
+
+  RETURN VALUE:  None
+*****************************************************************************/
+void
+stop_stage_clock
+(
+    const Stage_Clock_t *clock,
+    Stage_Time_t *time
+)
+{
+    struct timespec wall;
+    struct timespec cpu;
+
+    clock_gettime (CLOCK_MONOTONIC, &wall);
+    clock_gettime (clock->cpu_clock, &cpu);
+
+    time->wall_seconds += seconds_between (&clock->wall, &wall);
+    time->cpu_seconds += seconds_between (&clock->cpu, &cpu);
+}
+
+
+/*****************************************************************************
+  NAME:  init_run_report
+
+  PURPOSE:  Start the report of a run, with no scenes.
+
+  RETURN VALUE:  None
+*****************************************************************************/
+void
+init_run_report
+(
+    Run_Report_t *report
+)
+{
+    memset (report, 0, sizeof (*report));
+    start_stage_clock (false, &report->start);
+}
+
+
+/*****************************************************************************
+  NAME:  add_scene_report
+
+  PURPOSE:  Add an empty report for a scene to the report of the run.
+
+  RETURN VALUE:  Type = Scene_Report_t *
+      Value    Description
+      -------  ---------------------------------------------------------------
+      NULL     Failed allocating the report of the scene.
+      *        The report of the scene, valid until the next scene is added.
+*****************************************************************************/
+Scene_Report_t *
+add_scene_report
+(
+    Run_Report_t *report,
+    const char *xml_filename
+)
+{
+    Scene_Report_t *scenes;
+    Scene_Report_t *scene_report;
+    int capacity;
+
+    if (report->scene_count == report->scene_capacity)
+    {
+        capacity = report->scene_capacity * 2;
+        if (capacity == 0)
+            capacity = 4;
+
+        scenes = realloc (report->scenes, capacity * sizeof (*scenes));
+        if (scenes == NULL)
+        {
+            RETURN_ERROR ("Failed allocating the scene report", MODULE_NAME,
+                          NULL);
+        }
+        report->scenes = scenes;
+        report->scene_capacity = capacity;
+    }
+
+    scene_report = &report->scenes[report->scene_count];
+    memset (scene_report, 0, sizeof (*scene_report));
+
+    scene_report->xml_filename = strdup (xml_filename);
+    if (scene_report->xml_filename == NULL)
+    {
+        RETURN_ERROR ("Failed allocating the scene report", MODULE_NAME,
+                      NULL);
+    }
+
+    report->scene_count++;
+
+    return scene_report;
+}
+
+
+/*****************************************************************************
+  NAME:  count_class_values
+
+  PURPOSE:  Add up the pixels of each value of an output product.
+
+  RETURN VALUE:  None
+*****************************************************************************/
+void
+count_class_values
+(
+    const uint8_t *band,
+    long pixel_count,
+    long long *class_counts
+)
+{
+    long index;
+
+    for (index = 0; index < pixel_count; index++)
+        class_counts[band[index]]++;
+}
+
+
+/*****************************************************************************
+  NAME:  finish_scene_report
+
+  PURPOSE:  Record how the scene went and the peak memory use so far.
+
+  RETURN VALUE:  None
+*****************************************************************************/
+void
+finish_scene_report
+(
+    Scene_Report_t *scene_report,
+    int status
+)
+{
+    struct rusage usage;
+
+    scene_report->status = status;
+
+    /* Kilobytes on Linux */
+    if (getrusage (RUSAGE_SELF, &usage) == 0)
+        scene_report->peak_rss_kb = usage.ru_maxrss;
+}
+
+
+/*****************************************************************************
+  NAME:  write_json_string
+
+  PURPOSE:  Write a string as a quoted JSON string.
+
+  RETURN VALUE:  None
+*****************************************************************************/
+static void
+write_json_string
+(
+    FILE *fd,
+    const char *string
+)
+{
+    const unsigned char *character;
+
+    fputc ('"', fd);
+    for (character = (const unsigned char *) string; *character != '\0';
+         character++)
+    {
+        if (*character == '"' || *character == '\\')
+            fprintf (fd, "\\%c", *character);
+        else if (*character < 0x20)
+            fprintf (fd, "\\u%04x", *character);
+        else
+            fputc (*character, fd);
+    }
+    fputc ('"', fd);
+}
+
+
+/*****************************************************************************
+  NAME:  write_scene_report
+
+  PURPOSE:  Write the report of a scene as a JSON object.
+
+  RETURN VALUE:  None
+*****************************************************************************/
+static void
+write_scene_report
+(
+    FILE *fd,
+    const Scene_Report_t *scene_report
+)
+{
+    int stage;
+    int product;
+    int value;
+    int listed;
+    bool first_flag;
+    const char *status_name;
+
+    fprintf (fd, "    {\n      \"xml\": ");
+    write_json_string (fd, scene_report->xml_filename);
+    if (scene_report->status == SUCCESS)
+        status_name = "success";
+    else if (scene_report->status == SCENE_SKIPPED)
+        status_name = "skipped";
+    else
+        status_name = "failure";
+    fprintf (fd, ",\n      \"status\": \"%s\",\n", status_name);
+    if (scene_report->clear_estimated_flag)
+    {
+        fprintf (fd, "      \"clear_estimate\": {\"percent\": %.4f,"
+                 " \"sampled\": %s, \"low_clear\": %s},\n",
+                 scene_report->estimated_clear,
+                 scene_report->clear_sampled_flag ? "true" : "false",
+                 scene_report->low_clear_flag ? "true" : "false");
+    }
+    fprintf (fd, "      \"lines\": %d,\n      \"samples\": %d,\n"
+             "      \"strip_lines\": %d,\n",
+             scene_report->lines, scene_report->samples,
+             scene_report->strip_lines);
+    fprintf (fd, "      \"bytes_read\": %lld,\n"
+             "      \"bytes_written\": %lld,\n"
+             "      \"peak_rss_kb\": %ld,\n",
+             scene_report->bytes_read, scene_report->bytes_written,
+             scene_report->peak_rss_kb);
+
+    fprintf (fd, "      \"stages\": {");
+    for (stage = 0; stage < MAX_STAGES; stage++)
+    {
+        fprintf (fd, "%s\n        \"%s\": {\"wall_seconds\": %.6f,"
+                 " \"cpu_seconds\": %.6f}", stage == 0 ? "" : ",",
+                 stage_names[stage],
+                 scene_report->stages[stage].wall_seconds,
+                 scene_report->stages[stage].cpu_seconds);
+    }
+    fprintf (fd, "\n      },\n");
+
+    /* Only the values which occur are listed */
+    fprintf (fd, "      \"class_counts\": {");
+    first_flag = true;
+    for (product = 0; product < MAX_COUNTED_PRODUCTS; product++)
+    {
+        if (!scene_report->counted_flag[product])
+            continue;
+
+        fprintf (fd, "%s\n        \"%s\": {", first_flag ? "" : ",",
+                 counted_product_names[product]);
+        first_flag = false;
+
+        listed = 0;
+        for (value = 0; value < 256; value++)
+        {
+            if (scene_report->class_counts[product][value] == 0)
+                continue;
+
+            fprintf (fd, "%s\"%d\": %lld", listed == 0 ? "" : ", ", value,
+                     scene_report->class_counts[product][value]);
+            listed++;
+        }
+        fprintf (fd, "}");
+    }
+    fprintf (fd, "%s}\n    }", first_flag ? "" : "\n      ");
+}
+
+
+/*****************************************************************************
+  NAME:  write_run_report
+
+  PURPOSE:  Write the report of the run as JSON.  The times of the slope
+            and classify stages are summed over the threads processing the
+            pixels, so with more than one thread they can add up to more
+            than the wall time of the run.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      ERROR    Failed writing the report.
+      SUCCESS  No errors encountered.
+*****************************************************************************/
+int
+write_run_report
+(
+    const char *report_filename,
+    const Run_Report_t *report,
+    int num_threads
+)
+{
+    FILE *fd;
+    Stage_Time_t run_time;
+    struct rusage usage;
+    long peak_rss_kb = 0;
+    int scene;
+    char msg[256];
+
+    memset (&run_time, 0, sizeof (run_time));
+    stop_stage_clock (&report->start, &run_time);
+
+    if (getrusage (RUSAGE_SELF, &usage) == 0)
+        peak_rss_kb = usage.ru_maxrss;
+
+    fd = fopen (report_filename, "w");
+    if (fd == NULL)
+    {
+        snprintf (msg, sizeof (msg), "Failed creating the report file %s",
+                  report_filename);
+        RETURN_ERROR (msg, MODULE_NAME, ERROR);
+    }
+
+    fprintf (fd, "{\n  \"application\": \"%s\",\n  \"version\": \"%s\",\n",
+             DSWE_APP_NAME, DSWE_VERSION);
+    fprintf (fd, "  \"threads\": %d,\n  \"wall_seconds\": %.6f,\n"
+             "  \"cpu_seconds\": %.6f,\n  \"peak_rss_kb\": %ld,\n",
+             num_threads, run_time.wall_seconds, run_time.cpu_seconds,
+             peak_rss_kb);
+
+    fprintf (fd, "  \"scenes\": [");
+    for (scene = 0; scene < report->scene_count; scene++)
+    {
+        fprintf (fd, "%s\n", scene == 0 ? "" : ",");
+        write_scene_report (fd, &report->scenes[scene]);
+    }
+    fprintf (fd, "%s]\n}\n", report->scene_count == 0 ? "" : "\n  ");
+
+    if (fclose (fd) != 0)
+    {
+        snprintf (msg, sizeof (msg), "Failed writing the report file %s",
+                  report_filename);
+        RETURN_ERROR (msg, MODULE_NAME, ERROR);
+    }
+
+    return SUCCESS;
+}
+
+
+/*****************************************************************************
+  NAME:  free_run_report
+
+  PURPOSE:  Free the memory held by the report of a run.
+
+  RETURN VALUE:  None
+*****************************************************************************/
+void
+free_run_report
+(
+    Run_Report_t *report
+)
+{
+    int scene;
+
+    for (scene = 0; scene < report->scene_count; scene++)
+        free (report->scenes[scene].xml_filename);
+    free (report->scenes);
+
+    memset (report, 0, sizeof (*report));
+}
@@ -0,0 +1,159 @@
+
+#ifndef RUN_REPORT_H
+#define RUN_REPORT_H
+
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+
+/* The stages of processing a scene which are timed */
+typedef enum
+{
+    STAGE_PARSE_XML,    /* Parsing and validating the XML */
+    STAGE_OPEN,         /* Opening the input and output files */
+    STAGE_READ,         /* Waiting on the strips of the input bands */
+    STAGE_SLOPE,        /* Percent slope, summed over the threads */
+    STAGE_CLASSIFY,     /* Tests and recode, and the water test of the
+                           water QA, summed over the threads */
+    STAGE_WRITE_RAW,    /* Writing each of the output products */
+    STAGE_WRITE_CCSS,
+    STAGE_WRITE_PSCCSS,
+    STAGE_WRITE_DIAG,
+    STAGE_WRITE_PS,
+    STAGE_WRITE_WATER_QA,
+    STAGE_METADATA,     /* Adding the output bands to the XML, and the
+                           percentages of the water QA */
+    MAX_STAGES
+} Stage_e;
+
+
+/* The output products with class values which are counted */
+typedef enum
+{
+    COUNT_RAW,
+    COUNT_CCSS,
+    COUNT_PSCCSS,
+    MAX_COUNTED_PRODUCTS
+} Counted_Product_e;
+
+
+/* Time spent in a stage */
+typedef struct
+{
+    double wall_seconds;
+    double cpu_seconds;
+} Stage_Time_t;
+
+
+/* Start of a timed stage, see start_stage_clock */
+typedef struct
+{
+    clockid_t cpu_clock;     /* The process or the calling thread */
+    struct timespec wall;
+    struct timespec cpu;
+} Stage_Clock_t;
+
+
+/* Everything reported for a scene */
+typedef struct
+{
+    char *xml_filename;
+    int status;                /* SUCCESS, ERROR, or SCENE_SKIPPED */
+    bool clear_estimated_flag; /* The percent clear was estimated */
+    bool clear_sampled_flag;   /* From a sample of the cfmask lines instead
+                                  of its metadata */
+    float estimated_clear;     /* Estimated percent clear */
+    bool low_clear_flag;       /* The outputs were written as cloud and fill
+                                  without testing the scene */
+    int lines;
+    int samples;
+    int strip_lines;
+    long long bytes_read;      /* Bytes of the input bands provided */
+    long long bytes_written;   /* Bytes of the output bands written */
+    long peak_rss_kb;          /* Peak resident size of the process once
+                                  the scene is done */
+    Stage_Time_t stages[MAX_STAGES];
+    bool counted_flag[MAX_COUNTED_PRODUCTS]; /* The products counted */
+    long long class_counts[MAX_COUNTED_PRODUCTS][256]; /* Pixels of each
+                                                          class value */
+} Scene_Report_t;
+
+
+/* The report of a run, over every scene of a batch */
+typedef struct
+{
+    Stage_Clock_t start;       /* Start of the run */
+    int scene_count;
+    int scene_capacity;
+    Scene_Report_t *scenes;
+} Run_Report_t;
+
+
+void
+start_stage_clock
+(
+    bool thread_flag,      /* I: time the CPU of the calling thread instead
+                                 of the process */
+    Stage_Clock_t *clock   /* O: the start of the stage */
+);
+
+
+void
+stop_stage_clock
+(
+    const Stage_Clock_t *clock, /* I: the start of the stage */
+    Stage_Time_t *time          /* I/O: the time of the stage is added */
+);
+
+
+void
+init_run_report
+(
+    Run_Report_t *report   /* O: an empty report, the run starts now */
+);
+
+
+Scene_Report_t *
+add_scene_report
+(
+    Run_Report_t *report,     /* I/O: the report of the run */
+    const char *xml_filename  /* I: the XML of the scene */
+);
+
+
+void
+count_class_values
+(
+    const uint8_t *band,      /* I: the output product pixels */
+    long pixel_count,         /* I: number of pixels */
+    long long *class_counts   /* I/O: 256 counts, added to */
+);
+
+
+void
+finish_scene_report
+(
+    Scene_Report_t *scene_report, /* I/O: the report of the scene */
+    int status                    /* I: SUCCESS, ERROR, or SCENE_SKIPPED */
+);
+
+
+int
+write_run_report
+(
+    const char *report_filename, /* I: the JSON file to write */
+    const Run_Report_t *report,  /* I: the report of the run */
+    int num_threads              /* I: threads processing the pixels */
+);
+
+
+void
+free_run_report
+(
+    Run_Report_t *report   /* I: the report to free */
+);
+
+
+#endif /* RUN_REPORT_H */
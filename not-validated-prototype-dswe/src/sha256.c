@@ -0,0 +1,226 @@
+
+#include <stdint.h>
+#include <string.h>
+
+
+#include "sha256.h"
+
+
+/* Rotate a 32bit word right */
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+
+/* The round constants, from FIPS 180-4 */
+static const uint32_t round_constants[64] =
+{
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+    0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+    0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+    0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+    0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+    0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+
+/*****************************************************************************
+  NAME:  compress_block
+
+  PURPOSE:  Adds a 64 byte block to the hash values.
+
+  RETURN VALUE:  None
+*****************************************************************************/
+static void
+compress_block
+(
+    uint32_t state[8],     /* I/O: the hash values */
+    const uint8_t *block   /* I: the 64 byte block */
+)
+{
+    uint32_t schedule[64];
+    uint32_t a, b, c, d, e, f, g, h;
+    uint32_t temp1, temp2;
+    int index;
+
+    for (index = 0; index < 16; index++)
+    {
+        schedule[index] = ((uint32_t) block[4 * index] << 24)
+                          | ((uint32_t) block[4 * index + 1] << 16)
+                          | ((uint32_t) block[4 * index + 2] << 8)
+                          | (uint32_t) block[4 * index + 3];
+    }
+    for (; index < 64; index++)
+    {
+        schedule[index] = schedule[index - 16]
+            + (ROTR (schedule[index - 15], 7)
+               ^ ROTR (schedule[index - 15], 18)
+               ^ (schedule[index - 15] >> 3))
+            + schedule[index - 7]
+            + (ROTR (schedule[index - 2], 17)
+               ^ ROTR (schedule[index - 2], 19)
+               ^ (schedule[index - 2] >> 10));
+    }
+
+    a = state[0];
+    b = state[1];
+    c = state[2];
+    d = state[3];
+    e = state[4];
+    f = state[5];
+    g = state[6];
+    h = state[7];
+
+    for (index = 0; index < 64; index++)
+    {
+        temp1 = h + (ROTR (e, 6) ^ ROTR (e, 11) ^ ROTR (e, 25))
+                + ((e & f) ^ (~e & g)) + round_constants[index]
+                + schedule[index];
+        temp2 = (ROTR (a, 2) ^ ROTR (a, 13) ^ ROTR (a, 22))
+                + ((a & b) ^ (a & c) ^ (b & c));
+        h = g;
+        g = f;
+        f = e;
+        e = d + temp1;
+        d = c;
+        c = b;
+        b = a;
+        a = temp1 + temp2;
+    }
+
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
+}
+
+
+/*****************************************************************************
+  NAME:  sha256_init
+
+  PURPOSE:  Starts a SHA-256 digest.
+
+  RETURN VALUE:  None
+*****************************************************************************/
+void
+sha256_init
+(
+    Sha256_t *sha
+)
+{
+    sha->state[0] = 0x6a09e667;
+    sha->state[1] = 0xbb67ae85;
+    sha->state[2] = 0x3c6ef372;
+    sha->state[3] = 0xa54ff53a;
+    sha->state[4] = 0x510e527f;
+    sha->state[5] = 0x9b05688c;
+    sha->state[6] = 0x1f83d9ab;
+    sha->state[7] = 0x5be0cd19;
+    sha->length = 0;
+    sha->block_used = 0;
+}
+
+
+/*****************************************************************************
+  NAME:  sha256_update
+
+  PURPOSE:  Adds bytes to a SHA-256 digest.  Whole blocks are compressed
+            straight from the data, only the bytes left over are copied.
+
+  RETURN VALUE:  None
+*****************************************************************************/
+void
+sha256_update
+(
+    Sha256_t *sha,
+    const void *data,
+    size_t size
+)
+{
+    const uint8_t *bytes = data;
+    size_t count;
+
+    sha->length += size;
+
+    /* Finish the block started by the previous bytes */
+    if (sha->block_used > 0)
+    {
+        count = sizeof (sha->block) - sha->block_used;
+        if (count > size)
+            count = size;
+        memcpy (&sha->block[sha->block_used], bytes, count);
+        sha->block_used += count;
+        bytes += count;
+        size -= count;
+
+        if (sha->block_used < sizeof (sha->block))
+            return;
+        compress_block (sha->state, sha->block);
+        sha->block_used = 0;
+    }
+
+    for (; size >= sizeof (sha->block); size -= sizeof (sha->block))
+    {
+        compress_block (sha->state, bytes);
+        bytes += sizeof (sha->block);
+    }
+
+    memcpy (sha->block, bytes, size);
+    sha->block_used = size;
+}
+
+
+/*****************************************************************************
+  NAME:  sha256_final
+
+  PURPOSE:  Pads the bytes added to a SHA-256 digest and produces the
+            digest.
+
+  RETURN VALUE:  None
+*****************************************************************************/
+void
+sha256_final
+(
+    Sha256_t *sha,
+    uint8_t digest[SHA256_DIGEST_SIZE]
+)
+{
+    uint64_t bit_length = sha->length * 8;
+    int index;
+
+    /* A one bit, then zeros up to the length in the last eight bytes of a
+       block */
+    sha->block[sha->block_used++] = 0x80;
+    if (sha->block_used > sizeof (sha->block) - 8)
+    {
+        memset (&sha->block[sha->block_used], 0,
+                sizeof (sha->block) - sha->block_used);
+        compress_block (sha->state, sha->block);
+        sha->block_used = 0;
+    }
+    memset (&sha->block[sha->block_used], 0,
+            sizeof (sha->block) - 8 - sha->block_used);
+    for (index = 0; index < 8; index++)
+        sha->block[56 + index] = (uint8_t) (bit_length >> (56 - 8 * index));
+    compress_block (sha->state, sha->block);
+
+    for (index = 0; index < 8; index++)
+    {
+        digest[4 * index] = (uint8_t) (sha->state[index] >> 24);
+        digest[4 * index + 1] = (uint8_t) (sha->state[index] >> 16);
+        digest[4 * index + 2] = (uint8_t) (sha->state[index] >> 8);
+        digest[4 * index + 3] = (uint8_t) sha->state[index];
+    }
+}
@@ -0,0 +1,48 @@
+
+#ifndef SHA256_H
+#define SHA256_H
+
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+/* Bytes in a SHA-256 digest */
+#define SHA256_DIGEST_SIZE 32
+
+
+/* The state of a digest being computed */
+typedef struct
+{
+    uint32_t state[8];    /* The hash values */
+    uint64_t length;      /* Bytes added so far */
+    uint8_t block[64];    /* Bytes waiting for a full block */
+    size_t block_used;    /* Bytes held in block */
+} Sha256_t;
+
+
+void
+sha256_init
+(
+    Sha256_t *sha     /* O: the digest to start */
+);
+
+
+void
+sha256_update
+(
+    Sha256_t *sha,        /* I/O: the digest being computed */
+    const void *data,     /* I: bytes to add to the digest */
+    size_t size           /* I: number of bytes */
+);
+
+
+void
+sha256_final
+(
+    Sha256_t *sha,                        /* I: the digest being computed */
+    uint8_t digest[SHA256_DIGEST_SIZE]    /* O: the digest */
+);
+
+
+#endif /* SHA256_H */
@@ -0,0 +1,230 @@
+#include <stdint.h>
+#include <string.h>
+
+
+#include "build_slope_band.h"
+
+
+#ifdef DSWE_SIMD_X86
+
+
+#include <immintrin.h>
+
+
+/* Expands the four bit compare mask of four doubles to four bytes */
+static const uint32_t exceeded_bytes[16] =
+{
+    0x00000000, 0x000000ff, 0x0000ff00, 0x0000ffff,
+    0x00ff0000, 0x00ff00ff, 0x00ffff00, 0x00ffffff,
+    0xff000000, 0xff0000ff, 0xff00ff00, 0xff00ffff,
+    0xffff0000, 0xffff00ff, 0xffffff00, 0xffffffff
+};
+
+
+/*****************************************************************************
+  NAME:  slope_row_double_avx2
+
+  PURPOSE:  Computes the percent slope four pixels at a time using AVX2 and
+            double precision.
+
+  RETURN VALUE:  Type = None
+
+  NOTES:
+    1. The division and square root are correctly rounded, so the results
+       match slope_row_double_scalar exactly.
+*****************************************************************************/
+void
+slope_row_double_avx2
+(
+    const Slope_Kernel_t *kernel, /* I: slope kernel settings */
+    const int32_t *x_numerator,   /* I: east/west slope numerators */
+    const int32_t *y_numerator,   /* I: north/south slope numerators */
+    int count,                    /* I: number of pixels */
+    float *line_ps                /* O: percent slope for each pixel */
+)
+{
+    int index;
+    __m256d x_slope;
+    __m256d y_slope;
+    __m256d slope;
+
+    const __m256d x_divisor = _mm256_set1_pd (kernel->x_divisor);
+    const __m256d y_divisor = _mm256_set1_pd (kernel->y_divisor);
+    const __m256d percent = _mm256_set1_pd (100.0);
+
+    for (index = 0; index + 4 <= count; index += 4)
+    {
+        x_slope = _mm256_div_pd (_mm256_cvtepi32_pd (_mm_loadu_si128 (
+            (const __m128i *) &x_numerator[index])), x_divisor);
+        y_slope = _mm256_div_pd (_mm256_cvtepi32_pd (_mm_loadu_si128 (
+            (const __m128i *) &y_numerator[index])), y_divisor);
+
+        slope = _mm256_sqrt_pd (_mm256_add_pd (
+            _mm256_mul_pd (x_slope, x_slope),
+            _mm256_mul_pd (y_slope, y_slope)));
+
+        /* Convert from a 0.0 - 1.0 value to a 0.0 - 100.0 value */
+        _mm_storeu_ps (&line_ps[index],
+                       _mm256_cvtpd_ps (_mm256_mul_pd (slope, percent)));
+    }
+
+    /* Finish the remaining pixels */
+    slope_row_double_scalar (kernel, &x_numerator[index], &y_numerator[index],
+                             count - index, &line_ps[index]);
+}
+
+
+/*****************************************************************************
+  NAME:  slope_exceeds_double_avx2
+
+  PURPOSE:  Determines four pixels at a time using AVX2 if the percent slope
+            computed using double precision is at or above the threshold.
+
+  RETURN VALUE:  Type = None
+*****************************************************************************/
+void
+slope_exceeds_double_avx2
+(
+    const Slope_Kernel_t *kernel, /* I: slope kernel settings */
+    const int32_t *x_numerator,   /* I: east/west slope numerators */
+    const int32_t *y_numerator,   /* I: north/south slope numerators */
+    int count,                    /* I: number of pixels */
+    uint8_t *line_exceeded        /* O: 0xff where the slope is at or above
+                                        the threshold, 0 otherwise */
+)
+{
+    int index;
+    __m256d x_slope;
+    __m256d y_slope;
+    __m256d squared_slope;
+    int mask;
+
+    const __m256d x_divisor = _mm256_set1_pd (kernel->x_divisor);
+    const __m256d y_divisor = _mm256_set1_pd (kernel->y_divisor);
+    const __m256d threshold = _mm256_set1_pd (kernel->double_threshold);
+
+    for (index = 0; index + 4 <= count; index += 4)
+    {
+        x_slope = _mm256_div_pd (_mm256_cvtepi32_pd (_mm_loadu_si128 (
+            (const __m128i *) &x_numerator[index])), x_divisor);
+        y_slope = _mm256_div_pd (_mm256_cvtepi32_pd (_mm_loadu_si128 (
+            (const __m128i *) &y_numerator[index])), y_divisor);
+
+        squared_slope = _mm256_add_pd (_mm256_mul_pd (x_slope, x_slope),
+                                       _mm256_mul_pd (y_slope, y_slope));
+
+        mask = _mm256_movemask_pd (_mm256_cmp_pd (squared_slope, threshold,
+                                                  _CMP_GE_OQ));
+        memcpy (&line_exceeded[index], &exceeded_bytes[mask], 4);
+    }
+
+    /* Finish the remaining pixels */
+    slope_exceeds_double_scalar (kernel, &x_numerator[index],
+                                 &y_numerator[index], count - index,
+                                 &line_exceeded[index]);
+}
+
+
+/*****************************************************************************
+  NAME:  slope_row_float_avx2
+
+  PURPOSE:  Computes the percent slope eight pixels at a time using AVX2 and
+            single precision.
+
+  RETURN VALUE:  Type = None
+*****************************************************************************/
+void
+slope_row_float_avx2
+(
+    const Slope_Kernel_t *kernel, /* I: slope kernel settings */
+    const int32_t *x_numerator,   /* I: east/west slope numerators */
+    const int32_t *y_numerator,   /* I: north/south slope numerators */
+    int count,                    /* I: number of pixels */
+    float *line_ps                /* O: percent slope for each pixel */
+)
+{
+    int index;
+    __m256 x_slope;
+    __m256 y_slope;
+    __m256 slope;
+
+    const __m256 x_scale = _mm256_set1_ps (kernel->x_scale);
+    const __m256 y_scale = _mm256_set1_ps (kernel->y_scale);
+    const __m256 percent = _mm256_set1_ps (100.0F);
+
+    for (index = 0; index + 8 <= count; index += 8)
+    {
+        x_slope = _mm256_mul_ps (_mm256_cvtepi32_ps (_mm256_loadu_si256 (
+            (const __m256i *) &x_numerator[index])), x_scale);
+        y_slope = _mm256_mul_ps (_mm256_cvtepi32_ps (_mm256_loadu_si256 (
+            (const __m256i *) &y_numerator[index])), y_scale);
+
+        slope = _mm256_sqrt_ps (_mm256_add_ps (
+            _mm256_mul_ps (x_slope, x_slope),
+            _mm256_mul_ps (y_slope, y_slope)));
+
+        _mm256_storeu_ps (&line_ps[index], _mm256_mul_ps (slope, percent));
+    }
+
+    /* Finish the remaining pixels */
+    slope_row_float_scalar (kernel, &x_numerator[index], &y_numerator[index],
+                            count - index, &line_ps[index]);
+}
+
+
+/*****************************************************************************
+  NAME:  slope_exceeds_float_avx2
+
+  PURPOSE:  Determines eight pixels at a time using AVX2 if the percent slope
+            computed using single precision is at or above the threshold.
+
+  RETURN VALUE:  Type = None
+*****************************************************************************/
+void
+slope_exceeds_float_avx2
+(
+    const Slope_Kernel_t *kernel, /* I: slope kernel settings */
+    const int32_t *x_numerator,   /* I: east/west slope numerators */
+    const int32_t *y_numerator,   /* I: north/south slope numerators */
+    int count,                    /* I: number of pixels */
+    uint8_t *line_exceeded        /* O: 0xff where the slope is at or above
+                                        the threshold, 0 otherwise */
+)
+{
+    int index;
+    __m256 x_slope;
+    __m256 y_slope;
+    __m256i exceeded;
+    __m128i packed;
+
+    const __m256 x_scale = _mm256_set1_ps (kernel->x_scale);
+    const __m256 y_scale = _mm256_set1_ps (kernel->y_scale);
+    const __m256 threshold = _mm256_set1_ps (kernel->float_threshold);
+
+    for (index = 0; index + 8 <= count; index += 8)
+    {
+        x_slope = _mm256_mul_ps (_mm256_cvtepi32_ps (_mm256_loadu_si256 (
+            (const __m256i *) &x_numerator[index])), x_scale);
+        y_slope = _mm256_mul_ps (_mm256_cvtepi32_ps (_mm256_loadu_si256 (
+            (const __m256i *) &y_numerator[index])), y_scale);
+
+        exceeded = _mm256_castps_si256 (_mm256_cmp_ps (
+            _mm256_add_ps (_mm256_mul_ps (x_slope, x_slope),
+                           _mm256_mul_ps (y_slope, y_slope)),
+            threshold, _CMP_GE_OQ));
+
+        /* Narrow the eight 32bit masks to bytes */
+        packed = _mm_packs_epi32 (_mm256_castsi256_si128 (exceeded),
+                                  _mm256_extracti128_si256 (exceeded, 1));
+        _mm_storel_epi64 ((__m128i *) &line_exceeded[index],
+                          _mm_packs_epi16 (packed, packed));
+    }
+
+    /* Finish the remaining pixels */
+    slope_exceeds_float_scalar (kernel, &x_numerator[index],
+                                &y_numerator[index], count - index,
+                                &line_exceeded[index]);
+}
+
+
+#endif /* DSWE_SIMD_X86 */
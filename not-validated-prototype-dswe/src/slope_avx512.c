@@ -0,0 +1,222 @@
+#include <stdint.h>
+
+
+#include "build_slope_band.h"
+
+
+#ifdef DSWE_SIMD_X86
+
+
+#include <immintrin.h>
+
+
+/*****************************************************************************
+  NAME:  slope_row_double_avx512
+
+  PURPOSE:  Computes the percent slope eight pixels at a time using AVX-512F
+            and double precision.
+
+  RETURN VALUE:  Type = None
+
+  NOTES:
+    1. The division and square root are correctly rounded, so the results
+       match slope_row_double_scalar exactly.
+*****************************************************************************/
+void
+slope_row_double_avx512
+(
+    const Slope_Kernel_t *kernel, /* I: slope kernel settings */
+    const int32_t *x_numerator,   /* I: east/west slope numerators */
+    const int32_t *y_numerator,   /* I: north/south slope numerators */
+    int count,                    /* I: number of pixels */
+    float *line_ps                /* O: percent slope for each pixel */
+)
+{
+    int index;
+    __m512d x_slope;
+    __m512d y_slope;
+    __m512d slope;
+
+    const __m512d x_divisor = _mm512_set1_pd (kernel->x_divisor);
+    const __m512d y_divisor = _mm512_set1_pd (kernel->y_divisor);
+    const __m512d percent = _mm512_set1_pd (100.0);
+
+    for (index = 0; index + 8 <= count; index += 8)
+    {
+        x_slope = _mm512_div_pd (_mm512_cvtepi32_pd (_mm256_loadu_si256 (
+            (const __m256i *) &x_numerator[index])), x_divisor);
+        y_slope = _mm512_div_pd (_mm512_cvtepi32_pd (_mm256_loadu_si256 (
+            (const __m256i *) &y_numerator[index])), y_divisor);
+
+        slope = _mm512_sqrt_pd (_mm512_add_pd (
+            _mm512_mul_pd (x_slope, x_slope),
+            _mm512_mul_pd (y_slope, y_slope)));
+
+        /* Convert from a 0.0 - 1.0 value to a 0.0 - 100.0 value */
+        _mm256_storeu_ps (&line_ps[index],
+                          _mm512_cvtpd_ps (_mm512_mul_pd (slope, percent)));
+    }
+
+    /* Finish the remaining pixels */
+    slope_row_double_scalar (kernel, &x_numerator[index], &y_numerator[index],
+                             count - index, &line_ps[index]);
+}
+
+
+/*****************************************************************************
+  NAME:  slope_exceeds_double_avx512
+
+  PURPOSE:  Determines eight pixels at a time using AVX-512F if the percent
+            slope computed using double precision is at or above the
+            threshold.
+
+  RETURN VALUE:  Type = None
+*****************************************************************************/
+void
+slope_exceeds_double_avx512
+(
+    const Slope_Kernel_t *kernel, /* I: slope kernel settings */
+    const int32_t *x_numerator,   /* I: east/west slope numerators */
+    const int32_t *y_numerator,   /* I: north/south slope numerators */
+    int count,                    /* I: number of pixels */
+    uint8_t *line_exceeded        /* O: 0xff where the slope is at or above
+                                        the threshold, 0 otherwise */
+)
+{
+    int index;
+    __m512d x_slope;
+    __m512d y_slope;
+    __m512d squared_slope;
+    __mmask8 exceeded;
+
+    const __m512d x_divisor = _mm512_set1_pd (kernel->x_divisor);
+    const __m512d y_divisor = _mm512_set1_pd (kernel->y_divisor);
+    const __m512d threshold = _mm512_set1_pd (kernel->double_threshold);
+
+    for (index = 0; index + 8 <= count; index += 8)
+    {
+        x_slope = _mm512_div_pd (_mm512_cvtepi32_pd (_mm256_loadu_si256 (
+            (const __m256i *) &x_numerator[index])), x_divisor);
+        y_slope = _mm512_div_pd (_mm512_cvtepi32_pd (_mm256_loadu_si256 (
+            (const __m256i *) &y_numerator[index])), y_divisor);
+
+        squared_slope = _mm512_add_pd (_mm512_mul_pd (x_slope, x_slope),
+                                       _mm512_mul_pd (y_slope, y_slope));
+
+        exceeded = _mm512_cmp_pd_mask (squared_slope, threshold, _CMP_GE_OQ);
+
+        /* Narrow the eight 64bit results to bytes */
+        _mm_storel_epi64 ((__m128i *) &line_exceeded[index],
+                          _mm512_cvtepi64_epi8 (_mm512_maskz_mov_epi64 (
+                              exceeded, _mm512_set1_epi64 (0xff))));
+    }
+
+    /* Finish the remaining pixels */
+    slope_exceeds_double_scalar (kernel, &x_numerator[index],
+                                 &y_numerator[index], count - index,
+                                 &line_exceeded[index]);
+}
+
+
+/*****************************************************************************
+  NAME:  slope_row_float_avx512
+
+  PURPOSE:  Computes the percent slope sixteen pixels at a time using
+            AVX-512F and single precision.
+
+  RETURN VALUE:  Type = None
+*****************************************************************************/
+void
+slope_row_float_avx512
+(
+    const Slope_Kernel_t *kernel, /* I: slope kernel settings */
+    const int32_t *x_numerator,   /* I: east/west slope numerators */
+    const int32_t *y_numerator,   /* I: north/south slope numerators */
+    int count,                    /* I: number of pixels */
+    float *line_ps                /* O: percent slope for each pixel */
+)
+{
+    int index;
+    __m512 x_slope;
+    __m512 y_slope;
+    __m512 slope;
+
+    const __m512 x_scale = _mm512_set1_ps (kernel->x_scale);
+    const __m512 y_scale = _mm512_set1_ps (kernel->y_scale);
+    const __m512 percent = _mm512_set1_ps (100.0F);
+
+    for (index = 0; index + 16 <= count; index += 16)
+    {
+        x_slope = _mm512_mul_ps (_mm512_cvtepi32_ps (_mm512_loadu_si512 (
+            &x_numerator[index])), x_scale);
+        y_slope = _mm512_mul_ps (_mm512_cvtepi32_ps (_mm512_loadu_si512 (
+            &y_numerator[index])), y_scale);
+
+        slope = _mm512_sqrt_ps (_mm512_add_ps (
+            _mm512_mul_ps (x_slope, x_slope),
+            _mm512_mul_ps (y_slope, y_slope)));
+
+        _mm512_storeu_ps (&line_ps[index], _mm512_mul_ps (slope, percent));
+    }
+
+    /* Finish the remaining pixels */
+    slope_row_float_scalar (kernel, &x_numerator[index], &y_numerator[index],
+                            count - index, &line_ps[index]);
+}
+
+
+/*****************************************************************************
+  NAME:  slope_exceeds_float_avx512
+
+  PURPOSE:  Determines sixteen pixels at a time using AVX-512F if the percent
+            slope computed using single precision is at or above the
+            threshold.
+
+  RETURN VALUE:  Type = None
+*****************************************************************************/
+void
+slope_exceeds_float_avx512
+(
+    const Slope_Kernel_t *kernel, /* I: slope kernel settings */
+    const int32_t *x_numerator,   /* I: east/west slope numerators */
+    const int32_t *y_numerator,   /* I: north/south slope numerators */
+    int count,                    /* I: number of pixels */
+    uint8_t *line_exceeded        /* O: 0xff where the slope is at or above
+                                        the threshold, 0 otherwise */
+)
+{
+    int index;
+    __m512 x_slope;
+    __m512 y_slope;
+    __mmask16 exceeded;
+
+    const __m512 x_scale = _mm512_set1_ps (kernel->x_scale);
+    const __m512 y_scale = _mm512_set1_ps (kernel->y_scale);
+    const __m512 threshold = _mm512_set1_ps (kernel->float_threshold);
+
+    for (index = 0; index + 16 <= count; index += 16)
+    {
+        x_slope = _mm512_mul_ps (_mm512_cvtepi32_ps (_mm512_loadu_si512 (
+            &x_numerator[index])), x_scale);
+        y_slope = _mm512_mul_ps (_mm512_cvtepi32_ps (_mm512_loadu_si512 (
+            &y_numerator[index])), y_scale);
+
+        exceeded = _mm512_cmp_ps_mask (
+            _mm512_add_ps (_mm512_mul_ps (x_slope, x_slope),
+                           _mm512_mul_ps (y_slope, y_slope)),
+            threshold, _CMP_GE_OQ);
+
+        /* Narrow the sixteen 32bit results to bytes */
+        _mm_storeu_si128 ((__m128i *) &line_exceeded[index],
+                          _mm512_cvtepi32_epi8 (_mm512_maskz_mov_epi32 (
+                              exceeded, _mm512_set1_epi32 (0xff))));
+    }
+
+    /* Finish the remaining pixels */
+    slope_exceeds_float_scalar (kernel, &x_numerator[index],
+                                &y_numerator[index], count - index,
+                                &line_exceeded[index]);
+}
+
+
+#endif /* DSWE_SIMD_X86 */
@@ -0,0 +1,716 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+
+
+#include "const.h"
+#include "dswe.h"
+#include "utilities.h"
+#include "sha256.h"
+#include "slope_cache.h"
+
+
+/* Identifies a slope cache entry and the version of its layout */
+#define SLOPE_CACHE_MAGIC "DSWESLP2"
+
+/* The lines start a page into the entry so they are page aligned in the
+   mapping */
+#define SLOPE_CACHE_HEADER_SIZE 4096
+
+/* Size of the blocks the DEM is digested in */
+#define DIGEST_BLOCK_SIZE (1024 * 1024)
+
+
+/* Everything the slope depends on, the DEM is identified by its file so
+   finding an entry does not need the DEM to be read */
+typedef struct
+{
+    uint64_t dem_device;   /* Device holding the DEM file */
+    uint64_t dem_inode;    /* Inode of the DEM file */
+    uint64_t dem_size;     /* Size of the DEM file */
+    int64_t dem_mtime_sec; /* Modification time of the DEM file */
+    int64_t dem_mtime_nsec;
+    int64_t dem_ctime_sec; /* Status change time of the DEM file */
+    int64_t dem_ctime_nsec;
+    int32_t kind;          /* Slope_Cache_Kind_e */
+    int32_t zeven_thorne;  /* Non-zero for Zevenbergen & Thorne */
+    int32_t precision;     /* Slope_Precision_e */
+    int32_t lines;
+    int32_t samples;
+    float percent_slope;   /* Threshold for SLOPE_CACHE_EXCEEDED, zero
+                              otherwise */
+    double x_pixel_size;
+    double y_pixel_size;
+} Slope_Cache_Key_t;
+
+
+/* The start of every cache entry */
+typedef struct
+{
+    char magic[8];                          /* SLOPE_CACHE_MAGIC */
+    Slope_Cache_Key_t key;                  /* What the entry was made for */
+    uint8_t dem_digest[SHA256_DIGEST_SIZE]; /* SHA-256 of the DEM file
+                                               contents the entry was
+                                               populated from */
+} Slope_Cache_Header_t;
+
+
+/*****************************************************************************
+  NAME:  identify_dem_file
+
+  PURPOSE:  Fills in the identity of the DEM file in a cache key, from its
+            device, inode, size, and times.  A DEM which is rewritten or
+            replaced gets a new identity.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      SUCCESS  No errors were encountered.
+      ERROR    The DEM file could not be examined.
+*****************************************************************************/
+static int
+identify_dem_file
+(
+    int dem_fd,             /* I: the opened DEM file */
+    Slope_Cache_Key_t *key  /* O: the key with the DEM identity set */
+)
+{
+    struct stat dem_stat;
+
+    if (fstat (dem_fd, &dem_stat) != 0)
+        return ERROR;
+
+    key->dem_device = dem_stat.st_dev;
+    key->dem_inode = dem_stat.st_ino;
+    key->dem_size = dem_stat.st_size;
+    key->dem_mtime_sec = dem_stat.st_mtim.tv_sec;
+    key->dem_mtime_nsec = dem_stat.st_mtim.tv_nsec;
+    key->dem_ctime_sec = dem_stat.st_ctim.tv_sec;
+    key->dem_ctime_nsec = dem_stat.st_ctim.tv_nsec;
+
+    return SUCCESS;
+}
+
+
+/*****************************************************************************
+  NAME:  digest_dem_file
+
+  PURPOSE:  Computes the SHA-256 digest of the contents of the elevation
+            band file.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      SUCCESS  No errors were encountered.
+      ERROR    An error was encountered.
+*****************************************************************************/
+static int
+digest_dem_file
+(
+    Input_Data_t *input_data,              /* I: the opened input bands */
+    uint8_t dem_digest[SHA256_DIGEST_SIZE] /* O: digest of the DEM file
+                                                 contents */
+)
+{
+    FILE *fd = input_data->band_fd[I_BAND_ELEVATION];
+    uint8_t *block = NULL;
+    size_t count;
+    Sha256_t sha;
+    char msg[PATH_MAX + 40];
+
+    block = malloc (DIGEST_BLOCK_SIZE);
+    if (block == NULL)
+    {
+        RETURN_ERROR ("Failed allocating memory for the DEM digest",
+                      MODULE_NAME, ERROR);
+    }
+
+    if (fseeko (fd, 0, SEEK_SET) != 0)
+    {
+        free (block);
+        snprintf (msg, sizeof (msg), "Failed seeking in (%s)",
+                  input_data->band_name[I_BAND_ELEVATION]);
+        RETURN_ERROR (msg, MODULE_NAME, ERROR);
+    }
+
+    sha256_init (&sha);
+    while ((count = fread (block, 1, DIGEST_BLOCK_SIZE, fd)) > 0)
+        sha256_update (&sha, block, count);
+    sha256_final (&sha, dem_digest);
+
+    free (block);
+
+    if (ferror (fd))
+    {
+        clearerr (fd);
+        snprintf (msg, sizeof (msg), "Failed reading (%s)",
+                  input_data->band_name[I_BAND_ELEVATION]);
+        RETURN_ERROR (msg, MODULE_NAME, ERROR);
+    }
+
+    /* Leave the file usable by read_band_lines */
+    clearerr (fd);
+
+    return SUCCESS;
+}
+
+
+/*****************************************************************************
+  NAME:  map_cache_entry
+
+  PURPOSE:  Opens and maps a completed cache entry, if it exists and was
+            created for the same DEM file and slope parameters.
+
+  RETURN VALUE:  Type = bool
+      Value    Description
+      -------  ---------------------------------------------------------------
+      true     The entry was mapped.
+      false    There is no usable entry.
+*****************************************************************************/
+static bool
+map_cache_entry
+(
+    const Slope_Cache_Header_t *header, /* I: the expected header */
+    Slope_Cache_t *cache                /* IO: the cache entry */
+)
+{
+    struct stat entry_stat;
+    const Slope_Cache_Header_t *stored;
+    void *map;
+    int fd;
+
+    fd = open (cache->entry_filename, O_RDONLY);
+    if (fd == -1)
+        return false;
+
+    if (fstat (fd, &entry_stat) != 0
+        || (size_t) entry_stat.st_size != cache->map_size)
+    {
+        close (fd);
+        return false;
+    }
+
+    map = mmap (NULL, cache->map_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+    {
+        close (fd);
+        return false;
+    }
+
+    /* The name is a digest of the key, the key itself is compared so an
+       entry is only ever used for the DEM and parameters it was made for */
+    stored = map;
+    if (memcmp (stored->magic, header->magic, sizeof (header->magic)) != 0
+        || memcmp (&stored->key, &header->key, sizeof (header->key)) != 0)
+    {
+        munmap (map, cache->map_size);
+        close (fd);
+        return false;
+    }
+
+    /* The lines are read in order */
+    madvise (map, cache->map_size, MADV_SEQUENTIAL);
+
+    cache->fd = fd;
+    cache->map = map;
+    cache->data = (uint8_t *) map + SLOPE_CACHE_HEADER_SIZE;
+    cache->state = SLOPE_CACHE_HIT;
+
+    return true;
+}
+
+
+/*****************************************************************************
+  NAME:  create_cache_entry
+
+  PURPOSE:  Creates and maps a temporary file to populate the cache entry
+            in, and stores the header with the digest of the DEM contents.
+            The lock must be held.
+
+  RETURN VALUE:  Type = bool
+      Value    Description
+      -------  ---------------------------------------------------------------
+      true     The temporary entry was created.
+      false    The temporary entry could not be created.
+*****************************************************************************/
+static bool
+create_cache_entry
+(
+    const Slope_Cache_Header_t *header, /* I: the header for the entry */
+    Slope_Cache_t *cache                /* IO: the cache entry */
+)
+{
+    char msg[PATH_MAX + 40];
+    void *map;
+    int fd;
+
+    fd = open (cache->temp_filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1)
+    {
+        snprintf (msg, sizeof (msg), "Failed creating slope cache file %s",
+                  cache->temp_filename);
+        WARNING_MESSAGE (msg, MODULE_NAME);
+        return false;
+    }
+
+    if (ftruncate (fd, cache->map_size) != 0)
+    {
+        snprintf (msg, sizeof (msg), "Failed sizing slope cache file %s",
+                  cache->temp_filename);
+        WARNING_MESSAGE (msg, MODULE_NAME);
+        close (fd);
+        unlink (cache->temp_filename);
+        return false;
+    }
+
+    map = mmap (NULL, cache->map_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                fd, 0);
+    if (map == MAP_FAILED)
+    {
+        snprintf (msg, sizeof (msg), "Failed mapping slope cache file %s",
+                  cache->temp_filename);
+        WARNING_MESSAGE (msg, MODULE_NAME);
+        close (fd);
+        unlink (cache->temp_filename);
+        return false;
+    }
+
+    memcpy (map, header, sizeof (*header));
+
+    cache->fd = fd;
+    cache->map = map;
+    cache->data = (uint8_t *) map + SLOPE_CACHE_HEADER_SIZE;
+    cache->state = SLOPE_CACHE_POPULATE;
+
+    return true;
+}
+
+
+/*****************************************************************************
+  NAME:  release_cache_lock
+
+  PURPOSE:  Removes the lock file of the cache entry and releases the lock.
+            The file is removed while the lock is still held, so a process
+            which opened it before the removal finds it unlinked once it
+            gets the lock.
+
+  RETURN VALUE:  Type = None
+*****************************************************************************/
+static void
+release_cache_lock
+(
+    Slope_Cache_t *cache /* IO: the cache entry */
+)
+{
+    unlink (cache->lock_filename);
+    flock (cache->lock_fd, LOCK_UN);
+    close (cache->lock_fd);
+    cache->lock_fd = -1;
+}
+
+
+/*****************************************************************************
+  NAME:  lock_is_current
+
+  PURPOSE:  Determines whether a lock which was acquired is on the lock
+            file of the cache entry, and not on one another process has
+            already removed.
+
+  RETURN VALUE:  Type = bool
+      Value    Description
+      -------  ---------------------------------------------------------------
+      true     The lock file is still in place.
+      false    The lock file was removed or replaced.
+*****************************************************************************/
+static bool
+lock_is_current
+(
+    const Slope_Cache_t *cache /* I: the cache entry */
+)
+{
+    struct stat held_stat;
+    struct stat named_stat;
+
+    if (fstat (cache->lock_fd, &held_stat) != 0
+        || stat (cache->lock_filename, &named_stat) != 0)
+    {
+        return false;
+    }
+
+    return held_stat.st_dev == named_stat.st_dev
+           && held_stat.st_ino == named_stat.st_ino;
+}
+
+
+/*****************************************************************************
+  NAME:  open_slope_cache
+
+  PURPOSE:  Finds the cache entry for the DEM and slope parameters.  If it
+            exists it is memory mapped so the slope does not need to be
+            computed, otherwise a new entry is created to be populated as
+            the slope is computed.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      SUCCESS  No errors were encountered.
+      ERROR    An error was encountered examining or reading the DEM.
+
+  NOTES:
+    1. The entries are named from the SHA-256 digest of their key, which is
+       the identity of the DEM file (device, inode, size, and times), the
+       image size, the pixel size, the slope algorithm and precision, and
+       for SLOPE_CACHE_EXCEEDED the threshold.  The whole key is also stored
+       in the entry and compared when it is opened, so finding an entry
+       never reads the DEM.
+    2. The digest of the DEM contents is only computed when an entry is
+       populated, and is stored in its header.  An entry whose DEM was
+       changed while it was populated is not stored.
+    3. An entry is populated under a temporary name while holding a lock on
+       the entry, and renamed once complete, so other processes only ever
+       see complete entries.  The lock file is removed before the lock is
+       released.  A process which finds the lock held computes the slope
+       itself without using the cache.
+    4. Problems with the cache are reported as warnings and the slope is
+       computed instead.
+*****************************************************************************/
+int
+open_slope_cache
+(
+    const char *cache_dir,
+    Input_Data_t *input_data,
+    bool use_zeven_thorne_flag,
+    Slope_Precision_e precision,
+    Slope_Cache_Kind_e kind,
+    float percent_slope,
+    Slope_Cache_t *cache
+)
+{
+    Slope_Cache_Header_t header;
+    Sha256_t sha;
+    uint8_t key_digest[SHA256_DIGEST_SIZE];
+    char key_name[2 * SHA256_DIGEST_SIZE + 1];
+    char lock_filename[PATH_MAX];
+    char entry_filename[PATH_MAX];
+    char temp_filename[PATH_MAX];
+    char msg[PATH_MAX + 80];
+    int count;
+    int index;
+
+    cache->state = SLOPE_CACHE_BYPASS;
+    cache->kind = kind;
+    cache->lines = input_data->lines;
+    cache->samples = input_data->samples;
+    cache->percent_slope = percent_slope;
+    cache->fd = -1;
+    cache->lock_fd = -1;
+    cache->dem_fd = fileno (input_data->band_fd[I_BAND_ELEVATION]);
+    cache->map = NULL;
+    cache->data = NULL;
+    cache->entry_filename = NULL;
+    cache->temp_filename = NULL;
+    cache->lock_filename = NULL;
+
+    if (kind == SLOPE_CACHE_PERCENT_SLOPE)
+        cache->line_size = (size_t) cache->samples * sizeof (float);
+    else
+        cache->line_size = ((size_t) cache->samples + 7) / 8;
+    cache->map_size = SLOPE_CACHE_HEADER_SIZE
+                      + (size_t) cache->lines * cache->line_size;
+
+    /* Zero everything so the padding is the same for every run */
+    memset (&header, 0, sizeof (header));
+    memcpy (header.magic, SLOPE_CACHE_MAGIC, sizeof (header.magic));
+    if (identify_dem_file (cache->dem_fd, &header.key) != SUCCESS)
+    {
+        snprintf (msg, sizeof (msg), "Failed examining (%s) for the slope"
+                  " cache", input_data->band_name[I_BAND_ELEVATION]);
+        RETURN_ERROR (msg, MODULE_NAME, ERROR);
+    }
+    header.key.kind = kind;
+    header.key.zeven_thorne = use_zeven_thorne_flag;
+    header.key.precision = precision;
+    header.key.lines = cache->lines;
+    header.key.samples = cache->samples;
+    if (kind == SLOPE_CACHE_EXCEEDED)
+        header.key.percent_slope = percent_slope;
+    header.key.x_pixel_size = input_data->x_pixel_size;
+    header.key.y_pixel_size = input_data->y_pixel_size;
+
+    sha256_init (&sha);
+    sha256_update (&sha, &header.key, sizeof (header.key));
+    sha256_final (&sha, key_digest);
+    for (index = 0; index < SHA256_DIGEST_SIZE; index++)
+        sprintf (&key_name[2 * index], "%02x", key_digest[index]);
+
+    /* A truncated name could refer to the entry of another key, so the
+       cache is not used unless all of the names fit */
+    count = snprintf (entry_filename, sizeof (entry_filename),
+                      "%s/slope_%s.cache", cache_dir, key_name);
+    if (count < 0 || count >= sizeof (entry_filename))
+    {
+        WARNING_MESSAGE ("The slope cache entry filename is too long, not"
+                         " using the slope cache", MODULE_NAME);
+        close_slope_cache (cache, false);
+        return SUCCESS;
+    }
+    count = snprintf (lock_filename, sizeof (lock_filename), "%s.lock",
+                      entry_filename);
+    if (count < 0 || count >= sizeof (lock_filename))
+    {
+        WARNING_MESSAGE ("The slope cache lock filename is too long, not"
+                         " using the slope cache", MODULE_NAME);
+        close_slope_cache (cache, false);
+        return SUCCESS;
+    }
+    count = snprintf (temp_filename, sizeof (temp_filename), "%s.tmp.%ld",
+                      entry_filename, (long) getpid ());
+    if (count < 0 || count >= sizeof (temp_filename))
+    {
+        WARNING_MESSAGE ("The slope cache temporary filename is too long,"
+                         " not using the slope cache", MODULE_NAME);
+        close_slope_cache (cache, false);
+        return SUCCESS;
+    }
+    cache->entry_filename = strdup (entry_filename);
+    cache->temp_filename = strdup (temp_filename);
+    cache->lock_filename = strdup (lock_filename);
+    if (cache->entry_filename == NULL || cache->temp_filename == NULL
+        || cache->lock_filename == NULL)
+    {
+        WARNING_MESSAGE ("Failed allocating memory for the slope cache"
+                         " filenames, not using the slope cache",
+                         MODULE_NAME);
+        close_slope_cache (cache, false);
+        return SUCCESS;
+    }
+
+    /* Completed entries are only ever renamed into place, so no lock is
+       needed to use one */
+    if (map_cache_entry (&header, cache))
+        return SUCCESS;
+
+    if (mkdir (cache_dir, 0755) != 0 && errno != EEXIST)
+    {
+        snprintf (msg, sizeof (msg), "Failed creating slope cache directory"
+                  " %s, not using the slope cache", cache_dir);
+        WARNING_MESSAGE (msg, MODULE_NAME);
+        close_slope_cache (cache, false);
+        return SUCCESS;
+    }
+
+    cache->lock_fd = open (lock_filename, O_RDWR | O_CREAT, 0644);
+    if (cache->lock_fd == -1)
+    {
+        snprintf (msg, sizeof (msg), "Failed opening slope cache lock %s,"
+                  " not using the slope cache", lock_filename);
+        WARNING_MESSAGE (msg, MODULE_NAME);
+        close_slope_cache (cache, false);
+        return SUCCESS;
+    }
+
+    /* Another process is already populating the entry, or has finished
+       and removed the lock file this one was opened from.  The lock file
+       is only removed by the process holding the lock. */
+    if (flock (cache->lock_fd, LOCK_EX | LOCK_NB) != 0
+        || !lock_is_current (cache))
+    {
+        close (cache->lock_fd);
+        cache->lock_fd = -1;
+        if (!map_cache_entry (&header, cache))
+            close_slope_cache (cache, false);
+        return SUCCESS;
+    }
+
+    /* The entry may have been completed while acquiring the lock */
+    if (map_cache_entry (&header, cache))
+    {
+        release_cache_lock (cache);
+        return SUCCESS;
+    }
+
+    /* Only an entry being populated needs the DEM contents read */
+    if (digest_dem_file (input_data, header.dem_digest) != SUCCESS)
+    {
+        close_slope_cache (cache, false);
+        RETURN_ERROR ("Failed computing the DEM digest for the slope cache",
+                      MODULE_NAME, ERROR);
+    }
+
+    if (!create_cache_entry (&header, cache))
+        close_slope_cache (cache, false);
+
+    return SUCCESS;
+}
+
+
+/*****************************************************************************
+  NAME:  read_slope_cache_line
+
+  PURPOSE:  Reads a line of the slope from a cache entry.
+
+  RETURN VALUE:  Type = None
+*****************************************************************************/
+void
+read_slope_cache_line
+(
+    const Slope_Cache_t *cache,
+    int line,
+    float *line_ps,
+    uint8_t *line_exceeded
+)
+{
+    const uint8_t *line_data = &cache->data[(size_t) line * cache->line_size];
+    int sample;
+
+    if (cache->kind == SLOPE_CACHE_PERCENT_SLOPE)
+    {
+        memcpy (line_ps, line_data, cache->line_size);
+        return;
+    }
+
+    for (sample = 0; sample < cache->samples; sample++)
+    {
+        if (line_data[sample >> 3] & (1 << (sample & 7)))
+            line_exceeded[sample] = 0xff;
+        else
+            line_exceeded[sample] = 0;
+    }
+}
+
+
+/*****************************************************************************
+  NAME:  write_slope_cache_line
+
+  PURPOSE:  Writes a line of the slope to a cache entry being populated.
+            Every line is stored separately so the lines can be written by
+            different threads.
+
+  RETURN VALUE:  Type = None
+*****************************************************************************/
+void
+write_slope_cache_line
+(
+    Slope_Cache_t *cache,
+    int line,
+    const float *line_ps,
+    const uint8_t *line_exceeded
+)
+{
+    uint8_t *line_data = &cache->data[(size_t) line * cache->line_size];
+    int sample;
+
+    if (cache->kind == SLOPE_CACHE_PERCENT_SLOPE)
+    {
+        memcpy (line_data, line_ps, cache->line_size);
+        return;
+    }
+
+    memset (line_data, 0, cache->line_size);
+    for (sample = 0; sample < cache->samples; sample++)
+    {
+        if (line_exceeded[sample])
+            line_data[sample >> 3] |= 1 << (sample & 7);
+    }
+}
+
+
+/*****************************************************************************
+  NAME:  close_slope_cache
+
+  PURPOSE:  Releases the cache entry.  A populated entry is flushed to disk
+            and renamed into place when complete, otherwise it is removed.
+
+  RETURN VALUE:  Type = None
+*****************************************************************************/
+void
+close_slope_cache
+(
+    Slope_Cache_t *cache,
+    bool complete_flag
+)
+{
+    const Slope_Cache_Header_t *header;
+    Slope_Cache_Key_t key;
+    bool store_flag = false;
+    char msg[PATH_MAX + 80];
+
+    /* The slope was computed from the DEM as it was read while populating,
+       so the entry is only stored if the DEM is still the one in its key */
+    if (cache->state == SLOPE_CACHE_POPULATE && complete_flag)
+    {
+        header = cache->map;
+        key = header->key;
+        if (identify_dem_file (cache->dem_fd, &key) == SUCCESS
+            && memcmp (&key, &header->key, sizeof (key)) == 0)
+        {
+            store_flag = true;
+        }
+        else
+        {
+            snprintf (msg, sizeof (msg), "The DEM changed while populating"
+                      " slope cache file %s, not storing it",
+                      cache->entry_filename);
+            WARNING_MESSAGE (msg, MODULE_NAME);
+        }
+    }
+
+    if (cache->map != NULL)
+    {
+        munmap (cache->map, cache->map_size);
+        cache->map = NULL;
+        cache->data = NULL;
+    }
+
+    if (cache->state == SLOPE_CACHE_POPULATE)
+    {
+        if (store_flag && fsync (cache->fd) == 0
+            && rename (cache->temp_filename, cache->entry_filename) == 0)
+        {
+            snprintf (msg, sizeof (msg), "Stored the slope in cache file %s",
+                      cache->entry_filename);
+            LOG_MESSAGE (msg, MODULE_NAME);
+        }
+        else
+        {
+            if (store_flag)
+            {
+                snprintf (msg, sizeof (msg), "Failed storing slope cache"
+                          " file %s", cache->entry_filename);
+                WARNING_MESSAGE (msg, MODULE_NAME);
+            }
+            unlink (cache->temp_filename);
+        }
+    }
+
+    if (cache->fd != -1)
+    {
+        close (cache->fd);
+        cache->fd = -1;
+    }
+
+    /* Release the lock after the rename so a waiting process finds the
+       completed entry */
+    if (cache->lock_fd != -1)
+        release_cache_lock (cache);
+
+    free (cache->entry_filename);
+    free (cache->temp_filename);
+    free (cache->lock_filename);
+    cache->entry_filename = NULL;
+    cache->temp_filename = NULL;
+    cache->lock_filename = NULL;
+    cache->state = SLOPE_CACHE_BYPASS;
+}
@@ -0,0 +1,102 @@
+
+#ifndef SLOPE_CACHE_H
+#define SLOPE_CACHE_H
+
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+
+#include "input.h"
+#include "build_slope_band.h"
+
+
+/* What a slope cache entry holds for each pixel */
+typedef enum
+{
+    SLOPE_CACHE_PERCENT_SLOPE, /* The percent slope as a float */
+    SLOPE_CACHE_EXCEEDED       /* A bit set where the percent slope is at or
+                                  above the threshold */
+} Slope_Cache_Kind_e;
+
+
+/* How the slope cache is being used for this run */
+typedef enum
+{
+    SLOPE_CACHE_BYPASS,  /* Compute the slope, the cache is not used */
+    SLOPE_CACHE_HIT,     /* Read the slope from the cache entry */
+    SLOPE_CACHE_POPULATE /* Compute the slope and store it in a new entry */
+} Slope_Cache_State_e;
+
+
+/* An open slope cache entry */
+typedef struct
+{
+    Slope_Cache_State_e state;
+    Slope_Cache_Kind_e kind;
+    int lines;                 /* Lines in the entry */
+    int samples;               /* Samples in the entry */
+    size_t line_size;          /* Bytes held for each line */
+    float percent_slope;       /* Threshold for SLOPE_CACHE_EXCEEDED */
+    int fd;                    /* The entry file */
+    int lock_fd;               /* Lock held while populating the entry */
+    int dem_fd;                /* The DEM file, identified again before a
+                                  populated entry is stored */
+    void *map;                 /* The memory mapped entry file */
+    size_t map_size;           /* Size of the mapping */
+    uint8_t *data;             /* The lines of the entry within the map */
+    char *entry_filename;      /* The name of the completed entry */
+    char *temp_filename;       /* The name the entry is populated under */
+    char *lock_filename;       /* The name of the lock of the entry */
+} Slope_Cache_t;
+
+
+int
+open_slope_cache
+(
+    const char *cache_dir,       /* I: directory holding the cache entries */
+    Input_Data_t *input_data,    /* I: the opened input bands */
+    bool use_zeven_thorne_flag,  /* I: use Zevenbergen & Thorne's algorithm
+                                       instead of Horn's */
+    Slope_Precision_e precision, /* I: precision of the slope */
+    Slope_Cache_Kind_e kind,     /* I: what the entry holds for each pixel */
+    float percent_slope,         /* I: percent slope threshold */
+    Slope_Cache_t *cache         /* O: the opened cache entry */
+);
+
+
+void
+read_slope_cache_line
+(
+    const Slope_Cache_t *cache, /* I: the cache entry */
+    int line,                   /* I: the line to read */
+    float *line_ps,             /* O: the percent slope, only for
+                                      SLOPE_CACHE_PERCENT_SLOPE */
+    uint8_t *line_exceeded      /* O: 0xff where the slope is at or above the
+                                      threshold, 0 otherwise */
+);
+
+
+void
+write_slope_cache_line
+(
+    Slope_Cache_t *cache,         /* I: the cache entry */
+    int line,                     /* I: the line to write */
+    const float *line_ps,         /* I: the percent slope, only for
+                                        SLOPE_CACHE_PERCENT_SLOPE */
+    const uint8_t *line_exceeded  /* I: 0xff where the slope is at or above
+                                        the threshold, 0 otherwise */
+);
+
+
+void
+close_slope_cache
+(
+    Slope_Cache_t *cache, /* I: the cache entry */
+    bool complete_flag    /* I: every line of a populated entry was
+                                written, so it can be published */
+);
+
+
+#endif /* SLOPE_CACHE_H */
@@ -0,0 +1,362 @@
+#! /usr/bin/env python
+
+'''
+    PURPOSE: Check the surface water extent applications on a synthetic
+             scene of more than 2^31 pixels, built from sparse files.
+
+    PROJECT: Land Satellites Data Systems Science Research and Development
+             (LSRD) at the USGS EROS
+
+    LICENSE: NASA Open Source Agreement 1.3
+
+    NOTES:
+        A tile of a few lines is generated with generate_synthetic_scene.py
+            and placed as the last lines of the large scene.  The lines
+            above it are a hole in the sparse band files, which reads as
+            zeros without using the disk.  The hole alone has more than
+            2^31 pixels, so every pixel count is over the range of an int.
+        Zero reflectance with a clear Level-2 QA is water to the water
+            test, so the pixel counts of the large scene are those of the
+            tile plus every pixel of the hole.
+        Each application is run on the tile, and on the large scene without
+            --max-memory, so it is processed in strips within the default
+            memory budget.  The check fails when:
+            - The last lines of an output are not those of the tile.  The
+              first two lines of the tile are left out, the slope is not
+              computed for the first two lines of a scene.
+            - The reported pixel counts and percentages, or the percentages
+              in the XML, are not the expected ones.
+            - The peak resident set size is over the memory budget, on top
+              of the peak for the tile, which is the size of the
+              application itself.
+        The outputs are not sparse, the default scene needs about 12 GB of
+            free disk.
+'''
+
+import os
+import re
+import sys
+import shutil
+import logging
+import argparse
+import subprocess
+import xml.etree.ElementTree as ElementTree
+
+
+# The scenes with more pixels than this are processed in strips when no
+# memory budget is given, within LARGE_SCENE_MAX_MEMORY megabytes
+LARGE_SCENE_PIXELS = 2147483647
+LARGE_SCENE_MAX_MEMORY = 1024
+
+ESPA_NAMESPACE = '{http://espa.cr.usgs.gov/v2}'
+
+
+class CheckError(Exception):
+    '''Raised when the large scene does not give the expected results'''
+
+    def __init__(self, message, *args):
+        self.message = message
+        Exception.__init__(self, message, *args)
+
+
+def parse_cmd_line():
+    '''Parse the command line'''
+
+    parser = argparse.ArgumentParser(description='Check the surface water'
+                                     ' extent applications on a synthetic'
+                                     ' scene of more than 2^31 pixels')
+    parser.add_argument('--work-directory', action='store',
+                        dest='work_directory', default='large_scene_check',
+                        help='Directory to build the scenes in, removed'
+                        ' when the check passes (default'
+                        ' large_scene_check)')
+    parser.add_argument('--lines', action='store', dest='lines',
+                        type=int, default=1048704,
+                        help='Number of lines of the large scene'
+                        ' (default 1048704)')
+    parser.add_argument('--samples', action='store', dest='samples',
+                        type=int, default=2048,
+                        help='Number of samples (default 2048)')
+    parser.add_argument('--tile-lines', action='store', dest='tile_lines',
+                        type=int, default=16,
+                        help='Number of lines of the generated tile'
+                        ' (default 16)')
+    parser.add_argument('--dswe', action='store', dest='dswe',
+                        default='dswe',
+                        help='The dswe executable (default dswe)')
+    parser.add_argument('--cfmask-water-detection', action='store',
+                        dest='cfmask_water_detection',
+                        default='cfmask_water_detection',
+                        help='The cfmask_water_detection executable'
+                        ' (default cfmask_water_detection)')
+    parser.add_argument('--max-rss', action='store', dest='max_rss',
+                        type=int, default=LARGE_SCENE_MAX_MEMORY,
+                        help='Memory budget the peak resident set size must'
+                        ' stay within, in megabytes (default {0})'
+                        .format(LARGE_SCENE_MAX_MEMORY))
+    parser.add_argument('--keep', action='store_true', dest='keep',
+                        default=False,
+                        help='Keep the work directory')
+
+    args = parser.parse_args()
+
+    if args.tile_lines < 3:
+        parser.error('The tile must have at least 3 lines')
+    if (args.lines - args.tile_lines) * args.samples <= LARGE_SCENE_PIXELS:
+        parser.error('The lines above the tile must have more than 2^31'
+                     ' pixels')
+
+    return args
+
+
+def generate_tile(args, directory):
+    '''Generate the tile, returns the name of its XML file'''
+
+    generator = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                             'generate_synthetic_scene.py')
+    output = subprocess.check_output([sys.executable, generator,
+                                      '--output-directory', directory,
+                                      '--lines', str(args.tile_lines),
+                                      '--samples', str(args.samples)])
+
+    return os.path.basename(output.decode().strip())
+
+
+def build_band(source_name, scene_name, hole_lines, samples, tile_lines):
+    '''Copy a band of the tile into a scene, after hole_lines of zeros'''
+
+    with open(source_name, 'rb') as source_fd:
+        data = source_fd.read()
+
+    with open(scene_name, 'wb') as scene_fd:
+        if len(data) > 0:
+            hole_size = (hole_lines * samples
+                         * (len(data) // (tile_lines * samples)))
+            scene_fd.truncate(hole_size)
+            scene_fd.seek(hole_size)
+            scene_fd.write(data)
+
+
+def build_scene(args, source, scene, xml_name, lines):
+    '''Build a scene of lines from the tile, the tile is the last lines'''
+
+    if os.path.isdir(scene):
+        shutil.rmtree(scene)
+    os.makedirs(scene)
+
+    for name in os.listdir(source):
+        if name.endswith('.img'):
+            build_band(os.path.join(source, name),
+                       os.path.join(scene, name), lines - args.tile_lines,
+                       args.samples, args.tile_lines)
+            continue
+
+        with open(os.path.join(source, name)) as fd:
+            text = fd.read()
+        if name == xml_name:
+            text = text.replace('nlines="{0}"'.format(args.tile_lines),
+                                'nlines="{0}"'.format(lines))
+        elif name.endswith('.hdr'):
+            text = text.replace('lines = {0}\n'.format(args.tile_lines),
+                                'lines = {0}\n'.format(lines))
+        with open(os.path.join(scene, name), 'w') as fd:
+            fd.write(text)
+
+
+def run_application(cmd, directory, log_name):
+    '''Run an application in the scene directory
+
+    Returns:
+        (output, peak resident set size in megabytes)
+    '''
+
+    log_filename = os.path.join(directory, log_name)
+    with open(log_filename, 'w') as log_fd:
+        process = subprocess.Popen(cmd, cwd=directory, stdout=log_fd,
+                                   stderr=subprocess.STDOUT)
+        (pid, status, usage) = os.wait4(process.pid, 0)
+
+    with open(log_filename) as log_fd:
+        output = log_fd.read()
+
+    if not os.WIFEXITED(status) or os.WEXITSTATUS(status) != 0:
+        raise CheckError('Application failed [{0}] in {1}, see {2}'
+                         .format(' '.join(cmd), directory, log_filename))
+
+    # The maximum resident set size is in kilobytes on Linux
+    return (output, usage.ru_maxrss / 1024.0)
+
+
+def reported_counts(output):
+    '''The pixel counts and percentages written with --verbose'''
+
+    counts = {}
+    for (key, label) in (('image', 'Total Image Pixels'),
+                         ('clear', 'Total Clear Pixels'),
+                         ('water', 'Total Water Pixels'),
+                         ('percent_clear', 'Percent Clear Pixels'),
+                         ('percent_water', 'Percent Water Pixels')):
+        match = re.search(r'^{0} = (\S+)$'.format(label), output,
+                          re.MULTILINE)
+        if match is None:
+            raise CheckError('The output has no [{0}]'.format(label))
+        counts[key] = float(match.group(1))
+
+    return counts
+
+
+def xml_percentages(xml_filename):
+    '''The clear and water percentages of the Level-2 QA band'''
+
+    percentages = {}
+    root = ElementTree.parse(xml_filename).getroot()
+    for band in root.iter('{0}band'.format(ESPA_NAMESPACE)):
+        if band.get('name') != 'l2qa':
+            continue
+        for cover in band.iter('{0}cover'.format(ESPA_NAMESPACE)):
+            percentages[cover.get('type')] = float(cover.text)
+
+    return percentages
+
+
+def check_counts(name, tile_counts, counts, hole_pixels, xml_filename):
+    '''Check the counts of the large scene against those of the tile'''
+
+    expected = {'image': tile_counts['image'] + hole_pixels,
+                'clear': tile_counts['clear'],
+                'water': tile_counts['water'] + hole_pixels}
+    for key in ('image', 'clear', 'water'):
+        if counts[key] != expected[key]:
+            raise CheckError('{0} reported {1} {2} pixels instead of {3}'
+                             .format(name, int(counts[key]), key,
+                                     int(expected[key])))
+
+    # The percentages are computed with floats by the applications
+    percentages = xml_percentages(xml_filename)
+    for key in ('clear', 'water'):
+        percent = 100.0 * expected[key] / expected['image']
+        if abs(counts['percent_' + key] - percent) > 1e-4:
+            raise CheckError('{0} reported {1} percent {2} instead of {3}'
+                             .format(name, counts['percent_' + key], key,
+                                     percent))
+        if abs(percentages.get(key, -1.0) - percent) > 0.01:
+            raise CheckError('The XML has {0} percent {1} after {2} instead'
+                             ' of {3}'.format(percentages.get(key), key,
+                                              name, percent))
+
+
+def check_last_lines(args, tile, scene, names):
+    '''Check the last lines of outputs are the lines of the tile, except
+       its first two'''
+
+    for name in names:
+        tile_size = os.path.getsize(os.path.join(tile, name))
+        line_size = tile_size // args.tile_lines
+        with open(os.path.join(tile, name), 'rb') as fd:
+            fd.seek(2 * line_size)
+            expected = fd.read()
+        with open(os.path.join(scene, name), 'rb') as fd:
+            fd.seek(0, os.SEEK_END)
+            if fd.tell() != line_size * args.lines:
+                raise CheckError('{0} has {1} bytes instead of {2}'
+                                 .format(name, fd.tell(),
+                                         line_size * args.lines))
+            fd.seek(line_size * (args.lines - args.tile_lines + 2))
+            if fd.read() != expected:
+                raise CheckError('The last lines of {0} are not those of'
+                                 ' the tile'.format(name))
+
+
+def check_application(args, logger, name, cmd, source, tile, scene,
+                      xml_name, suffixes):
+    '''Run an application on the tile and the large scene, and check the
+       large scene gives the expected results'''
+
+    # Every run starts from the Level-2 QA without the water pixels
+    l2qa_name = xml_name.replace('.xml', '_l2qa.img')
+    for (directory, lines) in ((tile, args.tile_lines), (scene, args.lines)):
+        build_band(os.path.join(source, l2qa_name),
+                   os.path.join(directory, l2qa_name),
+                   lines - args.tile_lines, args.samples, args.tile_lines)
+
+    (output, tile_rss) = run_application(cmd + ['--xml', xml_name], tile,
+                                         name + '.log')
+    tile_counts = reported_counts(output)
+
+    logger.info('Running {0} on the large scene'.format(name))
+    (output, peak_rss) = run_application(cmd + ['--xml', xml_name], scene,
+                                         name + '.log')
+    logger.info('{0} peak resident set size {1:.0f} MB, {2:.0f} MB for the'
+                ' tile'.format(name, peak_rss, tile_rss))
+    if peak_rss - tile_rss > args.max_rss:
+        raise CheckError('{0} used {1:.0f} MB over the size for the tile,'
+                         ' over the {2} MB budget'
+                         .format(name, peak_rss - tile_rss, args.max_rss))
+
+    check_counts(name, tile_counts, reported_counts(output),
+                 (args.lines - args.tile_lines) * args.samples,
+                 os.path.join(scene, xml_name))
+
+    names = [xml_name.replace('.xml', suffix) for suffix in suffixes]
+    check_last_lines(args, tile, scene, names)
+
+    # The outputs are not sparse, free the disk for the next application
+    for band_name in names:
+        if band_name != l2qa_name:
+            os.remove(os.path.join(scene, band_name))
+
+    logger.info('{0} gives the expected results'.format(name))
+
+
+def main():
+    '''Builds the large scene and checks each application on it'''
+
+    # Setup the default logger format and level.  Log to STDOUT.
+    logging.basicConfig(format=('%(asctime)s.%(msecs)03d %(process)d'
+                                ' %(levelname)-8s'
+                                ' %(filename)s:%(lineno)d:'
+                                '%(funcName)s -- %(message)s'),
+                        datefmt='%Y-%m-%d %H:%M:%S',
+                        level=logging.INFO,
+                        stream=sys.stdout)
+
+    # Get the logger
+    logger = logging.getLogger(__name__)
+
+    args = parse_cmd_line()
+
+    source = os.path.join(args.work_directory, 'source')
+    tile = os.path.join(args.work_directory, 'tile')
+    scene = os.path.join(args.work_directory, 'large')
+
+    try:
+        if os.path.isdir(source):
+            shutil.rmtree(source)
+        xml_name = generate_tile(args, source)
+        build_scene(args, source, tile, xml_name, args.tile_lines)
+        build_scene(args, source, scene, xml_name, args.lines)
+        logger.info('Built a scene of {0} lines and {1} samples in {2}'
+                    .format(args.lines, args.samples, scene))
+
+        check_application(args, logger, 'dswe',
+                          [args.dswe, '--verbose', '--water-qa',
+                           '--include-tests'],
+                          source, tile, scene, xml_name,
+                          ['_dswe_raw.img', '_dswe_ccss.img',
+                           '_dswe_psccss.img', '_dswe_diag.img',
+                           '_l2qa.img'])
+        check_application(args, logger, 'cfmask_water_detection',
+                          [args.cfmask_water_detection, '--verbose'],
+                          source, tile, scene, xml_name, ['_l2qa.img'])
+    except CheckError as error:
+        logger.error(error.message)
+        sys.exit(1)
+
+    if not args.keep:
+        shutil.rmtree(args.work_directory)
+
+    logger.info('The large scene gives the expected results')
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,402 @@
+#! /usr/bin/env python
+
+'''
+    PURPOSE: Generate a synthetic ESPA internal format scene (XML metadata
+             plus ENVI raw binary bands and headers) for exercising and
+             benchmarking the surface water extent applications.
+
+    PROJECT: Land Satellites Data Systems Science Research and Development
+             (LSRD) at the USGS EROS
+
+    LICENSE: NASA Open Source Agreement 1.3
+
+    NOTES:
+        The generated data is not physically meaningful.  It only provides
+            reflectance, CFmask, Level-2 QA, and elevation values that
+            exercise every branch of the DSWE and CFmask based water
+            detection algorithms in controllable proportions.
+        Fill is placed outside a rotated footprint, the same way a Landsat
+            scene sits within its ENVI grid.
+        The same seed generates the same scene with the same version of
+            Python.
+'''
+
+import os
+import sys
+import math
+import array
+import random
+import argparse
+
+
+SR_FILL = -9999
+CFMASK_FILL = 255
+L2QA_FILL = 255
+
+CFMASK_CLEAR = 0
+CFMASK_WATER = 1
+CFMASK_CLOUD_SHADOW = 2
+CFMASK_SNOW = 3
+CFMASK_CLOUD = 4
+
+# blue, green, red, nir, swir1, swir2 surface reflectance (scaled by 10000)
+LAND_SIGNATURE = (500, 800, 900, 2500, 2000, 1200)
+WATER_SIGNATURE = (600, 700, 400, 200, 100, 50)
+CLOUD_SIGNATURE = (4500, 4600, 4700, 5000, 3500, 2500)
+
+APP_VERSION = 'generate_synthetic_scene'
+
+# Upper left corner of the grid, in UTM zone 10 meters
+UL_X = 499980.0
+UL_Y = 5300040.0
+PIXEL_SIZE = 30.0
+
+L47_BANDS = ('band1', 'band2', 'band3', 'band4', 'band5', 'band7')
+L8_BANDS = ('band2', 'band3', 'band4', 'band5', 'band6', 'band7')
+
+
+def parse_cmd_line():
+    '''Parse the command line'''
+
+    parser = argparse.ArgumentParser(description='Generate a synthetic ESPA'
+                                     ' scene for the surface water extent'
+                                     ' applications')
+    parser.add_argument('--output-directory', action='store',
+                        dest='output_directory', default='.',
+                        help='Directory to place the scene in')
+    parser.add_argument('--lines', action='store', dest='lines',
+                        type=int, default=1000,
+                        help='Number of lines (default 1000)')
+    parser.add_argument('--samples', action='store', dest='samples',
+                        type=int, default=1000,
+                        help='Number of samples (default 1000)')
+    parser.add_argument('--sensor', action='store', dest='sensor',
+                        choices=['L4', 'L5', 'L7', 'L8'], default='L8',
+                        help='Satellite to emulate (default L8)')
+    parser.add_argument('--water-fraction', action='store',
+                        dest='water_fraction', type=float, default=0.1,
+                        help='Fraction of valid pixels that are water')
+    parser.add_argument('--cloud-fraction', action='store',
+                        dest='cloud_fraction', type=float, default=0.2,
+                        help='Fraction of valid pixels that are cloud,'
+                        ' cloud shadow, or snow')
+    parser.add_argument('--fill-fraction', action='store',
+                        dest='fill_fraction', type=float, default=0.25,
+                        help='Fraction of the grid outside the footprint')
+    parser.add_argument('--seed', action='store', dest='seed',
+                        type=int, default=1,
+                        help='Random seed (default 1)')
+
+    return parser.parse_args()
+
+
+def field(line, sample, phase):
+    '''Smooth pseudo-random field in the range [0, 1]'''
+
+    value = (math.sin(line * 0.013 + phase)
+             + math.sin(sample * 0.011 + 2.0 * phase)
+             + math.sin((line + sample) * 0.007 + 3.0 * phase)
+             + math.sin((line - sample) * 0.023 + 5.0 * phase))
+
+    return (value + 4.0) / 8.0
+
+
+def field_threshold(fraction, phase, rng):
+    '''Find the field value that is exceeded by the requested fraction'''
+
+    if fraction <= 0.0:
+        return 2.0
+
+    values = sorted(field(rng.randint(0, 9999), rng.randint(0, 9999), phase)
+                    for index in range(4000))
+    position = int((1.0 - fraction) * len(values))
+    position = max(0, min(len(values) - 1, position))
+
+    return values[position]
+
+
+def footprint_edges(args):
+    '''Returns a function deciding if a pixel is inside the footprint'''
+
+    # Shrink a 12 degree rotated square until the requested fill remains
+    angle = math.radians(12.0)
+    cos_a = math.cos(angle)
+    sin_a = math.sin(angle)
+    center_line = args.lines / 2.0
+    center_sample = args.samples / 2.0
+    half = math.sqrt(max(0.0, 1.0 - args.fill_fraction)) / 2.0
+
+    def inside(line, sample):
+        y = (line - center_line) / float(args.lines)
+        x = (sample - center_sample) / float(args.samples)
+        u = x * cos_a + y * sin_a
+        v = -x * sin_a + y * cos_a
+        return abs(u) <= half and abs(v) <= half
+
+    if args.fill_fraction <= 0.0:
+        return lambda line, sample: True
+
+    return inside
+
+
+def write_band(filename, typecode, values):
+    '''Write an array to a little-endian raw binary file'''
+
+    data = array.array(typecode, values)
+    if sys.byteorder != 'little':
+        data.byteswap()
+    with open(filename, 'ab') as fd:
+        data.tofile(fd)
+
+
+def write_envi_header(filename, lines, samples, data_type):
+    '''Write a minimal ENVI header for a band'''
+
+    with open(filename, 'w') as fd:
+        fd.write('ENVI\n'
+                 'description = {{Synthetic ESPA band}}\n'
+                 'samples = {0}\n'
+                 'lines = {1}\n'
+                 'bands = 1\n'
+                 'header offset = 0\n'
+                 'file type = ENVI Standard\n'
+                 'data type = {2}\n'
+                 'interleave = bsq\n'
+                 'byte order = 0\n'.format(samples, lines, data_type))
+
+
+def band_element(product, name, data_type, args, file_name, fill_value,
+                 data_units, valid_range, scale_factor=None, covers=None):
+    '''Returns the XML for one band'''
+
+    attributes = ('product="{0}" source="level1" name="{1}"'
+                  ' category="image" data_type="{2}" nlines="{3}"'
+                  ' nsamps="{4}" fill_value="{5}"'
+                  .format(product, name, data_type, args.lines, args.samples,
+                          fill_value))
+    if scale_factor is not None:
+        attributes += ' scale_factor="{0}"'.format(scale_factor)
+
+    lines = ['        <band {0}>'.format(attributes),
+             '            <short_name>{0}</short_name>'
+             .format(args.short_name),
+             '            <long_name>{0}</long_name>'.format(name),
+             '            <file_name>{0}</file_name>'.format(file_name),
+             '            <pixel_size x="30" y="30" units="meters"/>',
+             '            <resample_method>none</resample_method>',
+             '            <data_units>{0}</data_units>'.format(data_units),
+             '            <valid_range min="{0}" max="{1}"/>'
+             .format(valid_range[0], valid_range[1])]
+    if covers is not None:
+        lines.append('            <percent_coverage>')
+        for (description, percent) in covers:
+            lines.append('                <cover type="{0}">{1:.2f}</cover>'
+                         .format(description, percent))
+        lines.append('            </percent_coverage>')
+    lines.extend(['            <app_version>{0}</app_version>'
+                  .format(APP_VERSION),
+                  '            <production_date>{0}</production_date>'
+                  .format(args.production_date),
+                  '        </band>'])
+
+    return '\n'.join(lines)
+
+
+def main():
+    '''Generate the scene'''
+
+    args = parse_cmd_line()
+    rng = random.Random(args.seed)
+    args.production_date = '2016-07-08T00:00:00Z'
+
+    if args.sensor == 'L8':
+        satellite = 'LANDSAT_8'
+        args.short_name = 'LC08SR'
+        scene_id = 'LC08_L1TP_043028_20160701_20160708_01_T1'
+        band_suffixes = L8_BANDS
+    else:
+        satellite = 'LANDSAT_{0}'.format(args.sensor[1])
+        args.short_name = 'L{0}0{1}SR'.format('E' if args.sensor == 'L7'
+                                             else 'T', args.sensor[1])
+        scene_id = ('{0}_L1TP_043028_20010701_20160908_01_T1'
+                    .format(args.short_name[0:4]))
+        band_suffixes = L47_BANDS
+
+    if not os.path.isdir(args.output_directory):
+        os.makedirs(args.output_directory)
+
+    base = os.path.join(args.output_directory, scene_id)
+
+    sr_names = ['{0}_sr_{1}.img'.format(base, suffix)
+                for suffix in band_suffixes]
+    toa_names = ['{0}_toa_{1}.img'.format(base, suffix)
+                 for suffix in band_suffixes[2:4]]
+    cfmask_name = '{0}_cfmask.img'.format(base)
+    l2qa_name = '{0}_l2qa.img'.format(base)
+    elevation_name = '{0}_elevation.img'.format(base)
+
+    # The sr_band1 is used by DSWE to determine the scene name
+    band1_name = '{0}_sr_band1.img'.format(base)
+    all_names = list(sr_names) + toa_names + [cfmask_name, l2qa_name,
+                                              elevation_name]
+    if band1_name not in all_names:
+        all_names.append(band1_name)
+    for filename in all_names:
+        if os.path.exists(filename):
+            os.remove(filename)
+
+    inside = footprint_edges(args)
+    water_threshold = field_threshold(args.water_fraction, 0.3, rng)
+    cloud_threshold = field_threshold(args.cloud_fraction, 1.7, rng)
+
+    counts = {'fill': 0, 'clear': 0, 'water': 0, 'cloud': 0}
+
+    for line in range(args.lines):
+        sr_rows = [[] for name in sr_names]
+        cfmask_row = []
+        elevation_row = []
+
+        for sample in range(args.samples):
+            elevation_row.append(int(400.0 * field(line, sample, 4.1)
+                                     + rng.randint(0, 1)))
+
+            if not inside(line, sample):
+                for row in sr_rows:
+                    row.append(SR_FILL)
+                cfmask_row.append(CFMASK_FILL)
+                counts['fill'] += 1
+                continue
+
+            if field(line, sample, 1.7) > cloud_threshold:
+                signature = CLOUD_SIGNATURE
+                cfmask_row.append(rng.choice((CFMASK_CLOUD,
+                                              CFMASK_CLOUD_SHADOW,
+                                              CFMASK_SNOW, CFMASK_CLOUD)))
+                counts['cloud'] += 1
+            elif field(line, sample, 0.3) > water_threshold:
+                signature = WATER_SIGNATURE
+                cfmask_row.append(CFMASK_WATER)
+                counts['water'] += 1
+            else:
+                signature = LAND_SIGNATURE
+                cfmask_row.append(CFMASK_CLEAR)
+                counts['clear'] += 1
+
+            for (row, value) in zip(sr_rows, signature):
+                row.append(max(0, value + rng.randint(-value // 2,
+                                                      value // 2)))
+
+        for (name, row) in zip(sr_names, sr_rows):
+            write_band(name, 'h', row)
+        for (name, row) in zip(toa_names, sr_rows[2:4]):
+            write_band(name, 'h', row)
+        write_band(cfmask_name, 'B', cfmask_row)
+        # The Level-2 QA has not had water detected yet, so water is clear
+        write_band(l2qa_name, 'B', [CFMASK_CLEAR if value == CFMASK_WATER
+                                    else value for value in cfmask_row])
+        write_band(elevation_name, 'h', elevation_row)
+
+    if band1_name not in sr_names:
+        # Only the name of this band is used, so keep it empty
+        open(band1_name, 'wb').close()
+
+    for filename in all_names:
+        if filename.endswith('_cfmask.img') or filename.endswith('_l2qa.img'):
+            data_type = 1
+        else:
+            data_type = 2
+        write_envi_header(filename.replace('.img', '.hdr'), args.lines,
+                          args.samples, data_type)
+
+    valid = max(1, args.lines * args.samples - counts['fill'])
+    covers = [('clear', 100.0 * counts['clear'] / valid),
+              ('water', 100.0 * counts['water'] / valid),
+              ('cloud_shadow', 0.0),
+              ('snow', 0.0),
+              ('cloud', 100.0 * counts['cloud'] / valid)]
+
+    bands = []
+    if band1_name not in sr_names:
+        bands.append(band_element('sr_refl', 'sr_band1', 'INT16', args,
+                                  os.path.basename(band1_name), SR_FILL,
+                                  'reflectance', (-2000, 16000),
+                                  scale_factor='0.0001'))
+    for (suffix, name) in zip(band_suffixes, sr_names):
+        bands.append(band_element('sr_refl', 'sr_{0}'.format(suffix),
+                                  'INT16', args, os.path.basename(name),
+                                  SR_FILL, 'reflectance', (-2000, 16000),
+                                  scale_factor='0.0001'))
+    for (suffix, name) in zip(band_suffixes[2:4], toa_names):
+        bands.append(band_element('toa_refl', 'toa_{0}'.format(suffix),
+                                  'INT16', args, os.path.basename(name),
+                                  SR_FILL, 'reflectance', (-2000, 16000),
+                                  scale_factor='0.0001'))
+    bands.append(band_element('cfmask', 'cfmask', 'UINT8', args,
+                              os.path.basename(cfmask_name), CFMASK_FILL,
+                              'quality/feature classification', (0, 4),
+                              covers=covers))
+    bands.append(band_element('l2qa', 'l2qa', 'UINT8', args,
+                              os.path.basename(l2qa_name), L2QA_FILL,
+                              'quality/feature classification', (0, 4),
+                              covers=covers))
+    bands.append(band_element('elevation', 'elevation', 'INT16', args,
+                              os.path.basename(elevation_name), -9999,
+                              'meters', (-500, 9000)))
+
+    lr_x = UL_X + args.samples * PIXEL_SIZE
+    lr_y = UL_Y - args.lines * PIXEL_SIZE
+
+    with open('{0}.xml'.format(base), 'w') as fd:
+        fd.write('<?xml version="1.0" encoding="UTF-8"?>\n'
+                 '<espa_metadata version="2.0"'
+                 ' xmlns="http://espa.cr.usgs.gov/v2">\n'
+                 '    <global_metadata>\n'
+                 '        <data_provider>USGS/EROS</data_provider>\n'
+                 '        <satellite>{0}</satellite>\n'
+                 '        <instrument>synthetic</instrument>\n'
+                 '        <acquisition_date>2016-07-01</acquisition_date>\n'
+                 '        <scene_center_time>18:50:00.000000Z'
+                 '</scene_center_time>\n'
+                 '        <level1_production_date>{1}'
+                 '</level1_production_date>\n'
+                 '        <solar_angles zenith="30.0" azimuth="140.0"'
+                 ' units="degrees"/>\n'
+                 '        <wrs system="2" path="43" row="28"/>\n'
+                 '        <product_id>{2}</product_id>\n'
+                 '        <lpgs_metadata_file>{2}_MTL.txt'
+                 '</lpgs_metadata_file>\n'
+                 '        <corner location="UL" latitude="47.85"'
+                 ' longitude="-123.00"/>\n'
+                 '        <corner location="LR" latitude="45.70"'
+                 ' longitude="-120.00"/>\n'
+                 '        <bounding_coordinates>\n'
+                 '            <west>-123.00</west>\n'
+                 '            <east>-120.00</east>\n'
+                 '            <north>47.85</north>\n'
+                 '            <south>45.70</south>\n'
+                 '        </bounding_coordinates>\n'
+                 '        <projection_information projection="UTM"'
+                 ' datum="WGS84" units="meters">\n'
+                 '            <corner_point location="UL" x="{3:.6f}"'
+                 ' y="{4:.6f}"/>\n'
+                 '            <corner_point location="LR" x="{5:.6f}"'
+                 ' y="{6:.6f}"/>\n'
+                 '            <grid_origin>CENTER</grid_origin>\n'
+                 '            <utm_proj_params>\n'
+                 '                <zone_code>10</zone_code>\n'
+                 '            </utm_proj_params>\n'
+                 '        </projection_information>\n'
+                 '        <orientation_angle>0.0</orientation_angle>\n'
+                 '    </global_metadata>\n'
+                 '    <bands>\n'
+                 '{7}\n'
+                 '    </bands>\n'
+                 '</espa_metadata>\n'
+                 .format(satellite, args.production_date, scene_id,
+                         UL_X, UL_Y, lr_x, lr_y, '\n'.join(bands)))
+
+    print('{0}.xml'.format(base))
+
+
+if __name__ == '__main__':
+    main()
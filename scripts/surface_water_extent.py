@@ -69,12 +69,14 @@ def execute_cmd(cmd_string):
 
 
 def parse_cmd_line():
-    '''Will only parse --xml XML_FILENAME from cmdline.
+    '''Will only parse --xml XML_FILENAME, --products LIST, and --water-qa
+       from cmdline.
 
     Precondition:
         '--xml FILENAME' exists in command line arguments
     Postcondition:
-        returns xml_filename
+        returns xml_filename, the products list or None, and whether the
+        water pixels are also added to the Level 2 QA band
 
     Note: Help is not included because the program will return
           the help from the underlying program.
@@ -86,9 +88,17 @@ def parse_cmd_line():
                            dest='xml_filename', required=True,
                            help='Input XML metadata file',
                            metavar='FILE')
+    parse_xml.add_argument('--products', action='store',
+                           dest='products', default=None,
+                           help='Comma separated output products',
+                           metavar='LIST')
+    parse_xml.add_argument('--water-qa', action='store_true',
+                           dest='water_qa', default=False,
+                           help='Also add the water pixels to the Level 2'
+                                ' QA band')
     (temp, extra_args) = parse_xml.parse_known_args()
 
-    return temp.xml_filename
+    return (temp.xml_filename, temp.products, temp.water_qa)
 
 
 def get_satellite_sensor_code(xml_filename):
@@ -124,6 +134,14 @@ def get_science_application_name(satellite_sensor_code):
                         .format(satellite_sensor_code))
 
 
+def has_level2_qa(satellite_sensor_code):
+    '''Returns True when the scene has the Level 2 QA band'''
+
+    collection_prefixes = ['LT04', 'LT05', 'LE07', 'LC08']
+
+    return satellite_sensor_code in collection_prefixes
+
+
 def main():
     '''Determines executable, and calls it with all input arguments '''
 
@@ -139,17 +157,27 @@ def main():
     # Get the logger
     logger = logging.getLogger(__name__)
 
-    xml_filename = parse_cmd_line()
+    (xml_filename, products, water_qa) = parse_cmd_line()
     satellite_sensor_code = get_satellite_sensor_code(xml_filename)
 
     # Get the science application
     cmd = [get_science_application_name(satellite_sensor_code)]
-    # Pass all arguments through to the since application
+
+    # The water pixels are added to the Level 2 QA band by dswe while the
+    # scene is open for DSWE, only the collection scenes have the band
+    if water_qa and not has_level2_qa(satellite_sensor_code):
+        raise Exception('Satellite-Sensor code ({0}) scenes have no Level 2'
+                        ' QA band for --water-qa'
+                        .format(satellite_sensor_code))
+
+    # Pass all arguments through to the since application, including the
+    # product selection and --water-qa
     cmd.extend(sys.argv[1:])
-    # TODO - For the time being we will always do this
-    #        They were placed here to be easily removed later
-    cmd.append('--include-tests')
-    cmd.append('--include-ps')
+    # Without --products the outputs are the same as before the option was
+    # added, the tests and percent slope bands are still generated
+    if products is None:
+        cmd.append('--include-tests')
+        cmd.append('--include-ps')
 
     # Convert the list to a string
     cmd_string = ' '.join(cmd)